@@ -1579,6 +1579,118 @@ static void test_reg_unload_key(void)
     DeleteFileA("saved_key.LOG");
 }
 
+/* return the path of the user registry file of the Wine prefix, if it exists */
+static BOOL get_wine_user_registry(char *path)
+{
+    char dir[MAX_PATH - 32], *p;
+
+    if (!GetEnvironmentVariableA("WINEPREFIX", dir, sizeof(dir)))
+    {
+        if (!GetEnvironmentVariableA("HOME", dir, sizeof(dir) - 6)) return FALSE;
+        strcat(dir, "/.wine");
+    }
+    sprintf(path, "\\\\?\\unix%s/user.reg", dir);
+    for (p = path; *p; p++) if (*p == '/') *p = '\\';
+    return GetFileAttributesA(path) != INVALID_FILE_ATTRIBUTES;
+}
+
+static void test_reload_after_flush(void)
+{
+    static BYTE data[0x10000], buffer[0x10000];
+    char path[MAX_PATH], journal[MAX_PATH];
+    DWORD type, size, value;
+    HKEY hkey, subkey, deleted;
+    unsigned int i, j;
+    LONG ret;
+
+    if (!get_wine_user_registry(path))
+    {
+        skip("Wine user registry file not found\n");
+        return;
+    }
+    sprintf(journal, "%s.journal", path);
+
+    ret = RegCreateKeyA(HKEY_CURRENT_USER, "Software\\Wine\\Test\\Reload", &hkey);
+    ok(!ret, "RegCreateKey failed, error %d\n", ret);
+    value = 1;
+    ret = RegSetValueExA(hkey, "value", 0, REG_DWORD, (BYTE *)&value, sizeof(value));
+    ok(!ret, "RegSetValueEx failed, error %d\n", ret);
+    ret = RegCreateKeyA(hkey, "Deleted", &subkey);
+    ok(!ret, "RegCreateKey failed, error %d\n", ret);
+    ret = RegSetValueExA(subkey, "value", 0, REG_DWORD, (BYTE *)&value, sizeof(value));
+    ok(!ret, "RegSetValueEx failed, error %d\n", ret);
+    RegCloseKey(subkey);
+    ret = RegFlushKey(hkey);
+    ok(!ret, "RegFlushKey failed, error %d\n", ret);
+
+    /* flushing a key only writes something when WINEREGJOURNAL is set */
+    if (GetFileAttributesA(journal) == INVALID_FILE_ATTRIBUTES)
+    {
+        skip("registry journal not enabled\n");
+        delete_key(hkey);
+        RegCloseKey(hkey);
+        return;
+    }
+
+    ret = RegDeleteKeyA(hkey, "Deleted");
+    ok(!ret, "RegDeleteKey failed, error %d\n", ret);
+    value = 2;
+    ret = RegSetValueExA(hkey, "value", 0, REG_DWORD, (BYTE *)&value, sizeof(value));
+    ok(!ret, "RegSetValueEx failed, error %d\n", ret);
+
+    /* with WINEREGJOURNAL, the flushes are appended to a journal until it gets
+     * larger than the registry file, which is then rewritten */
+    for (i = 0; i < 64; i++)
+    {
+        for (j = 0; j < sizeof(data); j++) data[j] = i + j;
+        ret = RegSetValueExA(hkey, "big", 0, REG_BINARY, data, sizeof(data));
+        ok(!ret, "RegSetValueEx failed, error %d\n", ret);
+        ret = RegFlushKey(hkey);
+        ok(!ret, "RegFlushKey failed, error %d\n", ret);
+        if (GetFileAttributesA(journal) == INVALID_FILE_ATTRIBUTES) break;
+    }
+    ok(i < 64, "the journal was never compacted\n");
+
+    /* the registry file alone must now contain all the changes */
+    if (!set_privileges(SE_RESTORE_NAME, TRUE))
+    {
+        win_skip("Failed to set SE_RESTORE_NAME privileges, skipping tests\n");
+        delete_key(hkey);
+        RegCloseKey(hkey);
+        return;
+    }
+    ret = RegLoadKeyA(HKEY_USERS, "winetest_reload", path);
+    ok(!ret, "RegLoadKey failed, error %d\n", ret);
+
+    ret = RegOpenKeyA(HKEY_USERS, "winetest_reload\\Software\\Wine\\Test\\Reload", &subkey);
+    ok(!ret, "RegOpenKey failed, error %d\n", ret);
+    if (!ret)
+    {
+        size = sizeof(value);
+        ret = RegQueryValueExA(subkey, "value", NULL, &type, (BYTE *)&value, &size);
+        ok(!ret, "RegQueryValueEx failed, error %d\n", ret);
+        ok(value == 2, "got value %u\n", value);
+
+        size = sizeof(buffer);
+        ret = RegQueryValueExA(subkey, "big", NULL, &type, buffer, &size);
+        ok(!ret, "RegQueryValueEx failed, error %d\n", ret);
+        ok(type == REG_BINARY, "got type %u\n", type);
+        ok(size == sizeof(data) && !memcmp(buffer, data, sizeof(data)), "wrong data, size %u\n", size);
+
+        ret = RegOpenKeyA(subkey, "Deleted", &deleted);
+        ok(ret == ERROR_FILE_NOT_FOUND, "expected ERROR_FILE_NOT_FOUND, got %d\n", ret);
+        if (!ret) RegCloseKey(deleted);
+        RegCloseKey(subkey);
+    }
+
+    ret = RegUnLoadKeyA(HKEY_USERS, "winetest_reload");
+    ok(!ret, "RegUnLoadKey failed, error %d\n", ret);
+    set_privileges(SE_RESTORE_NAME, FALSE);
+
+    delete_key(hkey);
+    RegCloseKey(hkey);
+}
+
 /* tests that show that RegConnectRegistry and 
    OpenSCManager accept computer names without the
    \\ prefix (what MSDN says).   */
@@ -2307,6 +2419,131 @@ static void test_rw_order(void)
     ok(!RegDeleteKeyA(HKEY_CURRENT_USER, keyname), "Failed to delete key\n");
 }
 
+static void check_sorted_subkeys_(unsigned int line, HKEY hkey, DWORD count)
+{
+    char name[16], prev[16];
+    DWORD i, len, subkeys;
+    LSTATUS ret;
+
+    ret = RegQueryInfoKeyA( hkey, NULL, NULL, NULL, &subkeys, NULL, NULL, NULL, NULL, NULL, NULL, NULL );
+    ok_(__FILE__,line)( !ret, "RegQueryInfoKeyA failed: %d\n", ret );
+    ok_(__FILE__,line)( subkeys == count, "got %u subkeys\n", subkeys );
+
+    prev[0] = 0;
+    for (i = 0; i < count; i++)
+    {
+        len = sizeof(name);
+        ret = RegEnumKeyExA( hkey, i, name, &len, NULL, NULL, NULL, NULL );
+        ok_(__FILE__,line)( !ret, "RegEnumKeyExA %u failed: %d\n", i, ret );
+        if (ret) break;
+        ok_(__FILE__,line)( lstrcmpiA( prev, name ) < 0, "%s enumerated after %s\n", name, prev );
+        strcpy( prev, name );
+    }
+    len = sizeof(name);
+    ret = RegEnumKeyExA( hkey, count, name, &len, NULL, NULL, NULL, NULL );
+    ok_(__FILE__,line)( ret == ERROR_NO_MORE_ITEMS, "RegEnumKeyExA returned %d\n", ret );
+}
+#define check_sorted_subkeys(a,b) check_sorted_subkeys_(__LINE__,a,b)
+
+static void test_many_subkeys(void)
+{
+    const DWORD count = winetest_interactive ? 100000 : 10000;
+    char name[16];
+    DWORD i, len, values, start;
+    HKEY hkey, subkey;
+    LSTATUS ret;
+
+    ret = RegCreateKeyA( hkey_main, "many_subkeys", &hkey );
+    ok( !ret, "RegCreateKeyA failed: %d\n", ret );
+
+    /* create the subkeys out of order, so that they need to be sorted */
+    start = GetTickCount();
+    for (i = 0; i < count; i++)
+    {
+        sprintf( name, "Key%06u", (i * 7919) % count );
+        ret = RegCreateKeyA( hkey, name, &subkey );
+        ok( !ret, "RegCreateKeyA %s failed: %d\n", name, ret );
+        RegCloseKey( subkey );
+    }
+    trace( "created %u subkeys in %u ms\n", count, GetTickCount() - start );
+
+    start = GetTickCount();
+    check_sorted_subkeys( hkey, count );
+    trace( "enumerated %u subkeys in %u ms\n", count, GetTickCount() - start );
+
+    start = GetTickCount();
+    for (i = 0; i < count; i++)
+    {
+        sprintf( name, "kEY%06u", i );
+        ret = RegOpenKeyA( hkey, name, &subkey );
+        ok( !ret, "RegOpenKeyA %s failed: %d\n", name, ret );
+        RegCloseKey( subkey );
+    }
+    trace( "opened %u subkeys in %u ms\n", count, GetTickCount() - start );
+
+    /* deleting from the middle keeps the order */
+    start = GetTickCount();
+    for (i = 1; i < count; i += 2)
+    {
+        sprintf( name, "Key%06u", i );
+        ret = RegDeleteKeyA( hkey, name );
+        ok( !ret, "RegDeleteKeyA %s failed: %d\n", name, ret );
+    }
+    trace( "deleted %u subkeys by name in %u ms\n", count / 2, GetTickCount() - start );
+    check_sorted_subkeys( hkey, count - count / 2 );
+    for (i = 0; i < count; i += 997)
+    {
+        sprintf( name, "Key%06u", i );
+        ret = RegOpenKeyA( hkey, name, &subkey );
+        ok( ret == ((i & 1) ? ERROR_FILE_NOT_FOUND : ERROR_SUCCESS), "RegOpenKeyA %s returned %d\n", name, ret );
+        if (!ret) RegCloseKey( subkey );
+    }
+    for (i = 1; i < count; i += 2)
+    {
+        sprintf( name, "Key%06u", i );
+        ret = RegCreateKeyA( hkey, name, &subkey );
+        ok( !ret, "RegCreateKeyA %s failed: %d\n", name, ret );
+        RegCloseKey( subkey );
+    }
+    check_sorted_subkeys( hkey, count );
+
+    /* enumerate and delete from the first one, like RegDeleteTree */
+    start = GetTickCount();
+    delete_key( hkey );
+    trace( "deleted %u subkeys in %u ms\n", count, GetTickCount() - start );
+    RegCloseKey( hkey );
+
+    ret = RegCreateKeyA( hkey_main, "many_values", &hkey );
+    ok( !ret, "RegCreateKeyA failed: %d\n", ret );
+    start = GetTickCount();
+    for (i = 0; i < count; i++)
+    {
+        sprintf( name, "Value%06u", (i * 7919) % count );
+        ret = RegSetValueExA( hkey, name, 0, REG_DWORD, (BYTE *)&i, sizeof(i) );
+        ok( !ret, "RegSetValueExA %s failed: %d\n", name, ret );
+    }
+    trace( "created %u values in %u ms\n", count, GetTickCount() - start );
+
+    start = GetTickCount();
+    for (i = 0; i < count; i++)
+    {
+        len = sizeof(name);
+        ret = RegEnumValueA( hkey, 0, name, &len, NULL, NULL, NULL, NULL );
+        ok( !ret, "RegEnumValueA failed: %d\n", ret );
+        if (ret) break;
+        ok( !strncmp( name, "Value", 5 ), "enumerated %s\n", name );
+        ret = RegDeleteValueA( hkey, name );
+        ok( !ret, "RegDeleteValueA %s failed: %d\n", name, ret );
+    }
+    trace( "deleted %u values in %u ms\n", count, GetTickCount() - start );
+    ret = RegQueryInfoKeyA( hkey, NULL, NULL, NULL, NULL, NULL, NULL, &values, NULL, NULL, NULL, NULL );
+    ok( !ret, "RegQueryInfoKeyA failed: %d\n", ret );
+    ok( !values, "got %u values\n", values );
+
+    delete_key( hkey );
+    RegCloseKey( hkey );
+}
+
 static void test_symlinks(void)
 {
     static const WCHAR targetW[] = {'\\','S','o','f','t','w','a','r','e','\\','W','i','n','e',
@@ -4132,8 +4369,142 @@ static void test_EnumDynamicTimeZoneInformation(void)
     RegCloseKey(key);
 }
 
+static void check_dword_value_(unsigned int line, HKEY hkey, const char *name, LONG expect_ret, DWORD expect)
+{
+    DWORD type, size, data = 0xdeadbeef;
+    LONG ret;
+
+    size = sizeof(data);
+    ret = RegQueryValueExA(hkey, name, NULL, &type, (BYTE *)&data, &size);
+    ok_(__FILE__,line)(ret == expect_ret, "value %s: expected %d, got %d\n", name, expect_ret, ret);
+    if (!ret && !expect_ret)
+    {
+        ok_(__FILE__,line)(type == REG_DWORD, "value %s: got type %u\n", name, type);
+        ok_(__FILE__,line)(data == expect, "value %s: expected %u, got %u\n", name, expect, data);
+    }
+}
+#define check_dword_value(a,b,c,d) check_dword_value_(__LINE__,a,b,c,d)
+
+/* runs with WINEREGCACHE set, so that values are cached by Wine across the queries */
+static void test_value_change_child(void)
+{
+    HANDLE ready, changed;
+    HKEY hkey, subkey;
+    LONG ret;
+
+    ready = OpenEventA(EVENT_ALL_ACCESS, FALSE, "winetest_registry_ready");
+    ok(ready != NULL, "OpenEvent failed, error %u\n", GetLastError());
+    changed = OpenEventA(EVENT_ALL_ACCESS, FALSE, "winetest_registry_changed");
+    ok(changed != NULL, "OpenEvent failed, error %u\n", GetLastError());
+
+    ret = RegOpenKeyA(HKEY_CURRENT_USER, "Software\\Wine\\Test\\Change", &hkey);
+    ok(!ret, "RegOpenKey failed, error %d\n", ret);
+    ret = RegOpenKeyA(hkey, "Subkey", &subkey);
+    ok(!ret, "RegOpenKey failed, error %d\n", ret);
+
+    /* query everything twice, the second time may be served from a cache */
+    check_dword_value(hkey, "changed", ERROR_SUCCESS, 1);
+    check_dword_value(hkey, "changed", ERROR_SUCCESS, 1);
+    check_dword_value(hkey, "created", ERROR_FILE_NOT_FOUND, 0);
+    check_dword_value(hkey, "created", ERROR_FILE_NOT_FOUND, 0);
+    check_dword_value(hkey, "deleted", ERROR_SUCCESS, 3);
+    check_dword_value(hkey, "deleted", ERROR_SUCCESS, 3);
+    check_dword_value(subkey, "value", ERROR_SUCCESS, 4);
+    check_dword_value(subkey, "value", ERROR_SUCCESS, 4);
+
+    SetEvent(ready);
+    ret = WaitForSingleObject(changed, 10000);
+    ok(!ret, "WaitForSingleObject returned %d\n", ret);
+
+    /* the changes made by the parent process must be visible right away */
+    check_dword_value(hkey, "changed", ERROR_SUCCESS, 2);
+    check_dword_value(hkey, "created", ERROR_SUCCESS, 5);
+    check_dword_value(hkey, "deleted", ERROR_FILE_NOT_FOUND, 0);
+    check_dword_value(subkey, "value", ERROR_KEY_DELETED, 0);
+
+    RegCloseKey(subkey);
+    RegCloseKey(hkey);
+    CloseHandle(changed);
+    CloseHandle(ready);
+}
+
+static void test_value_change_other_process(void)
+{
+    STARTUPINFOA si = { sizeof(si) };
+    PROCESS_INFORMATION pi;
+    HANDLE ready, changed;
+    char cmdline[MAX_PATH];
+    char **argv;
+    HKEY hkey, subkey;
+    DWORD data;
+    LONG ret;
+    BOOL res;
+
+    ret = RegCreateKeyA(HKEY_CURRENT_USER, "Software\\Wine\\Test\\Change", &hkey);
+    ok(!ret, "RegCreateKey failed, error %d\n", ret);
+    ret = RegCreateKeyA(hkey, "Subkey", &subkey);
+    ok(!ret, "RegCreateKey failed, error %d\n", ret);
+    data = 1;
+    ret = RegSetValueExA(hkey, "changed", 0, REG_DWORD, (BYTE *)&data, sizeof(data));
+    ok(!ret, "RegSetValueEx failed, error %d\n", ret);
+    data = 3;
+    ret = RegSetValueExA(hkey, "deleted", 0, REG_DWORD, (BYTE *)&data, sizeof(data));
+    ok(!ret, "RegSetValueEx failed, error %d\n", ret);
+    data = 4;
+    ret = RegSetValueExA(subkey, "value", 0, REG_DWORD, (BYTE *)&data, sizeof(data));
+    ok(!ret, "RegSetValueEx failed, error %d\n", ret);
+    RegCloseKey(subkey);
+
+    ready = CreateEventA(NULL, FALSE, FALSE, "winetest_registry_ready");
+    ok(ready != NULL, "CreateEvent failed, error %u\n", GetLastError());
+    changed = CreateEventA(NULL, FALSE, FALSE, "winetest_registry_changed");
+    ok(changed != NULL, "CreateEvent failed, error %u\n", GetLastError());
+
+    /* enable the client-side value cache of Wine in the child process */
+    SetEnvironmentVariableA("WINEREGCACHE", "1");
+    winetest_get_mainargs(&argv);
+    sprintf(cmdline, "\"%s\" registry value_change", argv[0]);
+    res = CreateProcessA(NULL, cmdline, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi);
+    ok(res, "CreateProcess failed, error %u\n", GetLastError());
+    SetEnvironmentVariableA("WINEREGCACHE", NULL);
+
+    ret = WaitForSingleObject(ready, 10000);
+    ok(!ret, "WaitForSingleObject returned %d\n", ret);
+
+    data = 2;
+    ret = RegSetValueExA(hkey, "changed", 0, REG_DWORD, (BYTE *)&data, sizeof(data));
+    ok(!ret, "RegSetValueEx failed, error %d\n", ret);
+    data = 5;
+    ret = RegSetValueExA(hkey, "created", 0, REG_DWORD, (BYTE *)&data, sizeof(data));
+    ok(!ret, "RegSetValueEx failed, error %d\n", ret);
+    ret = RegDeleteValueA(hkey, "deleted");
+    ok(!ret, "RegDeleteValue failed, error %d\n", ret);
+    ret = RegDeleteKeyA(hkey, "Subkey");
+    ok(!ret, "RegDeleteKey failed, error %d\n", ret);
+    SetEvent(changed);
+
+    wait_child_process(pi.hProcess);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    CloseHandle(changed);
+    CloseHandle(ready);
+
+    delete_key(hkey);
+    RegCloseKey(hkey);
+}
+
 START_TEST(registry)
 {
+    char **argv;
+    int argc;
+
+    argc = winetest_get_mainargs(&argv);
+    if (argc >= 3 && !strcmp(argv[2], "value_change"))
+    {
+        test_value_change_child();
+        return;
+    }
+
     /* Load pointers for functions that are not available in all Windows versions */
     InitFunctionPtrs();
 
@@ -4162,9 +4533,12 @@ START_TEST(registry)
     test_reg_copy_tree();
     test_reg_delete_tree();
     test_rw_order();
+    test_many_subkeys();
     test_deleted_key();
     test_delete_value();
     test_delete_key_value();
+    test_value_change_other_process();
+    test_reload_after_flush();
     test_RegOpenCurrentUser();
     test_RegNotifyChangeKeyValue();
     test_RegQueryValueExPerformanceData();
@@ -57,6 +57,7 @@ static BOOL is_wow64;
 static NTSTATUS (WINAPI *pNtCreateSection)(HANDLE *, ACCESS_MASK, const OBJECT_ATTRIBUTES *,
                                            const LARGE_INTEGER *, ULONG, ULONG, HANDLE );
 static NTSTATUS (WINAPI *pNtQuerySection)(HANDLE, SECTION_INFORMATION_CLASS, void *, SIZE_T, SIZE_T *);
+static NTSTATUS (WINAPI *pNtQueryVirtualMemory)(HANDLE, LPCVOID, MEMORY_INFORMATION_CLASS, PVOID, SIZE_T, SIZE_T *);
 static NTSTATUS (WINAPI *pNtMapViewOfSection)(HANDLE, HANDLE, PVOID *, ULONG_PTR, SIZE_T, const LARGE_INTEGER *, SIZE_T *, ULONG, ULONG, ULONG);
 static NTSTATUS (WINAPI *pNtUnmapViewOfSection)(HANDLE, PVOID);
 static NTSTATUS (WINAPI *pNtQueryInformationProcess)(HANDLE, PROCESSINFOCLASS, PVOID, ULONG, PULONG);
@@ -2180,6 +2181,216 @@ static void test_import_resolution(void)
     }
 }
 
+#define RELOC_IMAGE_BASE 0x12340000
+
+struct relocs
+{
+    IMAGE_BASE_RELOCATION rel;
+    WORD type_offset[2];
+    const char *str;
+    char buffer[16];
+};
+
+static void child_relocated_image( const char *dll_name, void *expect )
+{
+    MEMORY_WORKING_SET_EX_INFORMATION info;
+    HANDLE hfile, map;
+    NTSTATUS status;
+    SIZE_T size = 0;
+    void *reserve, *addr = NULL;
+    struct relocs *ptr;
+
+    reserve = VirtualAlloc( (void *)RELOC_IMAGE_BASE, 2 * page_size, MEM_RESERVE, PAGE_NOACCESS );
+    ok( reserve != NULL, "VirtualAlloc failed err %u\n", GetLastError() );
+
+    hfile = CreateFileA( dll_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, 0 );
+    ok( hfile != INVALID_HANDLE_VALUE, "CreateFile error %d\n", GetLastError() );
+    status = pNtCreateSection( &map, STANDARD_RIGHTS_REQUIRED | SECTION_MAP_READ | SECTION_QUERY,
+                               NULL, NULL, PAGE_READONLY, SEC_IMAGE, hfile );
+    ok( !status, "NtCreateSection failed %x\n", status );
+    status = pNtMapViewOfSection( map, GetCurrentProcess(), &addr, 0, 0, NULL,
+                                  &size, 1 /* ViewShare */, 0, PAGE_READONLY );
+    ok( status == STATUS_IMAGE_NOT_AT_BASE, "wrong status %x\n", status );
+    if (!addr) goto done;
+
+    ptr = (struct relocs *)((char *)addr + page_size);
+    ok( ptr->str == ptr->buffer, "wrong pointer %p / %p\n", ptr->str, ptr->buffer );
+    ok( !strcmp( ptr->str, "relocated" ), "wrong data %s\n", debugstr_a(ptr->str) );
+
+    /* Windows relocates images without dynamic base privately in each process */
+    if (addr != expect)
+    {
+        win_skip( "mapped at %p instead of %p, relocated image not shared\n", addr, expect );
+        goto done;
+    }
+
+    info.VirtualAddress = ptr;
+    status = pNtQueryVirtualMemory( GetCurrentProcess(), NULL, MemoryWorkingSetExInformation,
+                                    &info, sizeof(info), NULL );
+    ok( !status, "NtQueryVirtualMemory failed %x\n", status );
+    if (!info.VirtualAttributes.s.Valid)
+        skip( "no working set information for %p\n", ptr );
+    else
+        ok( info.VirtualAttributes.s.Shared, "relocated page %p not shared\n", ptr );
+
+done:
+    if (addr) pNtUnmapViewOfSection( GetCurrentProcess(), addr );
+    CloseHandle( map );
+    CloseHandle( hfile );
+    VirtualFree( reserve, 0, MEM_RELEASE );
+}
+
+static void test_relocated_image( DWORD scn_flags )
+{
+    char temp_path[MAX_PATH];
+    char dll_name[MAX_PATH];
+    DWORD dummy;
+    HANDLE hfile, map, reserve;
+    HMODULE mod;
+    NTSTATUS status;
+    SIZE_T size;
+    void *addr, *addr2;
+    struct relocs data, *ptr;
+    IMAGE_NT_HEADERS nt, *pnt;
+    IMAGE_SECTION_HEADER section;
+    int i;
+
+#define DATA_RVA(ptr) (page_size + ((char *)(ptr) - (char *)&data))
+    nt = nt_header_template;
+    nt.FileHeader.NumberOfSections = 1;
+    nt.FileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER);
+    nt.FileHeader.Characteristics = IMAGE_FILE_EXECUTABLE_IMAGE | IMAGE_FILE_DLL;
+    nt.OptionalHeader.SectionAlignment = page_size;
+    nt.OptionalHeader.FileAlignment = 0x200;
+    nt.OptionalHeader.ImageBase = RELOC_IMAGE_BASE;
+    nt.OptionalHeader.SizeOfImage = 2 * page_size;
+    nt.OptionalHeader.SizeOfHeaders = nt.OptionalHeader.FileAlignment;
+    nt.OptionalHeader.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+    memset( nt.OptionalHeader.DataDirectory, 0, sizeof(nt.OptionalHeader.DataDirectory) );
+    nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC].Size = sizeof(data.rel) + sizeof(data.type_offset);
+    nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC].VirtualAddress = DATA_RVA( &data.rel );
+
+    memset( &data, 0, sizeof(data) );
+    data.rel.VirtualAddress = page_size;
+    data.rel.SizeOfBlock = sizeof(data.rel) + sizeof(data.type_offset);
+#ifdef _WIN64
+    data.type_offset[0] = (IMAGE_REL_BASED_DIR64 << 12) | (DATA_RVA( &data.str ) - page_size);
+#else
+    data.type_offset[0] = (IMAGE_REL_BASED_HIGHLOW << 12) | (DATA_RVA( &data.str ) - page_size);
+#endif
+    data.str = (const char *)(nt.OptionalHeader.ImageBase + DATA_RVA( data.buffer ));
+    strcpy( data.buffer, "relocated" );
+
+    GetTempPathA(MAX_PATH, temp_path);
+    GetTempFileNameA(temp_path, "ldr", 0, dll_name);
+
+    hfile = CreateFileA(dll_name, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, 0, 0);
+    ok( hfile != INVALID_HANDLE_VALUE, "creation failed\n" );
+
+    memset( &section, 0, sizeof(section) );
+    memcpy( section.Name, ".data", sizeof(".data") );
+    section.PointerToRawData = nt.OptionalHeader.FileAlignment;
+    section.VirtualAddress = nt.OptionalHeader.SectionAlignment;
+    section.Misc.VirtualSize = sizeof(data);
+    section.SizeOfRawData = sizeof(data);
+    section.Characteristics = IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_WRITE | scn_flags;
+
+    WriteFile(hfile, &dos_header, sizeof(dos_header), &dummy, NULL);
+    WriteFile(hfile, &nt, sizeof(nt), &dummy, NULL);
+    WriteFile(hfile, &section, sizeof(section), &dummy, NULL);
+
+    SetFilePointer( hfile, section.PointerToRawData, NULL, SEEK_SET );
+    WriteFile(hfile, &data, sizeof(data), &dummy, NULL);
+
+    CloseHandle( hfile );
+
+    /* make sure the preferred base is not available */
+    reserve = VirtualAlloc( (void *)nt.OptionalHeader.ImageBase, nt.OptionalHeader.SizeOfImage,
+                            MEM_RESERVE, PAGE_NOACCESS );
+    ok( reserve != NULL, "VirtualAlloc failed err %u\n", GetLastError() );
+
+    hfile = CreateFileA( dll_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, 0 );
+    ok( hfile != INVALID_HANDLE_VALUE, "CreateFile error %d\n", GetLastError() );
+    status = pNtCreateSection( &map, STANDARD_RIGHTS_REQUIRED | SECTION_MAP_READ | SECTION_QUERY,
+                               NULL, NULL, PAGE_READONLY, SEC_IMAGE, hfile );
+    ok( !status, "NtCreateSection failed %x\n", status );
+
+    /* the image contents must match the base in the headers, whether it has been relocated or not */
+    addr = NULL;
+    for (i = 0; i < 2; i++)
+    {
+        addr2 = NULL;
+        size = 0;
+        status = pNtMapViewOfSection( map, GetCurrentProcess(), &addr2, 0, 0, NULL,
+                                      &size, 1 /* ViewShare */, 0, PAGE_READONLY );
+        ok( status == STATUS_IMAGE_NOT_AT_BASE, "%u: wrong status %x\n", i, status );
+        if (!addr2) break;
+        /* a shared section can't be relocated once for all processes */
+        if (addr && !scn_flags)
+            ok( addr2 == addr || broken( addr2 != addr ), /* relocated again on Windows */
+                "%u: mapped at %p instead of %p\n", i, addr2, addr );
+        addr = addr2;
+        pnt = pRtlImageNtHeader( addr );
+        ptr = (struct relocs *)((char *)addr + page_size);
+        ok( ptr->str == (char *)pnt->OptionalHeader.ImageBase + DATA_RVA( data.buffer ),
+            "%u: wrong pointer %p for base %p\n", i, ptr->str, (void *)pnt->OptionalHeader.ImageBase );
+        status = pNtUnmapViewOfSection( GetCurrentProcess(), addr );
+        ok( !status, "%u: NtUnmapViewOfSection failed %x\n", i, status );
+    }
+
+    /* another process mapping the image while it's mapped here gets the same relocated pages */
+    if (!scn_flags)
+    {
+        PROCESS_INFORMATION pi;
+        STARTUPINFOA si = { sizeof(si) };
+        char cmdline[MAX_PATH * 2], **argv;
+        BOOL ret;
+
+        addr = NULL;
+        size = 0;
+        status = pNtMapViewOfSection( map, GetCurrentProcess(), &addr, 0, 0, NULL,
+                                      &size, 1 /* ViewShare */, 0, PAGE_READONLY );
+        ok( status == STATUS_IMAGE_NOT_AT_BASE, "wrong status %x\n", status );
+        if (addr)
+        {
+            winetest_get_mainargs( &argv );
+            sprintf( cmdline, "\"%s\" loader relocated %s %p", argv[0], dll_name, addr );
+            ret = CreateProcessA( argv[0], cmdline, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi );
+            ok( ret, "CreateProcess(%s) error %d\n", cmdline, GetLastError() );
+            if (ret)
+            {
+                wait_child_process( pi.hProcess );
+                CloseHandle( pi.hThread );
+                CloseHandle( pi.hProcess );
+            }
+            pNtUnmapViewOfSection( GetCurrentProcess(), addr );
+        }
+    }
+
+    /* relocations are applied by the loader */
+    for (i = 0; i < 2; i++)
+    {
+        mod = LoadLibraryA( dll_name );
+        ok( mod != NULL, "%u: failed to load err %u\n", i, GetLastError() );
+        if (!mod) break;
+        ptr = (struct relocs *)((char *)mod + page_size);
+        ok( ptr->str == ptr->buffer, "%u: wrong pointer %p / %p\n", i, ptr->str, ptr->buffer );
+        ok( !strcmp( ptr->str, "relocated" ), "%u: wrong data %s\n", i, debugstr_a(ptr->str) );
+        FreeLibrary( mod );
+
+        /* the second time the section object doesn't exist anymore */
+        if (!i)
+        {
+            CloseHandle( map );
+            CloseHandle( hfile );
+        }
+    }
+
+    VirtualFree( reserve, 0, MEM_RELEASE );
+    DeleteFileA( dll_name );
+#undef DATA_RVA
+}
+
 #define MAX_COUNT 10
 static HANDLE attached_thread[MAX_COUNT];
 static DWORD attached_thread_count;
@@ -3918,6 +4129,40 @@ static void test_dll_file( const char *name )
 #undef OK_FIELD
 }
 
+static void test_export_lookup( const char *name )
+{
+    const IMAGE_EXPORT_DIRECTORY *exports;
+    const DWORD *names;
+    const WORD *ordinals;
+    HMODULE module;
+    DWORD i, size, start;
+    FARPROC proc;
+
+    if (!(module = LoadLibraryA( name )))
+    {
+        skip( "%s not available\n", name );
+        return;
+    }
+    exports = pRtlImageDirectoryEntryToData( module, TRUE, IMAGE_DIRECTORY_ENTRY_EXPORT, &size );
+    ok( exports != NULL, "%s: no exports\n", name );
+    names = (const DWORD *)((const char *)module + exports->AddressOfNames);
+    ordinals = (const WORD *)((const char *)module + exports->AddressOfNameOrdinals);
+
+    start = GetTickCount();
+    for (i = 0; i < exports->NumberOfNames; i++)
+    {
+        const char *export = (const char *)module + names[i];
+        proc = GetProcAddress( module, export );
+        ok( proc == GetProcAddress( module, (LPCSTR)(ULONG_PTR)(ordinals[i] + exports->Base) ),
+            "%s: wrong address %p for %s\n", name, proc, export );
+    }
+    trace( "%s: looked up %u names in %u ms\n", name, exports->NumberOfNames, GetTickCount() - start );
+
+    proc = GetProcAddress( module, "__wine_nonexistent_export" );
+    ok( !proc, "%s: got %p for nonexistent export\n", name, proc );
+    FreeLibrary( module );
+}
+
 static void test_LoadPackagedLibrary(void)
 {
     HMODULE h;
@@ -3945,6 +4190,7 @@ START_TEST(loader)
     kernel32 = GetModuleHandleA("kernel32.dll");
     pNtCreateSection = (void *)GetProcAddress(ntdll, "NtCreateSection");
     pNtQuerySection = (void *)GetProcAddress(ntdll, "NtQuerySection");
+    pNtQueryVirtualMemory = (void *)GetProcAddress(ntdll, "NtQueryVirtualMemory");
     pNtMapViewOfSection = (void *)GetProcAddress(ntdll, "NtMapViewOfSection");
     pNtUnmapViewOfSection = (void *)GetProcAddress(ntdll, "NtUnmapViewOfSection");
     pNtTerminateProcess = (void *)GetProcAddress(ntdll, "NtTerminateProcess");
@@ -3990,6 +4236,13 @@ START_TEST(loader)
         *child_failures = -1;
 
     argc = winetest_get_mainargs(&argv);
+    if (argc > 4 && !strcmp( argv[2], "relocated" ))
+    {
+        void *expect;
+        sscanf( argv[4], "%p", &expect );
+        child_relocated_image( argv[3], expect );
+        return;
+    }
     if (argc > 4)
     {
         test_dll_phase = atoi(argv[4]);
@@ -4002,6 +4255,8 @@ START_TEST(loader)
     test_ImportDescriptors();
     test_section_access();
     test_import_resolution();
+    test_relocated_image( 0 );
+    test_relocated_image( IMAGE_SCN_MEM_SHARED );
     test_ExitProcess();
     test_InMemoryOrderModuleList();
     test_LoadPackagedLibrary();
@@ -4010,6 +4265,9 @@ START_TEST(loader)
     test_dll_file( "kernel32.dll" );
     test_dll_file( "advapi32.dll" );
     test_dll_file( "user32.dll" );
+    test_export_lookup( "ntdll.dll" );
+    test_export_lookup( "mshtml.dll" );
+    test_export_lookup( "d3dx9_36.dll" );
     /* loader test must be last, it can corrupt the internal loader state on Windows */
     test_Loader();
 }
@@ -696,6 +696,234 @@ done:
     RemoveDirectoryA( buf );
 }
 
+static void set_dir_time( const char *dir, const FILETIME *ft )
+{
+    HANDLE handle;
+    BOOL ret;
+
+    handle = CreateFileA( dir, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                          NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, 0 );
+    ok( handle != INVALID_HANDLE_VALUE, "failed to open %s err %u\n", dir, GetLastError() );
+    ret = SetFileTime( handle, NULL, NULL, ft );
+    ok( ret, "SetFileTime failed err %u\n", GetLastError() );
+    CloseHandle( handle );
+}
+
+static void check_search_result( const char *name, const char *expect, int line )
+{
+    char path[MAX_PATH];
+    HMODULE mod;
+
+    SetLastError( 0xdeadbeef );
+    mod = LoadLibraryExA( name, 0, LOAD_LIBRARY_SEARCH_USER_DIRS );
+    ok_(__FILE__,line)( mod != NULL, "LoadLibrary failed err %u\n", GetLastError() );
+    if (!mod) return;
+    GetModuleFileNameA( mod, path, MAX_PATH );
+    ok_(__FILE__,line)( !lstrcmpiA( path, expect ), "wrong module %s expected %s\n", path, expect );
+    FreeLibrary( mod );
+}
+
+/* the result of a search must follow the changes of the searched directories,
+ * including directories that were last modified long ago, which the loader
+ * may remember the contents of */
+static void test_LoadLibraryEx_search_changes(void)
+{
+    char *p, path[MAX_PATH], buf[MAX_PATH], dll1[MAX_PATH], dll2[MAX_PATH];
+    WCHAR bufW[MAX_PATH];
+    DLL_DIRECTORY_COOKIE cookies[2];
+    ULARGE_INTEGER time;
+    FILETIME ft;
+    unsigned int i;
+    BOOL ret;
+
+    if (!pAddDllDirectory || !pRemoveDllDirectory)
+    {
+        win_skip( "AddDllDirectory not available\n" );
+        return;
+    }
+
+    GetTempPathA( sizeof(path), path );
+    GetTempFileNameA( path, "tmp", 0, buf );
+    DeleteFileA( buf );
+    ret = CreateDirectoryA( buf, NULL );
+    ok( ret, "CreateDirectory failed err %u\n", GetLastError() );
+    p = buf + strlen( buf );
+    sprintf( dll1, "%s\\1\\winetestdll.dll", buf );
+    sprintf( dll2, "%s\\2\\winetestdll.dll", buf );
+
+    GetSystemTimeAsFileTime( &ft );
+    time.u.LowPart = ft.dwLowDateTime;
+    time.u.HighPart = ft.dwHighDateTime;
+    time.QuadPart -= (ULONGLONG)3600 * 10000000;
+    ft.dwLowDateTime = time.u.LowPart;
+    ft.dwHighDateTime = time.u.HighPart;
+
+    /* the last added directory is searched first */
+    for (i = 2; i >= 1; i--)
+    {
+        sprintf( p, "\\%u", i );
+        ret = CreateDirectoryA( buf, NULL );
+        ok( ret, "CreateDirectory failed err %u\n", GetLastError() );
+        MultiByteToWideChar( CP_ACP, 0, buf, -1, bufW, MAX_PATH );
+        cookies[i - 1] = pAddDllDirectory( bufW );
+        ok( cookies[i - 1] != NULL, "failed to add %s\n", buf );
+    }
+    create_test_dll( dll2 );
+    for (i = 1; i <= 2; i++)
+    {
+        sprintf( p, "\\%u", i );
+        set_dir_time( buf, &ft );
+    }
+
+    check_search_result( "winetestdll.dll", dll2, __LINE__ );
+    check_search_result( "winetestdll.dll", dll2, __LINE__ );
+
+    /* a dll added to a directory searched earlier takes precedence */
+    create_test_dll( dll1 );
+    check_search_result( "winetestdll.dll", dll1, __LINE__ );
+    sprintf( p, "\\1" );
+    set_dir_time( buf, &ft );
+    check_search_result( "winetestdll.dll", dll1, __LINE__ );
+    check_search_result( "WineTestDll.dll", dll1, __LINE__ );
+
+    ret = DeleteFileA( dll1 );
+    ok( ret, "DeleteFile failed err %u\n", GetLastError() );
+    check_search_result( "winetestdll.dll", dll2, __LINE__ );
+    set_dir_time( buf, &ft );
+    check_search_result( "winetestdll.dll", dll2, __LINE__ );
+
+    /* the dll moves from the directory where it was found to an earlier one */
+    ret = MoveFileA( dll2, dll1 );
+    ok( ret, "MoveFile failed err %u\n", GetLastError() );
+    check_search_result( "winetestdll.dll", dll1, __LINE__ );
+
+    for (i = 0; i < 2; i++) pRemoveDllDirectory( cookies[i] );
+    DeleteFileA( dll1 );
+    DeleteFileA( dll2 );
+    for (i = 1; i <= 2; i++)
+    {
+        sprintf( p, "\\%u", i );
+        RemoveDirectoryA( buf );
+    }
+    *p = 0;
+    RemoveDirectoryA( buf );
+}
+
+/* runs in a child process: search for the test dll in dir\1, then dir\2 */
+static void child_search( const char *dir, const char *expect )
+{
+    char buf[MAX_PATH];
+    WCHAR bufW[MAX_PATH];
+    DLL_DIRECTORY_COOKIE cookie;
+    unsigned int i;
+
+    for (i = 2; i >= 1; i--)
+    {
+        sprintf( buf, "%s\\%u", dir, i );
+        MultiByteToWideChar( CP_ACP, 0, buf, -1, bufW, MAX_PATH );
+        cookie = pAddDllDirectory( bufW );
+        ok( cookie != NULL, "failed to add %s\n", buf );
+    }
+    check_search_result( "winetestdll.dll", expect, __LINE__ );
+}
+
+static void run_search_child( const char *dir, const char *expect )
+{
+    STARTUPINFOA si = { sizeof(si) };
+    PROCESS_INFORMATION pi;
+    char cmdline[3 * MAX_PATH];
+    char **argv;
+    BOOL ret;
+
+    winetest_get_mainargs( &argv );
+    sprintf( cmdline, "\"%s\" module search \"%s\" \"%s\"", argv[0], dir, expect );
+    ret = CreateProcessA( NULL, cmdline, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi );
+    ok( ret, "CreateProcess failed err %u\n", GetLastError() );
+    if (!ret) return;
+    wait_child_process( pi.hProcess );
+    CloseHandle( pi.hThread );
+    CloseHandle( pi.hProcess );
+}
+
+/* the search results that Wine saves across processes with WINEDLLCACHE
+ * must be invalidated when the searched directories change */
+static void test_LoadLibraryEx_search_cache(void)
+{
+    char path[MAX_PATH], dir[MAX_PATH], buf[MAX_PATH], dll1[MAX_PATH], dll2[MAX_PATH];
+    ULARGE_INTEGER time;
+    FILETIME ft;
+    unsigned int i;
+    BOOL ret;
+
+    if (!pAddDllDirectory || !pRemoveDllDirectory)
+    {
+        win_skip( "AddDllDirectory not available\n" );
+        return;
+    }
+
+    GetTempPathA( sizeof(path), path );
+    GetTempFileNameA( path, "tmp", 0, dir );
+    DeleteFileA( dir );
+    ret = CreateDirectoryA( dir, NULL );
+    ok( ret, "CreateDirectory failed err %u\n", GetLastError() );
+    for (i = 1; i <= 2; i++)
+    {
+        sprintf( buf, "%s\\%u", dir, i );
+        ret = CreateDirectoryA( buf, NULL );
+        ok( ret, "CreateDirectory failed err %u\n", GetLastError() );
+    }
+    sprintf( dll1, "%s\\1\\winetestdll.dll", dir );
+    sprintf( dll2, "%s\\2\\winetestdll.dll", dir );
+    create_test_dll( dll2 );
+
+    /* directories modified recently are not cached */
+    GetSystemTimeAsFileTime( &ft );
+    time.u.LowPart = ft.dwLowDateTime;
+    time.u.HighPart = ft.dwHighDateTime;
+    time.QuadPart -= (ULONGLONG)3600 * 10000000;
+    ft.dwLowDateTime = time.u.LowPart;
+    ft.dwHighDateTime = time.u.HighPart;
+    for (i = 1; i <= 2; i++)
+    {
+        sprintf( buf, "%s\\%u", dir, i );
+        set_dir_time( buf, &ft );
+    }
+
+    SetEnvironmentVariableA( "WINEDLLCACHE", "1" );
+
+    /* the second child may use the result saved by the first one */
+    run_search_child( dir, dll2 );
+    run_search_child( dir, dll2 );
+
+    /* a dll added to a directory searched earlier */
+    create_test_dll( dll1 );
+    run_search_child( dir, dll1 );
+    time.QuadPart += 10000000;
+    ft.dwLowDateTime = time.u.LowPart;
+    ft.dwHighDateTime = time.u.HighPart;
+    sprintf( buf, "%s\\1", dir );
+    set_dir_time( buf, &ft );
+    run_search_child( dir, dll1 );
+    run_search_child( dir, dll1 );
+
+    /* the dll is removed again */
+    ret = DeleteFileA( dll1 );
+    ok( ret, "DeleteFile failed err %u\n", GetLastError() );
+    run_search_child( dir, dll2 );
+    run_search_child( dir, dll2 );
+
+    SetEnvironmentVariableA( "WINEDLLCACHE", NULL );
+
+    DeleteFileA( dll1 );
+    DeleteFileA( dll2 );
+    for (i = 1; i <= 2; i++)
+    {
+        sprintf( buf, "%s\\%u", dir, i );
+        RemoveDirectoryA( buf );
+    }
+    RemoveDirectoryA( dir );
+}
+
 static void testGetDllDirectory(void)
 {
     CHAR bufferA[MAX_PATH];
@@ -1155,6 +1383,16 @@ static void test_SetDefaultDllDirectories(void)
 START_TEST(module)
 {
     WCHAR filenameW[MAX_PATH];
+    char **argv;
+    int argc;
+
+    argc = winetest_get_mainargs( &argv );
+    if (argc >= 5 && !strcmp( argv[2], "search" ))
+    {
+        init_pointers();
+        child_search( argv[3], argv[4] );
+        return;
+    }
 
     /* Test if we can use GetModuleFileNameW */
 
@@ -1180,6 +1418,8 @@ START_TEST(module)
     testGetProcAddress_Wrong();
     testLoadLibraryEx();
     test_LoadLibraryEx_search_flags();
+    test_LoadLibraryEx_search_changes();
+    test_LoadLibraryEx_search_cache();
     testGetModuleHandleEx();
     testK32GetModuleInformation();
     test_AddDllDirectory();
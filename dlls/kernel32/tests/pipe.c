@@ -43,6 +43,9 @@ static BOOL (WINAPI *pGetNamedPipeServerProcessId)(HANDLE,ULONG*);
 static BOOL (WINAPI *pGetNamedPipeClientSessionId)(HANDLE,ULONG*);
 static BOOL (WINAPI *pGetNamedPipeServerSessionId)(HANDLE,ULONG*);
 static BOOL (WINAPI *pGetOverlappedResultEx)(HANDLE,OVERLAPPED *,DWORD *,DWORD,BOOL);
+static NTSTATUS (WINAPI *pNtCreateFile)(HANDLE *,ACCESS_MASK,OBJECT_ATTRIBUTES *,IO_STATUS_BLOCK *,
+                                       LARGE_INTEGER *,ULONG,ULONG,ULONG,ULONG,void *,ULONG);
+static void (WINAPI *pRtlInitUnicodeString)(UNICODE_STRING *,const WCHAR *);
 
 static BOOL user_apc_ran;
 static void CALLBACK user_apc(ULONG_PTR param)
@@ -2923,6 +2926,318 @@ static void _cancel_overlapped(unsigned line, HANDLE handle, OVERLAPPED *overlap
     _test_overlapped_failure(line, handle, overlapped, ERROR_OPERATION_ABORTED);
 }
 
+struct sync_read_params
+{
+    HANDLE pipe;
+    char   buf[512];
+    DWORD  size;
+    BOOL   ret;
+    DWORD  error;
+};
+
+static DWORD CALLBACK sync_read_proc(void *arg)
+{
+    struct sync_read_params *params = arg;
+
+    params->size = 0xdeadbeef;
+    SetLastError(0xdeadbeef);
+    params->ret = ReadFile(params->pipe, params->buf, sizeof(params->buf), &params->size, NULL);
+    params->error = GetLastError();
+    return 0;
+}
+
+#define sync_read_async(a,b) _sync_read_async(__LINE__,a,b)
+static HANDLE _sync_read_async(unsigned line, HANDLE pipe, struct sync_read_params *params)
+{
+    HANDLE thread;
+
+    params->pipe = pipe;
+    thread = CreateThread(NULL, 0, sync_read_proc, params, 0, NULL);
+    ok_(__FILE__,line)(thread != NULL, "CreateThread failed: %u\n", GetLastError());
+    return thread;
+}
+
+#define sync_read_done(a,b) _sync_read_done(__LINE__,a,b)
+static void _sync_read_done(unsigned line, HANDLE thread, HANDLE writer)
+{
+    DWORD res = WaitForSingleObject(thread, 5000);
+    ok_(__FILE__,line)(res == WAIT_OBJECT_0, "ReadFile didn't return: %u\n", res);
+    if (res != WAIT_OBJECT_0)
+    {
+        /* unblock the reader so that the test doesn't hang */
+        CloseHandle(writer);
+        WaitForSingleObject(thread, INFINITE);
+    }
+    CloseHandle(thread);
+}
+
+static void create_sync_byte_pipe(HANDLE *server, HANDLE *client)
+{
+    *server = CreateNamedPipeA(PIPENAME, PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+                               1, 1024, 1024, NMPWAIT_USE_DEFAULT_WAIT, NULL);
+    ok(*server != INVALID_HANDLE_VALUE, "CreateNamedPipe failed: %u\n", GetLastError());
+    *client = CreateFileA(PIPENAME, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, 0);
+    ok(*client != INVALID_HANDLE_VALUE, "CreateFile failed: %u\n", GetLastError());
+}
+
+/* open the client end of the pipe for alertable synchronous I/O */
+static HANDLE open_alertable_client(void)
+{
+    static const WCHAR nameW[] = {'\\','?','?','\\','p','i','p','e','\\',
+                                  't','e','s','t','s','_','p','i','p','e','.','c',0};
+    OBJECT_ATTRIBUTES attr;
+    UNICODE_STRING name;
+    IO_STATUS_BLOCK io;
+    NTSTATUS status;
+    HANDLE client;
+
+    pRtlInitUnicodeString(&name, nameW);
+    InitializeObjectAttributes(&attr, &name, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    status = pNtCreateFile(&client, SYNCHRONIZE | GENERIC_READ | GENERIC_WRITE, &attr, &io, NULL, 0,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE, FILE_OPEN, FILE_SYNCHRONOUS_IO_ALERT, NULL, 0);
+    ok(!status, "NtCreateFile failed: %x\n", status);
+    return status ? INVALID_HANDLE_VALUE : client;
+}
+
+/* synchronous byte mode pipes, which the server may let the clients transfer directly */
+static void test_sync_byte_mode(void)
+{
+    struct sync_read_params params;
+    HANDLE server, client, thread;
+    char buf[512];
+    DWORD size, mode;
+    BOOL res;
+
+    create_sync_byte_pipe(&server, &client);
+
+    /* a read returns what is available instead of waiting for the full length */
+    res = WriteFile(client, "short", 5, &size, NULL);
+    ok(res && size == 5, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    thread = sync_read_async(server, &params);
+    sync_read_done(thread, client);
+    ok(params.ret, "ReadFile failed: %u\n", params.error);
+    ok(params.size == 5, "size = %u\n", params.size);
+    ok(!memcmp(params.buf, "short", 5), "got wrong data\n");
+
+    /* a pending read completes with the first data that arrives */
+    thread = sync_read_async(client, &params);
+    Sleep(50);
+    test_not_signaled(thread);
+    res = WriteFile(server, "late", 4, &size, NULL);
+    ok(res && size == 4, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    sync_read_done(thread, server);
+    ok(params.ret, "ReadFile failed: %u\n", params.error);
+    ok(params.size == 4, "size = %u\n", params.size);
+    ok(!memcmp(params.buf, "late", 4), "got wrong data\n");
+
+    /* peeking doesn't consume the data */
+    res = WriteFile(client, "peek", 4, &size, NULL);
+    ok(res && size == 4, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    test_peek_pipe(server, 4, 4, 0);
+    res = ReadFile(server, buf, sizeof(buf), &size, NULL);
+    ok(res && size == 4, "ReadFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    ok(!memcmp(buf, "peek", 4), "got wrong data\n");
+    test_peek_pipe(server, 0, 0, 0);
+
+    /* flushing waits for the data to be read, and the pipe keeps working afterwards */
+    test_flush_sync(server);
+    res = WriteFile(server, "flush", 5, &size, NULL);
+    ok(res && size == 5, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    thread = test_flush_async(server, ERROR_SUCCESS);
+    res = ReadFile(client, buf, sizeof(buf), &size, NULL);
+    ok(res && size == 5, "ReadFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    ok(!memcmp(buf, "flush", 5), "got wrong data\n");
+    test_flush_done(thread);
+    res = WriteFile(client, "again", 5, &size, NULL);
+    ok(res && size == 5, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    res = ReadFile(server, buf, sizeof(buf), &size, NULL);
+    ok(res && size == 5, "ReadFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    ok(!memcmp(buf, "again", 5), "got wrong data\n");
+
+    CloseHandle(client);
+    CloseHandle(server);
+
+    /* switching to non-blocking mode keeps the data written so far */
+    create_sync_byte_pipe(&server, &client);
+    res = WriteFile(client, "nowait", 6, &size, NULL);
+    ok(res && size == 6, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    mode = PIPE_READMODE_BYTE | PIPE_NOWAIT;
+    res = SetNamedPipeHandleState(server, &mode, NULL, NULL);
+    ok(res, "SetNamedPipeHandleState failed: %u\n", GetLastError());
+    res = ReadFile(server, buf, sizeof(buf), &size, NULL);
+    ok(res && size == 6, "ReadFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    ok(!memcmp(buf, "nowait", 6), "got wrong data\n");
+    SetLastError(0xdeadbeef);
+    res = ReadFile(server, buf, sizeof(buf), &size, NULL);
+    ok(!res && GetLastError() == ERROR_NO_DATA, "ReadFile returned %x (%u)\n", res, GetLastError());
+    res = WriteFile(client, "more", 4, &size, NULL);
+    ok(res && size == 4, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    res = ReadFile(server, buf, sizeof(buf), &size, NULL);
+    ok(res && size == 4, "ReadFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    ok(!memcmp(buf, "more", 4), "got wrong data\n");
+    CloseHandle(client);
+    CloseHandle(server);
+
+    /* disconnecting fails a pending read of the client */
+    create_sync_byte_pipe(&server, &client);
+    thread = sync_read_async(client, &params);
+    Sleep(50);
+    test_not_signaled(thread);
+    res = DisconnectNamedPipe(server);
+    ok(res, "DisconnectNamedPipe failed: %u\n", GetLastError());
+    sync_read_done(thread, server);
+    ok(!params.ret && params.error == ERROR_PIPE_NOT_CONNECTED, "ReadFile returned %x (%u)\n",
+       params.ret, params.error);
+    SetLastError(0xdeadbeef);
+    res = WriteFile(client, "lost", 4, &size, NULL);
+    ok(!res && GetLastError() == ERROR_PIPE_NOT_CONNECTED, "WriteFile returned %x (%u)\n", res, GetLastError());
+    CloseHandle(client);
+    CloseHandle(server);
+
+    /* a user APC aborts a read blocked on an alertable handle */
+    if (!pNtCreateFile || !pQueueUserAPC)
+    {
+        win_skip("NtCreateFile or QueueUserAPC not available\n");
+        return;
+    }
+    server = CreateNamedPipeA(PIPENAME, PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+                              1, 1024, 1024, NMPWAIT_USE_DEFAULT_WAIT, NULL);
+    ok(server != INVALID_HANDLE_VALUE, "CreateNamedPipe failed: %u\n", GetLastError());
+    client = open_alertable_client();
+    thread = sync_read_async(client, &params);
+    Sleep(50);
+    test_not_signaled(thread);
+    user_apc_ran = FALSE;
+    ok(pQueueUserAPC(user_apc, thread, 0), "QueueUserAPC failed: %u\n", GetLastError());
+    sync_read_done(thread, server);
+    ok(user_apc_ran, "user APC didn't run\n");
+    ok(!params.ret && params.error == ERROR_OPERATION_ABORTED, "ReadFile returned %x (%u)\n",
+       params.ret, params.error);
+    /* the data written afterwards is left for the next read */
+    res = WriteFile(server, "apc", 3, &size, NULL);
+    ok(res && size == 3, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    res = ReadFile(client, buf, sizeof(buf), &size, NULL);
+    ok(res && size == 3, "ReadFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    ok(!memcmp(buf, "apc", 3), "got wrong data\n");
+    CloseHandle(client);
+    CloseHandle(server);
+}
+
+static void create_sync_message_pipe(HANDLE *server, HANDLE *client)
+{
+    DWORD mode = PIPE_READMODE_MESSAGE;
+    BOOL res;
+
+    *server = CreateNamedPipeA(PIPENAME, PIPE_ACCESS_DUPLEX, PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT,
+                               1, 1024, 1024, NMPWAIT_USE_DEFAULT_WAIT, NULL);
+    ok(*server != INVALID_HANDLE_VALUE, "CreateNamedPipe failed: %u\n", GetLastError());
+    *client = CreateFileA(PIPENAME, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, 0);
+    ok(*client != INVALID_HANDLE_VALUE, "CreateFile failed: %u\n", GetLastError());
+    res = SetNamedPipeHandleState(*client, &mode, NULL, NULL);
+    ok(res, "SetNamedPipeHandleState failed: %u\n", GetLastError());
+}
+
+/* synchronous message mode pipes, which the server may let the clients transfer directly */
+static void test_sync_message_mode(void)
+{
+    struct sync_read_params params;
+    HANDLE server, client, thread;
+    char buf[512];
+    DWORD size, mode;
+    BOOL res;
+
+    create_sync_message_pipe(&server, &client);
+
+    /* each read returns a single message */
+    res = WriteFile(client, "hello", 5, &size, NULL);
+    ok(res && size == 5, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    res = WriteFile(client, "world!", 6, &size, NULL);
+    ok(res && size == 6, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    test_peek_pipe(server, 5, 11, 5);
+    res = ReadFile(server, buf, sizeof(buf), &size, NULL);
+    ok(res && size == 5, "ReadFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    ok(!memcmp(buf, "hello", 5), "got wrong data\n");
+    res = ReadFile(server, buf, sizeof(buf), &size, NULL);
+    ok(res && size == 6, "ReadFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    ok(!memcmp(buf, "world!", 6), "got wrong data\n");
+
+    /* a pending read completes with the first message that arrives */
+    thread = sync_read_async(client, &params);
+    Sleep(50);
+    test_not_signaled(thread);
+    res = WriteFile(server, "late", 4, &size, NULL);
+    ok(res && size == 4, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    sync_read_done(thread, server);
+    ok(params.ret, "ReadFile failed: %u\n", params.error);
+    ok(params.size == 4, "size = %u\n", params.size);
+    ok(!memcmp(params.buf, "late", 4), "got wrong data\n");
+
+    /* a partial read returns ERROR_MORE_DATA and leaves the rest of the message */
+    res = WriteFile(client, "partial message", 15, &size, NULL);
+    ok(res && size == 15, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    res = WriteFile(client, "next", 4, &size, NULL);
+    ok(res && size == 4, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    SetLastError(0xdeadbeef);
+    res = ReadFile(server, buf, 7, &size, NULL);
+    ok(!res && GetLastError() == ERROR_MORE_DATA, "ReadFile returned %x (%u)\n", res, GetLastError());
+    ok(size == 7, "size = %u\n", size);
+    ok(!memcmp(buf, "partial", 7), "got wrong data\n");
+    res = ReadFile(server, buf, sizeof(buf), &size, NULL);
+    ok(res && size == 8, "ReadFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    ok(!memcmp(buf, " message", 8), "got wrong data\n");
+    res = ReadFile(server, buf, sizeof(buf), &size, NULL);
+    ok(res && size == 4, "ReadFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    ok(!memcmp(buf, "next", 4), "got wrong data\n");
+
+    /* empty messages are kept in order with the others */
+    res = WriteFile(server, "", 0, &size, NULL);
+    ok(res && !size, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    res = WriteFile(server, "full", 4, &size, NULL);
+    ok(res && size == 4, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    res = ReadFile(client, buf, sizeof(buf), &size, NULL);
+    ok(res && !size, "ReadFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    res = ReadFile(client, buf, sizeof(buf), &size, NULL);
+    ok(res && size == 4, "ReadFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    ok(!memcmp(buf, "full", 4), "got wrong data\n");
+    CloseHandle(client);
+    CloseHandle(server);
+
+    /* switching to byte read mode reads across the message boundaries */
+    create_sync_message_pipe(&server, &client);
+    res = WriteFile(client, "ab", 2, &size, NULL);
+    ok(res && size == 2, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    res = WriteFile(client, "cd", 2, &size, NULL);
+    ok(res && size == 2, "WriteFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    mode = PIPE_READMODE_BYTE;
+    res = SetNamedPipeHandleState(server, &mode, NULL, NULL);
+    ok(res, "SetNamedPipeHandleState failed: %u\n", GetLastError());
+    res = ReadFile(server, buf, sizeof(buf), &size, NULL);
+    ok(res && size == 4, "ReadFile returned %x (%u), size %u\n", res, GetLastError(), size);
+    ok(!memcmp(buf, "abcd", 4), "got wrong data\n");
+    CloseHandle(client);
+    CloseHandle(server);
+}
+
+/* run the synchronous pipe tests again with the direct data path requested */
+static void test_sync_byte_mode_direct(void)
+{
+    STARTUPINFOA si = { sizeof(si) };
+    PROCESS_INFORMATION info;
+    char **argv, buf[MAX_PATH];
+    BOOL res;
+
+    winetest_get_mainargs(&argv);
+    sprintf(buf, "\"%s\" pipe directpipes", argv[0]);
+    SetEnvironmentVariableA("WINEDIRECTPIPES", "1");
+    res = CreateProcessA(NULL, buf, NULL, NULL, FALSE, 0, NULL, NULL, &si, &info);
+    SetEnvironmentVariableA("WINEDIRECTPIPES", NULL);
+    ok(res, "CreateProcess failed: %u\n", GetLastError());
+    if (!res) return;
+    wait_child_process(info.hProcess);
+    CloseHandle(info.hThread);
+    CloseHandle(info.hProcess);
+}
+
 static void test_blocking_rw(HANDLE writer, HANDLE reader, DWORD buf_size, BOOL msg_mode, BOOL msg_read)
 {
     OVERLAPPED read_overlapped, read_overlapped2, write_overlapped, write_overlapped2;
@@ -4133,9 +4448,18 @@ START_TEST(pipe)
     pGetNamedPipeClientSessionId = (void *) GetProcAddress(hmod, "GetNamedPipeClientSessionId");
     pGetNamedPipeServerSessionId = (void *) GetProcAddress(hmod, "GetNamedPipeServerSessionId");
     pGetOverlappedResultEx = (void *)GetProcAddress(hmod, "GetOverlappedResultEx");
+    hmod = GetModuleHandleA("ntdll.dll");
+    pNtCreateFile = (void *)GetProcAddress(hmod, "NtCreateFile");
+    pRtlInitUnicodeString = (void *)GetProcAddress(hmod, "RtlInitUnicodeString");
 
     argc = winetest_get_mainargs(&argv);
 
+    if (argc > 2 && !strcmp(argv[2], "directpipes"))
+    {
+        test_sync_byte_mode();
+        test_sync_message_mode();
+        return;
+    }
     if (argc > 3)
     {
         if (!strcmp(argv[2], "writepipe"))
@@ -4177,6 +4501,9 @@ START_TEST(pipe)
     test_NamedPipeHandleState();
     test_GetNamedPipeInfo();
     test_readfileex_pending();
+    test_sync_byte_mode();
+    test_sync_message_mode();
+    test_sync_byte_mode_direct();
     test_overlapped_transport(TRUE, FALSE);
     test_overlapped_transport(TRUE, TRUE);
     test_overlapped_transport(FALSE, FALSE);
@@ -665,6 +665,96 @@ static void test_waitable_timer(void)
     CloseHandle( handle );
 }
 
+static void test_many_waitable_timers(void)
+{
+    const DWORD count = winetest_interactive ? 50000 : 2000;
+    LARGE_INTEGER due;
+    HANDLE *timers;
+    DWORD i, ret, start;
+    BOOL res;
+
+    timers = HeapAlloc( GetProcessHeap(), 0, count * sizeof(*timers) );
+    for (i = 0; i < count; i++)
+    {
+        timers[i] = CreateWaitableTimerA( NULL, TRUE, NULL );
+        ok( timers[i] != NULL, "CreateWaitableTimer failed with error %u\n", GetLastError() );
+    }
+
+    /* set the timers out of order, so that they need to be sorted */
+    start = GetTickCount();
+    for (i = 0; i < count; i++)
+    {
+        due.QuadPart = -((LONGLONG)3600 + (i * 7919) % count) * 10000000;
+        res = SetWaitableTimer( timers[i], &due, 0, NULL, NULL, FALSE );
+        ok( res, "SetWaitableTimer failed with error %u\n", GetLastError() );
+    }
+    trace( "set %u timers in %u ms\n", count, GetTickCount() - start );
+
+    due.QuadPart = -100000;  /* 10 ms */
+    res = SetWaitableTimer( timers[0], &due, 0, NULL, NULL, FALSE );
+    ok( res, "SetWaitableTimer failed with error %u\n", GetLastError() );
+    ret = WaitForSingleObject( timers[0], 2000 );
+    ok( ret == WAIT_OBJECT_0, "WaitForSingleObject returned %u\n", ret );
+    ret = WaitForSingleObject( timers[1], 0 );
+    ok( ret == WAIT_TIMEOUT, "WaitForSingleObject returned %u\n", ret );
+
+    start = GetTickCount();
+    for (i = 1; i < count; i += 2)
+    {
+        res = CancelWaitableTimer( timers[i] );
+        ok( res, "CancelWaitableTimer failed with error %u\n", GetLastError() );
+    }
+    trace( "cancelled %u timers in %u ms\n", count / 2, GetTickCount() - start );
+
+    for (i = 0; i < count; i++) CloseHandle( timers[i] );
+    HeapFree( GetProcessHeap(), 0, timers );
+}
+
+static unsigned int timer_apc_order[16], timer_apc_count;
+
+static void CALLBACK timer_order_apc( void *arg, DWORD low, DWORD high )
+{
+    if (timer_apc_count < ARRAY_SIZE(timer_apc_order))
+        timer_apc_order[timer_apc_count] = PtrToUlong( arg );
+    timer_apc_count++;
+}
+
+static void test_waitable_timer_order(void)
+{
+    HANDLE timers[ARRAY_SIZE(timer_apc_order)];
+    LARGE_INTEGER due;
+    FILETIME now;
+    DWORD i, start;
+    BOOL res;
+
+    for (i = 0; i < ARRAY_SIZE(timers); i++)
+    {
+        timers[i] = CreateWaitableTimerA( NULL, TRUE, NULL );
+        ok( timers[i] != NULL, "CreateWaitableTimer failed with error %u\n", GetLastError() );
+    }
+
+    /* timers with the same expiry fire in the order they were set */
+    GetSystemTimeAsFileTime( &now );
+    due.u.LowPart = now.dwLowDateTime;
+    due.u.HighPart = now.dwHighDateTime;
+    due.QuadPart += 500000;  /* 50 ms */
+    for (i = 0; i < ARRAY_SIZE(timers); i++)
+    {
+        DWORD index = (i * 7) % ARRAY_SIZE(timers);
+        res = SetWaitableTimer( timers[index], &due, 0, timer_order_apc, ULongToPtr( index ), FALSE );
+        ok( res, "SetWaitableTimer failed with error %u\n", GetLastError() );
+    }
+
+    start = GetTickCount();
+    while (timer_apc_count < ARRAY_SIZE(timers) && GetTickCount() - start < 5000) SleepEx( 100, TRUE );
+
+    ok( timer_apc_count == ARRAY_SIZE(timers), "got %u APCs\n", timer_apc_count );
+    for (i = 0; i < min( timer_apc_count, ARRAY_SIZE(timers) ); i++)
+        ok( timer_apc_order[i] == (i * 7) % ARRAY_SIZE(timers), "APC %u: got timer %u\n", i, timer_apc_order[i] );
+
+    for (i = 0; i < ARRAY_SIZE(timers); i++) CloseHandle( timers[i] );
+}
+
 static HANDLE sem = 0;
 
 static void CALLBACK iocp_callback(DWORD dwErrorCode, DWORD dwNumberOfBytesTransferred, LPOVERLAPPED lpOverlapped)
@@ -2722,6 +2812,8 @@ START_TEST(sync)
     test_event();
     test_semaphore();
     test_waitable_timer();
+    test_many_waitable_timers();
+    test_waitable_timer_order();
     test_iocp_callback();
     test_timer_queue();
     test_WaitForSingleObject();
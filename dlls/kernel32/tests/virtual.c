@@ -2130,6 +2130,73 @@ static void test_write_watch(void)
     VirtualFree( base, 0, MEM_RELEASE );
 }
 
+static void test_write_watch_large(void)
+{
+    static const SIZE_T size = 64 * 1024 * 1024;
+    ULONG_PTR count, total, i, pages;
+    DWORD start_time, ret;
+    ULONG pagesize;
+    void **results;
+    char *base;
+    int iter;
+
+    if (!pGetWriteWatch || !pResetWriteWatch)
+    {
+        win_skip( "GetWriteWatch not supported\n" );
+        return;
+    }
+
+    base = VirtualAlloc( 0, size, MEM_RESERVE | MEM_COMMIT | MEM_WRITE_WATCH, PAGE_READWRITE );
+    if (!base)
+    {
+        win_skip( "MEM_WRITE_WATCH not supported\n" );
+        return;
+    }
+    pages = size / 0x1000;
+    results = HeapAlloc( GetProcessHeap(), 0, pages * sizeof(*results) );
+
+    start_time = GetTickCount();
+    for (iter = 0; iter < 16; iter++)
+    {
+        for (i = iter % 8; i < pages; i += 8) base[i * 0x1000 + iter] = iter;
+
+        count = pages;
+        ret = pGetWriteWatch( WRITE_WATCH_FLAG_RESET, base, size, results, &count, &pagesize );
+        ok( !ret, "%u: GetWriteWatch failed %u\n", iter, GetLastError() );
+        ok( pagesize == 0x1000, "%u: wrong page size %u\n", iter, pagesize );
+        ok( count == pages / 8, "%u: wrong count %lu\n", iter, count );
+        for (i = 0; i < count; i++)
+            if (results[i] != base + (i * 8 + iter % 8) * 0x1000) break;
+        ok( i == count, "%u: wrong result %lu %p\n", iter, i, i < count ? results[i] : NULL );
+    }
+    trace( "%u iterations over %lu pages took %u ms\n", iter, pages, GetTickCount() - start_time );
+
+    /* retrieve the written pages in small batches */
+    for (i = 0; i < pages; i += 3) base[i * 0x1000] = 1;
+    total = 0;
+    do
+    {
+        count = 1000;
+        ret = pGetWriteWatch( WRITE_WATCH_FLAG_RESET, base, size, results, &count, &pagesize );
+        ok( !ret, "GetWriteWatch failed %u\n", GetLastError() );
+        ok( !count || results[0] == base + (total * 3) * 0x1000, "wrong result %p after %lu\n",
+            results[0], total );
+        total += count;
+    } while (count == 1000);
+    ok( total == (pages + 2) / 3, "wrong total %lu\n", total );
+
+    base[5 * 0x1000] = 1;
+    ret = pResetWriteWatch( base, size );
+    ok( !ret, "ResetWriteWatch failed %u\n", GetLastError() );
+    count = pages;
+    ret = pGetWriteWatch( 0, base, size, results, &count, &pagesize );
+    ok( !ret, "GetWriteWatch failed %u\n", GetLastError() );
+    ok( count == 0, "wrong count %lu\n", count );
+
+    HeapFree( GetProcessHeap(), 0, results );
+    VirtualFree( base, 0, MEM_RELEASE );
+}
+
 #if defined(__i386__) || defined(__x86_64__)
 
 static DWORD WINAPI stack_commit_func( void *arg )
@@ -4284,6 +4351,7 @@ START_TEST(virtual)
     test_IsBadWritePtr();
     test_IsBadCodePtr();
     test_write_watch();
+    test_write_watch_large();
 #if defined(__i386__) || defined(__x86_64__)
     test_stack_commit();
 #endif
@@ -52,7 +52,7 @@ static inline LONG interlocked_dec( PLONG dest )
 
 static inline void small_pause(void)
 {
-#ifdef __i386__
+#if defined(__i386__) || defined(__x86_64__)
     __asm__ __volatile__( "rep;nop" : : : "memory" );
 #else
     __asm__ __volatile__( "" : : : "memory" );
@@ -66,6 +66,76 @@ static BOOL crit_section_has_debuginfo(const RTL_CRITICAL_SECTION *crit)
     return crit->DebugInfo != NULL && crit->DebugInfo != no_debug_info_marker;
 }
 
+/* debug info allocated by RtlInitializeCriticalSectionEx, with room for Wine private data */
+struct crit_section_debug
+{
+    RTL_CRITICAL_SECTION_DEBUG debug;
+    LONG                       spin_count;  /* adaptive spin count */
+};
+
+/* spin count used for dynamic spinning */
+#define CRIT_DYNAMIC_SPIN_COUNT 2000
+/* number of spins tried on top of the adaptive spin count */
+#define CRIT_MIN_SPIN_COUNT 64
+
+static inline ULONG crit_section_spin_count( const RTL_CRITICAL_SECTION *crit )
+{
+    ULONG count = crit->SpinCount & ~RTL_CRITICAL_SECTION_ALL_FLAG_BITS;
+
+    if (count || NtCurrentTeb()->Peb->NumberOfProcessors <= 1) return count;
+    if (crit->SpinCount & RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN) return CRIT_DYNAMIC_SPIN_COUNT;
+    return 0;
+}
+
+/* return the adaptive spin count of a critical section, if it has one */
+static inline LONG *crit_section_adaptive_count( RTL_CRITICAL_SECTION *crit )
+{
+    /* Wine internal sections have a static debug info, with their name in Spare[0] */
+    if (!crit_section_has_debuginfo( crit ) || crit->DebugInfo->Spare[0]) return NULL;
+    return &CONTAINING_RECORD( crit->DebugInfo, struct crit_section_debug, debug )->spin_count;
+}
+
+/* move the adaptive spin count towards a target, or halve it if target is negative */
+static void update_adaptive_count( LONG *adaptive, LONG target )
+{
+    LONG old, new;
+
+    do
+    {
+        old = *adaptive;
+        new = target < 0 ? old / 2 : old + (target - old) / 8;
+    } while (interlocked_cmpxchg( adaptive, new, old ) != old);
+}
+
+/***********************************************************************
+ *           crit_section_spin
+ *
+ * Spins until the critical section is released, and tries to acquire it.
+ * The number of spins adapts to the time the section is usually held: it
+ * moves towards twice the number of spins needed when spinning succeeds,
+ * and is halved when it fails.
+ */
+static BOOL crit_section_spin( RTL_CRITICAL_SECTION *crit, ULONG max_count )
+{
+    LONG *adaptive = crit_section_adaptive_count( crit );
+    ULONG count, limit = max_count;
+
+    if (adaptive) limit = min( max_count, *adaptive + CRIT_MIN_SPIN_COUNT );
+
+    for (count = 0; count < limit; count++)
+    {
+        if (crit->LockCount > 0) break;  /* more than one waiter, don't bother spinning */
+        if (crit->LockCount == -1 && interlocked_cmpxchg( &crit->LockCount, 0, -1 ) == -1)
+        {
+            if (adaptive) update_adaptive_count( adaptive, min( 2 * count, max_count ));
+            return TRUE;
+        }
+        small_pause();
+    }
+    if (adaptive) update_adaptive_count( adaptive, -1 );
+    return FALSE;
+}
+
 #ifdef __linux__
 
 static int wait_op = 128; /*FUTEX_WAIT|FUTEX_PRIVATE_FLAG*/
@@ -318,7 +388,7 @@ NTSTATUS WINAPI RtlInitializeCriticalSectionAndSpinCount( RTL_CRITICAL_SECTION *
  */
 NTSTATUS WINAPI RtlInitializeCriticalSectionEx( RTL_CRITICAL_SECTION *crit, ULONG spincount, ULONG flags )
 {
-    if (flags & (RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN|RTL_CRITICAL_SECTION_FLAG_STATIC_INIT))
+    if (flags & RTL_CRITICAL_SECTION_FLAG_STATIC_INIT)
         FIXME("(%p,%u,0x%08x) semi-stub\n", crit, spincount, flags);
 
     /* FIXME: if RTL_CRITICAL_SECTION_FLAG_STATIC_INIT is given, we should use
@@ -331,9 +401,12 @@ NTSTATUS WINAPI RtlInitializeCriticalSectionEx( RTL_CRITICAL_SECTION *crit, ULON
         crit->DebugInfo = no_debug_info_marker;
     else
     {
-        crit->DebugInfo = RtlAllocateHeap(GetProcessHeap(), 0, sizeof(RTL_CRITICAL_SECTION_DEBUG));
+        struct crit_section_debug *debug = RtlAllocateHeap( GetProcessHeap(), 0, sizeof(*debug) );
+
+        crit->DebugInfo = debug ? &debug->debug : NULL;
         if (crit->DebugInfo)
         {
+            debug->spin_count = 0;
             crit->DebugInfo->Type = 0;
             crit->DebugInfo->CreatorBackTraceIndex = 0;
             crit->DebugInfo->CriticalSection = crit;
@@ -349,7 +422,8 @@ NTSTATUS WINAPI RtlInitializeCriticalSectionEx( RTL_CRITICAL_SECTION *crit, ULON
     crit->OwningThread   = 0;
     crit->LockSemaphore  = 0;
     if (NtCurrentTeb()->Peb->NumberOfProcessors <= 1) spincount = 0;
-    crit->SpinCount = spincount & ~0x80000000;
+    crit->SpinCount = (spincount & ~RTL_CRITICAL_SECTION_ALL_FLAG_BITS) |
+                      (flags & RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN);
     return STATUS_SUCCESS;
 }
 
@@ -376,9 +450,10 @@ NTSTATUS WINAPI RtlInitializeCriticalSectionEx( RTL_CRITICAL_SECTION *crit, ULON
  */
 ULONG WINAPI RtlSetCriticalSectionSpinCount( RTL_CRITICAL_SECTION *crit, ULONG spincount )
 {
-    ULONG oldspincount = crit->SpinCount;
+    ULONG oldspincount = crit->SpinCount & ~RTL_CRITICAL_SECTION_ALL_FLAG_BITS;
     if (NtCurrentTeb()->Peb->NumberOfProcessors <= 1) spincount = 0;
-    crit->SpinCount = spincount;
+    crit->SpinCount = (spincount & ~RTL_CRITICAL_SECTION_ALL_FLAG_BITS) |
+                      (crit->SpinCount & RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN);
     return oldspincount;
 }
 
@@ -406,6 +481,11 @@ NTSTATUS WINAPI RtlDeleteCriticalSection( RTL_CRITICAL_SECTION *crit )
     crit->OwningThread   = 0;
     if (crit_section_has_debuginfo( crit ))
     {
+        if (crit->DebugInfo->EntryCount)
+            TRACE( "section %p %s: %u contended entries, %u waits\n", crit,
+                   debugstr_a((char *)crit->DebugInfo->Spare[0]), crit->DebugInfo->EntryCount,
+                   crit->DebugInfo->ContentionCount );
+
         /* only free the ones we made in here */
         if (!crit->DebugInfo->Spare[0])
         {
@@ -493,7 +573,11 @@ NTSTATUS WINAPI RtlpWaitForCriticalSection( RTL_CRITICAL_SECTION *crit )
         rec.ExceptionInformation[0] = (ULONG_PTR)crit;
         RtlRaiseException( &rec );
     }
-    if (crit_section_has_debuginfo( crit )) crit->DebugInfo->ContentionCount++;
+    if (crit_section_has_debuginfo( crit ))
+    {
+        crit->DebugInfo->EntryCount++;
+        crit->DebugInfo->ContentionCount++;
+    }
     return STATUS_SUCCESS;
 }
 
@@ -555,20 +639,14 @@ NTSTATUS WINAPI RtlpUnWaitCriticalSection( RTL_CRITICAL_SECTION *crit )
  */
 NTSTATUS WINAPI RtlEnterCriticalSection( RTL_CRITICAL_SECTION *crit )
 {
-    if (crit->SpinCount)
-    {
-        ULONG count;
+    ULONG spin_count;
 
-        if (RtlTryEnterCriticalSection( crit )) return STATUS_SUCCESS;
-        for (count = crit->SpinCount; count > 0; count--)
-        {
-            if (crit->LockCount > 0) break;  /* more than one waiter, don't bother spinning */
-            if (crit->LockCount == -1)       /* try again */
-            {
-                if (interlocked_cmpxchg( &crit->LockCount, 0, -1 ) == -1) goto done;
-            }
-            small_pause();
-        }
+    /* Spin for a while if the section is held by another thread. */
+    if (crit->LockCount != -1 && crit->OwningThread != ULongToHandle(GetCurrentThreadId()) &&
+        (spin_count = crit_section_spin_count( crit )) && crit_section_spin( crit, spin_count ))
+    {
+        if (crit_section_has_debuginfo( crit )) crit->DebugInfo->EntryCount++;
+        goto done;
     }
 
     if (interlocked_inc( &crit->LockCount ))
@@ -191,6 +191,7 @@ struct dir_data_names
     const WCHAR *long_name;          /* long file name in Unicode */
     const WCHAR *short_name;         /* short file name in Unicode */
     const char  *unix_name;          /* Unix file name in host encoding */
+    BOOL         regular;            /* known to be a regular file without calling stat */
 };
 
 struct dir_data
@@ -227,6 +228,42 @@ static RTL_CRITICAL_SECTION_DEBUG critsect_debug =
 };
 static RTL_CRITICAL_SECTION dir_section = { &critsect_debug, -1, 0, 0, 0, 0 };
 
+/* cache of directory contents for case-insensitive lookups */
+
+#define DIR_CACHE_MAX_DIRS  256
+#define DIR_CACHE_RACY_SECS 2    /* directories modified more recently than this are not cached */
+
+struct dir_cache_name
+{
+    struct dir_cache_name *next;      /* next name in the hash bucket */
+    unsigned int           hash;      /* hash of the case-folded name */
+    char                   name[1];   /* Unix name */
+};
+
+struct dir_cache
+{
+    struct list             entry;    /* entry in the LRU list */
+    dev_t                   dev;      /* identity of the directory */
+    ino_t                   ino;
+    time_t                  mtime;    /* modification time when the cache was built */
+    ULONG                   mtime_ns;
+    unsigned int            count;    /* number of names */
+    unsigned int            mask;     /* size of the hash table - 1 */
+    struct dir_cache_name **hash;     /* hash table of names */
+};
+
+static struct list dir_cache_lru = LIST_INIT( dir_cache_lru );
+static unsigned int dir_cache_count;
+
+static RTL_CRITICAL_SECTION dir_cache_section;
+static RTL_CRITICAL_SECTION_DEBUG dir_cache_critsect_debug =
+{
+    0, 0, &dir_cache_section,
+    { &dir_cache_critsect_debug.ProcessLocksList, &dir_cache_critsect_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": dir_cache_section") }
+};
+static RTL_CRITICAL_SECTION dir_cache_section = { &dir_cache_critsect_debug, -1, 0, 0, 0, 0 };
+
 
 /* check if a given Unicode char is OK in a DOS short name */
 static inline BOOL is_invalid_dos_char( WCHAR ch )
@@ -353,7 +390,7 @@ static const WCHAR *add_dir_data_nameW( struct dir_data *data, const WCHAR *name
 
 /* add an entry to the directory names array */
 static BOOL add_dir_data_names( struct dir_data *data, const WCHAR *long_name,
-                                const WCHAR *short_name, const char *unix_name )
+                                const WCHAR *short_name, const char *unix_name, BOOL regular )
 {
     static const WCHAR empty[1];
     struct dir_data_names *names = data->names;
@@ -377,6 +414,7 @@ static BOOL add_dir_data_names( struct dir_data *data, const WCHAR *long_name,
 
     if (!(names[data->count].long_name = add_dir_data_nameW( data, long_name ))) return FALSE;
     if (!(names[data->count].unix_name = add_dir_data_nameA( data, unix_name ))) return FALSE;
+    names[data->count].regular = regular;
     data->count++;
     return TRUE;
 }
@@ -1443,9 +1481,10 @@ static BOOLEAN match_filename( const UNICODE_STRING *name_str, const UNICODE_STR
  *           append_entry
  *
  * Add a file to the directory data if it matches the mask.
+ * regular is set if the file is known to be a regular file.
  */
 static BOOL append_entry( struct dir_data *data, const char *long_name,
-                          const char *short_name, const UNICODE_STRING *mask )
+                          const char *short_name, BOOL regular, const UNICODE_STRING *mask )
 {
     int long_len, short_len;
     WCHAR long_nameW[MAX_DIR_ENTRY_LEN + 1];
@@ -1488,7 +1527,7 @@ static BOOL append_entry( struct dir_data *data, const char *long_name,
         if (!match_filename( &str, mask )) return TRUE;
     }
 
-    return add_dir_data_names( data, long_nameW, short_nameW, long_name );
+    return add_dir_data_names( data, long_nameW, short_nameW, long_name, regular );
 }
 
 
@@ -1505,8 +1544,16 @@ static NTSTATUS get_dir_data_entry( struct dir_data *dir_data, void *info_ptr, I
     union file_directory_info *info;
     struct stat st;
     ULONG name_len, start, dir_size, attributes;
+    int ret;
 
-    if (get_file_info( names->unix_name, &st, &attributes ) == -1)
+    /* the ignored files are all directories, don't stat regular files if only the name is needed */
+    if (class == FileNamesInformation && names->regular) goto no_stat;
+
+    if (!strcmp( names->unix_name, "." ) || !strcmp( names->unix_name, ".." ))
+        ret = get_file_info( names->unix_name, &st, &attributes );
+    else
+        ret = get_dir_entry_info( names->unix_name, dir_data->id.dev, dir_data->id.ino, &st, &attributes );
+    if (ret == -1)
     {
         TRACE( "file no longer exists %s\n", names->unix_name );
         return STATUS_SUCCESS;
@@ -1516,6 +1563,7 @@ static NTSTATUS get_dir_data_entry( struct dir_data *dir_data, void *info_ptr, I
         TRACE( "ignoring file %s\n", names->unix_name );
         return STATUS_SUCCESS;
     }
+no_stat:
     start = dir_info_align( io->Information );
     dir_size = dir_info_size( class, 0 );
     if (start + dir_size > max_length) return STATUS_MORE_ENTRIES;
@@ -1651,8 +1699,8 @@ static NTSTATUS read_directory_data_vfat( struct dir_data *data, int fd, const U
 
     lseek( fd, 0, SEEK_SET );
 
-    if (!append_entry( data, ".", NULL, mask )) goto done;
-    if (!append_entry( data, "..", NULL, mask )) goto done;
+    if (!append_entry( data, ".", NULL, FALSE, mask )) goto done;
+    if (!append_entry( data, "..", NULL, FALSE, mask )) goto done;
 
     while (ioctl( fd, VFAT_IOCTL_READDIR_BOTH, (long)de ) != -1)
     {
@@ -1675,7 +1723,7 @@ static NTSTATUS read_directory_data_vfat( struct dir_data *data, int fd, const U
             long_name = de[0].d_name;
             short_name = NULL;
         }
-        if (!append_entry( data, long_name, short_name, mask )) goto done;
+        if (!append_entry( data, long_name, short_name, FALSE, mask )) goto done;
     }
     status = STATUS_SUCCESS;
 done:
@@ -1722,7 +1770,7 @@ static NTSTATUS read_directory_data_getattrlist( struct dir_data *data, const ch
 
     TRACE( "found %s\n", buffer.name );
 
-    if (!append_entry( data, buffer.name, NULL, NULL )) return STATUS_NO_MEMORY;
+    if (!append_entry( data, buffer.name, NULL, FALSE, NULL )) return STATUS_NO_MEMORY;
 
     return STATUS_SUCCESS;
 }
@@ -1745,12 +1793,73 @@ static NTSTATUS read_directory_data_stat( struct dir_data *data, const char *uni
 
     TRACE( "found %s\n", unix_name );
 
-    if (!append_entry( data, unix_name, NULL, NULL )) return STATUS_NO_MEMORY;
+    if (!append_entry( data, unix_name, NULL, FALSE, NULL )) return STATUS_NO_MEMORY;
 
     return STATUS_SUCCESS;
 }
 
 
+#if defined(__linux__) && defined(__NR_getdents64)
+
+struct linux_dirent64
+{
+    ULONG64        d_ino;
+    LONG64         d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[1];
+};
+
+#define LINUX_DT_REG 8
+
+/***********************************************************************
+ *           read_directory_getdents
+ *
+ * Read a directory using large getdents64 batches; helper for NtQueryDirectoryFile.
+ * The file type returned by the kernel avoids some stat calls later on.
+ */
+static NTSTATUS read_directory_data_getdents( struct dir_data *data, int fd, const UNICODE_STRING *mask )
+{
+    static const unsigned int buffer_size = 65536;
+    struct linux_dirent64 *de;
+    NTSTATUS status = STATUS_NO_MEMORY;
+    off_t old_pos = lseek( fd, 0, SEEK_CUR );
+    char *buffer;
+    int res, pos;
+
+    if (!(buffer = RtlAllocateHeap( GetProcessHeap(), 0, buffer_size ))) return STATUS_NO_MEMORY;
+
+    lseek( fd, 0, SEEK_SET );
+    if ((res = syscall( __NR_getdents64, fd, buffer, buffer_size )) == -1)
+    {
+        status = STATUS_NOT_SUPPORTED;
+        goto done;
+    }
+
+    if (!append_entry( data, ".", NULL, FALSE, mask )) goto done;
+    if (!append_entry( data, "..", NULL, FALSE, mask )) goto done;
+
+    while (res > 0)
+    {
+        for (pos = 0; pos < res; pos += de->d_reclen)
+        {
+            de = (struct linux_dirent64 *)(buffer + pos);
+            if (!strcmp( de->d_name, "." ) || !strcmp( de->d_name, ".." )) continue;
+            if (!append_entry( data, de->d_name, NULL, de->d_type == LINUX_DT_REG, mask )) goto done;
+        }
+        res = syscall( __NR_getdents64, fd, buffer, buffer_size );
+    }
+    status = STATUS_SUCCESS;
+
+done:
+    lseek( fd, old_pos, SEEK_SET );
+    RtlFreeHeap( GetProcessHeap(), 0, buffer );
+    return status;
+}
+
+#endif  /* __linux__ && __NR_getdents64 */
+
+
 /***********************************************************************
  *           read_directory_readdir
  *
@@ -1764,12 +1873,12 @@ static NTSTATUS read_directory_data_readdir( struct dir_data *data, const UNICOD
 
     if (!dir) return STATUS_NO_SUCH_FILE;
 
-    if (!append_entry( data, ".", NULL, mask )) goto done;
-    if (!append_entry( data, "..", NULL, mask )) goto done;
+    if (!append_entry( data, ".", NULL, FALSE, mask )) goto done;
+    if (!append_entry( data, "..", NULL, FALSE, mask )) goto done;
     while ((de = readdir( dir )))
     {
         if (!strcmp( de->d_name, "." ) || !strcmp( de->d_name, ".." )) continue;
-        if (!append_entry( data, de->d_name, NULL, mask )) goto done;
+        if (!append_entry( data, de->d_name, NULL, FALSE, mask )) goto done;
     }
     status = STATUS_SUCCESS;
 
@@ -1808,6 +1917,9 @@ static NTSTATUS read_directory_data( struct dir_data *data, int fd, const UNICOD
         }
     }
 
+#if defined(__linux__) && defined(__NR_getdents64)
+    if ((status = read_directory_data_getdents( data, fd, mask )) != STATUS_NOT_SUPPORTED) return status;
+#endif
     return read_directory_data_readdir( data, mask );
 }
 
@@ -2029,6 +2141,210 @@ NTSTATUS WINAPI DECLSPEC_HOTPATCH NtQueryDirectoryFile( HANDLE handle, HANDLE ev
 }
 
 
+static inline ULONG get_mtime_ns( const struct stat *st )
+{
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    return st->st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+    return st->st_mtimespec.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+static unsigned int hash_dir_cache_name( const WCHAR *name, int length )
+{
+    unsigned int hash = 0;
+    while (length--) hash = hash * 33 + RtlUpcaseUnicodeChar( *name++ );
+    return hash;
+}
+
+static void free_dir_cache( struct dir_cache *cache )
+{
+    struct dir_cache_name *name, *next;
+    unsigned int i;
+
+    for (i = 0; i <= cache->mask; i++)
+    {
+        for (name = cache->hash[i]; name; name = next)
+        {
+            next = name->next;
+            RtlFreeHeap( GetProcessHeap(), 0, name );
+        }
+    }
+    RtlFreeHeap( GetProcessHeap(), 0, cache->hash );
+    RtlFreeHeap( GetProcessHeap(), 0, cache );
+}
+
+/* double the size of the hash table of a directory cache */
+static BOOL grow_dir_cache( struct dir_cache *cache )
+{
+    struct dir_cache_name **hash, *name, *next;
+    unsigned int i, mask = cache->mask * 2 + 1;
+
+    if (!(hash = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY, (mask + 1) * sizeof(*hash) )))
+        return FALSE;
+    for (i = 0; i <= cache->mask; i++)
+    {
+        for (name = cache->hash[i]; name; name = next)
+        {
+            next = name->next;
+            name->next = hash[name->hash & mask];
+            hash[name->hash & mask] = name;
+        }
+    }
+    RtlFreeHeap( GetProcessHeap(), 0, cache->hash );
+    cache->hash = hash;
+    cache->mask = mask;
+    return TRUE;
+}
+
+/***********************************************************************
+ *           build_dir_cache
+ *
+ * Read the contents of a directory into a new cache entry.
+ */
+static struct dir_cache *build_dir_cache( const char *unix_name, const struct stat *st )
+{
+    WCHAR buffer[MAX_DIR_ENTRY_LEN];
+    struct dir_cache *cache;
+    struct dir_cache_name *name;
+    struct dirent *de;
+    size_t len;
+    DIR *dir;
+    int ret;
+
+#ifdef VFAT_IOCTL_READDIR_BOTH
+    {
+        /* the VFAT short names are not cached, don't bother with such directories */
+        int fd = open( unix_name, O_RDONLY | O_DIRECTORY );
+        BOOL vfat;
+
+        if (fd == -1) return NULL;
+        RtlEnterCriticalSection( &dir_section );
+        vfat = start_vfat_ioctl( fd ) != NULL;
+        RtlLeaveCriticalSection( &dir_section );
+        close( fd );
+        if (vfat) return NULL;
+    }
+#endif
+
+    if (!(cache = RtlAllocateHeap( GetProcessHeap(), 0, sizeof(*cache) ))) return NULL;
+    cache->dev      = st->st_dev;
+    cache->ino      = st->st_ino;
+    cache->mtime    = st->st_mtime;
+    cache->mtime_ns = get_mtime_ns( st );
+    cache->count    = 0;
+    cache->mask     = 15;
+    if (!(cache->hash = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY,
+                                         (cache->mask + 1) * sizeof(*cache->hash) )))
+    {
+        RtlFreeHeap( GetProcessHeap(), 0, cache );
+        return NULL;
+    }
+
+    if (!(dir = opendir( unix_name ))) goto failed;
+    while ((de = readdir( dir )))
+    {
+        if (!strcmp( de->d_name, "." ) || !strcmp( de->d_name, ".." )) continue;
+        len = strlen( de->d_name );
+        ret = ntdll_umbstowcs( de->d_name, len, buffer, MAX_DIR_ENTRY_LEN );
+        if (cache->count > cache->mask && !grow_dir_cache( cache )) break;
+        if (!(name = RtlAllocateHeap( GetProcessHeap(), 0, offsetof( struct dir_cache_name, name[len + 1] ))))
+            break;
+        memcpy( name->name, de->d_name, len + 1 );
+        name->hash = hash_dir_cache_name( buffer, ret );
+        name->next = cache->hash[name->hash & cache->mask];
+        cache->hash[name->hash & cache->mask] = name;
+        cache->count++;
+    }
+    closedir( dir );
+    if (!de) return cache;
+
+failed:
+    free_dir_cache( cache );
+    return NULL;
+}
+
+/***********************************************************************
+ *           lookup_dir_cache
+ *
+ * Look for a file name through the cached contents of a directory.
+ * unix_name must contain the directory name, terminated at pos - 1;
+ * the file found is appended to it at pos.
+ * Returns 1 if found, 0 if not found, -1 if the directory can't be cached.
+ */
+static int lookup_dir_cache( char *unix_name, int pos, const WCHAR *name, int length )
+{
+    WCHAR buffer[MAX_DIR_ENTRY_LEN];
+    struct dir_cache *cache, *new_cache = NULL;
+    struct dir_cache_name *entry;
+    struct stat st;
+    unsigned int hash;
+    int ret = -1;
+
+    if (stat( unix_name, &st )) return -1;
+
+    RtlEnterCriticalSection( &dir_cache_section );
+    for (;;)
+    {
+        LIST_FOR_EACH_ENTRY( cache, &dir_cache_lru, struct dir_cache, entry )
+        {
+            if (cache->dev != st.st_dev || cache->ino != st.st_ino) continue;
+            if (cache->mtime == st.st_mtime && cache->mtime_ns == get_mtime_ns( &st )) goto found;
+            TRACE( "directory %s changed\n", debugstr_a(unix_name) );
+            list_remove( &cache->entry );
+            free_dir_cache( cache );
+            dir_cache_count--;
+            break;
+        }
+        if (new_cache) break;
+
+        /* the directory could still be modified without changing its time stamp */
+        if (st.st_mtime + DIR_CACHE_RACY_SECS >= time( NULL )) goto done;
+
+        RtlLeaveCriticalSection( &dir_cache_section );
+        new_cache = build_dir_cache( unix_name, &st );
+        RtlEnterCriticalSection( &dir_cache_section );
+        if (!new_cache) goto done;
+    }
+
+    cache = new_cache;
+    new_cache = NULL;
+    if (dir_cache_count >= DIR_CACHE_MAX_DIRS)
+    {
+        struct dir_cache *old = LIST_ENTRY( list_tail( &dir_cache_lru ), struct dir_cache, entry );
+        list_remove( &old->entry );
+        free_dir_cache( old );
+        dir_cache_count--;
+    }
+    dir_cache_count++;
+    TRACE( "cached %u names for %s\n", cache->count, debugstr_a(unix_name) );
+
+found:
+    list_remove( &cache->entry );
+    list_add_head( &dir_cache_lru, &cache->entry );
+
+    ret = 0;
+    hash = hash_dir_cache_name( name, length );
+    for (entry = cache->hash[hash & cache->mask]; entry; entry = entry->next)
+    {
+        if (entry->hash != hash) continue;
+        if (ntdll_umbstowcs( entry->name, strlen(entry->name), buffer, MAX_DIR_ENTRY_LEN ) != length) continue;
+        if (RtlCompareUnicodeStrings( buffer, length, name, length, TRUE )) continue;
+        unix_name[pos - 1] = '/';
+        strcpy( unix_name + pos, entry->name );
+        ret = 1;
+        break;
+    }
+
+done:
+    RtlLeaveCriticalSection( &dir_cache_section );
+    if (new_cache) free_dir_cache( new_cache );
+    return ret;
+}
+
+
 /***********************************************************************
  *           find_file_in_dir
  *
@@ -2045,7 +2361,7 @@ static NTSTATUS find_file_in_dir( char *unix_name, int pos, const WCHAR *name, i
     DIR *dir;
     struct dirent *de;
     struct stat st;
-    int ret;
+    int i, ret;
 
     /* try a shortcut for this directory */
 
@@ -2077,6 +2393,18 @@ static NTSTATUS find_file_in_dir( char *unix_name, int pos, const WCHAR *name, i
 
     if (!is_name_8_dot_3 && !get_dir_case_sensitivity( unix_name )) goto not_found;
 
+    /* then look it up in the directory cache; hashed short names always contain a '~' */
+
+    for (i = 0; i < length; i++) if (name[i] == '~') break;
+    if (!is_name_8_dot_3 || i == length)
+    {
+        switch (lookup_dir_cache( unix_name, pos, name, length ))
+        {
+        case 1: goto success;
+        case 0: goto not_found;
+        }
+    }
+
     /* now look for it through the directory */
 
 #ifdef VFAT_IOCTL_READDIR_BOTH
@@ -0,0 +1,528 @@
+/*
+ * Persistent cache of dll search results
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * When WINEDLLCACHE is set, the loader remembers which dll names were not
+ * found in the directories of the search path, and in which directory of a
+ * given search path a dll was found, so that following process starts don't
+ * have to look them up again. Looking up a missing file is expensive because
+ * of the case-insensitive directory scan.
+ *
+ * A missing file entry is keyed on the Unix directory name and validated
+ * with the modification time of the directory, which changes whenever a file
+ * is added to it. A found file entry is keyed on the dll name and the search
+ * path, and validated with the modification times of all the directories
+ * up to the one containing the dll, since a file added to an earlier
+ * directory would be found first. The cache is stored in the prefix and
+ * rewritten at process exit if it changed.
+ */
+
+#include "config.h"
+#include "wine/port.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "ntstatus.h"
+#define WIN32_NO_STATUS
+#include "windef.h"
+#include "winternl.h"
+#include "ntdll_misc.h"
+#include "wine/library.h"
+#include "wine/list.h"
+#include "wine/debug.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL(module);
+
+#define DLL_CACHE_BUCKETS     256
+#define DLL_CACHE_MAX_ENTRIES 4096
+#define DLL_CACHE_MAX_DIRS    64    /* dlls found further in the search path are not cached */
+#define DLL_CACHE_RACY_SECS   2     /* directories modified more recently than this are not cached */
+
+static const char dll_cache_header[] = "WINE DLL CACHE 2\n";
+
+struct dll_cache_entry
+{
+    struct list  entry;
+    char        *key;       /* 'M', Unix directory name, '/', lower-case name for a missing dll */
+                            /* 'F', lower-case name, ':', search path for a found dll */
+    unsigned int count;     /* number of directory times */
+    ULONGLONG    mtime[1];  /* modification times of the directories in ns, 0 if missing */
+};
+
+static int dll_cache_enabled = -1;  /* -1 means not initialized yet */
+static BOOL dll_cache_dirty;
+static unsigned int dll_cache_count;
+static struct list dll_cache[DLL_CACHE_BUCKETS];
+
+static unsigned int hash_key( const char *key )
+{
+    unsigned int hash = 0;
+    while (*key) hash = hash * 33 + (unsigned char)*key++;
+    return hash % DLL_CACHE_BUCKETS;
+}
+
+static char *get_cache_file_name( const char *suffix )
+{
+    const char *config_dir = wine_get_config_dir();
+    char *name;
+
+    if (!(name = RtlAllocateHeap( GetProcessHeap(), 0,
+                                  strlen(config_dir) + sizeof("/dllcache") + strlen(suffix) )))
+        return NULL;
+    strcpy( name, config_dir );
+    strcat( name, "/dllcache" );
+    strcat( name, suffix );
+    return name;
+}
+
+static struct dll_cache_entry *find_entry( const char *key )
+{
+    struct dll_cache_entry *entry;
+
+    LIST_FOR_EACH_ENTRY( entry, &dll_cache[hash_key( key )], struct dll_cache_entry, entry )
+        if (!strcmp( entry->key, key )) return entry;
+    return NULL;
+}
+
+static void add_entry( const char *key, size_t len, const ULONGLONG *mtime, unsigned int count )
+{
+    struct dll_cache_entry *entry;
+    size_t size = offsetof( struct dll_cache_entry, mtime[count] );
+
+    if (dll_cache_count >= DLL_CACHE_MAX_ENTRIES) return;
+    if (!(entry = RtlAllocateHeap( GetProcessHeap(), 0, size + len + 1 ))) return;
+    entry->key = (char *)entry + size;
+    memcpy( entry->key, key, len );
+    entry->key[len] = 0;
+    memcpy( entry->mtime, mtime, count * sizeof(*mtime) );
+    entry->count = count;
+    list_add_head( &dll_cache[hash_key( entry->key )], &entry->entry );
+    dll_cache_count++;
+}
+
+static void remove_entry( struct dll_cache_entry *entry )
+{
+    list_remove( &entry->entry );
+    RtlFreeHeap( GetProcessHeap(), 0, entry );
+    dll_cache_count--;
+}
+
+/* load the cache file; lines are "<hex mtime>[,<hex mtime>...] <key>" */
+static void load_dll_cache(void)
+{
+    char *name, *data = NULL, *p, *end, *line;
+    struct stat st;
+    ULONGLONG mtime[DLL_CACHE_MAX_DIRS];
+    unsigned int count;
+    int fd;
+
+    if (!(name = get_cache_file_name( "" ))) return;
+    fd = open( name, O_RDONLY );
+    RtlFreeHeap( GetProcessHeap(), 0, name );
+    if (fd == -1) return;
+
+    if (!fstat( fd, &st ) && st.st_size > sizeof(dll_cache_header) &&
+        (data = RtlAllocateHeap( GetProcessHeap(), 0, st.st_size + 1 )) &&
+        read( fd, data, st.st_size ) == st.st_size &&
+        !memcmp( data, dll_cache_header, sizeof(dll_cache_header) - 1 ))
+    {
+        data[st.st_size] = 0;
+        for (line = data + sizeof(dll_cache_header) - 1; (end = strchr( line, '\n' )); line = end + 1)
+        {
+            for (p = line, count = 0; count < DLL_CACHE_MAX_DIRS; p++)
+            {
+                mtime[count++] = strtoull( p, &p, 16 );
+                if (*p != ',') break;
+            }
+            if (*p++ != ' ' || p >= end) continue;
+            if (*p != 'F' && (*p != 'M' || count != 1)) continue;
+            add_entry( p, end - p, mtime, count );
+        }
+        TRACE( "loaded %u entries\n", dll_cache_count );
+    }
+    RtlFreeHeap( GetProcessHeap(), 0, data );
+    close( fd );
+}
+
+static BOOL init_dll_cache(void)
+{
+    const char *env;
+    unsigned int i;
+
+    if (dll_cache_enabled != -1) return dll_cache_enabled;
+    dll_cache_enabled = 0;
+    if (!(env = getenv( "WINEDLLCACHE" )) || !atoi( env )) return FALSE;
+
+    for (i = 0; i < DLL_CACHE_BUCKETS; i++) list_init( &dll_cache[i] );
+    load_dll_cache();
+    dll_cache_enabled = 1;
+    return TRUE;
+}
+
+/* retrieve the Unix name and the modification time of a directory */
+static NTSTATUS get_dir_time( const UNICODE_STRING *dir, ANSI_STRING *unix_name, ULONGLONG *mtime, BOOL *racy )
+{
+    struct stat st;
+    NTSTATUS status;
+
+    if ((status = wine_nt_to_unix_file_name( dir, unix_name, FILE_OPEN, FALSE ))) return status;
+
+    if (stat( unix_name->Buffer, &st ) || !S_ISDIR( st.st_mode ))
+    {
+        RtlFreeAnsiString( unix_name );
+        return STATUS_OBJECT_PATH_NOT_FOUND;
+    }
+    *mtime = (ULONGLONG)st.st_mtime * 1000000000;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    *mtime += st.st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+    *mtime += st.st_mtimespec.tv_nsec;
+#endif
+    *racy = st.st_mtime + DLL_CACHE_RACY_SECS >= time( NULL );
+    return STATUS_SUCCESS;
+}
+
+/***********************************************************************
+ *           get_cache_key
+ *
+ * Build the missing file cache key for a dll file name, and retrieve the
+ * modification time of its directory. The directory must exist.
+ */
+static char *get_cache_key( const UNICODE_STRING *nt_name, ULONGLONG *mtime, BOOL *racy )
+{
+    UNICODE_STRING dir;
+    ANSI_STRING unix_name;
+    const WCHAR *name;
+    WCHAR lower[MAX_PATH];
+    char *key = NULL;
+    int len, name_len;
+    DWORD i;
+
+    for (i = nt_name->Length / sizeof(WCHAR); i > 0; i--) if (nt_name->Buffer[i - 1] == '\\') break;
+    if (i <= 1) return NULL;
+    name = nt_name->Buffer + i;
+    name_len = nt_name->Length / sizeof(WCHAR) - i;
+    if (!name_len || name_len >= MAX_PATH) return NULL;
+    for (i = 0; i < name_len; i++) lower[i] = RtlDowncaseUnicodeChar( name[i] );
+
+    dir.Buffer = nt_name->Buffer;
+    dir.Length = dir.MaximumLength = (name - nt_name->Buffer - 1) * sizeof(WCHAR);
+    if (get_dir_time( &dir, &unix_name, mtime, racy )) return NULL;
+    if (strchr( unix_name.Buffer, '\n' )) goto done;
+
+    if (!(key = RtlAllocateHeap( GetProcessHeap(), 0, unix_name.Length + 3 + name_len * 3 ))) goto done;
+    key[0] = 'M';
+    memcpy( key + 1, unix_name.Buffer, unix_name.Length );
+    key[unix_name.Length + 1] = '/';
+    len = ntdll_wcstoumbs( lower, name_len, key + unix_name.Length + 2, name_len * 3, TRUE );
+    if (len <= 0)
+    {
+        RtlFreeHeap( GetProcessHeap(), 0, key );
+        key = NULL;
+    }
+    else key[unix_name.Length + 2 + len] = 0;
+
+done:
+    RtlFreeAnsiString( &unix_name );
+    return key;
+}
+
+/***********************************************************************
+ *           get_search_key
+ *
+ * Build the found file cache key for a dll name and a search path. The
+ * current directory is part of the key when the path contains relative
+ * directories.
+ */
+static char *get_search_key( const WCHAR *paths, const WCHAR *search )
+{
+    WCHAR *buffer, *p;
+    const WCHAR *dir, *end;
+    char *key = NULL;
+    ULONG len, cwd_len = 0;
+    BOOL relative = FALSE;
+    int ret;
+
+    for (dir = paths; *dir; dir = *end ? end + 1 : end)
+    {
+        if (!(end = wcschr( dir, ';' ))) end = dir + wcslen( dir );
+        switch (RtlDetermineDosPathNameType_U( dir ))
+        {
+        case RELATIVE_PATH:
+        case RELATIVE_DRIVE_PATH:
+        case ABSOLUTE_PATH:
+            relative = TRUE;
+            break;
+        default:
+            break;
+        }
+    }
+
+    len = wcslen( search ) + 1 + wcslen( paths ) + 1;
+    if (relative) cwd_len = RtlGetCurrentDirectory_U( 0, NULL ) / sizeof(WCHAR);
+    if (!(buffer = RtlAllocateHeap( GetProcessHeap(), 0, (len + cwd_len) * sizeof(WCHAR) ))) return NULL;
+
+    for (p = buffer; *search; search++) *p++ = RtlDowncaseUnicodeChar( *search );
+    *p++ = ':';
+    wcscpy( p, paths );
+    p += wcslen( p );
+    if (relative)
+    {
+        *p++ = '|';
+        p += RtlGetCurrentDirectory_U( cwd_len * sizeof(WCHAR), p ) / sizeof(WCHAR);
+    }
+    len = p - buffer;
+
+    if (!wcschr( buffer, '\n' ) && (key = RtlAllocateHeap( GetProcessHeap(), 0, len * 3 + 2 )))
+    {
+        key[0] = 'F';
+        if ((ret = ntdll_wcstoumbs( buffer, len, key + 1, len * 3, TRUE )) > 0) key[ret + 1] = 0;
+        else
+        {
+            RtlFreeHeap( GetProcessHeap(), 0, key );
+            key = NULL;
+        }
+    }
+    RtlFreeHeap( GetProcessHeap(), 0, buffer );
+    return key;
+}
+
+/***********************************************************************
+ *           get_search_times
+ *
+ * Retrieve the modification times of the first directories of a search
+ * path, 0 for missing directories. Fails if one of them is racy.
+ */
+static BOOL get_search_times( const WCHAR *paths, ULONGLONG *mtime, unsigned int count )
+{
+    UNICODE_STRING nt_name;
+    ANSI_STRING unix_name;
+    WCHAR *name;
+    const WCHAR *end;
+    unsigned int i;
+    BOOL racy = FALSE;
+    ULONG len;
+
+    if (!(name = RtlAllocateHeap( GetProcessHeap(), 0, (wcslen( paths ) + 2) * sizeof(WCHAR) )))
+        return FALSE;
+
+    for (i = 0; i < count && !racy; i++, paths = *end ? end + 1 : end)
+    {
+        if (!(end = wcschr( paths, ';' ))) end = paths + wcslen( paths );
+        len = end - paths;
+        memcpy( name, paths, len * sizeof(WCHAR) );
+        if (!len) name[len++] = '.';
+        name[len] = 0;
+
+        mtime[i] = 0;
+        if (!RtlDosPathNameToNtPathName_U( name, &nt_name, NULL, NULL )) break;
+        if (!get_dir_time( &nt_name, &unix_name, &mtime[i], &racy )) RtlFreeAnsiString( &unix_name );
+        RtlFreeUnicodeString( &nt_name );
+    }
+    RtlFreeHeap( GetProcessHeap(), 0, name );
+    return i == count && !racy;
+}
+
+/***********************************************************************
+ *           dll_cache_is_missing
+ *
+ * Check whether a dll file is known not to exist.
+ * The loader_section must be locked while calling this function.
+ */
+BOOL dll_cache_is_missing( const UNICODE_STRING *nt_name )
+{
+    struct dll_cache_entry *entry;
+    ULONGLONG mtime;
+    BOOL racy, ret = FALSE;
+    char *key;
+
+    if (!init_dll_cache()) return FALSE;
+    if (!(key = get_cache_key( nt_name, &mtime, &racy ))) return FALSE;
+
+    if ((entry = find_entry( key )))
+    {
+        if (entry->mtime[0] == mtime)
+        {
+            TRACE( "%s is missing\n", debugstr_us(nt_name) );
+            ret = TRUE;
+        }
+        else
+        {
+            remove_entry( entry );
+            dll_cache_dirty = TRUE;
+        }
+    }
+    RtlFreeHeap( GetProcessHeap(), 0, key );
+    return ret;
+}
+
+/***********************************************************************
+ *           dll_cache_add_missing
+ *
+ * Remember that a dll file doesn't exist.
+ * The loader_section must be locked while calling this function.
+ */
+void dll_cache_add_missing( const UNICODE_STRING *nt_name )
+{
+    ULONGLONG mtime;
+    BOOL racy;
+    char *key;
+
+    if (!init_dll_cache()) return;
+    if (!(key = get_cache_key( nt_name, &mtime, &racy ))) return;
+
+    /* the directory could still be modified without changing its time stamp */
+    if (!racy && !find_entry( key ))
+    {
+        add_entry( key, strlen(key), &mtime, 1 );
+        dll_cache_dirty = TRUE;
+    }
+    RtlFreeHeap( GetProcessHeap(), 0, key );
+}
+
+/***********************************************************************
+ *           dll_cache_find_dir
+ *
+ * Find the index in the search path of the directory where a dll was
+ * found, or -1 if unknown.
+ * The loader_section must be locked while calling this function.
+ */
+int dll_cache_find_dir( const WCHAR *paths, const WCHAR *search )
+{
+    struct dll_cache_entry *entry;
+    ULONGLONG mtime[DLL_CACHE_MAX_DIRS];
+    char *key;
+    int ret = -1;
+
+    if (!init_dll_cache()) return -1;
+    if (!(key = get_search_key( paths, search ))) return -1;
+
+    if ((entry = find_entry( key )))
+    {
+        if (get_search_times( paths, mtime, entry->count ) &&
+            !memcmp( mtime, entry->mtime, entry->count * sizeof(mtime[0]) ))
+        {
+            TRACE( "%s found in directory %u\n", debugstr_w(search), entry->count - 1 );
+            ret = entry->count - 1;
+        }
+        else
+        {
+            remove_entry( entry );
+            dll_cache_dirty = TRUE;
+        }
+    }
+    RtlFreeHeap( GetProcessHeap(), 0, key );
+    return ret;
+}
+
+/***********************************************************************
+ *           dll_cache_add_dir
+ *
+ * Remember the index in the search path of the directory where a dll was
+ * found.
+ * The loader_section must be locked while calling this function.
+ */
+void dll_cache_add_dir( const WCHAR *paths, const WCHAR *search, unsigned int index )
+{
+    struct dll_cache_entry *entry;
+    ULONGLONG mtime[DLL_CACHE_MAX_DIRS];
+    char *key;
+
+    if (index >= DLL_CACHE_MAX_DIRS || !init_dll_cache()) return;
+    if (!(key = get_search_key( paths, search ))) return;
+
+    /* the directories could still be modified without changing their time stamps */
+    if (get_search_times( paths, mtime, index + 1 ))
+    {
+        if ((entry = find_entry( key ))) remove_entry( entry );
+        add_entry( key, strlen(key), mtime, index + 1 );
+        dll_cache_dirty = TRUE;
+    }
+    RtlFreeHeap( GetProcessHeap(), 0, key );
+}
+
+/***********************************************************************
+ *           dll_cache_save
+ *
+ * Write the cache back to disk if it changed.
+ * The loader_section must be locked while calling this function.
+ */
+void dll_cache_save(void)
+{
+    struct dll_cache_entry *entry;
+    char *name, *tmp = NULL, suffix[24];
+    unsigned int i, j, count = 0;
+    BOOL ret;
+    FILE *f;
+    int fd;
+
+    if (dll_cache_enabled != 1 || !dll_cache_dirty) return;
+    dll_cache_dirty = FALSE;
+
+    /* write a new file and rename it over the old one, so that readers
+     * never see a partially written cache */
+    if (!(name = get_cache_file_name( "" ))) return;
+    for (;;)
+    {
+        RtlFreeHeap( GetProcessHeap(), 0, tmp );
+        sprintf( suffix, ".%04x%04x.tmp", GetCurrentProcessId(), count++ );
+        if (!(tmp = get_cache_file_name( suffix ))) goto done;
+        if ((fd = open( tmp, O_WRONLY | O_CREAT | O_EXCL, 0666 )) != -1) break;
+        if (errno != EEXIST) goto done;
+    }
+    if (!(f = fdopen( fd, "w" )))
+    {
+        close( fd );
+        unlink( tmp );
+        goto done;
+    }
+    fputs( dll_cache_header, f );
+    for (i = 0; i < DLL_CACHE_BUCKETS; i++)
+        LIST_FOR_EACH_ENTRY( entry, &dll_cache[i], struct dll_cache_entry, entry )
+        {
+            for (j = 0; j < entry->count; j++)
+                fprintf( f, "%s%x%08x", j ? "," : "", (DWORD)(entry->mtime[j] >> 32), (DWORD)entry->mtime[j] );
+            fprintf( f, " %s\n", entry->key );
+        }
+
+    ret = !fflush( f ) && !ferror( f ) && !fsync( fd );
+    if (fclose( f )) ret = FALSE;
+    if (!ret || rename( tmp, name ))
+    {
+        WARN( "failed to write %s: %s\n", debugstr_a(name), strerror(errno) );
+        unlink( tmp );
+    }
+    else TRACE( "saved %u entries\n", dll_cache_count );
+
+done:
+    RtlFreeHeap( GetProcessHeap(), 0, tmp );
+    RtlFreeHeap( GetProcessHeap(), 0, name );
+}
@@ -289,42 +289,48 @@ static void set_additional_environment( WCHAR **env )
     static const WCHAR allusersW[] = {'A','L','L','U','S','E','R','S','P','R','O','F','I','L','E',0};
     static const WCHAR programdataW[] = {'P','r','o','g','r','a','m','D','a','t','a',0};
     static const WCHAR publicW[] = {'P','U','B','L','I','C',0};
-    OBJECT_ATTRIBUTES attr;
-    UNICODE_STRING nameW;
+    OBJECT_ATTRIBUTES attr[2];
+    UNICODE_STRING nameW[2];
+    NTSTATUS status[2];
+    HANDLE hkey[2];
     WCHAR *val;
-    HANDLE hkey;
+
+    /* both keys are opened in a single server round trip */
+
+    InitializeObjectAttributes( &attr[0], &nameW[0], 0, 0, NULL );
+    InitializeObjectAttributes( &attr[1], &nameW[1], 0, 0, NULL );
+    RtlInitUnicodeString( &nameW[0], profile_keyW );
+    RtlInitUnicodeString( &nameW[1], computer_keyW );
+    open_keys( attr, KEY_READ, hkey, status, 2 );
 
     /* set the user profile variables */
 
-    InitializeObjectAttributes( &attr, &nameW, 0, 0, NULL );
-    RtlInitUnicodeString( &nameW, profile_keyW );
-    if (!NtOpenKey( &hkey, KEY_READ, &attr ))
+    if (!status[0])
     {
-        if ((val = get_registry_value( *env, hkey, programdataW )))
+        if ((val = get_registry_value( *env, hkey[0], programdataW )))
         {
             set_env_var( env, allusersW, val );
             set_env_var( env, programdataW, val );
             RtlFreeHeap( GetProcessHeap(), 0, val );
         }
-        if ((val = get_registry_value( *env, hkey, public_valueW )))
+        if ((val = get_registry_value( *env, hkey[0], public_valueW )))
         {
             set_env_var( env, publicW, val );
             RtlFreeHeap( GetProcessHeap(), 0, val );
         }
-        NtClose( hkey );
+        NtClose( hkey[0] );
     }
 
     /* set the computer name */
 
-    RtlInitUnicodeString( &nameW, computer_keyW );
-    if (!NtOpenKey( &hkey, KEY_READ, &attr ))
+    if (!status[1])
     {
-        if ((val = get_registry_value( *env, hkey, computer_valueW )))
+        if ((val = get_registry_value( *env, hkey[1], computer_valueW )))
         {
             set_env_var( env, computernameW, val );
             RtlFreeHeap( GetProcessHeap(), 0, val );
         }
-        NtClose( hkey );
+        NtClose( hkey[1] );
     }
 }
 
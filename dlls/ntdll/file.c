@@ -190,6 +190,29 @@ int get_file_info( const char *path, struct stat *st, ULONG *attr )
     return ret;
 }
 
+/* get the stat info and file attributes for an entry of the directory identified
+ * by dir_dev and dir_ino; the parent of a subdirectory is then known without calling stat */
+int get_dir_entry_info( const char *path, dev_t dir_dev, ino_t dir_ino, struct stat *st, ULONG *attr )
+{
+    int ret;
+
+    *attr = 0;
+    ret = lstat( path, st );
+    if (ret == -1) return ret;
+    if (S_ISLNK( st->st_mode ))
+    {
+        ret = stat( path, st );
+        if (ret == -1) return ret;
+        /* is a symbolic link and a directory, consider these "reparse points" */
+        if (S_ISDIR( st->st_mode )) *attr |= FILE_ATTRIBUTE_REPARSE_POINT;
+    }
+    /* consider mount points to be reparse points (IO_REPARSE_TAG_MOUNT_POINT) */
+    else if (S_ISDIR( st->st_mode ) && (st->st_dev != dir_dev || st->st_ino == dir_ino))
+        *attr |= FILE_ATTRIBUTE_REPARSE_POINT;
+    *attr |= get_file_attributes( st );
+    return ret;
+}
+
 /**************************************************************************
  *                 FILE_CreateFile                    (internal)
  * Open a file.
@@ -448,9 +471,20 @@ static async_data_t server_async( HANDLE handle, struct async_fileio *user, HAND
     return async;
 }
 
-static NTSTATUS wait_async( HANDLE handle, BOOL alertable, IO_STATUS_BLOCK *io )
+/* wait for the server to complete a blocking async; when a user APC interrupts
+ * the wait on a handle opened for alertable I/O, the I/O is cancelled, as on Windows */
+static NTSTATUS wait_async( HANDLE file, HANDLE handle, BOOL alertable, IO_STATUS_BLOCK *io )
 {
-    if (NtWaitForSingleObject( handle, alertable, NULL )) return STATUS_PENDING;
+    NTSTATUS status = NtWaitForSingleObject( handle, alertable, NULL );
+
+    if (status == STATUS_USER_APC)
+    {
+        IO_STATUS_BLOCK cancel_io;
+
+        NtCancelIoFileEx( file, io, &cancel_io );
+        status = NtWaitForSingleObject( handle, FALSE, NULL );
+    }
+    if (status) return STATUS_PENDING;
     return io->u.Status;
 }
 
@@ -618,7 +652,7 @@ static NTSTATUS server_read_file( HANDLE handle, HANDLE event, PIO_APC_ROUTINE a
 
     if (status != STATUS_PENDING) RtlFreeHeap( GetProcessHeap(), 0, async );
 
-    if (wait_handle) status = wait_async( wait_handle, (options & FILE_SYNCHRONOUS_IO_ALERT), io );
+    if (wait_handle) status = wait_async( handle, wait_handle, (options & FILE_SYNCHRONOUS_IO_ALERT), io );
     return status;
 }
 
@@ -656,10 +690,68 @@ static NTSTATUS server_write_file( HANDLE handle, HANDLE event, PIO_APC_ROUTINE
 
     if (status != STATUS_PENDING) RtlFreeHeap( GetProcessHeap(), 0, async );
 
-    if (wait_handle) status = wait_async( wait_handle, (options & FILE_SYNCHRONOUS_IO_ALERT), io );
+    if (wait_handle) status = wait_async( handle, wait_handle, (options & FILE_SYNCHRONOUS_IO_ALERT), io );
     return status;
 }
 
+/* forget the socket of a pipe using the direct data path, after the server shut it down */
+static void release_pipe_fd( HANDLE handle, int unix_handle, int needs_close )
+{
+    int fd = server_remove_fd_from_cache( handle );
+
+    if (fd != -1) close( fd );
+    if (needs_close) close( unix_handle );
+}
+
+/* wait for the fd of a synchronous read or write to become ready; on the direct
+ * pipe data path the wait doesn't go through the server, so for alertable
+ * handles the server is asked to wake the thread up when an APC is queued,
+ * and the I/O is cancelled once the APC ran, like a wait in the server */
+static NTSTATUS wait_sync_fd( int fd, short events, int timeout, enum server_fd_type type,
+                              unsigned int options )
+{
+    struct pollfd pfd;
+    int ret;
+
+    if (type == FD_TYPE_PIPE && (options & FILE_SYNCHRONOUS_IO_ALERT))
+    {
+        NTSTATUS status = server_wait_unix_fd( fd, events, timeout );
+        return status == STATUS_USER_APC ? STATUS_CANCELLED : status;
+    }
+
+    pfd.fd = fd;
+    pfd.events = events;
+    while ((ret = poll( &pfd, 1, timeout )) == -1 && errno == EINTR) ;
+    if (ret == -1) return FILE_GetNtStatus();
+    return ret ? STATUS_SUCCESS : STATUS_TIMEOUT;
+}
+
+/* check whether the socket of a pipe on the direct data path carries messages */
+static BOOL is_message_pipe_fd( int fd )
+{
+#if defined(SOCK_SEQPACKET) && defined(MSG_TRUNC)
+    int sock_type;
+    socklen_t len = sizeof(sock_type);
+
+    return !getsockopt( fd, SOL_SOCKET, SO_TYPE, &sock_type, &len ) && sock_type == SOCK_SEQPACKET;
+#else
+    return FALSE;
+#endif
+}
+
+/* check whether pipes created by this process should use the direct data path */
+static BOOL use_direct_pipes(void)
+{
+    static int enabled = -1;
+
+    if (enabled == -1)
+    {
+        const char *env = getenv( "WINEDIRECTPIPES" );
+        enabled = env && atoi( env );
+    }
+    return enabled;
+}
+
 struct io_timeouts
 {
     int interval;   /* max interval between two bytes */
@@ -855,7 +947,7 @@ NTSTATUS WINAPI NtReadFile(HANDLE hFile, HANDLE hEvent,
     ULONG total = 0;
     enum server_fd_type type;
     ULONG_PTR cvalue = apc ? 0 : (ULONG_PTR)apc_user;
-    BOOL send_completion = FALSE, async_read, timeout_init_done = FALSE;
+    BOOL send_completion = FALSE, async_read, timeout_init_done = FALSE, message_pipe;
 
     TRACE("(%p,%p,%p,%p,%p,%p,0x%08x,%p,%p)\n",
           hFile,hEvent,apc,apc_user,io_status,buffer,length,offset,key);
@@ -872,6 +964,7 @@ NTSTATUS WINAPI NtReadFile(HANDLE hFile, HANDLE hEvent,
         return server_read_file( hFile, hEvent, apc, apc_user, io_status, buffer, length, offset, key );
 
     async_read = !(options & (FILE_SYNCHRONOUS_IO_ALERT | FILE_SYNCHRONOUS_IO_NONALERT));
+    message_pipe = type == FD_TYPE_PIPE && is_message_pipe_fd( unix_handle );
 
     if (type == FD_TYPE_FILE)
     {
@@ -926,7 +1019,22 @@ NTSTATUS WINAPI NtReadFile(HANDLE hFile, HANDLE hEvent,
 
     for (;;)
     {
-        if ((result = virtual_locked_read( unix_handle, (char *)buffer + total, length - total )) >= 0)
+        if (message_pipe)
+        {
+            /* get the size first, the part of a message that doesn't fit would be lost;
+             * concurrent reads of the same end could still take the message in between */
+            result = recv( unix_handle, NULL, 0, MSG_PEEK | MSG_TRUNC );
+            if (result > 0 && (ULONG)result > length)
+            {
+                /* the server keeps the rest of the message for the next read */
+                release_pipe_fd( hFile, unix_handle, needs_close );
+                return server_read_file( hFile, hEvent, apc, apc_user, io_status, buffer, length, offset, key );
+            }
+            if (result > 0) result = virtual_locked_read( unix_handle, buffer, length );
+        }
+        else result = virtual_locked_read( unix_handle, (char *)buffer + total, length - total );
+
+        if (result >= 0)
         {
             total += result;
             if (!result || total == length)
@@ -950,16 +1058,36 @@ NTSTATUS WINAPI NtReadFile(HANDLE hFile, HANDLE hEvent,
                         goto done;
                     }
                     break;
+                case FD_TYPE_PIPE:
+                    if (!length)
+                    {
+                        status = STATUS_SUCCESS;
+                        goto done;
+                    }
+                    /* the direct data path was shut down, retry through the server */
+                    release_pipe_fd( hFile, unix_handle, needs_close );
+                    return NtReadFile( hFile, hEvent, apc, apc_user, io_status, buffer, length, offset, key );
                 default:
                     status = STATUS_PIPE_BROKEN;
                     goto err;
                 }
             }
             else if (type == FD_TYPE_FILE) continue;  /* no async I/O on regular files */
+            else if (type == FD_TYPE_PIPE)
+            {
+                /* byte mode pipe reads return whatever is available, message reads one message */
+                status = STATUS_SUCCESS;
+                goto done;
+            }
         }
         else if (errno != EAGAIN)
         {
             if (errno == EINTR) continue;
+            if (type == FD_TYPE_PIPE && !total && errno == ECONNRESET)
+            {
+                release_pipe_fd( hFile, unix_handle, needs_close );
+                return NtReadFile( hFile, hEvent, apc, apc_user, io_status, buffer, length, offset, key );
+            }
             if (!total) status = FILE_GetNtStatus();
             goto err;
         }
@@ -981,8 +1109,7 @@ NTSTATUS WINAPI NtReadFile(HANDLE hFile, HANDLE hEvent,
         }
         else  /* synchronous read, wait for the fd to become ready */
         {
-            struct pollfd pfd;
-            int ret, timeout;
+            int timeout;
 
             if (!timeout_init_done)
             {
@@ -993,22 +1120,16 @@ NTSTATUS WINAPI NtReadFile(HANDLE hFile, HANDLE hEvent,
             }
             timeout = get_next_io_timeout( &timeouts, total );
 
-            pfd.fd = unix_handle;
-            pfd.events = POLLIN;
-
-            if (!timeout || !(ret = poll( &pfd, 1, timeout )))
+            status = timeout ? wait_sync_fd( unix_handle, POLLIN, timeout, type, options ) : STATUS_TIMEOUT;
+            if (status == STATUS_TIMEOUT)
             {
                 if (total)  /* return with what we got so far */
                     status = STATUS_SUCCESS;
-                else
-                    status = (type == FD_TYPE_MAILSLOT) ? STATUS_IO_TIMEOUT : STATUS_TIMEOUT;
-                goto done;
-            }
-            if (ret == -1 && errno != EINTR)
-            {
-                status = FILE_GetNtStatus();
+                else if (type == FD_TYPE_MAILSLOT)
+                    status = STATUS_IO_TIMEOUT;
                 goto done;
             }
+            if (status) goto done;
             /* will now restart the read */
         }
     }
@@ -1318,6 +1439,13 @@ NTSTATUS WINAPI NtWriteFile(HANDLE hFile, HANDLE hEvent,
         }
     }
 
+    if (!length && type == FD_TYPE_PIPE && is_message_pipe_fd( unix_handle ))
+    {
+        /* an empty message couldn't be told apart from the socket being shut down */
+        release_pipe_fd( hFile, unix_handle, needs_close );
+        return server_write_file( hFile, hEvent, apc, apc_user, io_status, buffer, length, offset, key );
+    }
+
     for (;;)
     {
         /* zero-length writes on sockets may not work with plain write(2) */
@@ -1339,6 +1467,21 @@ NTSTATUS WINAPI NtWriteFile(HANDLE hFile, HANDLE hEvent,
         else if (errno != EAGAIN)
         {
             if (errno == EINTR) continue;
+            if (type == FD_TYPE_PIPE && (errno == EPIPE || errno == ECONNRESET))
+            {
+                /* the direct data path was shut down, write the rest through the server */
+                release_pipe_fd( hFile, unix_handle, needs_close );
+                status = NtWriteFile( hFile, hEvent, apc, apc_user, io_status,
+                                      (const char *)buffer + total, length - total, offset, key );
+                if (status == STATUS_SUCCESS) io_status->Information += total;
+                return status;
+            }
+            if (type == FD_TYPE_PIPE && errno == EMSGSIZE)
+            {
+                /* the message doesn't fit in the socket buffer, pass it through the server */
+                release_pipe_fd( hFile, unix_handle, needs_close );
+                return server_write_file( hFile, hEvent, apc, apc_user, io_status, buffer, length, offset, key );
+            }
             if (!total)
             {
                 if (errno == EFAULT) status = STATUS_INVALID_USER_BUFFER;
@@ -1375,8 +1518,7 @@ NTSTATUS WINAPI NtWriteFile(HANDLE hFile, HANDLE hEvent,
         }
         else  /* synchronous write, wait for the fd to become ready */
         {
-            struct pollfd pfd;
-            int ret, timeout;
+            int timeout;
 
             if (!timeout_init_done)
             {
@@ -1387,20 +1529,10 @@ NTSTATUS WINAPI NtWriteFile(HANDLE hFile, HANDLE hEvent,
             }
             timeout = get_next_io_timeout( &timeouts, total );
 
-            pfd.fd = unix_handle;
-            pfd.events = POLLOUT;
-
-            if (!timeout || !(ret = poll( &pfd, 1, timeout )))
-            {
-                /* return with what we got so far */
-                status = total ? STATUS_SUCCESS : STATUS_TIMEOUT;
-                goto done;
-            }
-            if (ret == -1 && errno != EINTR)
-            {
-                status = FILE_GetNtStatus();
-                goto done;
-            }
+            status = timeout ? wait_sync_fd( unix_handle, POLLOUT, timeout, type, options ) : STATUS_TIMEOUT;
+            if ((status == STATUS_TIMEOUT || status == STATUS_CANCELLED) && total)
+                status = STATUS_SUCCESS;  /* return with what we got so far */
+            if (status) goto done;
             /* will now restart the write */
         }
     }
@@ -1570,7 +1702,7 @@ static NTSTATUS server_ioctl_file( HANDLE handle, HANDLE event,
 
     if (status != STATUS_PENDING) RtlFreeHeap( GetProcessHeap(), 0, async );
 
-    if (wait_handle) status = wait_async( wait_handle, (options & FILE_SYNCHRONOUS_IO_ALERT), io );
+    if (wait_handle) status = wait_async( handle, wait_handle, (options & FILE_SYNCHRONOUS_IO_ALERT), io );
     return status;
 }
 
@@ -1707,6 +1839,16 @@ NTSTATUS WINAPI NtFsControlFile(HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc
         if (!status) status = DIR_unmount_device( handle );
         return status;
 
+    case FSCTL_PIPE_DISCONNECT:
+        status = server_ioctl_file( handle, event, apc, apc_context, io, code,
+                                    in_buffer, in_size, out_buffer, out_size );
+        if (!status)
+        {
+            int fd = server_remove_fd_from_cache( handle );
+            if (fd != -1) close( fd );
+        }
+        return status;
+
     case FSCTL_PIPE_IMPERSONATE:
         FIXME("FSCTL_PIPE_IMPERSONATE: impersonating self\n");
         status = RtlImpersonateSelf( SecurityImpersonation );
@@ -2329,6 +2471,7 @@ NTSTATUS WINAPI NtQueryInformationFile( HANDLE hFile, PIO_STATUS_BLOCK io,
     int fd, needs_close = FALSE;
     ULONG attr;
     unsigned int options;
+    enum server_fd_type type;
 
     TRACE("(%p,%p,%p,0x%08x,0x%08x)\n", hFile, io, ptr, len, class);
 
@@ -2341,11 +2484,16 @@ NTSTATUS WINAPI NtQueryInformationFile( HANDLE hFile, PIO_STATUS_BLOCK io,
     if (len < info_sizes[class])
         return io->u.Status = STATUS_INFO_LENGTH_MISMATCH;
 
-    if ((io->u.Status = server_get_unix_fd( hFile, 0, &fd, &needs_close, NULL, &options )))
+    if ((io->u.Status = server_get_unix_fd( hFile, 0, &fd, &needs_close, &type, &options )))
     {
         if (io->u.Status != STATUS_BAD_DEVICE_TYPE) return io->u.Status;
         return server_get_file_info( hFile, io, ptr, len, class );
     }
+    if (type == FD_TYPE_PIPE)  /* the fd is only used for the pipe data */
+    {
+        if (needs_close) close( fd );
+        return server_get_file_info( hFile, io, ptr, len, class );
+    }
 
     switch (class)
     {
@@ -3144,9 +3292,15 @@ NTSTATUS WINAPI NtQueryVolumeInformationFile( HANDLE handle, PIO_STATUS_BLOCK io
 {
     int fd, needs_close;
     struct stat st;
+    enum server_fd_type type;
     static int once;
 
-    io->u.Status = server_get_unix_fd( handle, 0, &fd, &needs_close, NULL, NULL );
+    io->u.Status = server_get_unix_fd( handle, 0, &fd, &needs_close, &type, NULL );
+    if (!io->u.Status && type == FD_TYPE_PIPE)  /* the fd is only used for the pipe data */
+    {
+        if (needs_close) close( fd );
+        io->u.Status = STATUS_BAD_DEVICE_TYPE;
+    }
     if (io->u.Status == STATUS_BAD_DEVICE_TYPE)
     {
         SERVER_START_REQ( get_volume_info )
@@ -3386,7 +3540,7 @@ NTSTATUS WINAPI NtFlushBuffersFile( HANDLE hFile, IO_STATUS_BLOCK *io )
 
         if (ret != STATUS_PENDING) RtlFreeHeap( GetProcessHeap(), 0, async );
 
-        if (wait_handle) ret = wait_async( wait_handle, FALSE, io );
+        if (wait_handle) ret = wait_async( hFile, wait_handle, FALSE, io );
     }
 
     if (needs_close) close( fd );
@@ -3534,7 +3688,8 @@ NTSTATUS WINAPI NtCreateNamedPipeFile( PHANDLE handle, ULONG access,
         req->flags = 
             (pipe_type ? NAMED_PIPE_MESSAGE_STREAM_WRITE   : 0) |
             (read_mode ? NAMED_PIPE_MESSAGE_STREAM_READ    : 0) |
-            (completion_mode ? NAMED_PIPE_NONBLOCKING_MODE : 0);
+            (completion_mode ? NAMED_PIPE_NONBLOCKING_MODE : 0) |
+            (use_direct_pipes() ? NAMED_PIPE_DIRECT_DATA : 0);
         req->maxinstances = max_inst;
         req->outsize = outbound_quota;
         req->insize  = inbound_quota;
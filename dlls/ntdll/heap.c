@@ -42,6 +42,7 @@
 #include "ntdll_misc.h"
 #include "wine/list.h"
 #include "wine/debug.h"
+#include "wine/heapstats.h"
 #include "wine/server.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(heap);
@@ -164,10 +165,108 @@ typedef struct tagHEAP
     ARENA_INUSE    **pending_free;  /* Ring buffer for pending free requests */
     RTL_CRITICAL_SECTION critSection; /* Critical section for serialization */
     FREE_LIST_ENTRY *freeList;      /* Free lists */
+    struct tagLFH_HEAP *lfh;        /* Low-fragmentation front end, if enabled */
+    struct tagHEAP_STATS *stats;    /* Allocation statistics, if enabled */
 } HEAP;
 
 #define HEAP_MAGIC       ((DWORD)('H' | ('E'<<8) | ('A'<<16) | ('P'<<24)))
 
+/* Low-fragmentation front end, enabled with HeapCompatibilityInformation = 2.
+ *
+ * Small blocks are carved out of dedicated 64k regions, each region holding
+ * blocks of a single size class. The regions are registered in a process-wide
+ * hash table, so that a block can be identified from its address without
+ * taking the heap lock. Free blocks are kept in interlocked lists per size
+ * class and per affinity slot, which is selected from the thread id; in the
+ * common case allocating or freeing a block is a single interlocked operation.
+ * The heap lock is only taken to carve new blocks. Regions are only released
+ * when the heap is destroyed. */
+
+typedef struct tagLFH_REGION
+{
+    DWORD                  magic;      /* LFH_REGION_MAGIC */
+    DWORD                  class;      /* size class of the blocks */
+    struct tagHEAP        *heap;       /* heap owning the region */
+    struct tagLFH_REGION  *next;       /* next region of the same heap */
+    SIZE_T                 data_size;  /* data size of the blocks */
+    char                  *unused;     /* first never allocated block */
+} LFH_REGION;
+
+#define LFH_REGION_MAGIC  ((DWORD)('L' | ('F'<<8) | ('H'<<16) | ('R'<<24)))
+#define LFH_REGION_SIZE   0x10000  /* must match the virtual memory allocation granularity */
+#define LFH_FIRST_ARENA   (((sizeof(LFH_REGION) + ALIGNMENT - 1) & ~(ALIGNMENT - 1)) + ARENA_OFFSET)
+#define LFH_MAX_REGIONS   0x1000   /* size of the regions hash table, must be a power of 2 */
+#define LFH_DELETED       ((LFH_REGION *)1)
+
+/* size classes are ALIGNMENT bytes apart up to LFH_SMALL_SIZE, and LFH_STEP bytes apart above */
+#define LFH_SMALL_SIZE    0x100
+#define LFH_MAX_SIZE      0x800
+#define LFH_STEP          0x40
+#define LFH_NB_CLASSES    (LFH_SMALL_SIZE / ALIGNMENT + (LFH_MAX_SIZE - LFH_SMALL_SIZE) / LFH_STEP + 1)
+#define LFH_SLOTS         8        /* number of affinity slots */
+#define LFH_BATCH         16       /* number of blocks carved at a time */
+
+typedef struct tagLFH_HEAP
+{
+    SLIST_HEADER     free[LFH_SLOTS][LFH_NB_CLASSES];  /* free blocks per affinity slot and size class */
+    LFH_REGION      *current[LFH_NB_CLASSES];          /* region to carve new blocks from */
+    LFH_REGION      *regions;                          /* list of all the regions */
+} LFH_HEAP;
+
+/* Allocation statistics, enabled with the FLG_HEAP_ENABLE_TAGGING global flag, or
+ * for a single heap with RtlSetHeapInformation.
+ *
+ * The blocks allocated and freed under the heap lock are counted separately from
+ * the front end ones, which need interlocked operations. With
+ * FLG_USER_STACK_TRACE_DB, the call stack of one
+ * allocation out of HEAP_SAMPLE_RATE is recorded as well. The sampled blocks are
+ * kept in a hash table, so that their call stack can be credited back when they
+ * are freed; the table is protected by the heap lock. */
+
+typedef struct tagHEAP_STACK
+{
+    ULONG            hash;         /* hash of the frames */
+    ULONG            depth;        /* number of frames, 0 for an unused entry */
+    LONGLONG         blocks;       /* live sampled blocks */
+    LONGLONG         bytes;        /* bytes requested by the live sampled blocks */
+    void            *frames[HEAP_WINE_STACK_DEPTH];
+} HEAP_STACK;
+
+typedef struct tagHEAP_SAMPLE
+{
+    const void      *ptr;          /* sampled block, NULL for an unused entry */
+    SIZE_T           size;         /* requested size of the block */
+    HEAP_STACK      *stack;        /* call stack of the allocation */
+} HEAP_SAMPLE;
+
+#define HEAP_SAMPLE_RATE    64
+#define HEAP_MAX_STACKS     0x200   /* size of the call stacks hash table, must be a power of 2 */
+#define HEAP_MAX_SAMPLES    0x1000  /* size of the samples hash table, must be a power of 2 */
+
+#define HEAP_STATS_SHARDS   16      /* number of front end counter sets, must be a power of 2 */
+
+/* each set of counters is on its own cache lines */
+typedef struct DECLSPEC_ALIGN(64) tagHEAP_COUNTERS
+{
+    LONGLONG         bytes;        /* bytes requested by the live blocks */
+    LONGLONG         arena_bytes;  /* bytes used by the live blocks, including the arenas */
+    LONGLONG         allocs;       /* total number of allocations */
+    LONGLONG         frees;        /* total number of frees */
+    LONGLONG         classes[HEAP_WINE_SIZE_CLASSES];  /* allocations per size class */
+    int              sample_count; /* allocations since the stats were enabled, for sampling */
+} HEAP_COUNTERS;
+
+typedef struct tagHEAP_STATS
+{
+    HEAP_COUNTERS    locked;       /* blocks allocated or freed under the heap lock */
+    HEAP_COUNTERS    front_end[HEAP_STATS_SHARDS];  /* blocks allocated or freed by the front end,
+                                                     * selected by thread to avoid contention */
+    LONGLONG         blocks;       /* number of live blocks when the stats were enabled */
+    unsigned int     samples_used; /* number of entries in the samples table */
+    HEAP_STACK      *stacks;       /* call stacks, if enabled */
+    HEAP_SAMPLE     *samples;      /* sampled blocks, if enabled */
+} HEAP_STATS;
+
 #define HEAP_DEF_SIZE        0x110000   /* Default heap size = 1Mb + 64Kb */
 #define COMMIT_MASK          0xffff  /* bitmask for commit/decommit granularity */
 #define MAX_FREE_PENDING     1024    /* max number of free requests to delay */
@@ -869,6 +968,681 @@ static BOOL validate_large_arena( HEAP *heap, const ARENA_LARGE *arena, BOOL qui
 }
 
 
+/***********************************************************************
+ *           get_block_size
+ *
+ * Return the size used by an in-use block, and the size requested for it in data_size.
+ */
+static SIZE_T get_block_size( const ARENA_INUSE *arena, SIZE_T *data_size )
+{
+    if (arena->size == ARENA_LARGE_SIZE)
+    {
+        const ARENA_LARGE *large = (const ARENA_LARGE *)(arena + 1) - 1;
+        *data_size = large->data_size;
+        return large->block_size;
+    }
+    *data_size = (arena->size & ARENA_SIZE_MASK) - arena->unused_bytes;
+    return (arena->size & ARENA_SIZE_MASK) + sizeof(*arena);
+}
+
+/* return the counters to update from the current thread */
+static inline HEAP_COUNTERS *get_stats_counters( HEAP_STATS *stats, BOOL front_end )
+{
+    if (!front_end) return &stats->locked;
+    return &stats->front_end[(HandleToULong( NtCurrentTeb()->ClientId.UniqueThread ) >> 2) % HEAP_STATS_SHARDS];
+}
+
+static inline void add_stat( LONGLONG *stat, LONGLONG value, BOOL front_end )
+{
+    LONGLONG prev;
+
+    if (!front_end)
+    {
+        *stat += value;
+        return;
+    }
+    /* the counters are shared by the threads that map to the same set, but rarely contended */
+    do prev = *(volatile LONGLONG *)stat;
+    while (interlocked_cmpxchg64( stat, prev + value, prev ) != prev);
+}
+
+/* sum a front end counter over all the sets */
+static inline LONGLONG sum_front_end_stat( const HEAP_STATS *stats, SIZE_T offset )
+{
+    LONGLONG total = 0;
+    unsigned int i;
+
+    for (i = 0; i < HEAP_STATS_SHARDS; i++)
+        total += *(volatile const LONGLONG *)((const char *)&stats->front_end[i] + offset);
+    return total;
+}
+
+static inline unsigned int get_stats_class( SIZE_T size )
+{
+    unsigned int class = 0;
+
+    while (class < HEAP_WINE_SIZE_CLASSES - 1 && size > (SIZE_T)16 << class) class++;
+    return class;
+}
+
+static inline unsigned int get_sample_hash( const void *ptr )
+{
+    return ((ULONG_PTR)ptr / ALIGNMENT) % HEAP_MAX_SAMPLES;
+}
+
+/***********************************************************************
+ *           sample_block
+ *
+ * Record the call stack of a sampled allocation.
+ */
+static void sample_block( HEAP *heap, const void *ptr, SIZE_T size )
+{
+    HEAP_STATS *stats = heap->stats;
+    void *frames[HEAP_WINE_STACK_DEPTH];
+    HEAP_STACK *stack;
+    unsigned int i, count;
+    ULONG hash;
+    USHORT depth;
+
+    /* skip ourselves and record_alloc */
+    if (!(depth = RtlCaptureStackBackTrace( 2, HEAP_WINE_STACK_DEPTH, frames, &hash ))) return;
+
+    RtlEnterCriticalSection( &heap->critSection );
+
+    if (stats->samples_used >= HEAP_MAX_SAMPLES / 4 * 3) goto done;  /* keep the hash table sparse */
+
+    for (i = hash % HEAP_MAX_STACKS, count = 0; count < HEAP_MAX_STACKS; i = (i + 1) % HEAP_MAX_STACKS, count++)
+    {
+        stack = &stats->stacks[i];
+        if (!stack->depth)
+        {
+            stack->hash  = hash;
+            stack->depth = depth;
+            memcpy( stack->frames, frames, depth * sizeof(frames[0]) );
+            break;
+        }
+        if (stack->hash == hash && stack->depth == depth &&
+            !memcmp( stack->frames, frames, depth * sizeof(frames[0]) )) break;
+    }
+    if (count == HEAP_MAX_STACKS) goto done;  /* no room for a new call stack */
+
+    for (i = get_sample_hash( ptr ); stats->samples[i].ptr; i = (i + 1) % HEAP_MAX_SAMPLES) ;
+    stats->samples[i].ptr   = ptr;
+    stats->samples[i].size  = size;
+    stats->samples[i].stack = stack;
+    stats->samples_used++;
+    stack->blocks++;
+    stack->bytes += size;
+
+done:
+    RtlLeaveCriticalSection( &heap->critSection );
+}
+
+/***********************************************************************
+ *           unsample_block
+ *
+ * Credit back the call stack of a block being freed, if it was sampled.
+ */
+static void unsample_block( HEAP *heap, const void *ptr )
+{
+    HEAP_STATS *stats = heap->stats;
+    HEAP_SAMPLE *sample;
+    unsigned int i, j, hash;
+
+    RtlEnterCriticalSection( &heap->critSection );
+
+    for (i = get_sample_hash( ptr ); stats->samples[i].ptr; i = (i + 1) % HEAP_MAX_SAMPLES)
+        if (stats->samples[i].ptr == ptr) break;
+
+    if ((sample = &stats->samples[i])->ptr)
+    {
+        sample->stack->blocks--;
+        sample->stack->bytes -= sample->size;
+        stats->samples_used--;
+
+        /* move back the following entries that can't be found anymore */
+        for (j = (i + 1) % HEAP_MAX_SAMPLES; stats->samples[j].ptr; j = (j + 1) % HEAP_MAX_SAMPLES)
+        {
+            hash = get_sample_hash( stats->samples[j].ptr );
+            if (i <= j ? (i < hash && hash <= j) : (i < hash || hash <= j)) continue;
+            stats->samples[i] = stats->samples[j];
+            i = j;
+        }
+        stats->samples[i].ptr = NULL;
+    }
+
+    RtlLeaveCriticalSection( &heap->critSection );
+}
+
+/***********************************************************************
+ *           record_alloc
+ *
+ * Update the statistics after a block has been allocated.
+ */
+static void record_alloc( HEAP *heap, const void *ptr, BOOL front_end )
+{
+    HEAP_STATS *stats = heap->stats;
+    HEAP_COUNTERS *counters = get_stats_counters( stats, front_end );
+    SIZE_T size, block_size = get_block_size( (const ARENA_INUSE *)ptr - 1, &size );
+
+    add_stat( &counters->bytes, size, front_end );
+    add_stat( &counters->arena_bytes, block_size, front_end );
+    add_stat( &counters->allocs, 1, front_end );
+    add_stat( &counters->classes[get_stats_class( size )], 1, front_end );
+
+    if (stats->stacks && !(interlocked_xchg_add( &counters->sample_count, 1 ) % HEAP_SAMPLE_RATE))
+        sample_block( heap, ptr, size );
+}
+
+/***********************************************************************
+ *           record_free
+ *
+ * Update the statistics before a block is freed.
+ */
+static void record_free( HEAP *heap, const void *ptr, BOOL front_end )
+{
+    HEAP_STATS *stats = heap->stats;
+    HEAP_COUNTERS *counters = get_stats_counters( stats, front_end );
+    SIZE_T size, block_size = get_block_size( (const ARENA_INUSE *)ptr - 1, &size );
+
+    add_stat( &counters->bytes, -(LONGLONG)size, front_end );
+    add_stat( &counters->arena_bytes, -(LONGLONG)block_size, front_end );
+    add_stat( &counters->frees, 1, front_end );
+
+    if (*(volatile unsigned int *)&stats->samples_used) unsample_block( heap, ptr );
+}
+
+/***********************************************************************
+ *           enable_heap_stats
+ */
+static void enable_heap_stats( HEAP *heap, BOOL stack_traces )
+{
+    HEAP_STATS *stats = NULL;
+    SUBHEAP *subheap;
+    ARENA_LARGE *large;
+    SIZE_T size = sizeof(*stats);
+
+    if (heap->stats) return;
+    if (stack_traces) size += HEAP_MAX_STACKS * sizeof(HEAP_STACK) + HEAP_MAX_SAMPLES * sizeof(HEAP_SAMPLE);
+    if (NtAllocateVirtualMemory( NtCurrentProcess(), (void **)&stats, 0, &size, MEM_COMMIT, PAGE_READWRITE ))
+        return;
+    if (stack_traces)
+    {
+        stats->stacks  = (HEAP_STACK *)(stats + 1);
+        stats->samples = (HEAP_SAMPLE *)(stats->stacks + HEAP_MAX_STACKS);
+    }
+
+    /* account for the existing blocks */
+    LIST_FOR_EACH_ENTRY( subheap, &heap->subheap_list, SUBHEAP, entry )
+    {
+        char *ptr = (char *)subheap->base + subheap->headerSize;
+        char *end = (char *)subheap->base + subheap->commitSize;
+        while (ptr < end)
+        {
+            ARENA_INUSE *arena = (ARENA_INUSE *)ptr;
+            SIZE_T data_size, block_size;
+
+            if (arena->size & ARENA_FLAG_FREE)
+            {
+                ptr += sizeof(ARENA_FREE) + (arena->size & ARENA_SIZE_MASK);
+                continue;
+            }
+            block_size = get_block_size( arena, &data_size );
+            if (arena->magic == ARENA_INUSE_MAGIC)
+            {
+                stats->locked.bytes += data_size;
+                stats->locked.arena_bytes += block_size;
+                stats->blocks++;
+            }
+            ptr += block_size;
+        }
+    }
+    LIST_FOR_EACH_ENTRY( large, &heap->large_list, ARENA_LARGE, entry )
+    {
+        stats->locked.bytes += large->data_size;
+        stats->locked.arena_bytes += large->block_size;
+        stats->blocks++;
+    }
+
+    heap->stats = stats;
+    TRACE( "enabled statistics for heap %p\n", heap );
+}
+
+/***********************************************************************
+ *           get_heap_stats
+ *
+ * Fill the statistics of a heap. The heap must be locked.
+ */
+static void get_heap_stats( HEAP *heap, HEAP_WINE_STATISTICS *info )
+{
+    HEAP_STATS *stats = heap->stats;
+    SUBHEAP *subheap;
+    ARENA_LARGE *large;
+    LFH_REGION *region;
+    ULONGLONG commit = 0, used;
+    unsigned int i;
+
+    LIST_FOR_EACH_ENTRY( subheap, &heap->subheap_list, SUBHEAP, entry ) commit += subheap->commitSize;
+    LIST_FOR_EACH_ENTRY( large, &heap->large_list, ARENA_LARGE, entry ) commit += large->block_size;
+    if (heap->lfh) for (region = heap->lfh->regions; region; region = region->next) commit += LFH_REGION_SIZE;
+
+    used = stats->locked.arena_bytes + sum_front_end_stat( stats, FIELD_OFFSET( HEAP_COUNTERS, arena_bytes ));
+    info->BytesInUse       = stats->locked.bytes + sum_front_end_stat( stats, FIELD_OFFSET( HEAP_COUNTERS, bytes ));
+    info->TotalAllocations = stats->locked.allocs + sum_front_end_stat( stats, FIELD_OFFSET( HEAP_COUNTERS, allocs ));
+    info->TotalFrees       = stats->locked.frees + sum_front_end_stat( stats, FIELD_OFFSET( HEAP_COUNTERS, frees ));
+    info->BlocksInUse      = stats->blocks + info->TotalAllocations - info->TotalFrees;
+    info->BytesCommitted   = commit;
+    info->Fragmentation    = commit && used < commit ? (commit - used) * 100 / commit : 0;
+    info->SampleRate       = stats->stacks ? HEAP_SAMPLE_RATE : 0;
+    for (i = 0; i < HEAP_WINE_SIZE_CLASSES; i++)
+        info->SizeClassAllocations[i] = stats->locked.classes[i] +
+                                        sum_front_end_stat( stats, FIELD_OFFSET( HEAP_COUNTERS, classes[i] ));
+}
+
+/***********************************************************************
+ *           get_heap_stack_traces
+ *
+ * Fill the sampled call stacks of a heap. The heap must be locked.
+ */
+static SIZE_T get_heap_stack_traces( HEAP *heap, HEAP_WINE_STACK_TRACE *info, SIZE_T size )
+{
+    HEAP_STATS *stats = heap->stats;
+    SIZE_T count = 0;
+    unsigned int i;
+
+    if (!stats->stacks) return 0;
+    for (i = 0; i < HEAP_MAX_STACKS; i++)
+    {
+        HEAP_STACK *stack = &stats->stacks[i];
+
+        if (!stack->blocks) continue;
+        if ((count + 1) * sizeof(*info) <= size)
+        {
+            info[count].BlocksInUse = stack->blocks;
+            info[count].BytesInUse  = stack->bytes;
+            info[count].Depth       = stack->depth;
+            memset( info[count].Frames, 0, sizeof(info[count].Frames) );
+            memcpy( info[count].Frames, stack->frames, stack->depth * sizeof(stack->frames[0]) );
+        }
+        count++;
+    }
+    return count * sizeof(*info);
+}
+
+/***********************************************************************
+ *           dump_heap_stats
+ *
+ * Print the statistics of a heap. The heap must be locked.
+ */
+static void dump_heap_stats( HEAP *heap )
+{
+    HEAP_WINE_STATISTICS info;
+    HEAP_STACK *stack, *top[10];
+    unsigned int i, j, count = 0;
+
+    get_heap_stats( heap, &info );
+    MESSAGE( "heap %p: %s bytes in %s blocks, %s bytes committed, %u%% unused, %s allocs, %s frees\n",
+             heap, wine_dbgstr_longlong( info.BytesInUse ), wine_dbgstr_longlong( info.BlocksInUse ),
+             wine_dbgstr_longlong( info.BytesCommitted ), info.Fragmentation,
+             wine_dbgstr_longlong( info.TotalAllocations ), wine_dbgstr_longlong( info.TotalFrees ));
+    for (i = 0; i < HEAP_WINE_SIZE_CLASSES; i++)
+    {
+        if (!info.SizeClassAllocations[i]) continue;
+        if (i < HEAP_WINE_SIZE_CLASSES - 1)
+            MESSAGE( "  <= %8lu bytes: %s allocs\n", (SIZE_T)16 << i,
+                     wine_dbgstr_longlong( info.SizeClassAllocations[i] ));
+        else
+            MESSAGE( "   > %8lu bytes: %s allocs\n", (SIZE_T)16 << (i - 1),
+                     wine_dbgstr_longlong( info.SizeClassAllocations[i] ));
+    }
+
+    if (!heap->stats->stacks) return;
+
+    /* print the call stacks holding the most memory, one sample stands for HEAP_SAMPLE_RATE allocations */
+    for (i = 0; i < HEAP_MAX_STACKS; i++)
+    {
+        stack = &heap->stats->stacks[i];
+        if (!stack->blocks) continue;
+        for (j = count; j > 0 && top[j - 1]->bytes < stack->bytes; j--)
+            if (j < ARRAY_SIZE(top)) top[j] = top[j - 1];
+        if (j < ARRAY_SIZE(top)) top[j] = stack;
+        if (count < ARRAY_SIZE(top)) count++;
+    }
+    for (i = 0; i < count; i++)
+    {
+        MESSAGE( "  ~%s bytes in ~%s blocks from", wine_dbgstr_longlong( top[i]->bytes * HEAP_SAMPLE_RATE ),
+                 wine_dbgstr_longlong( top[i]->blocks * HEAP_SAMPLE_RATE ));
+        for (j = 0; j < top[i]->depth; j++) MESSAGE( " %p", top[i]->frames[j] );
+        MESSAGE( "\n" );
+    }
+}
+
+
+/* process-wide hash table of the front end regions, indexed by address */
+static LFH_REGION *lfh_regions[LFH_MAX_REGIONS];
+static unsigned int lfh_regions_used;     /* number of live entries */
+static unsigned int lfh_regions_deleted;  /* number of LFH_DELETED entries */
+static int lfh_regions_seq;               /* odd while the table is being rehashed */
+
+static RTL_CRITICAL_SECTION lfh_section;
+static RTL_CRITICAL_SECTION_DEBUG lfh_section_debug =
+{
+    0, 0, &lfh_section,
+    { &lfh_section_debug.ProcessLocksList, &lfh_section_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": lfh_section") }
+};
+static RTL_CRITICAL_SECTION lfh_section = { &lfh_section_debug, -1, 0, 0, 0, 0 };
+
+static inline unsigned int get_lfh_region_hash( const void *base )
+{
+    return ((ULONG_PTR)base / LFH_REGION_SIZE) % LFH_MAX_REGIONS;
+}
+
+/* return the size class of a block, or -1 if it's too large for the front end */
+static inline int get_lfh_class( SIZE_T size )
+{
+    if (size <= LFH_SMALL_SIZE) return (size + ALIGNMENT - 1) / ALIGNMENT;
+    if (size <= LFH_MAX_SIZE) return LFH_SMALL_SIZE / ALIGNMENT + (size - LFH_SMALL_SIZE + LFH_STEP - 1) / LFH_STEP;
+    return -1;
+}
+
+/* return the data size of the blocks of a size class */
+static inline SIZE_T get_lfh_class_size( int class )
+{
+    SIZE_T size;
+
+    if (class <= LFH_SMALL_SIZE / ALIGNMENT) size = class * ALIGNMENT;
+    else size = LFH_SMALL_SIZE + (class - LFH_SMALL_SIZE / ALIGNMENT) * LFH_STEP;
+    return max( ROUND_SIZE(size), ROUND_SIZE(sizeof(SLIST_ENTRY)) );
+}
+
+static inline SLIST_HEADER *get_lfh_list( LFH_HEAP *lfh, int class )
+{
+    ULONG slot = HandleToULong( NtCurrentTeb()->ClientId.UniqueThread ) / 4;
+    return &lfh->free[slot % LFH_SLOTS][class];
+}
+
+/***********************************************************************
+ *           find_lfh_region
+ *
+ * Find the front end region containing a block. Doesn't need any lock.
+ */
+static LFH_REGION *find_lfh_region( const void *ptr )
+{
+    LFH_REGION *base = (LFH_REGION *)((ULONG_PTR)ptr & ~(ULONG_PTR)(LFH_REGION_SIZE - 1));
+    unsigned int i, hash = get_lfh_region_hash( base );
+    int seq;
+
+    for (;;)
+    {
+        seq = *(volatile int *)&lfh_regions_seq;
+        for (i = 0; i < LFH_MAX_REGIONS; i++)
+        {
+            LFH_REGION *region = *(LFH_REGION * volatile *)&lfh_regions[(hash + i) % LFH_MAX_REGIONS];
+            if (!region) break;
+            if (region == base) return region;
+        }
+        /* a miss is only reliable if the table wasn't rehashed meanwhile */
+        if (!(seq & 1) && interlocked_cmpxchg( &lfh_regions_seq, seq, seq ) == seq) return NULL;
+    }
+}
+
+/***********************************************************************
+ *           rehash_lfh_regions
+ *
+ * Rebuild the regions hash table without the deleted entries.
+ * Must be called with the lfh_section held.
+ */
+static void rehash_lfh_regions(void)
+{
+    static LFH_REGION *live[LFH_MAX_REGIONS];
+    unsigned int i, j, count = 0;
+
+    for (i = 0; i < LFH_MAX_REGIONS; i++)
+        if (lfh_regions[i] && lfh_regions[i] != LFH_DELETED) live[count++] = lfh_regions[i];
+
+    interlocked_xchg_add( &lfh_regions_seq, 1 );
+    for (i = 0; i < LFH_MAX_REGIONS; i++) interlocked_xchg_ptr( (void **)&lfh_regions[i], NULL );
+    for (i = 0; i < count; i++)
+    {
+        for (j = get_lfh_region_hash( live[i] ); lfh_regions[j]; j = (j + 1) % LFH_MAX_REGIONS) ;
+        interlocked_xchg_ptr( (void **)&lfh_regions[j], live[i] );
+    }
+    interlocked_xchg_add( &lfh_regions_seq, 1 );
+    lfh_regions_deleted = 0;
+}
+
+/***********************************************************************
+ *           validate_lfh_block
+ */
+static BOOL validate_lfh_block( const LFH_REGION *region, const ARENA_INUSE *arena )
+{
+    SIZE_T offset = (const char *)arena - (const char *)region - LFH_FIRST_ARENA;
+
+    if ((const char *)arena < (const char *)region + LFH_FIRST_ARENA ||
+        offset % (region->data_size + sizeof(ARENA_INUSE)) ||
+        (const char *)arena >= *(char * volatile *)&region->unused)
+        WARN( "Heap %p: invalid front end block pointer %p\n", region->heap, arena + 1 );
+    else if (arena->magic == ARENA_PENDING_MAGIC)
+        WARN( "Heap %p: block %p used after free\n", region->heap, arena + 1 );
+    else if (arena->magic != ARENA_INUSE_MAGIC)
+        WARN( "Heap %p: invalid in-use arena magic %08x for %p\n", region->heap, arena->magic, arena );
+    else
+        return TRUE;
+    return FALSE;
+}
+
+/***********************************************************************
+ *           create_lfh_region
+ *
+ * Allocate a new region for a size class. Must be called with the heap lock held.
+ */
+static LFH_REGION *create_lfh_region( HEAP *heap, int class )
+{
+    LFH_REGION *region = NULL;
+    SIZE_T size = LFH_REGION_SIZE;
+    unsigned int i, hash;
+
+    RtlEnterCriticalSection( &lfh_section );
+    if (lfh_regions_used >= LFH_MAX_REGIONS / 4 * 3) goto done;  /* keep the hash table sparse */
+    if (NtAllocateVirtualMemory( NtCurrentProcess(), (void **)&region, 0, &size,
+                                 MEM_COMMIT, get_protection_type( heap->flags )))
+    {
+        region = NULL;
+        goto done;
+    }
+    region->magic     = LFH_REGION_MAGIC;
+    region->class     = class;
+    region->heap      = heap;
+    region->data_size = get_lfh_class_size( class );
+    region->unused    = (char *)region + LFH_FIRST_ARENA;
+    region->next      = heap->lfh->regions;
+    heap->lfh->regions = region;
+
+    if (lfh_regions_used + lfh_regions_deleted >= LFH_MAX_REGIONS / 4 * 3) rehash_lfh_regions();
+    hash = get_lfh_region_hash( region );
+    for (i = hash; lfh_regions[i] && lfh_regions[i] != LFH_DELETED; i = (i + 1) % LFH_MAX_REGIONS) ;
+    if (lfh_regions[i] == LFH_DELETED) lfh_regions_deleted--;
+    lfh_regions_used++;
+    interlocked_xchg_ptr( (void **)&lfh_regions[i], region );
+done:
+    RtlLeaveCriticalSection( &lfh_section );
+    return region;
+}
+
+/***********************************************************************
+ *           grow_lfh_class
+ *
+ * Carve new blocks for a size class, add them to a free list and return one of them.
+ */
+static ARENA_INUSE *grow_lfh_class( HEAP *heap, int class, SLIST_HEADER *list )
+{
+    LFH_HEAP *lfh = heap->lfh;
+    LFH_REGION *region;
+    ARENA_INUSE *ret = NULL;
+    SIZE_T block_size;
+    unsigned int i;
+
+    RtlEnterCriticalSection( &heap->critSection );
+
+    /* another thread may have freed some blocks in the meantime */
+    if ((ret = (ARENA_INUSE *)RtlInterlockedPopEntrySList( list ))) goto done;
+
+    block_size = get_lfh_class_size( class ) + sizeof(ARENA_INUSE);
+    region = lfh->current[class];
+    if (!region || region->unused + block_size > (char *)region + LFH_REGION_SIZE)
+    {
+        if (!(region = create_lfh_region( heap, class ))) goto done;
+        lfh->current[class] = region;
+    }
+
+    for (i = 0; i < LFH_BATCH && region->unused + block_size <= (char *)region + LFH_REGION_SIZE; i++)
+    {
+        ARENA_INUSE *arena = (ARENA_INUSE *)region->unused;
+
+        arena->size  = region->data_size;
+        arena->magic = ARENA_PENDING_MAGIC;
+        arena->unused_bytes = 0;
+        region->unused += block_size;
+        if (ret) RtlInterlockedPushEntrySList( list, (SLIST_ENTRY *)ret );
+        ret = arena + 1;
+    }
+
+done:
+    RtlLeaveCriticalSection( &heap->critSection );
+    return ret ? ret - 1 : NULL;
+}
+
+/***********************************************************************
+ *           lfh_allocate
+ *
+ * Allocate a block from the front end; return NULL to use the normal heap.
+ */
+static void *lfh_allocate( HEAP *heap, DWORD flags, SIZE_T size )
+{
+    int class = get_lfh_class( size );
+    SLIST_HEADER *list;
+    ARENA_INUSE *arena;
+    SLIST_ENTRY *entry;
+
+    if (class < 0) return NULL;
+    list = get_lfh_list( heap->lfh, class );
+    if ((entry = RtlInterlockedPopEntrySList( list ))) arena = (ARENA_INUSE *)entry - 1;
+    else if (!(arena = grow_lfh_class( heap, class, list ))) return NULL;
+
+    arena->magic = ARENA_INUSE_MAGIC;
+    arena->unused_bytes = arena->size - size;
+    initialize_block( arena + 1, size, arena->unused_bytes, flags );
+    return arena + 1;
+}
+
+/***********************************************************************
+ *           lfh_free
+ */
+static BOOL lfh_free( LFH_REGION *region, void *ptr )
+{
+    ARENA_INUSE *arena = (ARENA_INUSE *)ptr - 1;
+
+    if (!validate_lfh_block( region, arena )) return FALSE;
+    if (region->heap->stats) record_free( region->heap, ptr, TRUE );
+    arena->magic = ARENA_PENDING_MAGIC;
+    RtlInterlockedPushEntrySList( get_lfh_list( region->heap->lfh, region->class ), ptr );
+    return TRUE;
+}
+
+/***********************************************************************
+ *           lfh_realloc
+ */
+static void *lfh_realloc( LFH_REGION *region, DWORD flags, void *ptr, SIZE_T size )
+{
+    ARENA_INUSE *arena = (ARENA_INUSE *)ptr - 1;
+    SIZE_T old_size = arena->size - arena->unused_bytes;
+    void *ret;
+
+    if (size <= arena->size && get_lfh_class( size ) == region->class)
+    {
+        if (region->heap->stats) record_free( region->heap, ptr, TRUE );
+        arena->unused_bytes = arena->size - size;
+        if (size > old_size)
+            initialize_block( (char *)ptr + old_size, size - old_size, arena->unused_bytes, flags );
+        if (region->heap->stats) record_alloc( region->heap, ptr, TRUE );
+        return ptr;
+    }
+    if (flags & HEAP_REALLOC_IN_PLACE_ONLY) return NULL;
+    if (!(ret = RtlAllocateHeap( region->heap, flags & (HEAP_NO_SERIALIZE | HEAP_ZERO_MEMORY), size )))
+        return NULL;
+    memcpy( ret, ptr, min( old_size, size ));
+    lfh_free( region, ptr );
+    return ret;
+}
+
+/***********************************************************************
+ *           enable_lfh
+ */
+static NTSTATUS enable_lfh( HEAP *heap )
+{
+    LFH_HEAP *lfh = NULL;
+    SIZE_T size = sizeof(*lfh);
+    unsigned int i, j;
+
+    if (heap->lfh) return STATUS_SUCCESS;
+    /* the front end bypasses the debugging checks */
+    if (RUNNING_ON_VALGRIND || (heap->flags & (HEAP_NO_SERIALIZE | HEAP_TAIL_CHECKING_ENABLED |
+                                               HEAP_FREE_CHECKING_ENABLED | HEAP_VALIDATE)))
+        return STATUS_UNSUCCESSFUL;
+
+    if (NtAllocateVirtualMemory( NtCurrentProcess(), (void **)&lfh, 0, &size, MEM_COMMIT, PAGE_READWRITE ))
+        return STATUS_NO_MEMORY;
+    for (i = 0; i < LFH_SLOTS; i++)
+        for (j = 0; j < LFH_NB_CLASSES; j++) RtlInitializeSListHead( &lfh->free[i][j] );
+
+    RtlEnterCriticalSection( &heap->critSection );
+    if (!heap->lfh) heap->lfh = lfh;
+    else lfh = NULL;
+    RtlLeaveCriticalSection( &heap->critSection );
+
+    if (lfh) TRACE( "enabled front end for heap %p\n", heap );
+    else
+    {
+        size = 0;
+        NtFreeVirtualMemory( NtCurrentProcess(), (void **)&lfh, &size, MEM_RELEASE );
+    }
+    return STATUS_SUCCESS;
+}
+
+/***********************************************************************
+ *           destroy_lfh
+ */
+static void destroy_lfh( HEAP *heap )
+{
+    LFH_REGION *region, *next;
+    unsigned int i;
+    SIZE_T size;
+    void *addr;
+
+    RtlEnterCriticalSection( &lfh_section );
+    for (region = heap->lfh->regions; region; region = next)
+    {
+        next = region->next;
+        for (i = get_lfh_region_hash( region ); lfh_regions[i] != region; i = (i + 1) % LFH_MAX_REGIONS) ;
+        lfh_regions[i] = LFH_DELETED;
+        lfh_regions_used--;
+        lfh_regions_deleted++;
+        size = 0;
+        addr = region;
+        NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
+    }
+    /* long runs of deleted entries slow down the lookups of the other heaps */
+    if (lfh_regions_deleted >= LFH_MAX_REGIONS / 4) rehash_lfh_regions();
+    RtlLeaveCriticalSection( &lfh_section );
+
+    size = 0;
+    addr = heap->lfh;
+    NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
+    heap->lfh = NULL;
+}
+
+
 /***********************************************************************
  *           HEAP_CreateSubHeap
  */
@@ -924,6 +1698,8 @@ static SUBHEAP *HEAP_CreateSubHeap( HEAP *heap, LPVOID address, DWORD flags,
         heap->flags         = flags;
         heap->magic         = HEAP_MAGIC;
         heap->grow_size     = max( HEAP_DEF_SIZE, totalSize );
+        heap->lfh           = NULL;
+        heap->stats         = NULL;
         list_init( &heap->subheap_list );
         list_init( &heap->large_list );
 
@@ -1343,8 +2119,11 @@ static BOOL HEAP_IsRealArena( HEAP *heapPtr,   /* [in] ptr to the heap */
     if (block)  /* only check this single memory block */
     {
         const ARENA_INUSE *arena = (const ARENA_INUSE *)block - 1;
+        LFH_REGION *region;
 
-        if (!(subheap = HEAP_FindSubHeap( heapPtr, arena )) ||
+        if (heapPtr->lfh && (region = find_lfh_region( block )) && region->heap == heapPtr)
+            ret = validate_lfh_block( region, arena );
+        else if (!(subheap = HEAP_FindSubHeap( heapPtr, arena )) ||
             ((const char *)arena < (char *)subheap->base + subheap->headerSize))
         {
             if (!(large_arena = find_large_block( heapPtr, block )))
@@ -1517,6 +2296,9 @@ void heap_set_debug_flags( HANDLE handle )
             heap->pending_pos = 0;
         }
     }
+
+    if (global_flags & FLG_HEAP_ENABLE_TAGGING)
+        enable_heap_stats( heap, !!(global_flags & FLG_USER_STACK_TRACE_DB) );
 }
 
 
@@ -1602,6 +2384,14 @@ HANDLE WINAPI RtlDestroyHeap( HANDLE heap )
     list_remove( &heapPtr->entry );
     RtlLeaveCriticalSection( &processHeap->critSection );
 
+    if (heapPtr->lfh) destroy_lfh( heapPtr );
+    if (heapPtr->stats)
+    {
+        size = 0;
+        addr = heapPtr->stats;
+        NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
+    }
+
     heapPtr->critSection.DebugInfo->Spare[0] = 0;
     RtlDeleteCriticalSection( &heapPtr->critSection );
 
@@ -1673,11 +2463,23 @@ void * WINAPI DECLSPEC_HOTPATCH RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_
     }
     if (rounded_size < HEAP_MIN_DATA_SIZE) rounded_size = HEAP_MIN_DATA_SIZE;
 
+    if (heapPtr->lfh)
+    {
+        void *ret = lfh_allocate( heapPtr, flags, size );
+        if (ret)
+        {
+            if (heapPtr->stats) record_alloc( heapPtr, ret, TRUE );
+            TRACE("(%p,%08x,%08lx): returning %p\n", heap, flags, size, ret );
+            return ret;
+        }
+    }
+
     if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
 
     if (rounded_size >= HEAP_MIN_LARGE_BLOCK_SIZE && (flags & HEAP_GROWABLE))
     {
         void *ret = allocate_large_block( heap, flags, size );
+        if (ret && heapPtr->stats) record_alloc( heapPtr, ret, FALSE );
         if (!(flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heapPtr->critSection );
         if (!ret && (flags & HEAP_GENERATE_EXCEPTIONS)) RtlRaiseStatus( STATUS_NO_MEMORY );
         TRACE("(%p,%08x,%08lx): returning %p\n", heap, flags, size, ret );
@@ -1715,6 +2517,7 @@ void * WINAPI DECLSPEC_HOTPATCH RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_
 
     notify_alloc( pInUse + 1, size, flags & HEAP_ZERO_MEMORY );
     initialize_block( pInUse + 1, size, pInUse->unused_bytes, flags );
+    if (heapPtr->stats) record_alloc( heapPtr, pInUse + 1, FALSE );
 
     if (!(flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heapPtr->critSection );
 
@@ -1741,6 +2544,7 @@ BOOLEAN WINAPI DECLSPEC_HOTPATCH RtlFreeHeap( HANDLE heap, ULONG flags, void *pt
 {
     ARENA_INUSE *pInUse;
     SUBHEAP *subheap;
+    LFH_REGION *region;
     HEAP *heapPtr;
 
     /* Validate the parameters */
@@ -1754,6 +2558,18 @@ BOOLEAN WINAPI DECLSPEC_HOTPATCH RtlFreeHeap( HANDLE heap, ULONG flags, void *pt
         return FALSE;
     }
 
+    if (heapPtr->lfh && (region = find_lfh_region( ptr )) && region->heap == heapPtr)
+    {
+        if (lfh_free( region, ptr ))
+        {
+            TRACE("(%p,%08x,%p): returning TRUE\n", heap, flags, ptr );
+            return TRUE;
+        }
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_INVALID_PARAMETER );
+        TRACE("(%p,%08x,%p): returning FALSE\n", heap, flags, ptr );
+        return FALSE;
+    }
+
     flags &= HEAP_NO_SERIALIZE;
     flags |= heapPtr->flags;
     if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
@@ -1764,6 +2580,7 @@ BOOLEAN WINAPI DECLSPEC_HOTPATCH RtlFreeHeap( HANDLE heap, ULONG flags, void *pt
     /* Some sanity checks */
     pInUse  = (ARENA_INUSE *)ptr - 1;
     if (!validate_block_pointer( heapPtr, &subheap, pInUse )) goto error;
+    if (heapPtr->stats) record_free( heapPtr, ptr, FALSE );
 
     if (!subheap)
         free_large_block( heapPtr, flags, ptr );
@@ -1802,6 +2619,7 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
     ARENA_INUSE *pArena;
     HEAP *heapPtr;
     SUBHEAP *subheap;
+    LFH_REGION *region;
     SIZE_T oldBlockSize, oldActualSize, rounded_size;
     void *ret;
 
@@ -1817,14 +2635,33 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
     flags &= HEAP_GENERATE_EXCEPTIONS | HEAP_NO_SERIALIZE | HEAP_ZERO_MEMORY |
              HEAP_REALLOC_IN_PLACE_ONLY;
     flags |= heapPtr->flags;
+
+    if (heapPtr->lfh && (region = find_lfh_region( ptr )) && region->heap == heapPtr)
+    {
+        if (!validate_lfh_block( region, (ARENA_INUSE *)ptr - 1 ))
+        {
+            RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_INVALID_PARAMETER );
+            ret = NULL;
+        }
+        else if (!(ret = lfh_realloc( region, flags, ptr, size )))
+        {
+            if (flags & HEAP_GENERATE_EXCEPTIONS) RtlRaiseStatus( STATUS_NO_MEMORY );
+            RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_NO_MEMORY );
+        }
+        TRACE("(%p,%08x,%p,%08lx): returning %p\n", heap, flags, ptr, size, ret );
+        return ret;
+    }
+
     if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
 
+    pArena = (ARENA_INUSE *)ptr - 1;
+    if (!validate_block_pointer( heapPtr, &subheap, pArena )) goto error;
+    if (heapPtr->stats) record_free( heapPtr, ptr, FALSE );
+
     rounded_size = ROUND_SIZE(size) + HEAP_TAIL_EXTRA_SIZE(flags);
     if (rounded_size < size) goto oom;  /* overflow */
     if (rounded_size < HEAP_MIN_DATA_SIZE) rounded_size = HEAP_MIN_DATA_SIZE;
 
-    pArena = (ARENA_INUSE *)ptr - 1;
-    if (!validate_block_pointer( heapPtr, &subheap, pArena )) goto error;
     if (!subheap)
     {
         if (!(ret = realloc_large_block( heapPtr, flags, ptr, size ))) goto oom;
@@ -1911,11 +2748,13 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
 
     ret = pArena + 1;
 done:
+    if (heapPtr->stats) record_alloc( heapPtr, ret, FALSE );
     if (!(flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heapPtr->critSection );
     TRACE("(%p,%08x,%p,%08lx): returning %p\n", heap, flags, ptr, size, ret );
     return ret;
 
 oom:
+    if (heapPtr->stats) record_alloc( heapPtr, ptr, FALSE );  /* the block is left unchanged */
     if (!(flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heapPtr->critSection );
     if (flags & HEAP_GENERATE_EXCEPTIONS) RtlRaiseStatus( STATUS_NO_MEMORY );
     RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_NO_MEMORY );
@@ -2017,6 +2856,7 @@ SIZE_T WINAPI RtlSizeHeap( HANDLE heap, ULONG flags, const void *ptr )
     SIZE_T ret;
     const ARENA_INUSE *pArena;
     SUBHEAP *subheap;
+    LFH_REGION *region;
     HEAP *heapPtr = HEAP_GetPtr( heap );
 
     if (!heapPtr)
@@ -2024,6 +2864,18 @@ SIZE_T WINAPI RtlSizeHeap( HANDLE heap, ULONG flags, const void *ptr )
         RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_INVALID_HANDLE );
         return ~0UL;
     }
+    if (heapPtr->lfh && (region = find_lfh_region( ptr )) && region->heap == heapPtr)
+    {
+        pArena = (const ARENA_INUSE *)ptr - 1;
+        if (!validate_lfh_block( region, pArena ))
+        {
+            RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_INVALID_PARAMETER );
+            ret = ~0UL;
+        }
+        else ret = pArena->size - pArena->unused_bytes;
+        TRACE("(%p,%08x,%p): returning %08lx\n", heap, flags, ptr, ret );
+        return ret;
+    }
     flags &= HEAP_NO_SERIALIZE;
     flags |= heapPtr->flags;
     if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
@@ -2236,7 +3088,10 @@ ULONG WINAPI RtlGetProcessHeaps( ULONG count, HANDLE *heaps )
 NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS info_class,
                                          PVOID info, SIZE_T size_in, PSIZE_T size_out)
 {
-    switch (info_class)
+    HEAP *heapPtr;
+    SIZE_T size;
+
+    switch ((ULONG)info_class)
     {
     case HeapCompatibilityInformation:
         if (size_out) *size_out = sizeof(ULONG);
@@ -2244,7 +3099,52 @@ NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS inf
         if (size_in < sizeof(ULONG))
             return STATUS_BUFFER_TOO_SMALL;
 
-        *(ULONG *)info = 0; /* standard heap */
+        if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_HANDLE;
+        *(ULONG *)info = heapPtr->lfh ? 2 : 0; /* low-fragmentation or standard heap */
+        return STATUS_SUCCESS;
+
+    case HeapWineStatistics:
+        if (size_out) *size_out = sizeof(HEAP_WINE_STATISTICS);
+
+        if (size_in < sizeof(HEAP_WINE_STATISTICS))
+            return STATUS_BUFFER_TOO_SMALL;
+
+        if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_HANDLE;
+        if (!heapPtr->stats) return STATUS_NOT_SUPPORTED;
+        RtlEnterCriticalSection( &heapPtr->critSection );
+        get_heap_stats( heapPtr, info );
+        RtlLeaveCriticalSection( &heapPtr->critSection );
+        return STATUS_SUCCESS;
+
+    case HeapWineStackTraces:
+        if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_HANDLE;
+        if (!heapPtr->stats || !heapPtr->stats->stacks) return STATUS_NOT_SUPPORTED;
+        RtlEnterCriticalSection( &heapPtr->critSection );
+        size = get_heap_stack_traces( heapPtr, info, size_in );
+        RtlLeaveCriticalSection( &heapPtr->critSection );
+        if (size_out) *size_out = size;
+        return size <= size_in ? STATUS_SUCCESS : STATUS_BUFFER_TOO_SMALL;
+
+    case HeapWineDumpStatistics:  /* print the statistics of the heap, or of all the heaps if NULL */
+        if (heap)
+        {
+            if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_HANDLE;
+            if (!heapPtr->stats) return STATUS_NOT_SUPPORTED;
+            RtlEnterCriticalSection( &heapPtr->critSection );
+            dump_heap_stats( heapPtr );
+            RtlLeaveCriticalSection( &heapPtr->critSection );
+            return STATUS_SUCCESS;
+        }
+        RtlEnterCriticalSection( &processHeap->critSection );
+        if (processHeap->stats) dump_heap_stats( processHeap );
+        LIST_FOR_EACH_ENTRY( heapPtr, &processHeap->entry, HEAP, entry )
+        {
+            if (!heapPtr->stats) continue;
+            RtlEnterCriticalSection( &heapPtr->critSection );
+            dump_heap_stats( heapPtr );
+            RtlLeaveCriticalSection( &heapPtr->critSection );
+        }
+        RtlLeaveCriticalSection( &processHeap->critSection );
         return STATUS_SUCCESS;
 
     default:
@@ -2258,6 +3158,44 @@ NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS inf
  */
 NTSTATUS WINAPI RtlSetHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS info_class, PVOID info, SIZE_T size)
 {
-    FIXME("%p %d %p %ld stub\n", heap, info_class, info, size);
-    return STATUS_SUCCESS;
+    NTSTATUS status = STATUS_SUCCESS;
+    HEAP *heapPtr;
+
+    switch ((ULONG)info_class)
+    {
+    case HeapCompatibilityInformation:
+        if (size < sizeof(ULONG)) return STATUS_BUFFER_TOO_SMALL;
+        if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_HANDLE;
+
+        switch (*(ULONG *)info)
+        {
+        case 0:  /* the front end can't be disabled once enabled */
+            return heapPtr->lfh ? STATUS_UNSUCCESSFUL : STATUS_SUCCESS;
+        case 2:
+            return enable_lfh( heapPtr );
+        default:
+            FIXME("%p: unsupported compatibility mode %u\n", heap, *(ULONG *)info);
+            return STATUS_SUCCESS;
+        }
+
+    case HeapWineStatistics:  /* enable the statistics, with call stacks if the value is non-zero */
+        if (size < sizeof(ULONG)) return STATUS_BUFFER_TOO_SMALL;
+        if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_HANDLE;
+
+        RtlEnterCriticalSection( &heapPtr->critSection );
+        if (heapPtr->stats) status = STATUS_SUCCESS;
+        /* the blocks of the front end can't be accounted for once it is in use */
+        else if (heapPtr->lfh && heapPtr->lfh->regions) status = STATUS_UNSUCCESSFUL;
+        else
+        {
+            enable_heap_stats( heapPtr, *(ULONG *)info != 0 );
+            if (!heapPtr->stats) status = STATUS_NO_MEMORY;
+        }
+        RtlLeaveCriticalSection( &heapPtr->critSection );
+        return status;
+
+    default:
+        FIXME("%p %d %p %ld stub\n", heap, info_class, info, size);
+        return STATUS_SUCCESS;
+    }
 }
@@ -123,6 +123,8 @@ typedef struct _wine_modref
     int                   alloc_deps;
     int                   nDeps;
     struct _wine_modref **deps;
+    DWORD                *export_hash;      /* hash table of export name indices + 1 */
+    DWORD                 export_hash_mask; /* size of the hash table - 1 */
 } WINE_MODREF;
 
 /* info about the current builtin dll load */
@@ -712,6 +714,52 @@ static FARPROC find_ordinal_export( HMODULE module, const IMAGE_EXPORT_DIRECTORY
 }
 
 
+/* minimum number of exported names for building a hash table */
+#define EXPORT_HASH_MIN_NAMES 32
+
+static inline DWORD hash_export_name( const char *name )
+{
+    DWORD hash = 0;
+    while (*name) hash = hash * 33 + (unsigned char)*name++;
+    return hash ^ (hash >> 16);
+}
+
+/*************************************************************************
+ *		get_export_hash
+ *
+ * Get the hash table of the export names of a module, building it on first use.
+ * The loader_section must be locked while calling this function.
+ */
+static const DWORD *get_export_hash( HMODULE module, const IMAGE_EXPORT_DIRECTORY *exports, DWORD *mask )
+{
+    const DWORD *names = get_rva( module, exports->AddressOfNames );
+    WINE_MODREF *wm;
+    DWORD i, pos, size;
+
+    if (exports->NumberOfNames < EXPORT_HASH_MIN_NAMES) return NULL;
+    if (!(wm = get_modref( module ))) return NULL;
+
+    if (!wm->export_hash)
+    {
+        for (size = 1; size < 2 * exports->NumberOfNames; size *= 2) ;
+        if (!(wm->export_hash = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY,
+                                                 size * sizeof(*wm->export_hash) )))
+            return NULL;
+        wm->export_hash_mask = size - 1;
+        for (i = 0; i < exports->NumberOfNames; i++)
+        {
+            pos = hash_export_name( get_rva( module, names[i] ));
+            while (wm->export_hash[pos & wm->export_hash_mask]) pos++;
+            wm->export_hash[pos & wm->export_hash_mask] = i + 1;
+        }
+        TRACE( "built export hash for %s, %u names\n",
+               debugstr_w(wm->ldr.BaseDllName.Buffer), exports->NumberOfNames );
+    }
+    *mask = wm->export_hash_mask;
+    return wm->export_hash;
+}
+
+
 /*************************************************************************
  *		find_named_export
  *
@@ -723,6 +771,8 @@ static FARPROC find_named_export( HMODULE module, const IMAGE_EXPORT_DIRECTORY *
 {
     const WORD *ordinals = get_rva( module, exports->AddressOfNameOrdinals );
     const DWORD *names = get_rva( module, exports->AddressOfNames );
+    const DWORD *hash;
+    DWORD pos, mask;
     int min = 0, max = exports->NumberOfNames - 1;
 
     /* first check the hint */
@@ -733,7 +783,20 @@ static FARPROC find_named_export( HMODULE module, const IMAGE_EXPORT_DIRECTORY *
             return find_ordinal_export( module, exports, exp_size, ordinals[hint], load_path );
     }
 
-    /* then do a binary search */
+    /* then look it up in the hash table */
+    if ((hash = get_export_hash( module, exports, &mask )))
+    {
+        for (pos = hash_export_name( name ); hash[pos & mask]; pos++)
+        {
+            DWORD index = hash[pos & mask] - 1;
+            char *ename = get_rva( module, names[index] );
+            if (!strcmp( ename, name ))
+                return find_ordinal_export( module, exports, exp_size, ordinals[index], load_path );
+        }
+        return NULL;
+    }
+
+    /* else do a binary search */
     while (min <= max)
     {
         int res, pos = (min + max) / 2;
@@ -2272,6 +2335,8 @@ static NTSTATUS open_dll_file( UNICODE_STRING *nt_name, WINE_MODREF **pwm,
         return STATUS_SUCCESS;
     }
 
+    if (dll_cache_is_missing( nt_name )) return STATUS_DLL_NOT_FOUND;
+
     attr.Length = sizeof(attr);
     attr.RootDirectory = 0;
     attr.Attributes = OBJ_CASE_INSENSITIVE;
@@ -2289,6 +2354,7 @@ static NTSTATUS open_dll_file( UNICODE_STRING *nt_name, WINE_MODREF **pwm,
             /* if the file exists but failed to open, report the error */
             return status;
         }
+        if (status == STATUS_OBJECT_NAME_NOT_FOUND) dll_cache_add_missing( nt_name );
         /* otherwise continue searching */
         return STATUS_DLL_NOT_FOUND;
     }
@@ -2828,7 +2894,9 @@ static NTSTATUS search_dll_file( LPCWSTR paths, LPCWSTR search, UNICODE_STRING *
     WCHAR *name;
     BOOL found_image = FALSE;
     NTSTATUS status = STATUS_DLL_NOT_FOUND;
+    LPCWSTR start = paths;
     ULONG len = wcslen( paths );
+    int i, cached;
 
     if (len < wcslen( system_dir )) len = wcslen( system_dir );
     len += wcslen( search ) + 2;
@@ -2836,13 +2904,21 @@ static NTSTATUS search_dll_file( LPCWSTR paths, LPCWSTR search, UNICODE_STRING *
     if (!(name = RtlAllocateHeap( GetProcessHeap(), 0, len * sizeof(WCHAR) )))
         return STATUS_NO_MEMORY;
 
-    while (*paths)
+    /* skip the directories where the dll wasn't found last time */
+    cached = dll_cache_find_dir( start, search );
+
+    for (i = 0; *paths; i++)
     {
         LPCWSTR ptr = paths;
 
         while (*ptr && *ptr != ';') ptr++;
         len = ptr - paths;
         if (*ptr == ';') ptr++;
+        if (i < cached)
+        {
+            paths = ptr;
+            continue;
+        }
         memcpy( name, paths, len * sizeof(WCHAR) );
         if (len && name[len - 1] != '\\') name[len++] = '\\';
         wcscpy( name + len, search );
@@ -2852,9 +2928,20 @@ static NTSTATUS search_dll_file( LPCWSTR paths, LPCWSTR search, UNICODE_STRING *
 
         status = open_dll_file( nt_name, pwm, module, image_info, st );
         if (status == STATUS_IMAGE_MACHINE_TYPE_MISMATCH) found_image = TRUE;
-        else if (status != STATUS_DLL_NOT_FOUND) goto done;
+        else if (status != STATUS_DLL_NOT_FOUND)
+        {
+            if (!status && !found_image && i != cached) dll_cache_add_dir( start, search, i );
+            goto done;
+        }
         RtlFreeUnicodeString( nt_name );
         paths = ptr;
+        if (i == cached)
+        {
+            /* the file changed without its directory, search again from the start */
+            paths = start;
+            i = cached = -1;
+            found_image = FALSE;
+        }
     }
 
     if (!found_image)
@@ -3303,13 +3390,24 @@ NTSTATUS WINAPI LdrQueryProcessModuleInformation(PSYSTEM_MODULE_INFORMATION smi,
 }
 
 
+static void get_dword_option( WCHAR *buffer, ULONG size, ULONG *value )
+{
+    KEY_VALUE_PARTIAL_INFORMATION *info = (KEY_VALUE_PARTIAL_INFORMATION *)buffer;
+
+    if (info->Type != REG_DWORD)
+    {
+        buffer[size / sizeof(WCHAR)] = 0;
+        *value = wcstoul( (WCHAR *)info->Data, 0, 16 );
+    }
+    else memcpy( value, info->Data, sizeof(*value) );
+}
+
 static NTSTATUS query_dword_option( HANDLE hkey, LPCWSTR name, ULONG *value )
 {
     NTSTATUS status;
     UNICODE_STRING str;
     ULONG size;
     WCHAR buffer[64];
-    KEY_VALUE_PARTIAL_INFORMATION *info = (KEY_VALUE_PARTIAL_INFORMATION *)buffer;
 
     RtlInitUnicodeString( &str, name );
 
@@ -3317,12 +3415,7 @@ static NTSTATUS query_dword_option( HANDLE hkey, LPCWSTR name, ULONG *value )
     if ((status = NtQueryValueKey( hkey, &str, KeyValuePartialInformation, buffer, size, &size )))
         return status;
 
-    if (info->Type != REG_DWORD)
-    {
-        buffer[size / sizeof(WCHAR)] = 0;
-        *value = wcstoul( (WCHAR *)info->Data, 0, 16 );
-    }
-    else memcpy( value, info->Data, sizeof(*value) );
+    get_dword_option( buffer, size, value );
     return status;
 }
 
@@ -3499,6 +3592,9 @@ void WINAPI LdrShutdownProcess(void)
     TRACE("()\n");
     process_detaching = TRUE;
     process_detach();
+    RtlEnterCriticalSection( &loader_section );
+    dll_cache_save();
+    RtlLeaveCriticalSection( &loader_section );
 }
 
 
@@ -3594,6 +3690,7 @@ static void free_modref( WINE_MODREF *wm )
     if (cached_modref == wm) cached_modref = NULL;
     RtlFreeUnicodeString( &wm->ldr.FullDllName );
     RtlFreeHeap( GetProcessHeap(), 0, wm->deps );
+    RtlFreeHeap( GetProcessHeap(), 0, wm->export_hash );
     RtlFreeHeap( GetProcessHeap(), 0, wm );
 }
 
@@ -3828,10 +3925,16 @@ static void load_global_options(void)
     static const WCHAR decommittotalW[] = {'H','e','a','p','D','e','C','o','m','m','i','t','T','o','t','a','l','F','r','e','e','T','h','r','e','s','h','o','l','d',0};
     static const WCHAR decommitfreeW[] = {'H','e','a','p','D','e','C','o','m','m','i','t','F','r','e','e','B','l','o','c','k','T','h','r','e','s','h','o','l','d',0};
 
+    static const WCHAR * const names[] = { globalflagW, safesearchW, safedllmodeW, critsectW,
+                                           heapresW, heapcommitW, decommittotalW, decommitfreeW };
+
     OBJECT_ATTRIBUTES attr;
     UNICODE_STRING name_str;
     HANDLE hkey;
-    ULONG value;
+    struct key_value_query queries[ARRAY_SIZE(names)];
+    WCHAR buffers[ARRAY_SIZE(names)][64];
+    ULONG values[ARRAY_SIZE(names)];
+    unsigned int i;
 
     attr.Length = sizeof(attr);
     attr.RootDirectory = 0;
@@ -3843,26 +3946,37 @@ static void load_global_options(void)
 
     if (!NtOpenKey( &hkey, KEY_QUERY_VALUE, &attr ))
     {
-        query_dword_option( hkey, globalflagW, &NtCurrentTeb()->Peb->NtGlobalFlag );
-        query_dword_option( hkey, safesearchW, &path_safe_mode );
-        query_dword_option( hkey, safedllmodeW, &dll_safe_mode );
+        /* all the options are read in a single server round trip */
+        for (i = 0; i < ARRAY_SIZE(names); i++)
+        {
+            queries[i].name   = names[i];
+            queries[i].info   = (KEY_VALUE_PARTIAL_INFORMATION *)buffers[i];
+            queries[i].length = sizeof(buffers[i]) - sizeof(WCHAR);
+        }
+        query_key_values( hkey, queries, ARRAY_SIZE(queries) );
+        NtClose( hkey );
 
-        if (!query_dword_option( hkey, critsectW, &value ))
-            NtCurrentTeb()->Peb->CriticalSectionTimeout.QuadPart = (ULONGLONG)value * -10000000;
+        for (i = 0; i < ARRAY_SIZE(names); i++)
+            if (!queries[i].status) get_dword_option( buffers[i], queries[i].result, &values[i] );
 
-        if (!query_dword_option( hkey, heapresW, &value ))
-            NtCurrentTeb()->Peb->HeapSegmentReserve = value;
+        if (!queries[0].status) NtCurrentTeb()->Peb->NtGlobalFlag = values[0];
+        if (!queries[1].status) path_safe_mode = values[1];
+        if (!queries[2].status) dll_safe_mode = values[2];
 
-        if (!query_dword_option( hkey, heapcommitW, &value ))
-            NtCurrentTeb()->Peb->HeapSegmentCommit = value;
+        if (!queries[3].status)
+            NtCurrentTeb()->Peb->CriticalSectionTimeout.QuadPart = (ULONGLONG)values[3] * -10000000;
 
-        if (!query_dword_option( hkey, decommittotalW, &value ))
-            NtCurrentTeb()->Peb->HeapDeCommitTotalFreeThreshold = value;
+        if (!queries[4].status)
+            NtCurrentTeb()->Peb->HeapSegmentReserve = values[4];
 
-        if (!query_dword_option( hkey, decommitfreeW, &value ))
-            NtCurrentTeb()->Peb->HeapDeCommitFreeBlockThreshold = value;
+        if (!queries[5].status)
+            NtCurrentTeb()->Peb->HeapSegmentCommit = values[5];
 
-        NtClose( hkey );
+        if (!queries[6].status)
+            NtCurrentTeb()->Peb->HeapDeCommitTotalFreeThreshold = values[6];
+
+        if (!queries[7].status)
+            NtCurrentTeb()->Peb->HeapDeCommitFreeBlockThreshold = values[7];
     }
     LdrQueryImageFileExecutionOptions( &NtCurrentTeb()->Peb->ProcessParameters->ImagePathName,
                                        globalflagW, REG_DWORD, &NtCurrentTeb()->Peb->NtGlobalFlag,
@@ -2713,37 +2713,44 @@ NTSTATUS WINAPI NtQuerySystemInformation(
 
                 if (Length >= len)
                 {
-                    int     i, j;
+                    struct __server_request_info thread_info[16], *thread_reqs[16];
+                    int     i, j, k;
 
-                    /* set thread info */
+                    /* set thread info, fetching the threads in batches to save round trips */
                     i = j = 0;
                     while (ret == STATUS_SUCCESS)
                     {
-                        SERVER_START_REQ( next_thread )
+                        for (k = 0; k < ARRAY_SIZE(thread_info); k++)
                         {
+                            struct next_thread_request *req = SERVER_INIT_REQ( &thread_info[k], next_thread );
                             req->handle = wine_server_obj_handle( hSnap );
-                            req->reset = (j == 0);
-                            if (!(ret = wine_server_call( req )))
+                            req->reset = (j == 0 && k == 0);
+                            thread_reqs[k] = &thread_info[k];
+                        }
+                        if ((ret = wine_server_call_batch( thread_reqs, ARRAY_SIZE(thread_info) ))) break;
+
+                        for (k = 0; k < ARRAY_SIZE(thread_info); k++)
+                        {
+                            const struct next_thread_reply *reply = &thread_info[k].u.reply.next_thread_reply;
+
+                            if ((ret = reply->__header.error)) break;
+                            j++;
+                            if (UlongToHandle(reply->pid) == spi->UniqueProcessId)
                             {
-                                j++;
-                                if (UlongToHandle(reply->pid) == spi->UniqueProcessId)
-                                {
-                                    /* ftKernelTime, ftUserTime, ftCreateTime;
-                                     * dwTickCount, dwStartAddress
-                                     */
-
-                                    memset(&spi->ti[i], 0, sizeof(spi->ti));
-
-                                    spi->ti[i].CreateTime.QuadPart = 0xdeadbeef;
-                                    spi->ti[i].ClientId.UniqueProcess = UlongToHandle(reply->pid);
-                                    spi->ti[i].ClientId.UniqueThread  = UlongToHandle(reply->tid);
-                                    spi->ti[i].dwCurrentPriority = reply->base_pri + reply->delta_pri;
-                                    spi->ti[i].dwBasePriority = reply->base_pri;
-                                    i++;
-                                }
+                                /* ftKernelTime, ftUserTime, ftCreateTime;
+                                 * dwTickCount, dwStartAddress
+                                 */
+
+                                memset(&spi->ti[i], 0, sizeof(spi->ti));
+
+                                spi->ti[i].CreateTime.QuadPart = 0xdeadbeef;
+                                spi->ti[i].ClientId.UniqueProcess = UlongToHandle(reply->pid);
+                                spi->ti[i].ClientId.UniqueThread  = UlongToHandle(reply->tid);
+                                spi->ti[i].dwCurrentPriority = reply->base_pri + reply->delta_pri;
+                                spi->ti[i].dwBasePriority = reply->base_pri;
+                                i++;
                             }
                         }
-                        SERVER_END_REQ;
                     }
                     if (ret == STATUS_NO_MORE_FILES) ret = STATUS_SUCCESS;
 
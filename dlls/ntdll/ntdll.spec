@@ -143,11 +143,13 @@
 @ stdcall NtAllocateVirtualMemory(long ptr long ptr long long)
 @ stdcall NtAreMappedFilesTheSame(ptr ptr)
 @ stdcall NtAssignProcessToJobObject(long long)
+@ stdcall NtAssociateWaitCompletionPacket(long long long ptr ptr long long ptr)
 @ stub NtCallbackReturn
 # @ stub NtCancelDeviceWakeupRequest
 @ stdcall NtCancelIoFile(long ptr)
 @ stdcall NtCancelIoFileEx(long ptr ptr)
 @ stdcall NtCancelTimer(long ptr)
+@ stdcall NtCancelWaitCompletionPacket(long long)
 @ stdcall NtClearEvent(long)
 @ stdcall NtClearPowerRequest(long long)
 @ stdcall NtClose(long)
@@ -186,6 +188,7 @@
 @ stdcall NtCreateThreadEx(ptr long ptr long ptr ptr long long long long ptr)
 @ stdcall NtCreateTimer(ptr long ptr long)
 @ stub NtCreateToken
+@ stdcall NtCreateWaitCompletionPacket(ptr long ptr)
 # @ stub NtCreateWaitablePort
 @ stdcall -arch=win32,arm64 NtCurrentTeb()
 # @ stub NtDebugActiveProcess
@@ -1116,11 +1119,13 @@
 @ stdcall -private ZwAllocateVirtualMemory(long ptr long ptr long long) NtAllocateVirtualMemory
 @ stdcall -private ZwAreMappedFilesTheSame(ptr ptr) NtAreMappedFilesTheSame
 @ stdcall -private ZwAssignProcessToJobObject(long long) NtAssignProcessToJobObject
+@ stdcall -private ZwAssociateWaitCompletionPacket(long long long ptr ptr long long ptr) NtAssociateWaitCompletionPacket
 @ stub ZwCallbackReturn
 # @ stub ZwCancelDeviceWakeupRequest
 @ stdcall -private ZwCancelIoFile(long ptr) NtCancelIoFile
 @ stdcall -private ZwCancelIoFileEx(long ptr ptr) NtCancelIoFileEx
 @ stdcall -private ZwCancelTimer(long ptr) NtCancelTimer
+@ stdcall -private ZwCancelWaitCompletionPacket(long long) NtCancelWaitCompletionPacket
 @ stdcall -private ZwClearEvent(long) NtClearEvent
 @ stdcall -private ZwClearPowerRequest(long long) NtClearPowerRequest
 @ stdcall -private ZwClose(long) NtClose
@@ -1157,6 +1162,7 @@
 @ stub ZwCreateThread
 @ stdcall -private ZwCreateTimer(ptr long ptr long) NtCreateTimer
 @ stub ZwCreateToken
+@ stdcall -private ZwCreateWaitCompletionPacket(ptr long ptr) NtCreateWaitCompletionPacket
 # @ stub ZwCreateWaitablePort
 # @ stub ZwDebugActiveProcess
 # @ stub ZwDebugContinue
@@ -1553,6 +1559,7 @@
 
 # Server interface
 @ cdecl -norelay wine_server_call(ptr)
+@ cdecl wine_server_call_batch(ptr long)
 @ cdecl wine_server_fd_to_handle(long long long ptr)
 @ cdecl wine_server_handle_to_fd(long long ptr ptr)
 @ cdecl wine_server_release_fd(long long)
@@ -1567,6 +1574,7 @@
 @ cdecl -norelay __wine_dbg_strdup(str)
 
 # Virtual memory
+@ cdecl __wine_locked_recvmmsg(long ptr long long)
 @ cdecl __wine_locked_recvmsg(long ptr long)
 
 # Version
@@ -107,11 +107,33 @@ extern void server_enter_uninterrupted_section( RTL_CRITICAL_SECTION *cs, sigset
 extern void server_leave_uninterrupted_section( RTL_CRITICAL_SECTION *cs, sigset_t *sigset ) DECLSPEC_HIDDEN;
 extern unsigned int server_select( const select_op_t *select_op, data_size_t size,
                                    UINT flags, const LARGE_INTEGER *timeout ) DECLSPEC_HIDDEN;
+extern unsigned int server_wait_unix_fd( int fd, short events, int timeout ) DECLSPEC_HIDDEN;
 extern unsigned int server_queue_process_apc( HANDLE process, const apc_call_t *call, apc_result_t *result ) DECLSPEC_HIDDEN;
 extern int server_remove_fd_from_cache( HANDLE handle ) DECLSPEC_HIDDEN;
+extern BOOL server_fd_has_completion( HANDLE handle, BOOL async ) DECLSPEC_HIDDEN;
 extern int server_get_unix_fd( HANDLE handle, unsigned int access, int *unix_fd,
                                int *needs_close, enum server_fd_type *type, unsigned int *options ) DECLSPEC_HIDDEN;
 extern int server_pipe( int fd[2] ) DECLSPEC_HIDDEN;
+extern int server_get_fsync_fd( data_size_t *size ) DECLSPEC_HIDDEN;
+extern int server_get_registry_cache_fd( data_size_t *size ) DECLSPEC_HIDDEN;
+extern NTSTATUS server_get_handle_info( HANDLE handle, ACCESS_MASK *access, ULONG *flags ) DECLSPEC_HIDDEN;
+extern BOOL server_get_handle_serial( HANDLE handle, unsigned int *serial ) DECLSPEC_HIDDEN;
+extern void fsync_remove_from_cache( HANDLE handle ) DECLSPEC_HIDDEN;
+extern void registry_remove_from_cache( HANDLE handle ) DECLSPEC_HIDDEN;
+
+/* value of a key to retrieve with query_key_values */
+struct key_value_query
+{
+    const WCHAR                   *name;    /* name of the value */
+    KEY_VALUE_PARTIAL_INFORMATION *info;    /* buffer for the value */
+    DWORD                          length;  /* size of the buffer */
+    DWORD                          result;  /* size of the value information */
+    NTSTATUS                       status;  /* result of the query, as returned by NtQueryValueKey */
+};
+
+extern void open_keys( const OBJECT_ATTRIBUTES *attr, ACCESS_MASK access, HANDLE *keys,
+                       NTSTATUS *status, unsigned int count ) DECLSPEC_HIDDEN;
+extern void query_key_values( HANDLE key, struct key_value_query *queries, unsigned int count ) DECLSPEC_HIDDEN;
 extern NTSTATUS alloc_object_attributes( const OBJECT_ATTRIBUTES *attr, struct object_attributes **ret,
                                          data_size_t *ret_len ) DECLSPEC_HIDDEN;
 extern NTSTATUS validate_open_object_attributes( const OBJECT_ATTRIBUTES *attr ) DECLSPEC_HIDDEN;
@@ -159,6 +181,8 @@ extern NTSTATUS COMM_FlushBuffersFile( int fd ) DECLSPEC_HIDDEN;
 struct stat;
 extern NTSTATUS FILE_GetNtStatus(void) DECLSPEC_HIDDEN;
 extern int get_file_info( const char *path, struct stat *st, ULONG *attr ) DECLSPEC_HIDDEN;
+extern int get_dir_entry_info( const char *path, dev_t dir_dev, ino_t dir_ino,
+                               struct stat *st, ULONG *attr ) DECLSPEC_HIDDEN;
 extern NTSTATUS fill_file_info( const struct stat *st, ULONG attr, void *ptr,
                                 FILE_INFORMATION_CLASS class ) DECLSPEC_HIDDEN;
 extern NTSTATUS server_get_unix_name( HANDLE handle, ANSI_STRING *unix_name ) DECLSPEC_HIDDEN;
@@ -202,6 +226,9 @@ extern struct _KUSER_SHARED_DATA *user_shared_data DECLSPEC_HIDDEN;
 /* completion */
 extern NTSTATUS NTDLL_AddCompletion( HANDLE hFile, ULONG_PTR CompletionValue,
                                      NTSTATUS CompletionStatus, ULONG Information, BOOL async) DECLSPEC_HIDDEN;
+extern NTSTATUS associate_wait_packet( HANDLE packet, HANDLE port, HANDLE object, HANDLE thread,
+                                       void *key, void *value, NTSTATUS io_status, ULONG_PTR io_info,
+                                       BOOLEAN *signaled ) DECLSPEC_HIDDEN;
 
 /* locale */
 extern LCID user_lcid, system_lcid;
@@ -226,6 +253,13 @@ enum loadorder
 
 extern enum loadorder get_load_order( const WCHAR *app_name, const UNICODE_STRING *nt_name ) DECLSPEC_HIDDEN;
 
+/* dll search cache */
+extern BOOL dll_cache_is_missing( const UNICODE_STRING *nt_name ) DECLSPEC_HIDDEN;
+extern void dll_cache_add_missing( const UNICODE_STRING *nt_name ) DECLSPEC_HIDDEN;
+extern int dll_cache_find_dir( const WCHAR *paths, const WCHAR *search ) DECLSPEC_HIDDEN;
+extern void dll_cache_add_dir( const WCHAR *paths, const WCHAR *search, unsigned int index ) DECLSPEC_HIDDEN;
+extern void dll_cache_save(void) DECLSPEC_HIDDEN;
+
 struct debug_info
 {
     unsigned int str_pos;       /* current position in strings buffer */
@@ -244,6 +278,8 @@ struct ntdll_thread_data
     int                wait_fd[2];    /* fd for sleeping server requests */
     BOOL               wow64_redir;   /* Wow64 filesystem redirection flag */
     pthread_t          pthread_id;    /* pthread thread id */
+    unsigned int       fsync_owned;   /* index of the owned shared mutex list, ~0 if unavailable */
+    unsigned int       fsync_id;      /* id in the owner field of the shared mutexes */
 };
 
 C_ASSERT( sizeof(struct ntdll_thread_data) <= sizeof(((TEB *)0)->GdiTebBatch) );
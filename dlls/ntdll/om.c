@@ -187,9 +187,22 @@ NTSTATUS WINAPI NtQueryObject(IN HANDLE handle,
     case ObjectDataInformation:
         {
             OBJECT_DATA_INFORMATION* p = ptr;
+            ULONG flags;
 
             if (len < sizeof(*p)) return STATUS_INVALID_BUFFER_SIZE;
 
+            /* try the mirror of the handle table first */
+            if ((status = server_get_handle_info( handle, NULL, &flags )) != STATUS_NOT_IMPLEMENTED)
+            {
+                if (status == STATUS_SUCCESS)
+                {
+                    p->InheritHandle = (flags & HANDLE_FLAG_INHERIT) != 0;
+                    p->ProtectFromClose = (flags & HANDLE_FLAG_PROTECT_FROM_CLOSE) != 0;
+                    if (used_len) *used_len = sizeof(*p);
+                }
+                break;
+            }
+
             SERVER_START_REQ( set_handle_info )
             {
                 req->handle = wine_server_obj_handle( handle );
@@ -352,6 +365,12 @@ NTSTATUS WINAPI NtDuplicateObject( HANDLE source_process, HANDLE source,
                                    ACCESS_MASK access, ULONG attributes, ULONG options )
 {
     NTSTATUS ret;
+
+    /* the mirror of the handle table tells whether a source handle of our own is valid */
+    if (source_process == NtCurrentProcess() &&
+        server_get_handle_info( source, NULL, NULL ) == STATUS_INVALID_HANDLE)
+        return STATUS_INVALID_HANDLE;
+
     SERVER_START_REQ( dup_handle )
     {
         req->src_process = wine_server_obj_handle( source_process );
@@ -368,6 +387,8 @@ NTSTATUS WINAPI NtDuplicateObject( HANDLE source_process, HANDLE source,
             {
                 int fd = server_remove_fd_from_cache( source );
                 if (fd != -1) close( fd );
+                fsync_remove_from_cache( source );
+                registry_remove_from_cache( source );
             }
         }
     }
@@ -387,6 +408,8 @@ NTSTATUS close_handle( HANDLE handle )
     NTSTATUS ret;
     int fd = server_remove_fd_from_cache( handle );
 
+    fsync_remove_from_cache( handle );
+    registry_remove_from_cache( handle );
     SERVER_START_REQ( close_handle )
     {
         req->handle = wine_server_obj_handle( handle );
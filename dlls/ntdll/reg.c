@@ -31,7 +31,14 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
@@ -143,6 +150,37 @@ static NTSTATUS open_key( PHANDLE retkey, ACCESS_MASK access, const OBJECT_ATTRI
     return ret;
 }
 
+/* open several keys with the same access in a single server round trip */
+void open_keys( const OBJECT_ATTRIBUTES *attr, ACCESS_MASK access, HANDLE *keys,
+                NTSTATUS *status, unsigned int count )
+{
+    struct __server_request_info info[8], *reqs[8];
+    unsigned int i, j, n;
+
+    for (i = 0; i < count; i += n)
+    {
+        n = min( count - i, ARRAY_SIZE(info) );
+        for (j = 0; j < n; j++)
+        {
+            struct open_key_request *req = SERVER_INIT_REQ( &info[j], open_key );
+
+            req->parent     = wine_server_obj_handle( attr[i + j].RootDirectory );
+            req->access     = access;
+            req->attributes = attr[i + j].Attributes;
+            wine_server_add_data( &info[j], attr[i + j].ObjectName->Buffer, attr[i + j].ObjectName->Length );
+            reqs[j] = &info[j];
+        }
+        wine_server_call_batch( reqs, n );
+        for (j = 0; j < n; j++)
+        {
+            status[i + j] = info[j].u.reply.reply_header.error;
+            keys[i + j] = status[i + j] ? 0 : wine_server_ptr_handle( info[j].u.reply.open_key_reply.hkey );
+            TRACE( "(%p,%s,%x) <- %p\n", attr[i + j].RootDirectory,
+                   debugstr_us(attr[i + j].ObjectName), access, keys[i + j] );
+        }
+    }
+}
+
 /******************************************************************************
  * NtOpenKeyEx [NTDLL.@]
  * ZwOpenKeyEx [NTDLL.@]
@@ -522,6 +560,169 @@ NTSTATUS WINAPI NtEnumerateValueKey( HANDLE handle, ULONG index,
 }
 
 
+/* Client-side cache of registry values, enabled with WINEREGCACHE.
+ *
+ * Small values are cached per key handle, along with the generation of the
+ * key values returned by the server. The server increments the generation in
+ * shared memory whenever the values of the key change, which invalidates the
+ * cached entries without any round trip. */
+
+#define REG_CACHE_BUCKETS     64   /* number of buckets, selected by handle */
+#define REG_CACHE_BUCKET_SIZE 8    /* number of entries per bucket */
+#define REG_CACHE_MAX_NAME    64   /* max. length of a cached value name in chars */
+#define REG_CACHE_MAX_DATA    128  /* max. size of cached value data */
+
+struct reg_cache_entry
+{
+    HANDLE       handle;      /* key handle, 0 if the entry is free */
+    unsigned int serial;      /* serial of the handle table entry when cached */
+    unsigned int slot;        /* index of the key generation counter */
+    unsigned int gen;         /* generation of the key values when cached */
+    NTSTATUS     status;      /* STATUS_SUCCESS or STATUS_OBJECT_NAME_NOT_FOUND */
+    int          type;        /* value type */
+    DWORD        total;       /* value data size */
+    USHORT       name_len;    /* value name length in bytes */
+    WCHAR        name[REG_CACHE_MAX_NAME];
+    BYTE         data[REG_CACHE_MAX_DATA];
+};
+
+struct reg_cache_bucket
+{
+    unsigned int           next;  /* next entry to replace */
+    struct reg_cache_entry entries[REG_CACHE_BUCKET_SIZE];
+};
+
+static struct reg_cache_bucket reg_cache[REG_CACHE_BUCKETS];
+static const unsigned int *reg_cache_generations;  /* NULL if the cache is disabled */
+static BOOL reg_cache_initialized;
+
+static RTL_CRITICAL_SECTION reg_cache_section;
+static RTL_CRITICAL_SECTION_DEBUG reg_cache_section_debug =
+{
+    0, 0, &reg_cache_section,
+    { &reg_cache_section_debug.ProcessLocksList, &reg_cache_section_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": reg_cache_section") }
+};
+static RTL_CRITICAL_SECTION reg_cache_section = { &reg_cache_section_debug, -1, 0, 0, 0, 0 };
+
+static BOOL init_reg_cache(void)
+{
+    const char *env;
+
+    if (reg_cache_initialized) return reg_cache_generations != NULL;
+
+    RtlEnterCriticalSection( &reg_cache_section );
+    if (!reg_cache_initialized)
+    {
+#ifdef HAVE_SYS_MMAN_H
+        if ((env = getenv( "WINEREGCACHE" )) && atoi( env ))
+        {
+            data_size_t size = 0;
+            void *ptr;
+            int fd;
+
+            if ((fd = server_get_registry_cache_fd( &size )) != -1)
+            {
+                if ((ptr = mmap( NULL, size, PROT_READ, MAP_SHARED, fd, 0 )) != MAP_FAILED)
+                    reg_cache_generations = ptr;
+                close( fd );
+            }
+            if (reg_cache_generations) TRACE( "using client-side registry cache\n" );
+        }
+#endif
+        reg_cache_initialized = TRUE;
+    }
+    RtlLeaveCriticalSection( &reg_cache_section );
+    return reg_cache_generations != NULL;
+}
+
+static inline struct reg_cache_bucket *get_reg_cache_bucket( HANDLE handle )
+{
+    return &reg_cache[((ULONG_PTR)handle >> 2) % REG_CACHE_BUCKETS];
+}
+
+/* retrieve a value from the cache; return FALSE if the server must be asked */
+static BOOL get_cached_value( HANDLE handle, const UNICODE_STRING *name, struct reg_cache_entry *ret )
+{
+    struct reg_cache_bucket *bucket = get_reg_cache_bucket( handle );
+    struct reg_cache_entry *entry;
+    BOOL found = FALSE;
+    unsigned int i, serial;
+
+    if (!init_reg_cache()) return FALSE;
+    if (name->Length > sizeof(entry->name)) return FALSE;
+    if (!server_get_handle_serial( handle, &serial )) return FALSE;
+
+    RtlEnterCriticalSection( &reg_cache_section );
+    for (i = 0; i < REG_CACHE_BUCKET_SIZE; i++)
+    {
+        entry = &bucket->entries[i];
+        if (entry->handle != handle || entry->name_len != name->Length) continue;
+        if (RtlCompareUnicodeStrings( entry->name, entry->name_len / sizeof(WCHAR),
+                                      name->Buffer, name->Length / sizeof(WCHAR), TRUE )) continue;
+        /* the handle may have been closed by another process and reused for another key */
+        if (entry->serial == serial &&
+            entry->gen == *(volatile const unsigned int *)&reg_cache_generations[entry->slot])
+        {
+            *ret = *entry;
+            found = TRUE;
+        }
+        else entry->handle = 0;  /* outdated */
+        break;
+    }
+    RtlLeaveCriticalSection( &reg_cache_section );
+    return found;
+}
+
+/* store the result of a get_key_value request in the cache */
+static void cache_value( HANDLE handle, unsigned int serial, const UNICODE_STRING *name,
+                         unsigned int slot, unsigned int gen, NTSTATUS status, int type, const void *data, DWORD total )
+{
+    struct reg_cache_bucket *bucket = get_reg_cache_bucket( handle );
+    struct reg_cache_entry *entry = NULL;
+    unsigned int i;
+
+    if (!reg_cache_generations || slot >= REGISTRY_CACHE_SLOTS) return;
+    if (status != STATUS_SUCCESS && status != STATUS_OBJECT_NAME_NOT_FOUND) return;
+    if (name->Length > sizeof(entry->name) || total > sizeof(entry->data)) return;
+
+    RtlEnterCriticalSection( &reg_cache_section );
+    for (i = 0; i < REG_CACHE_BUCKET_SIZE; i++)
+    {
+        if (bucket->entries[i].handle != handle || bucket->entries[i].name_len != name->Length) continue;
+        if (RtlCompareUnicodeStrings( bucket->entries[i].name, name->Length / sizeof(WCHAR),
+                                      name->Buffer, name->Length / sizeof(WCHAR), TRUE )) continue;
+        entry = &bucket->entries[i];
+        break;
+    }
+    if (!entry) entry = &bucket->entries[bucket->next++ % REG_CACHE_BUCKET_SIZE];
+    entry->handle   = handle;
+    entry->serial   = serial;
+    entry->slot     = slot;
+    entry->gen      = gen;
+    entry->status   = status;
+    entry->type     = type;
+    entry->total    = status ? 0 : total;
+    entry->name_len = name->Length;
+    memcpy( entry->name, name->Buffer, name->Length );
+    if (!status) memcpy( entry->data, data, total );
+    RtlLeaveCriticalSection( &reg_cache_section );
+}
+
+/* remove the cached values of a handle that is being closed */
+void registry_remove_from_cache( HANDLE handle )
+{
+    struct reg_cache_bucket *bucket = get_reg_cache_bucket( handle );
+    unsigned int i;
+
+    if (!reg_cache_generations) return;
+
+    RtlEnterCriticalSection( &reg_cache_section );
+    for (i = 0; i < REG_CACHE_BUCKET_SIZE; i++)
+        if (bucket->entries[i].handle == handle) bucket->entries[i].handle = 0;
+    RtlLeaveCriticalSection( &reg_cache_section );
+}
+
 /******************************************************************************
  * NtQueryValueKey [NTDLL.@]
  * ZwQueryValueKey [NTDLL.@]
@@ -536,6 +737,11 @@ NTSTATUS WINAPI DECLSPEC_HOTPATCH NtQueryValueKey( HANDLE handle, const UNICODE_
     NTSTATUS ret;
     UCHAR *data_ptr;
     unsigned int fixed_size, min_size;
+    struct reg_cache_entry cached;
+    unsigned int serial;
+    BOOL cacheable;
+    DWORD total;
+    int type;
 
     TRACE( "(%p,%s,%d,%p,%d)\n", handle, debugstr_us(name), info_class, info, length );
 
@@ -573,24 +779,77 @@ NTSTATUS WINAPI DECLSPEC_HOTPATCH NtQueryValueKey( HANDLE handle, const UNICODE_
         return STATUS_INVALID_PARAMETER;
     }
 
-    SERVER_START_REQ( get_key_value )
+    if (get_cached_value( handle, name, &cached ))
     {
-        req->hkey = wine_server_obj_handle( handle );
-        wine_server_add_data( req, name->Buffer, name->Length );
-        if (length > fixed_size && data_ptr) wine_server_set_reply( req, data_ptr, length - fixed_size );
-        if (!(ret = wine_server_call( req )))
+        if (cached.status) return cached.status;
+        if (length > fixed_size && data_ptr) memcpy( data_ptr, cached.data, min( length - fixed_size, cached.total ));
+        type  = cached.type;
+        total = cached.total;
+    }
+    else
+    {
+        /* read the serial before the request, so that a handle reused meanwhile invalidates the entry */
+        cacheable = reg_cache_generations && server_get_handle_serial( handle, &serial );
+        SERVER_START_REQ( get_key_value )
         {
-            copy_key_value_info( info_class, info, length, reply->type,
-                                 name->Length, reply->total );
-            *result_len = fixed_size + (info_class == KeyValueBasicInformation ? 0 : reply->total);
-            if (length < min_size) ret = STATUS_BUFFER_TOO_SMALL;
-            else if (length < *result_len) ret = STATUS_BUFFER_OVERFLOW;
+            req->hkey = wine_server_obj_handle( handle );
+            wine_server_add_data( req, name->Buffer, name->Length );
+            if (length > fixed_size && data_ptr) wine_server_set_reply( req, data_ptr, length - fixed_size );
+            ret = wine_server_call( req );
+            type  = reply->type;
+            total = reply->total;
+            /* only cache the value if we got all the data */
+            if (cacheable && (ret || !total || wine_server_reply_size( reply ) == total))
+                cache_value( handle, serial, name, reply->cache_slot, reply->cache_gen, ret, type, data_ptr, total );
         }
+        SERVER_END_REQ;
+        if (ret) return ret;
     }
-    SERVER_END_REQ;
+
+    copy_key_value_info( info_class, info, length, type, name->Length, total );
+    *result_len = fixed_size + (info_class == KeyValueBasicInformation ? 0 : total);
+    if (length < min_size) ret = STATUS_BUFFER_TOO_SMALL;
+    else if (length < *result_len) ret = STATUS_BUFFER_OVERFLOW;
     return ret;
 }
 
+/* query the partial information of several values of a key in a single server round trip */
+void query_key_values( HANDLE handle, struct key_value_query *queries, unsigned int count )
+{
+    static const DWORD fixed_size = FIELD_OFFSET(KEY_VALUE_PARTIAL_INFORMATION, Data);
+    struct __server_request_info info[16], *reqs[16];
+    unsigned int i, j, n;
+
+    for (i = 0; i < count; i += n)
+    {
+        n = min( count - i, ARRAY_SIZE(info) );
+        for (j = 0; j < n; j++)
+        {
+            struct key_value_query *query = &queries[i + j];
+            struct get_key_value_request *req = SERVER_INIT_REQ( &info[j], get_key_value );
+
+            req->hkey = wine_server_obj_handle( handle );
+            wine_server_add_data( &info[j], query->name, wcslen( query->name ) * sizeof(WCHAR) );
+            if (query->length > fixed_size)
+                wine_server_set_reply( &info[j], query->info->Data, query->length - fixed_size );
+            reqs[j] = &info[j];
+        }
+        wine_server_call_batch( reqs, n );
+        for (j = 0; j < n; j++)
+        {
+            struct key_value_query *query = &queries[i + j];
+            const struct get_key_value_reply *reply = &info[j].u.reply.get_key_value_reply;
+
+            if ((query->status = reply->__header.error)) continue;
+            copy_key_value_info( KeyValuePartialInformation, query->info, query->length,
+                                 reply->type, 0, reply->total );
+            query->result = fixed_size + reply->total;
+            if (query->length < fixed_size) query->status = STATUS_BUFFER_TOO_SMALL;
+            else if (query->length < query->result) query->status = STATUS_BUFFER_OVERFLOW;
+        }
+    }
+}
+
 /******************************************************************************
  * RtlpNtQueryValueKey [NTDLL.@]
  *
@@ -34,6 +34,9 @@
 #ifdef HAVE_PTHREAD_NP_H
 # include <pthread_np.h>
 #endif
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -51,6 +54,9 @@
 #ifdef HAVE_SYS_MMAN_H
 #include <sys/mman.h>
 #endif
+#ifdef HAVE_SYS_POLL_H
+#include <sys/poll.h>
+#endif
 #ifdef HAVE_SYS_PRCTL_H
 # include <sys/prctl.h>
 #endif
@@ -324,6 +330,89 @@ unsigned int CDECL wine_server_call( void *req_ptr )
 }
 
 
+/***********************************************************************
+ *           wine_server_call_batch (NTDLL.@)
+ *
+ * Perform several independent server calls in a single round trip.
+ *
+ * PARAMS
+ *     reqs  [I/O] Array of pointers to the request structures.
+ *     count [I]   Number of requests.
+ *
+ * RETURNS
+ *     The status of the batch itself; the status of each request is set in
+ *     its reply header, like wine_server_call would return it.
+ *
+ * NOTES
+ *     Use SERVER_INIT_REQ to fill out each request structure, e.g:
+ *|     struct __server_request_info info[2], *reqs[2] = { &info[0], &info[1] };
+ *|     struct get_key_info_request *req = SERVER_INIT_REQ( &info[0], get_key_info );
+ *|     req->hkey = wine_server_obj_handle( key );
+ *|     ...
+ *|     ret = wine_server_call_batch( reqs, 2 );
+ *     The requests are executed in order and must not depend on each other.
+ *     Only simple queries and object operations can be batched, the others
+ *     fail with STATUS_NOT_SUPPORTED; see is_batch_request_allowed in the server.
+ */
+unsigned int CDECL wine_server_call_batch( struct __server_request_info **reqs, unsigned int count )
+{
+    data_size_t req_size = 0, reply_size = 0, pos, size;
+    unsigned int i, j, ret, done = 0;
+    char *req_buffer, *reply_buffer;
+
+    for (i = 0; i < count; i++)
+    {
+        req_size += sizeof(reqs[i]->u.req) + ((reqs[i]->u.req.request_header.request_size + 7) & ~7);
+        reply_size += sizeof(reqs[i]->u.reply) + ((reqs[i]->u.req.request_header.reply_size + 7) & ~7);
+    }
+    if (!(req_buffer = RtlAllocateHeap( GetProcessHeap(), 0, req_size + reply_size )))
+        return STATUS_NO_MEMORY;
+    reply_buffer = req_buffer + req_size;
+
+    for (i = pos = 0; i < count; i++)
+    {
+        memcpy( req_buffer + pos, &reqs[i]->u.req, sizeof(reqs[i]->u.req) );
+        pos += sizeof(reqs[i]->u.req);
+        for (j = 0; j < reqs[i]->data_count; j++)
+        {
+            memcpy( req_buffer + pos, reqs[i]->data[j].ptr, reqs[i]->data[j].size );
+            pos += reqs[i]->data[j].size;
+        }
+        size = (pos + 7) & ~7;
+        memset( req_buffer + pos, 0, size - pos );
+        pos = size;
+    }
+
+    SERVER_START_REQ( call_batch )
+    {
+        wine_server_add_data( req, req_buffer, req_size );
+        wine_server_set_reply( req, reply_buffer, reply_size );
+        if (!(ret = wine_server_call( req ))) done = reply->count;
+    }
+    SERVER_END_REQ;
+
+    for (i = pos = 0; i < count; i++)
+    {
+        struct __server_request_info *info = reqs[i];
+
+        if (i >= done)
+        {
+            memset( &info->u.reply, 0, sizeof(info->u.reply) );
+            info->u.reply.reply_header.error = ret ? ret : STATUS_REQUEST_ABORTED;
+            continue;
+        }
+        memcpy( &info->u.reply, reply_buffer + pos, sizeof(info->u.reply) );
+        pos += sizeof(info->u.reply);
+        if ((size = info->u.reply.reply_header.reply_size))
+            memcpy( info->reply_data, reply_buffer + pos, size );
+        pos += (size + 7) & ~7;
+    }
+
+    RtlFreeHeap( GetProcessHeap(), 0, req_buffer );
+    return ret;
+}
+
+
 /***********************************************************************
  *           server_enter_uninterrupted_section
  */
@@ -659,6 +748,93 @@ unsigned int server_select( const select_op_t *select_op, data_size_t size, UINT
 }
 
 
+/***********************************************************************
+ *           server_wait_unix_fd
+ *
+ * Wait for a unix fd to become ready while staying alertable. A pending
+ * alertable server wait makes the server write to the wait fd of the thread
+ * when an APC is queued, so both fds are polled together. The server wait
+ * is ended with a wakeup APC once the unix fd is ready.
+ * Returns STATUS_SUCCESS, STATUS_TIMEOUT or STATUS_USER_APC.
+ */
+unsigned int server_wait_unix_fd( int fd, short events, int timeout )
+{
+    unsigned int ret, status = STATUS_PENDING;  /* status of the unix fd, pending until known */
+    int cookie, res;
+    BOOL user_apc = FALSE;
+    obj_handle_t apc_handle = 0;
+    apc_call_t call;
+    apc_result_t result;
+    timeout_t abs_timeout = TIMEOUT_INFINITE;
+    ULONG end = NtGetTickCount() + timeout;
+    struct pollfd pfd[2];
+    sigset_t old_set;
+
+    memset( &result, 0, sizeof(result) );
+    pfd[0].fd     = fd;
+    pfd[0].events = events;
+    pfd[1].fd     = ntdll_get_thread_data()->wait_fd[0];
+    pfd[1].events = POLLIN;
+
+    for (;;)
+    {
+        pthread_sigmask( SIG_BLOCK, &server_block_set, &old_set );
+        for (;;)
+        {
+            SERVER_START_REQ( select )
+            {
+                req->flags    = SELECT_INTERRUPTIBLE | SELECT_ALERTABLE;
+                req->cookie   = wine_server_client_ptr( &cookie );
+                req->prev_apc = apc_handle;
+                req->timeout  = abs_timeout;
+                wine_server_add_data( req, &result, sizeof(result) );
+                ret = server_call_unlocked( req );
+                apc_handle = reply->apc_handle;
+                call       = reply->call;
+            }
+            SERVER_END_REQ;
+            if (ret != STATUS_KERNEL_APC) break;
+            invoke_apc( &call, &result );
+        }
+        pthread_sigmask( SIG_SETMASK, &old_set, NULL );
+
+        if (ret == STATUS_USER_APC)
+        {
+            /* an APC_NONE is only a wakeup, such as the one ending our wait */
+            if (call.type != APC_NONE) user_apc = TRUE;
+            invoke_apc( &call, &result );
+            /* check once more for queued APCs, without waiting */
+            if (user_apc) abs_timeout = 0;
+            continue;
+        }
+        if (ret != STATUS_PENDING) break;
+
+        if (status == STATUS_PENDING)
+        {
+            if (timeout != -1) timeout = max( 0, (LONG)(end - NtGetTickCount()) );
+            while ((res = poll( pfd, 2, timeout )) == -1 && errno == EINTR) ;
+            if (res > 0 && !pfd[0].revents)
+            {
+                /* an APC was queued, the next select fetches it */
+                wait_select_reply( &cookie );
+                continue;
+            }
+            if (res > 0) status = STATUS_SUCCESS;
+            else if (!res) status = STATUS_TIMEOUT;
+            else status = FILE_GetNtStatus();
+        }
+
+        NtQueueApcThread( GetCurrentThread(), NULL, 0, 0, 0 );
+        wait_select_reply( &cookie );
+        abs_timeout = 0;
+    }
+
+    if (user_apc) return STATUS_USER_APC;
+    if (status != STATUS_PENDING) return status;
+    return ret;
+}
+
+
 /***********************************************************************
  *           server_queue_process_apc
  */
@@ -937,6 +1113,75 @@ int server_remove_fd_from_cache( HANDLE handle )
 }
 
 
+/***********************************************************************
+ *           get_handle_mirror
+ *
+ * Map the read-only mirror of the server handle table.
+ */
+static const struct handle_mirror_entry *get_handle_mirror(void)
+{
+    static const struct handle_mirror_entry *handle_mirror;
+    static BOOL handle_mirror_failed;
+    obj_handle_t handle;
+    data_size_t size = 0;
+    sigset_t sigset;
+    void *ptr = NULL;
+    int fd = -1;
+
+    if (handle_mirror || handle_mirror_failed) return handle_mirror;
+
+    /* the fd_cache_section ensures that we receive the fd that matches our request */
+    server_enter_uninterrupted_section( &fd_cache_section, &sigset );
+    if (!handle_mirror && !handle_mirror_failed)
+    {
+        SERVER_START_REQ( get_handle_mirror )
+        {
+            if (!wine_server_call( req ))
+            {
+                size = reply->size;
+                fd = receive_fd( &handle );
+            }
+        }
+        SERVER_END_REQ;
+        if (fd != -1)
+        {
+            if ((ptr = mmap( NULL, size, PROT_READ, MAP_SHARED, fd, 0 )) == MAP_FAILED) ptr = NULL;
+            close( fd );
+        }
+        if (ptr) handle_mirror = ptr;
+        else handle_mirror_failed = TRUE;
+    }
+    server_leave_uninterrupted_section( &fd_cache_section, &sigset );
+    return handle_mirror;
+}
+
+
+/***********************************************************************
+ *           check_handle_mirror_access
+ *
+ * Check a handle against the mirror of the server handle table before
+ * asking the server for its unix fd. Return STATUS_SUCCESS if the server
+ * has to be asked.
+ */
+static NTSTATUS check_handle_mirror_access( HANDLE handle, unsigned int wanted_access )
+{
+    const struct handle_mirror_entry *mirror;
+    ULONG_PTR index = ((ULONG_PTR)handle >> 2) - 1;
+    unsigned int flags;
+
+    if (((ULONG_PTR)handle & 3) || index >= HANDLE_MIRROR_ENTRIES) return STATUS_SUCCESS;
+    if (!(mirror = get_handle_mirror())) return STATUS_SUCCESS;
+
+    flags = *(volatile const unsigned int *)&mirror[index].flags;
+    if (!(flags & HANDLE_MIRROR_IN_USE)) return STATUS_INVALID_HANDLE;
+    /* the object type is only known once the server has sent an fd for the handle */
+    if (!(flags & HANDLE_MIRROR_HAS_FD)) return STATUS_SUCCESS;
+    if ((*(volatile const unsigned int *)&mirror[index].access & wanted_access) != wanted_access)
+        return STATUS_ACCESS_DENIED;
+    return STATUS_SUCCESS;
+}
+
+
 /***********************************************************************
  *           server_get_unix_fd
  *
@@ -957,6 +1202,9 @@ int server_get_unix_fd( HANDLE handle, unsigned int wanted_access, int *unix_fd,
     ret = get_cached_fd( handle, &fd, type, &access, options );
     if (ret != STATUS_INVALID_HANDLE) goto done;
 
+    /* fds that can't be cached are fetched every time, but failures can be answered from the mirror */
+    if ((ret = check_handle_mirror_access( handle, wanted_access ))) return ret;
+
     server_enter_uninterrupted_section( &fd_cache_section, &sigset );
     ret = get_cached_fd( handle, &fd, type, &access, options );
     if (ret == STATUS_INVALID_HANDLE)
@@ -998,6 +1246,132 @@ done:
 }
 
 
+/***********************************************************************
+ *           server_get_fsync_fd
+ *
+ * Retrieve the fd of the shared memory area used for client-side synchronization.
+ */
+int server_get_fsync_fd( data_size_t *size )
+{
+    sigset_t sigset;
+    obj_handle_t handle;
+    int fd = -1;
+
+    /* the fd_cache_section ensures that we receive the fd that matches our request */
+    server_enter_uninterrupted_section( &fd_cache_section, &sigset );
+    SERVER_START_REQ( get_fsync_shm )
+    {
+        if (!wine_server_call( req ))
+        {
+            *size = reply->size;
+            fd = receive_fd( &handle );
+        }
+    }
+    SERVER_END_REQ;
+    server_leave_uninterrupted_section( &fd_cache_section, &sigset );
+    return fd;
+}
+
+
+/***********************************************************************
+ *           server_get_registry_cache_fd
+ *
+ * Retrieve the fd of the shared memory area used for client-side registry caching.
+ */
+int server_get_registry_cache_fd( data_size_t *size )
+{
+    sigset_t sigset;
+    obj_handle_t handle;
+    int fd = -1;
+
+    /* the fd_cache_section ensures that we receive the fd that matches our request */
+    server_enter_uninterrupted_section( &fd_cache_section, &sigset );
+    SERVER_START_REQ( get_registry_cache )
+    {
+        if (!wine_server_call( req ))
+        {
+            *size = reply->size;
+            fd = receive_fd( &handle );
+        }
+    }
+    SERVER_END_REQ;
+    server_leave_uninterrupted_section( &fd_cache_section, &sigset );
+    return fd;
+}
+
+
+/***********************************************************************
+ *           server_get_handle_info
+ *
+ * Retrieve the access rights and flags of a handle from the mirror of the
+ * server handle table, without a server round trip.
+ * Return STATUS_NOT_IMPLEMENTED if the server has to be asked instead.
+ */
+NTSTATUS server_get_handle_info( HANDLE handle, ACCESS_MASK *access, ULONG *flags )
+{
+    const struct handle_mirror_entry *mirror;
+    ULONG_PTR index = ((ULONG_PTR)handle >> 2) - 1;
+    unsigned int entry_flags;
+
+    if (((ULONG_PTR)handle & 3) || index >= HANDLE_MIRROR_ENTRIES) return STATUS_NOT_IMPLEMENTED;
+    if (!(mirror = get_handle_mirror())) return STATUS_NOT_IMPLEMENTED;
+
+    entry_flags = *(volatile const unsigned int *)&mirror[index].flags;
+    if (!(entry_flags & HANDLE_MIRROR_IN_USE)) return STATUS_INVALID_HANDLE;
+    if (access) *access = *(volatile const unsigned int *)&mirror[index].access;
+    if (flags) *flags = entry_flags & (HANDLE_FLAG_INHERIT | HANDLE_FLAG_PROTECT_FROM_CLOSE);
+    return STATUS_SUCCESS;
+}
+
+
+/***********************************************************************
+ *           server_get_handle_serial
+ *
+ * Retrieve the serial of the handle table entry of a handle. The server
+ * changes it whenever the entry is reused, so that client-side caches can
+ * detect a handle value that was closed, even by another process, and
+ * allocated again. Return FALSE if the handle isn't mirrored.
+ */
+BOOL server_get_handle_serial( HANDLE handle, unsigned int *serial )
+{
+    const struct handle_mirror_entry *mirror;
+    ULONG_PTR index = ((ULONG_PTR)handle >> 2) - 1;
+
+    if (((ULONG_PTR)handle & 3) || index >= HANDLE_MIRROR_ENTRIES) return FALSE;
+    if (!(mirror = get_handle_mirror())) return FALSE;
+    if (!(*(volatile const unsigned int *)&mirror[index].flags & HANDLE_MIRROR_IN_USE)) return FALSE;
+    *serial = *(volatile const unsigned int *)&mirror[index].serial;
+    return TRUE;
+}
+
+
+/***********************************************************************
+ *           server_fd_has_completion
+ *
+ * Check whether a completion of an I/O on a handle may have to be posted.
+ * The server sets hints in the handle mirror once it has ignored such a
+ * completion, and clears them in all processes when a completion port is
+ * associated with the file. This saves a server round trip for every
+ * overlapped I/O on files without a port, or with a port that skips the
+ * completions of synchronous I/O. The completions that go to a port are
+ * queued by NTDLL_AddCompletion.
+ */
+BOOL server_fd_has_completion( HANDLE handle, BOOL async )
+{
+    const struct handle_mirror_entry *mirror;
+    ULONG_PTR index = ((ULONG_PTR)handle >> 2) - 1;
+    unsigned int flags;
+
+    if (((ULONG_PTR)handle & 3) || index >= HANDLE_MIRROR_ENTRIES) return TRUE;
+    if (!(mirror = get_handle_mirror())) return TRUE;
+
+    flags = *(volatile const unsigned int *)&mirror[index].flags;
+    if (!(flags & HANDLE_MIRROR_IN_USE)) return TRUE;
+    if (flags & HANDLE_MIRROR_NO_COMPLETION) return FALSE;
+    return async || !(flags & HANDLE_MIRROR_SKIP_COMPLETION);
+}
+
+
 /***********************************************************************
  *           wine_server_fd_to_handle   (NTDLL.@)
  *
@@ -46,6 +46,9 @@
 #ifdef HAVE_SCHED_H
 # include <sched.h>
 #endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -58,6 +61,7 @@
 #include "windef.h"
 #include "winternl.h"
 #include "wine/server.h"
+#include "wine/library.h"
 #include "wine/debug.h"
 #include "ntdll_misc.h"
 
@@ -133,6 +137,690 @@ static void timespec_from_timeout( struct timespec *timespec, const LARGE_INTEGE
 }
 #endif
 
+
+/*
+ *	Client-side synchronization on shared memory, see server/fsync.c
+ */
+
+#if defined(__linux__) && defined(HAVE_SYS_MMAN_H)
+
+/* the shared memory area is also mapped by the server, so we can't use private futexes */
+static inline int futex_wait_shared( const int *addr, int val, struct timespec *timeout )
+{
+    return syscall( __NR_futex, addr, FUTEX_WAIT, val, timeout, 0, 0 );
+}
+
+static inline int futex_wake_shared( const int *addr, int val )
+{
+    return syscall( __NR_futex, addr, FUTEX_WAKE, val, NULL, 0, 0 );
+}
+
+union fsync_cache_entry
+{
+    LONG64 data;
+    struct
+    {
+        unsigned int serial;           /* serial of the handle table entry when cached */
+        unsigned int index : 16;       /* index in the shared memory area, 0 if not an fsync object */
+        unsigned int type : 8;         /* object type */
+        unsigned int cached : 1;       /* entry is valid */
+    } s;
+};
+
+C_ASSERT( sizeof(union fsync_cache_entry) == sizeof(LONG64) );
+
+/* atomically exchange a 64-bit value */
+static inline LONG64 interlocked_xchg64( LONG64 *dest, LONG64 val )
+{
+#ifdef _WIN64
+    return (LONG64)interlocked_xchg_ptr( (void **)dest, (void *)val );
+#else
+    LONG64 tmp = *dest;
+    while (interlocked_cmpxchg64( dest, val, tmp ) != tmp) tmp = *dest;
+    return tmp;
+#endif
+}
+
+#define FSYNC_CACHE_BLOCK_SIZE  (65536 / sizeof(union fsync_cache_entry))
+#define FSYNC_CACHE_ENTRIES     128
+
+static union fsync_cache_entry *fsync_cache[FSYNC_CACHE_ENTRIES];
+static struct fsync_object *fsync_objects;
+static BOOL fsync_disabled;
+
+/* map the shared memory area of the process; objects created before don't use it */
+static BOOL fsync_init(void)
+{
+    data_size_t size;
+    void *ptr;
+    int fd;
+
+    const char *env;
+
+    if (fsync_objects) return TRUE;
+    if (fsync_disabled) return FALSE;
+
+    if (!(env = getenv( "WINEFSYNC" )) || !atoi( env ) ||
+        !use_futexes() || (fd = server_get_fsync_fd( &size )) == -1)
+    {
+        fsync_disabled = TRUE;
+        return FALSE;
+    }
+    ptr = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if (ptr == MAP_FAILED)
+    {
+        fsync_disabled = TRUE;
+        return FALSE;
+    }
+    if (interlocked_cmpxchg_ptr( (void **)&fsync_objects, ptr, NULL )) munmap( ptr, size );
+    TRACE( "using shared memory synchronization\n" );
+    return TRUE;
+}
+
+static inline unsigned int fsync_handle_to_index( HANDLE handle, unsigned int *entry )
+{
+    unsigned int idx = (wine_server_obj_handle(handle) >> 2) - 1;
+    *entry = idx / FSYNC_CACHE_BLOCK_SIZE;
+    return idx % FSYNC_CACHE_BLOCK_SIZE;
+}
+
+static union fsync_cache_entry *get_fsync_cache_entry( HANDLE handle )
+{
+    unsigned int entry, idx = fsync_handle_to_index( handle, &entry );
+
+    if (entry >= FSYNC_CACHE_ENTRIES) return NULL;
+
+    if (!fsync_cache[entry])  /* do we need to allocate a new block of entries? */
+    {
+        void *ptr = wine_anon_mmap( NULL, FSYNC_CACHE_BLOCK_SIZE * sizeof(union fsync_cache_entry),
+                                    PROT_READ | PROT_WRITE, 0 );
+        if (ptr == MAP_FAILED) return NULL;
+        if (interlocked_cmpxchg_ptr( (void **)&fsync_cache[entry], ptr, NULL ))
+            munmap( ptr, FSYNC_CACHE_BLOCK_SIZE * sizeof(union fsync_cache_entry) );
+    }
+    return &fsync_cache[entry][idx];
+}
+
+/***********************************************************************
+ *           fsync_remove_from_cache
+ */
+void fsync_remove_from_cache( HANDLE handle )
+{
+    unsigned int entry, idx = fsync_handle_to_index( handle, &entry );
+
+    if (entry < FSYNC_CACHE_ENTRIES && fsync_cache[entry])
+        interlocked_xchg64( &fsync_cache[entry][idx].data, 0 );
+}
+
+/* return the shared state of an object, or NULL if the server has to handle it */
+static struct fsync_object *get_fsync_object( HANDLE handle, ACCESS_MASK access, enum fsync_type *type )
+{
+    union fsync_cache_entry *entry, cache;
+    ACCESS_MASK handle_access;
+    unsigned int serial;
+    NTSTATUS ret;
+
+    if (!fsync_init()) return NULL;
+    /* the handle may have been closed by another process and reused since it was cached */
+    if (!server_get_handle_serial( handle, &serial )) return NULL;
+    if (!(entry = get_fsync_cache_entry( handle ))) return NULL;
+
+    cache.data = interlocked_cmpxchg64( &entry->data, 0, 0 );
+    if (!cache.s.cached || cache.s.serial != serial)
+    {
+        cache.data = 0;
+        SERVER_START_REQ( get_fsync_idx )
+        {
+            req->handle = wine_server_obj_handle( handle );
+            if (!(ret = wine_server_call( req )))
+            {
+                cache.s.index = reply->index;
+                cache.s.type  = reply->type;
+            }
+        }
+        SERVER_END_REQ;
+
+        if (ret == STATUS_OBJECT_TYPE_MISMATCH) cache.s.index = 0;
+        else if (ret) return NULL;
+        /* the serial was read before the request, a handle reused meanwhile invalidates the entry */
+        cache.s.serial = serial;
+        cache.s.cached = 1;
+        interlocked_xchg64( &entry->data, cache.data );
+    }
+    if (!cache.s.index) return NULL;
+
+    /* let the server report access errors */
+    if (access && (server_get_handle_info( handle, &handle_access, NULL ) ||
+                   (handle_access & access) != access))
+        return NULL;
+    *type = cache.s.type;
+    return &fsync_objects[cache.s.index];
+}
+
+/* wake up the client threads waiting for a state change */
+static void fsync_wake( struct fsync_object *obj )
+{
+    struct fsync_object *multiple = &fsync_objects[0];
+
+    if (*(volatile int *)&obj->waiters)
+    {
+        interlocked_xchg_add( &obj->seq, 1 );
+        futex_wake_shared( &obj->seq, INT_MAX );
+    }
+    if (*(volatile int *)&multiple->waiters)
+    {
+        interlocked_xchg_add( &multiple->seq, 1 );
+        futex_wake_shared( &multiple->seq, INT_MAX );
+    }
+}
+
+/* get the list where the current thread records the mutexes it acquires */
+static struct fsync_owned *get_fsync_owned(void)
+{
+    struct ntdll_thread_data *thread_data = ntdll_get_thread_data();
+    unsigned int index = thread_data->fsync_owned;
+
+    if (!index)
+    {
+        SERVER_START_REQ( get_fsync_owned )
+        {
+            if (wine_server_call( req )) index = ~0u;
+            else
+            {
+                index = reply->index;
+                thread_data->fsync_id = reply->owner;
+            }
+        }
+        SERVER_END_REQ;
+        thread_data->fsync_owned = index;
+    }
+    if (index == ~0u) return NULL;
+    return (struct fsync_owned *)&fsync_objects[index];
+}
+
+/* get the id of the current thread in the owner field of the mutexes, 0 if unavailable */
+static unsigned int get_fsync_owner_id(void)
+{
+    if (!get_fsync_owned()) return 0;
+    return ntdll_get_thread_data()->fsync_id;
+}
+
+static NTSTATUS fsync_set_event( HANDLE handle, LONG *prev_state )
+{
+    struct fsync_object *obj;
+    enum fsync_type type;
+    unsigned int state;
+
+    if (!(obj = get_fsync_object( handle, EVENT_MODIFY_STATE, &type ))) return STATUS_NOT_IMPLEMENTED;
+    if (type != FSYNC_AUTO_EVENT && type != FSYNC_MANUAL_EVENT) return STATUS_NOT_IMPLEMENTED;
+
+    do
+    {
+        state = *(volatile unsigned int *)&obj->state;
+        /* the server has to wake up its own waiters */
+        if (state & FSYNC_SERVER_WAIT) return STATUS_NOT_IMPLEMENTED;
+    } while (interlocked_cmpxchg( (int *)&obj->state, 1, state ) != state);
+
+    if (!state) fsync_wake( obj );
+    if (prev_state) *prev_state = state;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsync_reset_event( HANDLE handle, LONG *prev_state )
+{
+    struct fsync_object *obj;
+    enum fsync_type type;
+    unsigned int state;
+
+    if (!(obj = get_fsync_object( handle, EVENT_MODIFY_STATE, &type ))) return STATUS_NOT_IMPLEMENTED;
+    if (type != FSYNC_AUTO_EVENT && type != FSYNC_MANUAL_EVENT) return STATUS_NOT_IMPLEMENTED;
+
+    do
+    {
+        state = *(volatile unsigned int *)&obj->state;
+        /* the server may have taken over the state */
+        if (state & FSYNC_SERVER_WAIT) return STATUS_NOT_IMPLEMENTED;
+    } while (interlocked_cmpxchg( (int *)&obj->state, 0, state ) != state);
+
+    if (prev_state) *prev_state = state;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsync_release_semaphore( HANDLE handle, ULONG count, ULONG *previous )
+{
+    struct fsync_object *obj;
+    enum fsync_type type;
+    unsigned int state;
+
+    if (!(obj = get_fsync_object( handle, SEMAPHORE_MODIFY_STATE, &type ))) return STATUS_NOT_IMPLEMENTED;
+    if (type != FSYNC_SEMAPHORE) return STATUS_NOT_IMPLEMENTED;
+
+    do
+    {
+        state = *(volatile unsigned int *)&obj->state;
+        if (state & FSYNC_SERVER_WAIT) return STATUS_NOT_IMPLEMENTED;
+        if (state > obj->max || count > obj->max - state) return STATUS_SEMAPHORE_LIMIT_EXCEEDED;
+    } while (interlocked_cmpxchg( (int *)&obj->state, state + count, state ) != state);
+
+    if (!state) fsync_wake( obj );
+    if (previous) *previous = state;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsync_release_mutex( HANDLE handle, LONG *prev_count )
+{
+    struct fsync_object *obj;
+    enum fsync_type type;
+    unsigned int state, count, owner;
+
+    if (!(obj = get_fsync_object( handle, 0, &type ))) return STATUS_NOT_IMPLEMENTED;
+    if (type != FSYNC_MUTEX) return STATUS_NOT_IMPLEMENTED;
+    if (!(owner = get_fsync_owner_id())) return STATUS_NOT_IMPLEMENTED;
+
+    state = *(volatile unsigned int *)&obj->state;
+    if (state & FSYNC_SERVER_WAIT) return STATUS_NOT_IMPLEMENTED;
+    if (state != owner) return STATUS_MUTANT_NOT_OWNED;
+
+    /* only the owner modifies the recursion count */
+    count = obj->count;
+    if (count == 1)
+    {
+        obj->count = 0;
+        if (interlocked_cmpxchg( (int *)&obj->state, 0, owner ) != owner)
+        {
+            /* a server wait has been queued in the meantime */
+            obj->count = 1;
+            return STATUS_NOT_IMPLEMENTED;
+        }
+        fsync_wake( obj );
+    }
+    else obj->count = count - 1;
+
+    if (prev_count) *prev_count = 1 - count;
+    return STATUS_SUCCESS;
+}
+
+/* record a mutex in the owned list of the thread before acquiring it, so that
+ * the server can abandon it if the thread dies; entries of mutexes that the
+ * thread doesn't own anymore are reused */
+static BOOL fsync_record_owned( struct fsync_object *obj, unsigned int owner )
+{
+    struct fsync_owned *owned = get_fsync_owned();
+    unsigned int i, index = obj - fsync_objects, free = FSYNC_OWNED_MAX;
+    struct fsync_object *other;
+
+    if (!owned) return FALSE;
+
+    for (i = 0; i < FSYNC_OWNED_MAX; i++)
+    {
+        if (owned->index[i] == index) return TRUE;
+        if (free < FSYNC_OWNED_MAX) continue;
+        other = &fsync_objects[owned->index[i]];
+        if (!owned->index[i] || other->type != FSYNC_MUTEX ||
+            (*(volatile unsigned int *)&other->state & ~FSYNC_SERVER_WAIT) != owner)
+            free = i;
+    }
+    /* too many mutexes owned at the same time, let the server keep track of this one */
+    if (free == FSYNC_OWNED_MAX) return FALSE;
+    owned->index[free] = index;
+    return TRUE;
+}
+
+/* try to acquire an object; return STATUS_PENDING if it is not signaled */
+static NTSTATUS fsync_try_acquire( struct fsync_object *obj, enum fsync_type type, unsigned int owner )
+{
+    unsigned int state;
+
+    switch (type)
+    {
+    case FSYNC_MANUAL_EVENT:
+        state = *(volatile unsigned int *)&obj->state;
+        if (state & FSYNC_SERVER_WAIT) return STATUS_NOT_IMPLEMENTED;
+        return state ? STATUS_SUCCESS : STATUS_PENDING;
+
+    case FSYNC_AUTO_EVENT:
+        state = interlocked_cmpxchg( (int *)&obj->state, 0, 1 );
+        if (state == 1) return STATUS_SUCCESS;
+        break;
+
+    case FSYNC_SEMAPHORE:
+        do
+        {
+            state = *(volatile unsigned int *)&obj->state;
+            if (!state || (state & FSYNC_SERVER_WAIT)) break;
+        } while (interlocked_cmpxchg( (int *)&obj->state, state - 1, state ) != state);
+        if (state && !(state & FSYNC_SERVER_WAIT)) return STATUS_SUCCESS;
+        break;
+
+    case FSYNC_MUTEX:
+        state = *(volatile unsigned int *)&obj->state;
+        if (state == owner)
+        {
+            obj->count++;
+            return STATUS_SUCCESS;
+        }
+        if (state) break;
+        if (!fsync_record_owned( obj, owner )) return STATUS_NOT_IMPLEMENTED;
+        if ((state = interlocked_cmpxchg( (int *)&obj->state, owner, 0 ))) break;
+        obj->count = 1;
+        if (obj->abandoned)
+        {
+            obj->abandoned = 0;
+            return STATUS_ABANDONED_WAIT_0;
+        }
+        return STATUS_SUCCESS;
+
+    case FSYNC_COMPLETION:
+        /* a wait on a port doesn't remove a message */
+        state = *(volatile unsigned int *)&obj->state;
+        if (state & FSYNC_SERVER_WAIT) return STATUS_NOT_IMPLEMENTED;
+        if (FSYNC_COMPLETION_COUNT( state ) || *(volatile unsigned int *)&obj->max) return STATUS_SUCCESS;
+        return STATUS_PENDING;
+
+    default:
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    /* objects can't be acquired by clients while the server is waiting on them,
+     * or once the server has taken over their state */
+    return (state & FSYNC_SERVER_WAIT) ? STATUS_NOT_IMPLEMENTED : STATUS_PENDING;
+}
+
+/* check whether an event has been pulsed since the pulse count was recorded in *pulse */
+static BOOL fsync_check_pulse( struct fsync_object *obj, enum fsync_type type, unsigned int *pulse )
+{
+    unsigned int cur;
+
+    if (type != FSYNC_MANUAL_EVENT && type != FSYNC_AUTO_EVENT) return FALSE;
+    for (;;)
+    {
+        cur = *(volatile unsigned int *)&obj->pulse;
+        if ((cur >> 1) == (*pulse >> 1)) return FALSE;
+        if (type == FSYNC_MANUAL_EVENT) return TRUE;
+        /* an auto-reset pulse releases a single thread */
+        if (!(cur & 1))
+        {
+            *pulse = cur;
+            return FALSE;
+        }
+        if ((unsigned int)interlocked_cmpxchg( (int *)&obj->pulse, cur & ~1, cur ) == cur) return TRUE;
+    }
+}
+
+/* wait on the shared state of the objects; timeout is converted to an absolute time */
+static NTSTATUS fsync_wait_objects( DWORD count, const HANDLE *handles, BOOLEAN wait_any,
+                                    BOOLEAN alertable, LARGE_INTEGER *timeout )
+{
+    struct fsync_object *objs[MAXIMUM_WAIT_OBJECTS], *futex;
+    enum fsync_type types[MAXIMUM_WAIT_OBJECTS];
+    unsigned int pulses[MAXIMUM_WAIT_OBJECTS];
+    unsigned int owner = 0;
+    struct timespec timespec;
+    LARGE_INTEGER now;
+    NTSTATUS ret;
+    DWORD i;
+    int seq;
+
+    /* waiting for all objects must be atomic, and APCs are delivered by the server */
+    if (alertable || (!wait_any && count > 1)) return STATUS_NOT_IMPLEMENTED;
+
+    for (i = 0; i < count; i++)
+    {
+        if (!(objs[i] = get_fsync_object( handles[i], SYNCHRONIZE, &types[i] )))
+            return STATUS_NOT_IMPLEMENTED;
+        if (types[i] == FSYNC_MUTEX && !owner && !(owner = get_fsync_owner_id()))
+            return STATUS_NOT_IMPLEMENTED;
+    }
+
+    if (timeout && timeout->QuadPart == TIMEOUT_INFINITE) timeout = NULL;
+    if (timeout && timeout->QuadPart <= 0)
+    {
+        NtQuerySystemTime( &now );
+        timeout->QuadPart = now.QuadPart - timeout->QuadPart;
+    }
+
+    futex = (count == 1) ? objs[0] : &fsync_objects[0];
+    interlocked_xchg_add( &futex->waiters, 1 );
+    /* a pulse is only seen by threads that are already waiting, see server/event.c */
+    for (i = 0; i < count; i++) pulses[i] = *(volatile unsigned int *)&objs[i]->pulse;
+    for (;;)
+    {
+        /* the sequence number has to be read before checking the objects */
+        seq = *(volatile int *)&futex->seq;
+
+        for (i = 0; i < count; i++)
+        {
+            ret = fsync_try_acquire( objs[i], types[i], owner );
+            if (ret == STATUS_PENDING && fsync_check_pulse( objs[i], types[i], &pulses[i] ))
+                ret = STATUS_SUCCESS;
+            if (ret == STATUS_PENDING) continue;
+            if (ret == STATUS_SUCCESS || ret == STATUS_ABANDONED_WAIT_0) ret += i;
+            goto done;
+        }
+
+        if (timeout)
+        {
+            NtQuerySystemTime( &now );
+            if (now.QuadPart >= timeout->QuadPart)
+            {
+                ret = STATUS_TIMEOUT;
+                goto done;
+            }
+            timespec_from_timeout( &timespec, timeout );
+            futex_wait_shared( &futex->seq, seq, &timespec );
+        }
+        else futex_wait_shared( &futex->seq, seq, NULL );
+    }
+
+done:
+    interlocked_xchg_add( &futex->waiters, -1 );
+    return ret;
+}
+
+/* completion ports that the completions of files are queued to, see NTDLL_AddCompletion */
+struct completion_port_cache
+{
+    HANDLE        file;    /* handle of the file */
+    unsigned int  serial;  /* serial of the handle table entry of the file */
+    unsigned int  port;    /* index of the port in the shared memory area */
+    ULONG_PTR     ckey;    /* completion key of the file */
+};
+
+#define COMPLETION_PORT_CACHE_SIZE 64
+
+static struct completion_port_cache completion_port_cache[COMPLETION_PORT_CACHE_SIZE];
+
+/* the clients of a process queue the messages of a port one at a time */
+static RTL_CRITICAL_SECTION completion_section;
+static RTL_CRITICAL_SECTION_DEBUG completion_section_debug =
+{
+    0, 0, &completion_section,
+    { &completion_section_debug.ProcessLocksList, &completion_section_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": completion_section") }
+};
+static RTL_CRITICAL_SECTION completion_section = { &completion_section_debug, -1, 0, 0, 0, 0 };
+
+static inline struct completion_port_cache *get_completion_port_cache( HANDLE file )
+{
+    return &completion_port_cache[((ULONG_PTR)file >> 2) % COMPLETION_PORT_CACHE_SIZE];
+}
+
+/* queue a message to the ring of a port; the caller holds completion_section */
+static NTSTATUS fsync_queue_completion( struct fsync_object *obj, ULONG_PTR key, ULONG_PTR value,
+                                        NTSTATUS status, ULONG_PTR information )
+{
+    struct fsync_completion_msg *ring = (struct fsync_completion_msg *)(obj + 1), *msg;
+    unsigned int state, count;
+
+    do
+    {
+        state = *(volatile unsigned int *)&obj->state;
+        /* the server has to wake up its own waiters */
+        if (state & FSYNC_SERVER_WAIT) return STATUS_NOT_IMPLEMENTED;
+        /* the messages of the ring must be older than the server-side ones */
+        if (*(volatile unsigned int *)&obj->max) return STATUS_NOT_IMPLEMENTED;
+        if ((count = FSYNC_COMPLETION_COUNT( state )) >= FSYNC_COMPLETION_RING) return STATUS_NOT_IMPLEMENTED;
+        /* the slot after the last message isn't read until the count includes it */
+        msg = &ring[(FSYNC_COMPLETION_HEAD( state ) + count) % FSYNC_COMPLETION_RING];
+        msg->ckey        = key;
+        msg->cvalue      = value;
+        msg->information = information;
+        msg->status      = status;
+    } while (interlocked_cmpxchg( (int *)&obj->state, state + 1, state ) != state);
+
+    fsync_wake( obj );
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsync_set_completion( HANDLE port, ULONG_PTR key, ULONG_PTR value,
+                                      NTSTATUS status, ULONG_PTR information )
+{
+    struct fsync_object *obj;
+    enum fsync_type type;
+    sigset_t sigset;
+    NTSTATUS ret;
+
+    if (!(obj = get_fsync_object( port, IO_COMPLETION_MODIFY_STATE, &type ))) return STATUS_NOT_IMPLEMENTED;
+    if (type != FSYNC_COMPLETION) return STATUS_NOT_IMPLEMENTED;
+
+    server_enter_uninterrupted_section( &completion_section, &sigset );
+    ret = fsync_queue_completion( obj, key, value, status, information );
+    server_leave_uninterrupted_section( &completion_section, &sigset );
+    return ret;
+}
+
+/* queue the completion of an I/O on a file to its port, if the server has told us which one it is */
+static NTSTATUS fsync_add_file_completion( HANDLE file, ULONG_PTR value, NTSTATUS status, ULONG_PTR information )
+{
+    struct completion_port_cache *cache = get_completion_port_cache( file );
+    NTSTATUS ret = STATUS_NOT_IMPLEMENTED;
+    unsigned int serial;
+    sigset_t sigset;
+
+    if (!fsync_objects || !server_get_handle_serial( file, &serial )) return STATUS_NOT_IMPLEMENTED;
+
+    server_enter_uninterrupted_section( &completion_section, &sigset );
+    if (cache->file == file && cache->serial == serial && fsync_objects[cache->port].type == FSYNC_COMPLETION)
+        ret = fsync_queue_completion( &fsync_objects[cache->port], cache->ckey, value, status, information );
+    server_leave_uninterrupted_section( &completion_section, &sigset );
+    return ret;
+}
+
+/* remember the port of a file that the server lets us queue the completions to */
+static void fsync_cache_completion_port( HANDLE file, unsigned int port, ULONG_PTR key )
+{
+    struct completion_port_cache *cache = get_completion_port_cache( file );
+    unsigned int serial;
+    sigset_t sigset;
+
+    /* the serial is read after the request, which is fine since the association can't change */
+    if (!fsync_objects || !server_get_handle_serial( file, &serial )) return;
+
+    server_enter_uninterrupted_section( &completion_section, &sigset );
+    cache->file   = file;
+    cache->serial = serial;
+    cache->port   = port;
+    cache->ckey   = key;
+    server_leave_uninterrupted_section( &completion_section, &sigset );
+}
+
+/* remove the first message of the ring of a port; return STATUS_PENDING if the port is empty */
+static NTSTATUS fsync_remove_completion( HANDLE port, ULONG_PTR *key, ULONG_PTR *value,
+                                         IO_STATUS_BLOCK *iosb )
+{
+    const struct fsync_completion_msg *ring;
+    struct fsync_completion_msg msg;
+    struct fsync_object *obj;
+    enum fsync_type type;
+    unsigned int state, head, count;
+
+    if (!(obj = get_fsync_object( port, IO_COMPLETION_MODIFY_STATE, &type ))) return STATUS_NOT_IMPLEMENTED;
+    if (type != FSYNC_COMPLETION) return STATUS_NOT_IMPLEMENTED;
+
+    ring = (const struct fsync_completion_msg *)(obj + 1);
+    do
+    {
+        state = *(volatile unsigned int *)&obj->state;
+        if (state & FSYNC_SERVER_WAIT) return STATUS_NOT_IMPLEMENTED;
+        if (!(count = FSYNC_COMPLETION_COUNT( state )))
+        {
+            /* the messages queued on the server side have to be removed there */
+            if (*(volatile unsigned int *)&obj->max) return STATUS_NOT_IMPLEMENTED;
+            return STATUS_PENDING;
+        }
+        head = FSYNC_COMPLETION_HEAD( state );
+        msg = ring[head % FSYNC_COMPLETION_RING];
+    } while (interlocked_cmpxchg( (int *)&obj->state, FSYNC_COMPLETION_STATE( head + 1, count - 1 ),
+                                  state ) != state);
+
+    *key              = msg.ckey;
+    *value            = msg.cvalue;
+    iosb->Information = msg.information;
+    iosb->u.Status    = msg.status;
+    return STATUS_SUCCESS;
+}
+
+#else  /* __linux__ */
+
+static BOOL fsync_init(void)
+{
+    return FALSE;
+}
+
+void fsync_remove_from_cache( HANDLE handle )
+{
+}
+
+static NTSTATUS fsync_set_event( HANDLE handle, LONG *prev_state )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fsync_reset_event( HANDLE handle, LONG *prev_state )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fsync_release_semaphore( HANDLE handle, ULONG count, ULONG *previous )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fsync_release_mutex( HANDLE handle, LONG *prev_count )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fsync_wait_objects( DWORD count, const HANDLE *handles, BOOLEAN wait_any,
+                                    BOOLEAN alertable, LARGE_INTEGER *timeout )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fsync_set_completion( HANDLE port, ULONG_PTR key, ULONG_PTR value,
+                                      NTSTATUS status, ULONG_PTR information )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fsync_add_file_completion( HANDLE file, ULONG_PTR value, NTSTATUS status, ULONG_PTR information )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static void fsync_cache_completion_port( HANDLE file, unsigned int port, ULONG_PTR key )
+{
+}
+
+static NTSTATUS fsync_remove_completion( HANDLE port, ULONG_PTR *key, ULONG_PTR *value,
+                                         IO_STATUS_BLOCK *iosb )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+#endif  /* __linux__ */
+
 /* creates a struct security_descriptor and contained information in one contiguous piece of memory */
 NTSTATUS alloc_object_attributes( const OBJECT_ATTRIBUTES *attr, struct object_attributes **ret,
                                   data_size_t *ret_len )
@@ -250,6 +938,7 @@ NTSTATUS WINAPI NtCreateSemaphore( OUT PHANDLE SemaphoreHandle,
         return STATUS_INVALID_PARAMETER;
 
     if ((ret = alloc_object_attributes( attr, &objattr, &len ))) return ret;
+    fsync_init();  /* the shared state is only allocated once the area is mapped */
 
     SERVER_START_REQ( create_semaphore )
     {
@@ -329,6 +1018,10 @@ NTSTATUS WINAPI NtQuerySemaphore( HANDLE handle, SEMAPHORE_INFORMATION_CLASS cla
 NTSTATUS WINAPI NtReleaseSemaphore( HANDLE handle, ULONG count, PULONG previous )
 {
     NTSTATUS ret;
+
+    if ((ret = fsync_release_semaphore( handle, count, previous )) != STATUS_NOT_IMPLEMENTED)
+        return ret;
+
     SERVER_START_REQ( release_semaphore )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -358,6 +1051,7 @@ NTSTATUS WINAPI NtCreateEvent( PHANDLE EventHandle, ACCESS_MASK DesiredAccess,
     struct object_attributes *objattr;
 
     if ((ret = alloc_object_attributes( attr, &objattr, &len ))) return ret;
+    fsync_init();  /* the shared state is only allocated once the area is mapped */
 
     SERVER_START_REQ( create_event )
     {
@@ -406,6 +1100,9 @@ NTSTATUS WINAPI NtOpenEvent( HANDLE *handle, ACCESS_MASK access, const OBJECT_AT
 NTSTATUS WINAPI NtSetEvent( HANDLE handle, LONG *prev_state )
 {
     NTSTATUS ret;
+
+    if ((ret = fsync_set_event( handle, prev_state )) != STATUS_NOT_IMPLEMENTED) return ret;
+
     SERVER_START_REQ( event_op )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -423,6 +1120,9 @@ NTSTATUS WINAPI NtSetEvent( HANDLE handle, LONG *prev_state )
 NTSTATUS WINAPI NtResetEvent( HANDLE handle, LONG *prev_state )
 {
     NTSTATUS ret;
+
+    if ((ret = fsync_reset_event( handle, prev_state )) != STATUS_NOT_IMPLEMENTED) return ret;
+
     SERVER_START_REQ( event_op )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -519,6 +1219,7 @@ NTSTATUS WINAPI NtCreateMutant(OUT HANDLE* MutantHandle,
     struct object_attributes *objattr;
 
     if ((status = alloc_object_attributes( attr, &objattr, &len ))) return status;
+    fsync_init();  /* the shared state is only allocated once the area is mapped */
 
     SERVER_START_REQ( create_mutex )
     {
@@ -566,6 +1267,9 @@ NTSTATUS WINAPI NtReleaseMutant( IN HANDLE handle, OUT PLONG prev_count OPTIONAL
 {
     NTSTATUS    status;
 
+    if ((status = fsync_release_mutex( handle, prev_count )) != STATUS_NOT_IMPLEMENTED)
+        return status;
+
     SERVER_START_REQ( release_mutex )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -1077,14 +1781,24 @@ static NTSTATUS wait_objects( DWORD count, const HANDLE *handles,
                               const LARGE_INTEGER *timeout )
 {
     select_op_t select_op;
+    LARGE_INTEGER abs_timeout, *ptimeout = NULL;
     UINT i, flags = SELECT_INTERRUPTIBLE;
+    NTSTATUS ret;
 
     if (!count || count > MAXIMUM_WAIT_OBJECTS) return STATUS_INVALID_PARAMETER_1;
 
+    if (timeout)
+    {
+        abs_timeout = *timeout;
+        ptimeout = &abs_timeout;
+    }
+    if ((ret = fsync_wait_objects( count, handles, wait_any, alertable, ptimeout )) != STATUS_NOT_IMPLEMENTED)
+        return ret;
+
     if (alertable) flags |= SELECT_ALERTABLE;
     select_op.wait.op = wait_any ? SELECT_WAIT : SELECT_WAIT_ALL;
     for (i = 0; i < count; i++) select_op.wait.handles[i] = wine_server_obj_handle( handles[i] );
-    return server_select( &select_op, offsetof( select_op_t, wait.handles[count] ), flags, timeout );
+    return server_select( &select_op, offsetof( select_op_t, wait.handles[count] ), flags, ptimeout );
 }
 
 
@@ -1331,6 +2045,10 @@ NTSTATUS WINAPI NtSetIoCompletion( HANDLE CompletionPort, ULONG_PTR CompletionKe
     TRACE("(%p, %lx, %lx, %x, %lx)\n", CompletionPort, CompletionKey,
           CompletionValue, Status, NumberOfBytesTransferred);
 
+    if ((status = fsync_set_completion( CompletionPort, CompletionKey, CompletionValue, Status,
+                                        NumberOfBytesTransferred )) != STATUS_NOT_IMPLEMENTED)
+        return status;
+
     SERVER_START_REQ( add_completion )
     {
         req->handle      = wine_server_obj_handle( CompletionPort );
@@ -1369,18 +2087,22 @@ NTSTATUS WINAPI NtRemoveIoCompletion( HANDLE CompletionPort, PULONG_PTR Completi
 
     for(;;)
     {
-        SERVER_START_REQ( remove_completion )
+        status = fsync_remove_completion( CompletionPort, CompletionKey, CompletionValue, iosb );
+        if (status == STATUS_NOT_IMPLEMENTED)
         {
-            req->handle = wine_server_obj_handle( CompletionPort );
-            if (!(status = wine_server_call( req )))
+            SERVER_START_REQ( remove_completion )
             {
-                *CompletionKey    = reply->ckey;
-                *CompletionValue  = reply->cvalue;
-                iosb->Information = reply->information;
-                iosb->u.Status    = reply->status;
+                req->handle = wine_server_obj_handle( CompletionPort );
+                if (!(status = wine_server_call( req )))
+                {
+                    *CompletionKey    = reply->ckey;
+                    *CompletionValue  = reply->cvalue;
+                    iosb->Information = reply->information;
+                    iosb->u.Status    = reply->status;
+                }
             }
+            SERVER_END_REQ;
         }
-        SERVER_END_REQ;
         if (status != STATUS_PENDING) break;
 
         status = NtWaitForSingleObject( CompletionPort, FALSE, WaitTime );
@@ -1405,18 +2127,23 @@ NTSTATUS WINAPI NtRemoveIoCompletionEx( HANDLE port, FILE_IO_COMPLETION_INFORMAT
     {
         while (i < count)
         {
-            SERVER_START_REQ( remove_completion )
+            ret = fsync_remove_completion( port, &info[i].CompletionKey, &info[i].CompletionValue,
+                                           &info[i].IoStatusBlock );
+            if (ret == STATUS_NOT_IMPLEMENTED)
             {
-                req->handle = wine_server_obj_handle( port );
-                if (!(ret = wine_server_call( req )))
+                SERVER_START_REQ( remove_completion )
                 {
-                    info[i].CompletionKey             = reply->ckey;
-                    info[i].CompletionValue           = reply->cvalue;
-                    info[i].IoStatusBlock.Information = reply->information;
-                    info[i].IoStatusBlock.u.Status    = reply->status;
+                    req->handle = wine_server_obj_handle( port );
+                    if (!(ret = wine_server_call( req )))
+                    {
+                        info[i].CompletionKey             = reply->ckey;
+                        info[i].CompletionValue           = reply->cvalue;
+                        info[i].IoStatusBlock.Information = reply->information;
+                        info[i].IoStatusBlock.u.Status    = reply->status;
+                    }
                 }
+                SERVER_END_REQ;
             }
-            SERVER_END_REQ;
 
             if (ret != STATUS_SUCCESS) break;
 
@@ -1522,11 +2249,122 @@ NTSTATUS WINAPI NtQueryIoCompletion( HANDLE CompletionPort, IO_COMPLETION_INFORM
     return status;
 }
 
+/******************************************************************
+ *              NtCreateWaitCompletionPacket (NTDLL.@)
+ *              ZwCreateWaitCompletionPacket (NTDLL.@)
+ *
+ * Creates a packet that is queued to a completion port once an object is signaled.
+ */
+NTSTATUS WINAPI NtCreateWaitCompletionPacket( HANDLE *handle, ACCESS_MASK access, const OBJECT_ATTRIBUTES *attr )
+{
+    NTSTATUS status;
+    data_size_t len;
+    struct object_attributes *objattr;
+
+    TRACE( "(%p, %x, %p)\n", handle, access, attr );
+
+    if (!handle) return STATUS_INVALID_PARAMETER;
+
+    if ((status = alloc_object_attributes( attr, &objattr, &len ))) return status;
+
+    SERVER_START_REQ( create_completion_wait )
+    {
+        req->access = access;
+        wine_server_add_data( req, objattr, len );
+        if (!(status = wine_server_call( req )))
+            *handle = wine_server_ptr_handle( reply->handle );
+    }
+    SERVER_END_REQ;
+
+    RtlFreeHeap( GetProcessHeap(), 0, objattr );
+    return status;
+}
+
+/******************************************************************
+ *              NtAssociateWaitCompletionPacket (NTDLL.@)
+ *              ZwAssociateWaitCompletionPacket (NTDLL.@)
+ *
+ * Queues a wait completion packet to a completion port once an object is signaled.
+ *
+ * PARAMS
+ *      packet      [I] wait completion packet
+ *      port        [I] completion port receiving the packet
+ *      object      [I] object to wait for, the wait is satisfied as for NtWaitForSingleObject
+ *      key         [I] completion key
+ *      value       [I] completion value
+ *      io_status   [I] completion status
+ *      io_info     [I] IO_STATUS_BLOCK Information
+ *      signaled    [O] optional, set if the object was already signaled
+ */
+NTSTATUS WINAPI NtAssociateWaitCompletionPacket( HANDLE packet, HANDLE port, HANDLE object, void *key,
+                                                 void *value, NTSTATUS io_status, ULONG_PTR io_info,
+                                                 BOOLEAN *signaled )
+{
+    TRACE( "(%p, %p, %p, %p, %p, %x, %lx, %p)\n", packet, port, object, key, value,
+           io_status, io_info, signaled );
+
+    return associate_wait_packet( packet, port, object, 0, key, value, io_status, io_info, signaled );
+}
+
+/* associate a wait completion packet; the object is acquired by the given thread, or by the current one */
+NTSTATUS associate_wait_packet( HANDLE packet, HANDLE port, HANDLE object, HANDLE thread,
+                                void *key, void *value, NTSTATUS io_status, ULONG_PTR io_info,
+                                BOOLEAN *signaled )
+{
+    NTSTATUS status;
+
+    SERVER_START_REQ( associate_completion_wait )
+    {
+        req->wait        = wine_server_obj_handle( packet );
+        req->completion  = wine_server_obj_handle( port );
+        req->handle      = wine_server_obj_handle( object );
+        req->thread      = wine_server_obj_handle( thread );
+        req->ckey        = wine_server_client_ptr( key );
+        req->cvalue      = wine_server_client_ptr( value );
+        req->status      = io_status;
+        req->information = io_info;
+        if (!(status = wine_server_call( req )) && signaled)
+            *signaled = reply->signaled;
+    }
+    SERVER_END_REQ;
+    return status;
+}
+
+/******************************************************************
+ *              NtCancelWaitCompletionPacket (NTDLL.@)
+ *              ZwCancelWaitCompletionPacket (NTDLL.@)
+ *
+ * Cancels a wait completion packet. Returns STATUS_SUCCESS if the object
+ * was not signaled yet, STATUS_CANCELLED if the packet was removed from the
+ * port queue, and STATUS_PENDING if it has already been queued or removed.
+ */
+NTSTATUS WINAPI NtCancelWaitCompletionPacket( HANDLE packet, BOOLEAN remove )
+{
+    NTSTATUS status;
+
+    TRACE( "(%p, %d)\n", packet, remove );
+
+    SERVER_START_REQ( cancel_completion_wait )
+    {
+        req->wait   = wine_server_obj_handle( packet );
+        req->remove = remove;
+        status = wine_server_call( req );
+    }
+    SERVER_END_REQ;
+    return status;
+}
+
 NTSTATUS NTDLL_AddCompletion( HANDLE hFile, ULONG_PTR CompletionValue,
                               NTSTATUS CompletionStatus, ULONG Information, BOOL async )
 {
     NTSTATUS status;
 
+    if (!server_fd_has_completion( hFile, async )) return STATUS_SUCCESS;
+
+    /* once the server has told us the port of the file, the completions are queued to it directly */
+    if (!fsync_add_file_completion( hFile, CompletionValue, CompletionStatus, Information ))
+        return STATUS_SUCCESS;
+
     SERVER_START_REQ( add_fd_completion )
     {
         req->handle      = wine_server_obj_handle( hFile );
@@ -1534,7 +2372,8 @@ NTSTATUS NTDLL_AddCompletion( HANDLE hFile, ULONG_PTR CompletionValue,
         req->status      = CompletionStatus;
         req->information = Information;
         req->async       = async;
-        status = wine_server_call( req );
+        if (!(status = wine_server_call( req )) && reply->port)
+            fsync_cache_completion_port( hFile, reply->port, reply->ckey );
     }
     SERVER_END_REQ;
     return status;
@@ -762,6 +762,191 @@ static void tear_down_case_test(const char *testdir)
     RemoveDirectoryA(testdir);
 }
 
+#define ENUM_FILES 2000
+#define ENUM_DIRS  16
+
+/* check that every entry of the enumeration test directory is returned exactly once */
+#define check_enum_entries(a,b) check_enum_entries_(__LINE__,a,b)
+static void check_enum_entries_( unsigned int line, HANDLE handle, FILE_INFORMATION_CLASS class )
+{
+    static BYTE data[4096];
+    static BYTE found[ENUM_FILES + ENUM_DIRS];
+    unsigned int i, index, dots = 0, count = 0;
+    FILE_DIRECTORY_INFORMATION *dir_info;
+    FILE_NAMES_INFORMATION *names_info;
+    char name[MAX_PATH];
+    IO_STATUS_BLOCK io;
+    ULONG pos, attributes, name_len, next;
+    const WCHAR *nameW;
+    NTSTATUS status;
+    BOOLEAN restart = TRUE;
+
+    memset( found, 0, sizeof(found) );
+    for (;;)
+    {
+        status = pNtQueryDirectoryFile( handle, 0, NULL, NULL, &io, data, sizeof(data), class, FALSE, NULL, restart );
+        if (status == STATUS_NO_MORE_FILES) break;
+        ok_(__FILE__,line)( !status, "failed to query directory, status %x\n", status );
+        if (status) break;
+        restart = FALSE;
+
+        for (pos = 0; ; pos += next)
+        {
+            if (class == FileNamesInformation)
+            {
+                names_info = (FILE_NAMES_INFORMATION *)(data + pos);
+                attributes = 0;
+                name_len = names_info->FileNameLength;
+                nameW = names_info->FileName;
+                next = names_info->NextEntryOffset;
+            }
+            else
+            {
+                dir_info = (FILE_DIRECTORY_INFORMATION *)(data + pos);
+                attributes = dir_info->FileAttributes;
+                name_len = dir_info->FileNameLength;
+                nameW = dir_info->FileName;
+                next = dir_info->NextEntryOffset;
+            }
+            name_len = WideCharToMultiByte( CP_ACP, 0, nameW, name_len / sizeof(WCHAR), name, sizeof(name) - 1, NULL, NULL );
+            name[name_len] = 0;
+            count++;
+
+            if (!strcmp( name, "." ) || !strcmp( name, ".." )) dots++;
+            else if (sscanf( name, "enumeration test file with a long name %u", &index ) == 1 && index < ENUM_FILES)
+            {
+                ok_(__FILE__,line)( !found[index]++, "%s listed twice\n", name );
+                ok_(__FILE__,line)( !(attributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)),
+                                    "%s: got attributes %#x\n", name, attributes );
+            }
+            else if (sscanf( name, "enumeration test dir %u", &index ) == 1 && index < ENUM_DIRS)
+            {
+                ok_(__FILE__,line)( !found[ENUM_FILES + index]++, "%s listed twice\n", name );
+                /* a plain subdirectory is not a mount point */
+                if (class != FileNamesInformation)
+                    ok_(__FILE__,line)( (attributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)) ==
+                                        FILE_ATTRIBUTE_DIRECTORY, "%s: got attributes %#x\n", name, attributes );
+            }
+            else ok_(__FILE__,line)( 0, "unexpected entry %s\n", name );
+            if (!next) break;
+        }
+    }
+    ok_(__FILE__,line)( dots == 2, "got %u dot entries\n", dots );
+    ok_(__FILE__,line)( count == ENUM_FILES + ENUM_DIRS + 2, "got %u entries\n", count );
+    for (i = 0; i < ENUM_FILES + ENUM_DIRS; i++)
+        if (!found[i]) break;
+    ok_(__FILE__,line)( i == ENUM_FILES + ENUM_DIRS, "entry %u not listed\n", i );
+}
+
+/* return the attributes of an entry of an open directory, or INVALID_FILE_ATTRIBUTES */
+static ULONG get_entry_attributes( HANDLE handle, const WCHAR *name )
+{
+    static BYTE data[65536];
+    FILE_DIRECTORY_INFORMATION *info;
+    IO_STATUS_BLOCK io;
+    BOOLEAN restart = TRUE;
+    ULONG pos;
+
+    while (!pNtQueryDirectoryFile( handle, 0, NULL, NULL, &io, data, sizeof(data),
+                                   FileDirectoryInformation, FALSE, NULL, restart ))
+    {
+        restart = FALSE;
+        for (pos = 0; ; pos += info->NextEntryOffset)
+        {
+            info = (FILE_DIRECTORY_INFORMATION *)(data + pos);
+            if (info->FileNameLength == lstrlenW( name ) * sizeof(WCHAR) &&
+                !memcmp( info->FileName, name, info->FileNameLength ))
+                return info->FileAttributes;
+            if (!info->NextEntryOffset) break;
+        }
+    }
+    return INVALID_FILE_ATTRIBUTES;
+}
+
+static void test_NtQueryDirectoryFile_enum(void)
+{
+    static const WCHAR rootW[] = {'Z',':','\\',0};
+    static const WCHAR procW[] = {'p','r','o','c',0};
+    char testdir[MAX_PATH], name[MAX_PATH];
+    WCHAR testdirW[MAX_PATH];
+    UNICODE_STRING ntdirname;
+    OBJECT_ATTRIBUTES attr;
+    IO_STATUS_BLOCK io;
+    unsigned int i;
+    NTSTATUS status;
+    HANDLE handle, file;
+    ULONG attributes;
+
+    /* enough long names to need several reads of the unix directory */
+    GetTempPathA( MAX_PATH, testdir );
+    strcat( testdir, "NtQueryDirectoryFile_enum.tmp" );
+    ok( CreateDirectoryA( testdir, NULL ), "CreateDirectory failed %u\n", GetLastError() );
+    for (i = 0; i < ENUM_FILES; i++)
+    {
+        sprintf( name, "%s\\enumeration test file with a long name %04u", testdir, i );
+        file = CreateFileA( name, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, NULL );
+        ok( file != INVALID_HANDLE_VALUE, "failed to create %s, error %u\n", name, GetLastError() );
+        CloseHandle( file );
+    }
+    for (i = 0; i < ENUM_DIRS; i++)
+    {
+        sprintf( name, "%s\\enumeration test dir %02u", testdir, i );
+        ok( CreateDirectoryA( name, NULL ), "failed to create %s, error %u\n", name, GetLastError() );
+    }
+
+    pRtlMultiByteToUnicodeN( testdirW, sizeof(testdirW), NULL, testdir, strlen(testdir) + 1 );
+    if (pRtlDosPathNameToNtPathName_U( testdirW, &ntdirname, NULL, NULL ))
+    {
+        InitializeObjectAttributes( &attr, &ntdirname, OBJ_CASE_INSENSITIVE, 0, NULL );
+        status = pNtOpenFile( &handle, SYNCHRONIZE | FILE_LIST_DIRECTORY, &attr, &io, FILE_SHARE_READ,
+                              FILE_SYNCHRONOUS_IO_NONALERT | FILE_OPEN_FOR_BACKUP_INTENT | FILE_DIRECTORY_FILE );
+        ok( !status, "failed to open dir %s, status %x\n", testdir, status );
+        if (!status)
+        {
+            /* the names only class doesn't need the file attributes */
+            check_enum_entries( handle, FileNamesInformation );
+            check_enum_entries( handle, FileDirectoryInformation );
+            check_enum_entries( handle, FileNamesInformation );
+            pNtClose( handle );
+        }
+        pRtlFreeUnicodeString( &ntdirname );
+    }
+    else ok( 0, "RtlDosPathNameToNtPathName_U failed\n" );
+
+    for (i = 0; i < ENUM_FILES; i++)
+    {
+        sprintf( name, "%s\\enumeration test file with a long name %04u", testdir, i );
+        DeleteFileA( name );
+    }
+    for (i = 0; i < ENUM_DIRS; i++)
+    {
+        sprintf( name, "%s\\enumeration test dir %02u", testdir, i );
+        RemoveDirectoryA( name );
+    }
+    ok( RemoveDirectoryA( testdir ), "RemoveDirectory failed %u\n", GetLastError() );
+
+    /* unix mount points are reported as reparse points */
+    if (!GetProcAddress( GetModuleHandleA( "ntdll.dll" ), "wine_get_version" ))
+    {
+        skip( "mount points are only tested on Wine\n" );
+        return;
+    }
+    if (!pRtlDosPathNameToNtPathName_U( rootW, &ntdirname, NULL, NULL )) return;
+    InitializeObjectAttributes( &attr, &ntdirname, OBJ_CASE_INSENSITIVE, 0, NULL );
+    status = pNtOpenFile( &handle, SYNCHRONIZE | FILE_LIST_DIRECTORY, &attr, &io, FILE_SHARE_READ,
+                          FILE_SYNCHRONOUS_IO_NONALERT | FILE_OPEN_FOR_BACKUP_INTENT | FILE_DIRECTORY_FILE );
+    pRtlFreeUnicodeString( &ntdirname );
+    if (status)
+    {
+        skip( "Z: drive not available, status %x\n", status );
+        return;
+    }
+    attributes = get_entry_attributes( handle, procW );
+    if (attributes == INVALID_FILE_ATTRIBUTES) skip( "/proc not found\n" );
+    else ok( attributes & FILE_ATTRIBUTE_REPARSE_POINT, "/proc: got attributes %#x\n", attributes );
+    pNtClose( handle );
+}
+
 static void test_NtQueryDirectoryFile_case(void)
 {
     static const char testfile[] = "TesT";
@@ -829,6 +1014,153 @@ done:
     pRtlFreeUnicodeString(&ntdirname);
 }
 
+/* make a directory look older than it is, so that its contents can be cached */
+static void backdate_directory(const char *dir)
+{
+    ULARGE_INTEGER time;
+    FILETIME ft;
+    HANDLE handle;
+
+    GetSystemTimeAsFileTime(&ft);
+    time.u.LowPart = ft.dwLowDateTime;
+    time.u.HighPart = ft.dwHighDateTime;
+    time.QuadPart -= (ULONGLONG)3600 * 10000000;
+    ft.dwLowDateTime = time.u.LowPart;
+    ft.dwHighDateTime = time.u.HighPart;
+
+    handle = CreateFileA(dir, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                         NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    ok(handle != INVALID_HANDLE_VALUE, "failed to open %s: %u\n", dir, GetLastError());
+    ok(SetFileTime(handle, NULL, NULL, &ft), "failed to set time of %s: %u\n", dir, GetLastError());
+    CloseHandle(handle);
+}
+
+/* look up 100k mixed-case paths spread over several directories */
+static void benchmark_case_insensitive_lookup(const char *testdir)
+{
+    char name[MAX_PATH];
+    DWORD i, j, k, start, failures = 0;
+    HANDLE file;
+
+    for (i = 0; i < 10; i++)
+    {
+        sprintf(name, "%s\\Sub%u", testdir, i);
+        ok(CreateDirectoryA(name, NULL), "failed to create %s: %u\n", name, GetLastError());
+        for (j = 0; j < 100; j++)
+        {
+            sprintf(name, "%s\\Sub%u\\File%u.Txt", testdir, i, j);
+            file = CreateFileA(name, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, NULL);
+            ok(file != INVALID_HANDLE_VALUE, "failed to create %s: %u\n", name, GetLastError());
+            CloseHandle(file);
+        }
+        sprintf(name, "%s\\Sub%u", testdir, i);
+        backdate_directory(name);
+    }
+    backdate_directory(testdir);
+
+    start = GetTickCount();
+    for (k = 0; k < 100; k++)
+    {
+        for (i = 0; i < 10; i++)
+        {
+            for (j = 0; j < 100; j++)
+            {
+                sprintf(name, "%s\\sUB%u\\fILE%u.tXT", testdir, i, j);
+                if (GetFileAttributesA(name) == INVALID_FILE_ATTRIBUTES) failures++;
+            }
+        }
+    }
+    trace("looked up 100000 mixed-case paths in %u ms\n", GetTickCount() - start);
+    ok(!failures, "%u lookups failed\n", failures);
+
+    for (i = 0; i < 10; i++)
+    {
+        for (j = 0; j < 100; j++)
+        {
+            sprintf(name, "%s\\Sub%u\\File%u.Txt", testdir, i, j);
+            DeleteFileA(name);
+        }
+        sprintf(name, "%s\\Sub%u", testdir, i);
+        RemoveDirectoryA(name);
+    }
+}
+
+static void test_case_insensitive_lookup(void)
+{
+    char testdir[MAX_PATH], name[MAX_PATH];
+    DWORD i, j, start;
+    HANDLE file;
+
+    GetTempPathA(MAX_PATH, testdir);
+    strcat(testdir, "lookup.tmp");
+    ok(CreateDirectoryA(testdir, NULL), "failed to create %s: %u\n", testdir, GetLastError());
+
+    benchmark_case_insensitive_lookup(testdir);
+
+    for (i = 0; i < 100; i++)
+    {
+        sprintf(name, "%s\\File%u.Txt", testdir, i);
+        file = CreateFileA(name, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, NULL);
+        ok(file != INVALID_HANDLE_VALUE, "failed to create %s: %u\n", name, GetLastError());
+        CloseHandle(file);
+    }
+    backdate_directory(testdir);
+
+    start = GetTickCount();
+    for (j = 0; j < 10; j++)
+    {
+        for (i = 0; i < 100; i++)
+        {
+            sprintf(name, "%s\\fILE%u.tXT", testdir, i);
+            file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+            ok(file != INVALID_HANDLE_VALUE, "failed to open %s: %u\n", name, GetLastError());
+            CloseHandle(file);
+        }
+    }
+    trace("opened 1000 mixed-case names in %u ms\n", GetTickCount() - start);
+
+    /* new files must be found after a failed lookup */
+    sprintf(name, "%s\\NEWFILE.TXT", testdir);
+    file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    ok(file == INVALID_HANDLE_VALUE, "%s shouldn't exist\n", name);
+    ok(GetLastError() == ERROR_FILE_NOT_FOUND, "got error %u\n", GetLastError());
+
+    sprintf(name, "%s\\NewFile.txt", testdir);
+    file = CreateFileA(name, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, NULL);
+    ok(file != INVALID_HANDLE_VALUE, "failed to create %s: %u\n", name, GetLastError());
+    CloseHandle(file);
+
+    sprintf(name, "%s\\NEWFILE.TXT", testdir);
+    file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    ok(file != INVALID_HANDLE_VALUE, "failed to open %s: %u\n", name, GetLastError());
+    CloseHandle(file);
+
+    backdate_directory(testdir);
+    sprintf(name, "%s\\newFILE.txt", testdir);
+    file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    ok(file != INVALID_HANDLE_VALUE, "failed to open %s: %u\n", name, GetLastError());
+    CloseHandle(file);
+
+    /* and deleted files must not */
+    sprintf(name, "%s\\newfile.TXT", testdir);
+    ok(DeleteFileA(name), "failed to delete %s: %u\n", name, GetLastError());
+    file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    ok(file == INVALID_HANDLE_VALUE, "%s shouldn't exist\n", name);
+
+    backdate_directory(testdir);
+    sprintf(name, "%s\\NEWfile.txt", testdir);
+    file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    ok(file == INVALID_HANDLE_VALUE, "%s shouldn't exist\n", name);
+    ok(GetLastError() == ERROR_FILE_NOT_FOUND, "got error %u\n", GetLastError());
+
+    for (i = 0; i < 100; i++)
+    {
+        sprintf(name, "%s\\File%u.Txt", testdir, i);
+        DeleteFileA(name);
+    }
+    RemoveDirectoryA(testdir);
+}
+
 static void test_redirection(void)
 {
     ULONG old, cur;
@@ -906,6 +1238,8 @@ START_TEST(directory)
     GetSystemDirectoryW( sysdir, MAX_PATH );
     test_directory_sort( sysdir );
     test_NtQueryDirectoryFile();
+    test_NtQueryDirectoryFile_enum();
     test_NtQueryDirectoryFile_case();
+    test_case_insensitive_lookup();
     test_redirection();
 }
@@ -76,6 +76,9 @@ static NTSTATUS (WINAPI *pNtQueryIoCompletion)(HANDLE, IO_COMPLETION_INFORMATION
 static NTSTATUS (WINAPI *pNtRemoveIoCompletion)(HANDLE, PULONG_PTR, PULONG_PTR, PIO_STATUS_BLOCK, PLARGE_INTEGER);
 static NTSTATUS (WINAPI *pNtRemoveIoCompletionEx)(HANDLE,FILE_IO_COMPLETION_INFORMATION*,ULONG,ULONG*,LARGE_INTEGER*,BOOLEAN);
 static NTSTATUS (WINAPI *pNtSetIoCompletion)(HANDLE, ULONG_PTR, ULONG_PTR, NTSTATUS, SIZE_T);
+static NTSTATUS (WINAPI *pNtCreateWaitCompletionPacket)(HANDLE*, ACCESS_MASK, const OBJECT_ATTRIBUTES*);
+static NTSTATUS (WINAPI *pNtAssociateWaitCompletionPacket)(HANDLE, HANDLE, HANDLE, void*, void*, NTSTATUS, ULONG_PTR, BOOLEAN*);
+static NTSTATUS (WINAPI *pNtCancelWaitCompletionPacket)(HANDLE, BOOLEAN);
 static NTSTATUS (WINAPI *pNtSetInformationFile)(HANDLE, PIO_STATUS_BLOCK, PVOID, ULONG, FILE_INFORMATION_CLASS);
 static NTSTATUS (WINAPI *pNtQueryAttributesFile)(const OBJECT_ATTRIBUTES*,FILE_BASIC_INFORMATION*);
 static NTSTATUS (WINAPI *pNtQueryInformationFile)(HANDLE, PIO_STATUS_BLOCK, PVOID, ULONG, FILE_INFORMATION_CLASS);
@@ -1054,6 +1057,80 @@ static void test_set_io_completion(void)
     pNtClose( h );
 }
 
+static void test_wait_completion_packet(void)
+{
+    LARGE_INTEGER timeout = {{0}};
+    IO_STATUS_BLOCK iosb;
+    ULONG_PTR key, value;
+    HANDLE port, packet, event;
+    BOOLEAN signaled;
+    NTSTATUS res;
+
+    if (!pNtCreateWaitCompletionPacket)
+    {
+        win_skip("NtCreateWaitCompletionPacket() not present\n");
+        return;
+    }
+
+    res = pNtCreateIoCompletion( &port, IO_COMPLETION_ALL_ACCESS, NULL, 0 );
+    ok( res == STATUS_SUCCESS, "NtCreateIoCompletion failed: %#x\n", res );
+    res = pNtCreateWaitCompletionPacket( &packet, GENERIC_ALL, NULL );
+    ok( res == STATUS_SUCCESS, "NtCreateWaitCompletionPacket failed: %#x\n", res );
+    event = CreateEventW( NULL, FALSE, FALSE, NULL );
+
+    /* the packet is queued once the object is signaled, and the wait is satisfied */
+    signaled = TRUE;
+    res = pNtAssociateWaitCompletionPacket( packet, port, event, (void *)CKEY_FIRST, (void *)CVALUE_FIRST,
+                                            STATUS_INVALID_DEVICE_REQUEST, 3, &signaled );
+    ok( res == STATUS_SUCCESS, "NtAssociateWaitCompletionPacket failed: %#x\n", res );
+    ok( !signaled, "expected signaled = FALSE\n" );
+    ok( !get_pending_msgs( port ), "expected no pending message\n" );
+
+    res = pNtAssociateWaitCompletionPacket( packet, port, event, NULL, NULL, STATUS_SUCCESS, 0, NULL );
+    ok( res == STATUS_INVALID_PARAMETER_1, "NtAssociateWaitCompletionPacket returned %#x\n", res );
+
+    SetEvent( event );
+    ok( get_pending_msgs( port ) == 1, "expected a pending message\n" );
+    ok( !is_signaled( event ), "expected the event to be reset\n" );
+
+    res = pNtRemoveIoCompletion( port, &key, &value, &iosb, &timeout );
+    ok( res == STATUS_SUCCESS, "NtRemoveIoCompletion failed: %#x\n", res );
+    ok( key == CKEY_FIRST, "Invalid completion key: %#lx\n", key );
+    ok( value == CVALUE_FIRST, "Invalid completion value: %#lx\n", value );
+    ok( iosb.Information == 3, "Invalid iosb.Information: %lu\n", iosb.Information );
+    ok( U(iosb).Status == STATUS_INVALID_DEVICE_REQUEST, "Invalid iosb.Status: %#x\n", U(iosb).Status );
+
+    res = pNtCancelWaitCompletionPacket( packet, TRUE );
+    ok( res == STATUS_PENDING, "NtCancelWaitCompletionPacket returned %#x\n", res );
+
+    /* an already signaled object queues the packet immediately */
+    SetEvent( event );
+    res = pNtAssociateWaitCompletionPacket( packet, port, event, (void *)CKEY_SECOND, (void *)CVALUE_FIRST,
+                                            STATUS_SUCCESS, 0, &signaled );
+    ok( res == STATUS_SUCCESS, "NtAssociateWaitCompletionPacket failed: %#x\n", res );
+    ok( signaled, "expected signaled = TRUE\n" );
+    ok( get_pending_msgs( port ) == 1, "expected a pending message\n" );
+
+    res = pNtCancelWaitCompletionPacket( packet, FALSE );
+    ok( res == STATUS_PENDING, "NtCancelWaitCompletionPacket returned %#x\n", res );
+    res = pNtCancelWaitCompletionPacket( packet, TRUE );
+    ok( res == STATUS_CANCELLED, "NtCancelWaitCompletionPacket returned %#x\n", res );
+    ok( !get_pending_msgs( port ), "expected no pending message\n" );
+
+    /* cancel the wait before the object is signaled */
+    res = pNtAssociateWaitCompletionPacket( packet, port, event, NULL, NULL, STATUS_SUCCESS, 0, NULL );
+    ok( res == STATUS_SUCCESS, "NtAssociateWaitCompletionPacket failed: %#x\n", res );
+    res = pNtCancelWaitCompletionPacket( packet, FALSE );
+    ok( res == STATUS_SUCCESS, "NtCancelWaitCompletionPacket returned %#x\n", res );
+    SetEvent( event );
+    ok( !get_pending_msgs( port ), "expected no pending message\n" );
+    ok( is_signaled( event ), "expected the event to be signaled\n" );
+
+    pNtClose( packet );
+    pNtClose( port );
+    CloseHandle( event );
+}
+
 static void test_file_io_completion(void)
 {
     static const char pipe_name[] = "\\\\.\\pipe\\iocompletiontestnamedpipe";
@@ -3665,6 +3742,201 @@ static void test_file_completion_information(void)
     CloseHandle(h);
 }
 
+static void test_file_completion_duplicate_handle(void)
+{
+    static const char buf[] = "testdata";
+    OVERLAPPED ov, *pov;
+    DWORD num_bytes;
+    HANDLE port, h, h2;
+    ULONG_PTR key;
+    BOOL ret;
+
+    if (!(h = create_temp_file(FILE_FLAG_OVERLAPPED))) return;
+
+    memset(&ov, 0, sizeof(ov));
+    ov.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+
+    /* I/O without a completion port */
+    ret = WriteFile(h, buf, sizeof(buf), &num_bytes, &ov);
+    if (!ret && GetLastError() == ERROR_IO_PENDING) ret = GetOverlappedResult(h, &ov, &num_bytes, TRUE);
+    ok(ret, "WriteFile failed, error %u\n", GetLastError());
+
+    /* associate the port through another handle to the same file */
+    ret = DuplicateHandle(GetCurrentProcess(), h, GetCurrentProcess(), &h2, 0, FALSE, DUPLICATE_SAME_ACCESS);
+    ok(ret, "DuplicateHandle failed, error %u\n", GetLastError());
+    port = CreateIoCompletionPort(h2, NULL, 0xdeadbeef, 0);
+    ok(port != NULL, "CreateIoCompletionPort failed, error %u\n", GetLastError());
+
+    ret = WriteFile(h, buf, sizeof(buf), &num_bytes, &ov);
+    if (!ret && GetLastError() == ERROR_IO_PENDING) ret = GetOverlappedResult(h, &ov, &num_bytes, TRUE);
+    ok(ret, "WriteFile failed, error %u\n", GetLastError());
+
+    key = 0;
+    pov = NULL;
+    ret = GetQueuedCompletionStatus(port, &num_bytes, &key, &pov, 1000);
+    ok(ret, "GetQueuedCompletionStatus failed, error %u\n", GetLastError());
+    ok(key == 0xdeadbeef, "expected 0xdeadbeef, got %lx\n", key);
+    ok(pov == &ov, "expected %p, got %p\n", &ov, pov);
+    ok(num_bytes == sizeof(buf), "expected sizeof(buf), got %u\n", num_bytes);
+
+    CloseHandle(ov.hEvent);
+    CloseHandle(port);
+    CloseHandle(h2);
+    CloseHandle(h);
+}
+
+static DWORD WINAPI completion_wait_thread(void *arg)
+{
+    OVERLAPPED *pov;
+    DWORD num_bytes;
+    ULONG_PTR key;
+
+    if (!GetQueuedCompletionStatus(arg, &num_bytes, &key, &pov, 5000)) return 0;
+    return num_bytes;
+}
+
+/* completions of file I/O and posted messages are received in order, more than fit in a client-side ring */
+static void test_file_completion_order(void)
+{
+    static const char buf[] = "testdata";
+    OVERLAPPED ov[100], *pov;
+    IO_STATUS_BLOCK iosb;
+    LARGE_INTEGER timeout = {{0}};
+    ULONG_PTR key, value;
+    DWORD num_bytes;
+    HANDLE h, port, thread;
+    NTSTATUS status;
+    ULONG count;
+    BOOL ret;
+    int i;
+
+    if (!(h = create_temp_file(FILE_FLAG_OVERLAPPED))) return;
+    port = CreateIoCompletionPort(h, NULL, 0xdeadbeef, 0);
+    ok(port != NULL, "CreateIoCompletionPort failed, error %u\n", GetLastError());
+
+    for (i = 0; i < ARRAY_SIZE(ov); i++)
+    {
+        if (i % 10 == 5)
+        {
+            status = pNtSetIoCompletion(port, CKEY_FIRST, i, STATUS_SUCCESS, 0);
+            ok(status == STATUS_SUCCESS, "NtSetIoCompletion failed: %#x\n", status);
+            continue;
+        }
+        memset(&ov[i], 0, sizeof(ov[i]));
+        ov[i].Offset = i * sizeof(buf);
+        ret = WriteFile(h, buf, sizeof(buf), &num_bytes, &ov[i]);
+        if (!ret && GetLastError() == ERROR_IO_PENDING) ret = GetOverlappedResult(h, &ov[i], &num_bytes, TRUE);
+        ok(ret, "WriteFile failed, error %u\n", GetLastError());
+    }
+
+    count = get_pending_msgs(port);
+    ok(count == ARRAY_SIZE(ov), "got %u messages\n", count);
+
+    for (i = 0; i < ARRAY_SIZE(ov); i++)
+    {
+        status = pNtRemoveIoCompletion(port, &key, &value, &iosb, &timeout);
+        ok(status == STATUS_SUCCESS, "%u: NtRemoveIoCompletion failed: %#x\n", i, status);
+        if (status) break;
+        if (i % 10 == 5)
+        {
+            ok(key == CKEY_FIRST, "%u: got key %#lx\n", i, key);
+            ok(value == i, "%u: got value %#lx\n", i, value);
+        }
+        else
+        {
+            ok(key == 0xdeadbeef, "%u: got key %#lx\n", i, key);
+            ok(value == (ULONG_PTR)&ov[i], "%u: got value %#lx\n", i, value);
+            ok(iosb.Information == sizeof(buf), "%u: got %lu bytes\n", i, iosb.Information);
+        }
+    }
+    status = pNtRemoveIoCompletion(port, &key, &value, &iosb, &timeout);
+    ok(status == STATUS_TIMEOUT, "NtRemoveIoCompletion returned %#x\n", status);
+
+    /* a thread waiting on the port is woken up by a completion */
+    thread = CreateThread(NULL, 0, completion_wait_thread, port, 0, NULL);
+    ok(WaitForSingleObject(thread, 100) == WAIT_TIMEOUT, "thread didn't wait\n");
+    memset(&ov[0], 0, sizeof(ov[0]));
+    ret = WriteFile(h, buf, 3, &num_bytes, &ov[0]);
+    if (!ret && GetLastError() == ERROR_IO_PENDING) ret = GetOverlappedResult(h, &ov[0], &num_bytes, TRUE);
+    ok(ret, "WriteFile failed, error %u\n", GetLastError());
+    ok(!WaitForSingleObject(thread, 5000), "thread didn't finish\n");
+    ok(GetExitCodeThread(thread, &num_bytes), "GetExitCodeThread failed\n");
+    ok(num_bytes == 3, "got %u bytes\n", num_bytes);
+    CloseHandle(thread);
+
+    pov = NULL;
+    ret = GetQueuedCompletionStatus(port, &num_bytes, &key, &pov, 0);
+    ok(!ret && !pov, "got unexpected completion\n");
+
+    CloseHandle(port);
+    CloseHandle(h);
+}
+
+/* associate a completion port with a file handle inherited from the parent */
+static void completion_child(HANDLE h, HANDLE ready)
+{
+    OVERLAPPED *pov;
+    DWORD num_bytes;
+    HANDLE port;
+    ULONG_PTR key;
+    BOOL ret;
+
+    port = CreateIoCompletionPort(h, NULL, 0xdeadbeef, 0);
+    ok(port != NULL, "CreateIoCompletionPort failed, error %u\n", GetLastError());
+    SetEvent(ready);
+
+    key = 0;
+    ret = GetQueuedCompletionStatus(port, &num_bytes, &key, &pov, 5000);
+    ok(ret, "GetQueuedCompletionStatus failed, error %u\n", GetLastError());
+    ok(key == 0xdeadbeef, "expected 0xdeadbeef, got %lx\n", key);
+    ok(num_bytes == 8, "got %u bytes\n", num_bytes);
+    CloseHandle(port);
+}
+
+static void test_file_completion_other_process(void)
+{
+    static const char buf[] = "testdata";
+    SECURITY_ATTRIBUTES sa = { sizeof(sa), NULL, TRUE };
+    PROCESS_INFORMATION pi;
+    STARTUPINFOA si = { sizeof(si) };
+    char cmdline[MAX_PATH], **argv;
+    OVERLAPPED ov;
+    DWORD num_bytes;
+    HANDLE h, ready;
+    BOOL ret;
+
+    if (!(h = create_temp_file(FILE_FLAG_OVERLAPPED))) return;
+    SetHandleInformation(h, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+    ready = CreateEventA(&sa, TRUE, FALSE, NULL);
+
+    memset(&ov, 0, sizeof(ov));
+    ov.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+
+    /* I/O without a completion port */
+    ret = WriteFile(h, buf, sizeof(buf) - 1, &num_bytes, &ov);
+    if (!ret && GetLastError() == ERROR_IO_PENDING) ret = GetOverlappedResult(h, &ov, &num_bytes, TRUE);
+    ok(ret, "WriteFile failed, error %u\n", GetLastError());
+
+    /* the child associates a port with the same file */
+    winetest_get_mainargs(&argv);
+    sprintf(cmdline, "\"%s\" file completion %x %x", argv[0], HandleToULong(h), HandleToULong(ready));
+    ret = CreateProcessA(NULL, cmdline, NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi);
+    ok(ret, "CreateProcess failed, error %u\n", GetLastError());
+    ok(!WaitForSingleObject(ready, 5000), "child didn't associate the port\n");
+
+    ov.Offset = sizeof(buf) - 1;
+    ret = WriteFile(h, buf, sizeof(buf) - 1, &num_bytes, &ov);
+    if (!ret && GetLastError() == ERROR_IO_PENDING) ret = GetOverlappedResult(h, &ov, &num_bytes, TRUE);
+    ok(ret, "WriteFile failed, error %u\n", GetLastError());
+
+    wait_child_process(pi.hProcess);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    CloseHandle(ov.hEvent);
+    CloseHandle(ready);
+    CloseHandle(h);
+}
+
 static void test_file_id_information(void)
 {
     BY_HANDLE_FILE_INFORMATION info;
@@ -4958,6 +5230,10 @@ START_TEST(file)
 {
     HMODULE hkernel32 = GetModuleHandleA("kernel32.dll");
     HMODULE hntdll = GetModuleHandleA("ntdll.dll");
+    char **argv;
+    int argc;
+
+    argc = winetest_get_mainargs(&argv);
     if (!hntdll)
     {
         skip("not running on NT, skipping test\n");
@@ -4987,6 +5263,9 @@ START_TEST(file)
     pNtRemoveIoCompletion   = (void *)GetProcAddress(hntdll, "NtRemoveIoCompletion");
     pNtRemoveIoCompletionEx = (void *)GetProcAddress(hntdll, "NtRemoveIoCompletionEx");
     pNtSetIoCompletion      = (void *)GetProcAddress(hntdll, "NtSetIoCompletion");
+    pNtCreateWaitCompletionPacket = (void *)GetProcAddress(hntdll, "NtCreateWaitCompletionPacket");
+    pNtAssociateWaitCompletionPacket = (void *)GetProcAddress(hntdll, "NtAssociateWaitCompletionPacket");
+    pNtCancelWaitCompletionPacket = (void *)GetProcAddress(hntdll, "NtCancelWaitCompletionPacket");
     pNtSetInformationFile   = (void *)GetProcAddress(hntdll, "NtSetInformationFile");
     pNtQueryAttributesFile  = (void *)GetProcAddress(hntdll, "NtQueryAttributesFile");
     pNtQueryInformationFile = (void *)GetProcAddress(hntdll, "NtQueryInformationFile");
@@ -4995,6 +5274,12 @@ START_TEST(file)
     pNtQueryFullAttributesFile = (void *)GetProcAddress(hntdll, "NtQueryFullAttributesFile");
     pNtFlushBuffersFile = (void *)GetProcAddress(hntdll, "NtFlushBuffersFile");
 
+    if (argc >= 5 && !strcmp(argv[2], "completion"))
+    {
+        completion_child(ULongToHandle(strtoul(argv[3], NULL, 16)), ULongToHandle(strtoul(argv[4], NULL, 16)));
+        return;
+    }
+
     test_read_write();
     test_NtCreateFile();
     create_file_test();
@@ -5004,6 +5289,7 @@ START_TEST(file)
     append_file_test();
     nt_mailslot_test();
     test_set_io_completion();
+    test_wait_completion_packet();
     test_file_io_completion();
     test_file_basic_information();
     test_file_all_information();
@@ -5015,6 +5301,9 @@ START_TEST(file)
     test_file_link_information();
     test_file_disposition_information();
     test_file_completion_information();
+    test_file_completion_duplicate_handle();
+    test_file_completion_other_process();
+    test_file_completion_order();
     test_file_id_information();
     test_file_access_information();
     test_file_attribute_tag_information();
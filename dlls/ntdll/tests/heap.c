@@ -0,0 +1,317 @@
+/*
+ * Unit test suite for the ntdll heap functions
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "ntdll_test.h"
+#include "wine/heapstats.h"
+
+static HANDLE  (WINAPI *pRtlCreateHeap)(ULONG,PVOID,SIZE_T,SIZE_T,PVOID,PRTL_HEAP_DEFINITION);
+static HANDLE  (WINAPI *pRtlDestroyHeap)(HANDLE);
+static void *  (WINAPI *pRtlAllocateHeap)(HANDLE,ULONG,SIZE_T);
+static BOOLEAN (WINAPI *pRtlFreeHeap)(HANDLE,ULONG,void *);
+static void *  (WINAPI *pRtlReAllocateHeap)(HANDLE,ULONG,void *,SIZE_T);
+static SIZE_T  (WINAPI *pRtlSizeHeap)(HANDLE,ULONG,const void *);
+static NTSTATUS (WINAPI *pRtlQueryHeapInformation)(HANDLE,HEAP_INFORMATION_CLASS,void *,SIZE_T,SIZE_T *);
+static NTSTATUS (WINAPI *pRtlSetHeapInformation)(HANDLE,HEAP_INFORMATION_CLASS,void *,SIZE_T);
+
+static void init_function_pointers(void)
+{
+    HMODULE hntdll = GetModuleHandleA( "ntdll.dll" );
+
+#define GET_PROC(func) p##func = (void *)GetProcAddress( hntdll, #func )
+    GET_PROC( RtlCreateHeap );
+    GET_PROC( RtlDestroyHeap );
+    GET_PROC( RtlAllocateHeap );
+    GET_PROC( RtlFreeHeap );
+    GET_PROC( RtlReAllocateHeap );
+    GET_PROC( RtlSizeHeap );
+    GET_PROC( RtlQueryHeapInformation );
+    GET_PROC( RtlSetHeapInformation );
+#undef GET_PROC
+}
+
+static HANDLE create_lfh_heap(void)
+{
+    ULONG info = 2;
+    NTSTATUS status;
+    HANDLE heap;
+
+    heap = pRtlCreateHeap( HEAP_GROWABLE, NULL, 0, 0, NULL, NULL );
+    ok( heap != NULL, "RtlCreateHeap failed\n" );
+    status = pRtlSetHeapInformation( heap, HeapCompatibilityInformation, &info, sizeof(info) );
+    ok( !status, "RtlSetHeapInformation failed: %08x\n", status );
+    return heap;
+}
+
+static void test_lfh(void)
+{
+    SIZE_T size, ret_size;
+    NTSTATUS status;
+    HANDLE heap, heap2;
+    BYTE *ptr, *ptr2;
+    unsigned int i;
+    ULONG info;
+
+    if (!pRtlSetHeapInformation || !pRtlQueryHeapInformation)
+    {
+        win_skip( "RtlSetHeapInformation is not available\n" );
+        return;
+    }
+
+    heap = create_lfh_heap();
+    info = 0xdeadbeef;
+    status = pRtlQueryHeapInformation( heap, HeapCompatibilityInformation, &info, sizeof(info), &ret_size );
+    ok( !status, "RtlQueryHeapInformation failed: %08x\n", status );
+    ok( info == 2, "got %u\n", info );
+    ok( ret_size == sizeof(info), "got size %lu\n", ret_size );
+
+    for (size = 0; size < 4096; size += 13)
+    {
+        ptr = pRtlAllocateHeap( heap, HEAP_ZERO_MEMORY, size );
+        ok( ptr != NULL, "RtlAllocateHeap %lu failed\n", size );
+        ok( !((ULONG_PTR)ptr % (2 * sizeof(void *))), "%lu: unaligned block %p\n", size, ptr );
+        ok( pRtlSizeHeap( heap, 0, ptr ) == size, "%lu: got size %lu\n", size, pRtlSizeHeap( heap, 0, ptr ));
+        ok( !size || (!ptr[0] && !ptr[size - 1]), "%lu: block is not zeroed\n", size );
+        memset( ptr, 0xcc, size );
+
+        ptr2 = pRtlReAllocateHeap( heap, HEAP_ZERO_MEMORY, ptr, size + 100 );
+        ok( ptr2 != NULL, "RtlReAllocateHeap %lu failed\n", size );
+        ok( pRtlSizeHeap( heap, 0, ptr2 ) == size + 100, "%lu: got size %lu\n", size, pRtlSizeHeap( heap, 0, ptr2 ));
+        ok( !size || ptr2[size - 1] == 0xcc, "%lu: data not copied\n", size );
+        ok( !ptr2[size] && !ptr2[size + 99], "%lu: new data is not zeroed\n", size );
+        ok( pRtlFreeHeap( heap, 0, ptr2 ), "RtlFreeHeap %lu failed\n", size );
+    }
+
+    /* blocks can't be freed from another heap */
+    heap2 = pRtlCreateHeap( HEAP_GROWABLE, NULL, 0, 0, NULL, NULL );
+    ptr = pRtlAllocateHeap( heap, 0, 40 );
+    ok( !pRtlFreeHeap( heap2, 0, ptr ), "RtlFreeHeap succeeded\n" );
+    ok( pRtlFreeHeap( heap, 0, ptr ), "RtlFreeHeap failed\n" );
+    pRtlDestroyHeap( heap2 );
+
+    /* destroying many front end heaps must not break the lookups of the others */
+    ptr = pRtlAllocateHeap( heap, 0, 40 );
+    for (i = 0; i < 5000; i++)
+    {
+        heap2 = create_lfh_heap();
+        ptr2 = pRtlAllocateHeap( heap2, 0, 24 + i % 1000 );
+        ok( ptr2 != NULL, "%u: RtlAllocateHeap failed\n", i );
+        pRtlDestroyHeap( heap2 );
+        if (!(i % 500))
+        {
+            ptr2 = pRtlAllocateHeap( heap, 0, 60 );
+            ok( pRtlSizeHeap( heap, 0, ptr2 ) == 60, "%u: got size %lu\n", i, pRtlSizeHeap( heap, 0, ptr2 ));
+            ok( pRtlFreeHeap( heap, 0, ptr2 ), "%u: RtlFreeHeap failed\n", i );
+        }
+    }
+    ok( pRtlSizeHeap( heap, 0, ptr ) == 40, "got size %lu\n", pRtlSizeHeap( heap, 0, ptr ));
+    ok( pRtlFreeHeap( heap, 0, ptr ), "RtlFreeHeap failed\n" );
+
+    pRtlDestroyHeap( heap );
+}
+
+static void test_heap_stats( HANDLE heap )
+{
+    HEAP_WINE_STATISTICS stats, stats2;
+    HEAP_WINE_STACK_TRACE *traces;
+    SIZE_T ret_size;
+    NTSTATUS status;
+    void *ptrs[100];
+    unsigned int i;
+
+    status = pRtlQueryHeapInformation( heap, HeapWineStatistics, &stats, sizeof(stats), &ret_size );
+    ok( !status, "RtlQueryHeapInformation failed: %08x\n", status );
+    if (status) return;
+    ok( ret_size == sizeof(stats), "got size %lu\n", ret_size );
+    status = pRtlQueryHeapInformation( heap, HeapWineStatistics, &stats, sizeof(stats) - 1, &ret_size );
+    ok( status == STATUS_BUFFER_TOO_SMALL, "got %08x\n", status );
+
+    for (i = 0; i < ARRAY_SIZE(ptrs); i++) ptrs[i] = pRtlAllocateHeap( heap, 0, 100 );
+    status = pRtlQueryHeapInformation( heap, HeapWineStatistics, &stats2, sizeof(stats2), NULL );
+    ok( !status, "RtlQueryHeapInformation failed: %08x\n", status );
+    ok( stats2.BlocksInUse == stats.BlocksInUse + 100, "got %s blocks\n", wine_dbgstr_longlong(stats2.BlocksInUse) );
+    ok( stats2.BytesInUse == stats.BytesInUse + 10000, "got %s bytes\n", wine_dbgstr_longlong(stats2.BytesInUse) );
+    ok( stats2.TotalAllocations == stats.TotalAllocations + 100, "got %s allocations\n",
+        wine_dbgstr_longlong(stats2.TotalAllocations) );
+    ok( stats2.SizeClassAllocations[3] == stats.SizeClassAllocations[3] + 100, "got %s allocations\n",
+        wine_dbgstr_longlong(stats2.SizeClassAllocations[3]) );
+    ok( stats2.BytesCommitted >= stats2.BytesInUse, "got %s committed\n", wine_dbgstr_longlong(stats2.BytesCommitted) );
+    ok( stats2.Fragmentation <= 100, "got %u%%\n", stats2.Fragmentation );
+
+    if (stats2.SampleRate)
+    {
+        status = pRtlQueryHeapInformation( heap, HeapWineStackTraces, NULL, 0, &ret_size );
+        ok( status == STATUS_BUFFER_TOO_SMALL, "got %08x\n", status );
+        ok( ret_size && !(ret_size % sizeof(*traces)), "got size %lu\n", ret_size );
+        traces = HeapAlloc( GetProcessHeap(), 0, ret_size );
+        status = pRtlQueryHeapInformation( heap, HeapWineStackTraces, traces, ret_size, &ret_size );
+        ok( !status, "RtlQueryHeapInformation failed: %08x\n", status );
+        ok( traces[0].BlocksInUse && traces[0].Depth, "got %s blocks, %u frames\n",
+            wine_dbgstr_longlong(traces[0].BlocksInUse), traces[0].Depth );
+        HeapFree( GetProcessHeap(), 0, traces );
+    }
+
+    for (i = 0; i < ARRAY_SIZE(ptrs); i++) pRtlFreeHeap( heap, 0, ptrs[i] );
+    status = pRtlQueryHeapInformation( heap, HeapWineStatistics, &stats2, sizeof(stats2), NULL );
+    ok( !status, "RtlQueryHeapInformation failed: %08x\n", status );
+    ok( stats2.BlocksInUse == stats.BlocksInUse, "got %s blocks\n", wine_dbgstr_longlong(stats2.BlocksInUse) );
+    ok( stats2.BytesInUse == stats.BytesInUse, "got %s bytes\n", wine_dbgstr_longlong(stats2.BytesInUse) );
+    ok( stats2.TotalFrees == stats.TotalFrees + 100, "got %s frees\n", wine_dbgstr_longlong(stats2.TotalFrees) );
+
+    status = pRtlQueryHeapInformation( heap, HeapWineDumpStatistics, NULL, 0, NULL );
+    ok( !status, "RtlQueryHeapInformation failed: %08x\n", status );
+}
+
+static void test_statistics(void)
+{
+    ULONG stack_traces, info;
+    NTSTATUS status;
+    HANDLE heap;
+    void *ptr;
+
+    if (!pRtlQueryHeapInformation || !pRtlSetHeapInformation)
+    {
+        win_skip( "RtlQueryHeapInformation is not available\n" );
+        return;
+    }
+
+    heap = pRtlCreateHeap( HEAP_GROWABLE, NULL, 0, 0, NULL, NULL );
+    stack_traces = 0;
+    status = pRtlSetHeapInformation( heap, HeapWineStatistics, &stack_traces, sizeof(stack_traces) );
+    if (status)
+    {
+        win_skip( "heap statistics are not supported\n" );
+        pRtlDestroyHeap( heap );
+        return;
+    }
+    test_heap_stats( heap );
+    pRtlDestroyHeap( heap );
+
+    /* existing blocks are accounted for */
+    heap = pRtlCreateHeap( HEAP_GROWABLE, NULL, 0, 0, NULL, NULL );
+    ptr = pRtlAllocateHeap( heap, 0, 100 );
+    stack_traces = 1;
+    status = pRtlSetHeapInformation( heap, HeapWineStatistics, &stack_traces, sizeof(stack_traces) );
+    ok( !status, "RtlSetHeapInformation failed: %08x\n", status );
+    status = pRtlSetHeapInformation( heap, HeapWineStatistics, &stack_traces, sizeof(stack_traces) );
+    ok( !status, "RtlSetHeapInformation failed: %08x\n", status );
+    test_heap_stats( heap );
+    pRtlFreeHeap( heap, 0, ptr );
+    pRtlDestroyHeap( heap );
+
+    heap = create_lfh_heap();
+    stack_traces = 1;
+    status = pRtlSetHeapInformation( heap, HeapWineStatistics, &stack_traces, sizeof(stack_traces) );
+    ok( !status, "RtlSetHeapInformation failed: %08x\n", status );
+    test_heap_stats( heap );
+    pRtlDestroyHeap( heap );
+
+    /* the blocks of the front end can't be accounted for once it is in use */
+    heap = create_lfh_heap();
+    ptr = pRtlAllocateHeap( heap, 0, 100 );
+    status = pRtlQueryHeapInformation( heap, HeapCompatibilityInformation, &info, sizeof(info), NULL );
+    ok( !status && info == 2, "got %08x, mode %u\n", status, info );
+    stack_traces = 0;
+    status = pRtlSetHeapInformation( heap, HeapWineStatistics, &stack_traces, sizeof(stack_traces) );
+    ok( status == STATUS_UNSUCCESSFUL, "RtlSetHeapInformation returned %08x\n", status );
+    pRtlFreeHeap( heap, 0, ptr );
+    pRtlDestroyHeap( heap );
+}
+
+#define BENCH_BLOCKS 256
+
+struct bench_params
+{
+    HANDLE heap;
+    DWORD  count;
+};
+
+static DWORD WINAPI bench_thread( void *arg )
+{
+    const struct bench_params *params = arg;
+    void *blocks[BENCH_BLOCKS];
+    DWORD i, seed = GetCurrentThreadId();
+
+    memset( blocks, 0, sizeof(blocks) );
+    for (i = 0; i < params->count; i++)
+    {
+        DWORD index;
+
+        seed = seed * 1103515245 + 12345;
+        index = (seed >> 16) % BENCH_BLOCKS;
+        if (blocks[index])
+        {
+            pRtlFreeHeap( params->heap, 0, blocks[index] );
+            blocks[index] = NULL;
+        }
+        else blocks[index] = pRtlAllocateHeap( params->heap, 0, (seed >> 8) % 512 );
+    }
+    for (i = 0; i < BENCH_BLOCKS; i++) pRtlFreeHeap( params->heap, 0, blocks[i] );
+    return 0;
+}
+
+static DWORD run_heap_bench( HANDLE heap, DWORD nb_threads, DWORD count )
+{
+    struct bench_params params;
+    HANDLE threads[16];
+    DWORD i, start;
+
+    params.heap  = heap;
+    params.count = count;
+    start = GetTickCount();
+    for (i = 0; i < nb_threads; i++)
+        threads[i] = CreateThread( NULL, 0, bench_thread, &params, 0, NULL );
+    WaitForMultipleObjects( nb_threads, threads, TRUE, INFINITE );
+    for (i = 0; i < nb_threads; i++) CloseHandle( threads[i] );
+    return GetTickCount() - start;
+}
+
+static void test_heap_bench(void)
+{
+    const DWORD count = winetest_interactive ? 2000000 : 100000;
+    DWORD nb_threads, time, lfh_time;
+    HANDLE heap;
+
+    if (!pRtlSetHeapInformation)
+    {
+        win_skip( "RtlSetHeapInformation is not available\n" );
+        return;
+    }
+
+    for (nb_threads = 1; nb_threads <= 8; nb_threads *= 2)
+    {
+        heap = pRtlCreateHeap( HEAP_GROWABLE, NULL, 0, 0, NULL, NULL );
+        time = run_heap_bench( heap, nb_threads, count );
+        pRtlDestroyHeap( heap );
+
+        heap = create_lfh_heap();
+        lfh_time = run_heap_bench( heap, nb_threads, count );
+        pRtlDestroyHeap( heap );
+
+        trace( "%u threads, %u alloc/free each: %u ms, %u ms with the low-fragmentation heap\n",
+               nb_threads, count, time, lfh_time );
+    }
+}
+
+START_TEST(heap)
+{
+    init_function_pointers();
+
+    test_lfh();
+    test_statistics();
+    test_heap_bench();
+}
@@ -21,6 +21,7 @@
 #include "ntdll_test.h"
 #include <winnls.h>
 #include <stdio.h>
+#include "wine/server.h"
 
 static NTSTATUS (WINAPI * pNtQuerySystemInformation)(SYSTEM_INFORMATION_CLASS, PVOID, ULONG, PULONG);
 static NTSTATUS (WINAPI * pRtlGetNativeSystemInformation)(SYSTEM_INFORMATION_CLASS, PVOID, ULONG, PULONG);
@@ -42,6 +43,8 @@ static BOOL     (WINAPI * pGetLogicalProcessorInformationEx)(LOGICAL_PROCESSOR_R
 static DEP_SYSTEM_POLICY_TYPE (WINAPI * pGetSystemDEPPolicy)(void);
 static NTSTATUS (WINAPI * pNtOpenThread)(HANDLE *, ACCESS_MASK, const OBJECT_ATTRIBUTES *, const CLIENT_ID *);
 static NTSTATUS (WINAPI * pNtQueryObject)(HANDLE, OBJECT_INFORMATION_CLASS, void *, ULONG, ULONG *);
+static unsigned int (CDECL * pwine_server_call)(void *);
+static unsigned int (CDECL * pwine_server_call_batch)(struct __server_request_info **, unsigned int);
 
 static BOOL is_wow64;
 
@@ -91,6 +94,10 @@ static BOOL InitFunctionPtrs(void)
     NTDLL_GET_PROC(NtOpenThread);
     NTDLL_GET_PROC(NtQueryObject);
 
+    /* Wine-specific */
+    pwine_server_call = (void *)GetProcAddress(hntdll, "wine_server_call");
+    pwine_server_call_batch = (void *)GetProcAddress(hntdll, "wine_server_call_batch");
+
     /* not present before XP */
     pNtGetCurrentProcessorNumber = (void *) GetProcAddress(hntdll, "NtGetCurrentProcessorNumber");
 
@@ -425,6 +432,82 @@ static void test_query_process(void)
     HeapFree( GetProcessHeap(), 0, spi_buf);
 }
 
+static DWORD WINAPI query_process_thread( void *arg )
+{
+    return WaitForSingleObject( arg, INFINITE );
+}
+
+static void test_query_process_threads(void)
+{
+    HANDLE event, threads[40];
+    DWORD tids[40], pid = GetCurrentProcessId();
+    ULONG size = 0x10000, len;
+    NTSTATUS status;
+    int i, j, found = 0;
+
+    /* Copy of our winternl.h structure turned into a private one */
+    typedef struct _SYSTEM_PROCESS_INFORMATION_PRIVATE {
+        ULONG NextEntryOffset;
+        DWORD dwThreadCount;
+        DWORD dwUnknown1[6];
+        FILETIME ftCreationTime;
+        FILETIME ftUserTime;
+        FILETIME ftKernelTime;
+        UNICODE_STRING ProcessName;
+        DWORD dwBasePriority;
+        HANDLE UniqueProcessId;
+        HANDLE ParentProcessId;
+        ULONG HandleCount;
+        DWORD dwUnknown3;
+        DWORD dwUnknown4;
+        VM_COUNTERS vmCounters;
+        IO_COUNTERS ioCounters;
+        SYSTEM_THREAD_INFORMATION ti[1];
+    } SYSTEM_PROCESS_INFORMATION_PRIVATE;
+
+    SYSTEM_PROCESS_INFORMATION_PRIVATE *spi, *spi_buf;
+
+    /* more threads than Wine fetches in a single batch of server requests */
+    event = CreateEventW( NULL, TRUE, FALSE, NULL );
+    for (i = 0; i < ARRAY_SIZE(threads); i++)
+    {
+        threads[i] = CreateThread( NULL, 0, query_process_thread, event, 0, &tids[i] );
+        ok( threads[i] != NULL, "CreateThread failed %u\n", GetLastError() );
+    }
+
+    spi_buf = HeapAlloc( GetProcessHeap(), 0, size );
+    while ((status = pNtQuerySystemInformation( SystemProcessInformation, spi_buf, size, &len )) == STATUS_INFO_LENGTH_MISMATCH)
+        spi_buf = HeapReAlloc( GetProcessHeap(), 0, spi_buf, size *= 2 );
+    ok( status == STATUS_SUCCESS, "NtQuerySystemInformation failed %08x\n", status );
+
+    for (spi = spi_buf; ; spi = (SYSTEM_PROCESS_INFORMATION_PRIVATE *)((char *)spi + spi->NextEntryOffset))
+    {
+        if (HandleToUlong( spi->UniqueProcessId ) == pid)
+        {
+            ok( spi->dwThreadCount > ARRAY_SIZE(threads), "got %u threads\n", spi->dwThreadCount );
+            for (i = 0; i < ARRAY_SIZE(threads); i++)
+            {
+                for (j = 0; j < spi->dwThreadCount; j++)
+                    if (HandleToUlong( spi->ti[j].ClientId.UniqueThread ) == tids[i]) break;
+                ok( j < spi->dwThreadCount, "thread %04x not found\n", tids[i] );
+            }
+            found = 1;
+            break;
+        }
+        if (!spi->NextEntryOffset) break;
+    }
+    ok( found, "current process not found\n" );
+
+    SetEvent( event );
+    for (i = 0; i < ARRAY_SIZE(threads); i++)
+    {
+        WaitForSingleObject( threads[i], INFINITE );
+        CloseHandle( threads[i] );
+    }
+    CloseHandle( event );
+    HeapFree( GetProcessHeap(), 0, spi_buf );
+}
+
 static void test_query_procperf(void)
 {
     NTSTATUS status;
@@ -2508,6 +2591,179 @@ static void test_thread_lookup(void)
        "NtOpenThread returned %#x\n", status);
 }
 
+#define PROFILE_BUCKETS 64
+
+/* the histogram buckets end at 0, 1, 2, 3, and then alternately at (3 << n) - 1 and (4 << n) - 1 */
+static timeout_t get_profile_bucket_limit( unsigned int bucket )
+{
+    if (bucket < 4) return bucket;
+    return ((timeout_t)((bucket & 1) + 3) << (bucket / 2 - 1)) - 1;
+}
+
+/* return the bucket ending at a time, or PROFILE_BUCKETS if there is none */
+static unsigned int get_profile_bucket( timeout_t limit )
+{
+    unsigned int i;
+
+    for (i = 0; i < PROFILE_BUCKETS; i++) if (get_profile_bucket_limit( i ) == limit) break;
+    return i;
+}
+
+#define check_request_profile(a,b) check_request_profile_(__LINE__,a,b)
+static unsigned int check_request_profile_( unsigned int line, HANDLE process, struct request_profile_info *stats )
+{
+    unsigned int i, bucket, count = 0;
+    BOOL seen[REQ_NB_REQUESTS];
+    NTSTATUS status;
+
+    SERVER_START_REQ( get_request_profile )
+    {
+        req->handle = wine_server_obj_handle( process );
+        wine_server_set_reply( req, stats, REQ_NB_REQUESTS * sizeof(*stats) );
+        if (!(status = pwine_server_call( req ))) count = reply->count;
+    }
+    SERVER_END_REQ;
+    ok_(__FILE__,line)( !status, "get_request_profile failed %08x\n", status );
+
+    /* the requests are listed once each, sorted by total time */
+    memset( seen, 0, sizeof(seen) );
+    for (i = 0; i < count; i++)
+    {
+        ok_(__FILE__,line)( stats[i].request < REQ_NB_REQUESTS, "%u: got request %u\n", i, stats[i].request );
+        if (stats[i].request >= REQ_NB_REQUESTS) continue;
+        ok_(__FILE__,line)( !seen[stats[i].request], "%u: request %u listed twice\n", i, stats[i].request );
+        seen[stats[i].request] = TRUE;
+        ok_(__FILE__,line)( stats[i].count > 0, "%u: got count 0\n", i );
+        ok_(__FILE__,line)( !i || stats[i].total <= stats[i - 1].total, "%u: not sorted by total time\n", i );
+        ok_(__FILE__,line)( stats[i].p50 <= stats[i].p99, "%u: p50 %s above p99 %s\n", i,
+                            wine_dbgstr_longlong( stats[i].p50 ), wine_dbgstr_longlong( stats[i].p99 ));
+
+        /* the percentiles are the upper limits of histogram buckets */
+        bucket = get_profile_bucket( stats[i].p50 );
+        ok_(__FILE__,line)( bucket < PROFILE_BUCKETS, "%u: p50 %s is not a bucket limit\n", i,
+                            wine_dbgstr_longlong( stats[i].p50 ));
+        ok_(__FILE__,line)( get_profile_bucket( stats[i].p99 ) < PROFILE_BUCKETS,
+                            "%u: p99 %s is not a bucket limit\n", i, wine_dbgstr_longlong( stats[i].p99 ));
+
+        /* with a single call, the total time falls in the bucket of the percentiles */
+        if (stats[i].count != 1 || bucket >= PROFILE_BUCKETS) continue;
+        ok_(__FILE__,line)( stats[i].p50 == stats[i].p99, "%u: p50 %s, p99 %s\n", i,
+                            wine_dbgstr_longlong( stats[i].p50 ), wine_dbgstr_longlong( stats[i].p99 ));
+        ok_(__FILE__,line)( !bucket || stats[i].total > get_profile_bucket_limit( bucket - 1 ),
+                            "%u: time %s below bucket %u\n", i, wine_dbgstr_longlong( stats[i].total ), bucket );
+        ok_(__FILE__,line)( bucket == PROFILE_BUCKETS - 1 || stats[i].total <= stats[i].p50,
+                            "%u: time %s above bucket %u\n", i, wine_dbgstr_longlong( stats[i].total ), bucket );
+    }
+    return count;
+}
+
+static NTSTATUS get_request_profile( enum request type, struct request_profile_info *ret )
+{
+    struct request_profile_info stats[REQ_NB_REQUESTS];
+    unsigned int i, count = 0;
+    NTSTATUS status;
+
+    memset( ret, 0, sizeof(*ret) );
+    SERVER_START_REQ( get_request_profile )
+    {
+        req->handle = wine_server_obj_handle( GetCurrentProcess() );
+        wine_server_set_reply( req, stats, sizeof(stats) );
+        if (!(status = pwine_server_call( req ))) count = reply->count;
+    }
+    SERVER_END_REQ;
+    for (i = 0; i < count; i++) if (stats[i].request == type) *ret = stats[i];
+    return status;
+}
+
+static void test_request_profile(void)
+{
+    struct __server_request_info info[3], *reqs[3];
+    struct request_profile_info before, after, batch_before, batch_after;
+    struct request_profile_info stats[REQ_NB_REQUESTS], global_stats[REQ_NB_REQUESTS];
+    unsigned int count, global_count, j, k;
+    OBJECT_BASIC_INFORMATION obj_info;
+    NTSTATUS status;
+    HANDLE event;
+    int i;
+
+    if (!pwine_server_call || !pwine_server_call_batch)
+    {
+        win_skip( "Not running on Wine\n" );
+        return;
+    }
+    status = get_request_profile( REQ_get_object_info, &before );
+    if (status == STATUS_NOT_IMPLEMENTED)
+    {
+        skip( "Request profiling is not enabled in the server\n" );
+        return;
+    }
+    ok( !status, "get_request_profile failed %08x\n", status );
+
+    event = CreateEventW( NULL, TRUE, FALSE, NULL );
+    for (i = 0; i < 10; i++)
+    {
+        status = pNtQueryObject( event, ObjectBasicInformation, &obj_info, sizeof(obj_info), NULL );
+        ok( !status, "NtQueryObject failed %08x\n", status );
+    }
+    status = get_request_profile( REQ_get_object_info, &after );
+    ok( !status, "get_request_profile failed %08x\n", status );
+    ok( after.request == REQ_get_object_info, "get_object_info not found\n" );
+    ok( after.count == before.count + 10, "got count %u, expected %u\n", after.count, before.count + 10 );
+    ok( after.total >= before.total, "total decreased\n" );
+    ok( after.p50 <= after.p99, "p50 %s above p99 %s\n",
+        wine_dbgstr_longlong( after.p50 ), wine_dbgstr_longlong( after.p99 ));
+    ok( after.p50 > 0, "got p50 %s\n", wine_dbgstr_longlong( after.p50 ));
+
+    /* the requests of a batch are counted, the batch itself is not */
+    get_request_profile( REQ_call_batch, &batch_before );
+    before = after;
+    for (i = 0; i < ARRAY_SIZE(info); i++)
+    {
+        struct get_object_info_request *req = SERVER_INIT_REQ( &info[i], get_object_info );
+        req->handle = wine_server_obj_handle( event );
+        reqs[i] = &info[i];
+    }
+    status = pwine_server_call_batch( reqs, ARRAY_SIZE(info) );
+    ok( !status, "wine_server_call_batch failed %08x\n", status );
+    for (i = 0; i < ARRAY_SIZE(info); i++)
+        ok( !info[i].u.reply.reply_header.error, "%d: got error %08x\n", i, info[i].u.reply.reply_header.error );
+
+    get_request_profile( REQ_get_object_info, &after );
+    get_request_profile( REQ_call_batch, &batch_after );
+    ok( after.count == before.count + 3, "got count %u, expected %u\n", after.count, before.count + 3 );
+    ok( batch_after.count == batch_before.count, "call_batch counted %u times\n",
+        batch_after.count - batch_before.count );
+
+    /* the global statistics include the ones of this process */
+    count = check_request_profile( GetCurrentProcess(), stats );
+    ok( count > 1, "got %u requests\n", count );
+    global_count = check_request_profile( 0, global_stats );
+    ok( global_count >= count, "got %u global requests, %u for the process\n", global_count, count );
+    for (j = 0; j < count; j++)
+    {
+        for (k = 0; k < global_count; k++) if (global_stats[k].request == stats[j].request) break;
+        ok( k < global_count, "request %u missing from the global statistics\n", stats[j].request );
+        if (k < global_count)
+            ok( global_stats[k].count >= stats[j].count, "request %u: got global count %u, %u for the process\n",
+                stats[j].request, global_stats[k].count, stats[j].count );
+    }
+
+    /* the percentiles come from the histogram of all the calls */
+    for (j = 0; j < 2000; j++) pNtQueryObject( event, ObjectBasicInformation, &obj_info, sizeof(obj_info), NULL );
+    count = check_request_profile( GetCurrentProcess(), stats );
+    for (j = 0; j < count; j++) if (stats[j].request == REQ_get_object_info) break;
+    ok( j < count, "get_object_info not found\n" );
+    if (j < count)
+    {
+        ok( stats[j].count == after.count + 2000, "got count %u, expected %u\n", stats[j].count, after.count + 2000 );
+        ok( stats[j].p50 > 0, "got p50 %s\n", wine_dbgstr_longlong( stats[j].p50 ));
+        ok( stats[j].p50 * stats[j].count <= stats[j].total * 2, "p50 %s above twice the mean\n",
+            wine_dbgstr_longlong( stats[j].p50 ));
+    }
+
+    CloseHandle( event );
+}
+
 START_TEST(info)
 {
     char **argv;
@@ -2540,6 +2796,7 @@ START_TEST(info)
     /* 0x5 SystemProcessInformation */
     trace("Starting test_query_process()\n");
     test_query_process();
+    test_query_process_threads();
 
     /* 0x8 SystemProcessorPerformanceInformation */
     trace("Starting test_query_procperf()\n");
@@ -2657,4 +2914,5 @@ START_TEST(info)
     test_query_data_alignment();
 
     test_thread_lookup();
+    test_request_profile();
 }
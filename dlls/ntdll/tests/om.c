@@ -1673,6 +1673,196 @@ static void test_event(void)
     pNtClose(Event);
 }
 
+static LONG pulse_waiters;
+
+static DWORD WINAPI pulse_event_thread( void *arg )
+{
+    InterlockedIncrement( &pulse_waiters );
+    return WaitForSingleObject( arg, 5000 );
+}
+
+static void test_event_pulse(void)
+{
+    HANDLE event, threads[2];
+    NTSTATUS status;
+    DWORD ret, code;
+    int i;
+
+    /* a manual-reset pulse releases all the waiting threads */
+    status = pNtCreateEvent( &event, GENERIC_ALL, NULL, NotificationEvent, FALSE );
+    ok( status == STATUS_SUCCESS, "NtCreateEvent failed %08x\n", status );
+
+    pulse_waiters = 0;
+    for (i = 0; i < 2; i++) threads[i] = CreateThread( NULL, 0, pulse_event_thread, event, 0, NULL );
+    while (pulse_waiters < 2) Sleep( 10 );
+    Sleep( 100 );
+
+    status = pNtPulseEvent( event, NULL );
+    ok( status == STATUS_SUCCESS, "NtPulseEvent failed %08x\n", status );
+    ret = WaitForMultipleObjects( 2, threads, TRUE, 1000 );
+    ok( ret == WAIT_OBJECT_0, "threads not released, ret %u\n", ret );
+    for (i = 0; i < 2; i++)
+    {
+        GetExitCodeThread( threads[i], &code );
+        ok( code == WAIT_OBJECT_0, "%d: wait returned %u\n", i, code );
+        CloseHandle( threads[i] );
+    }
+    ret = WaitForSingleObject( event, 0 );
+    ok( ret == WAIT_TIMEOUT, "event is signaled\n" );
+    pNtClose( event );
+
+    /* an auto-reset pulse releases a single thread */
+    status = pNtCreateEvent( &event, GENERIC_ALL, NULL, SynchronizationEvent, FALSE );
+    ok( status == STATUS_SUCCESS, "NtCreateEvent failed %08x\n", status );
+
+    pulse_waiters = 0;
+    for (i = 0; i < 2; i++) threads[i] = CreateThread( NULL, 0, pulse_event_thread, event, 0, NULL );
+    while (pulse_waiters < 2) Sleep( 10 );
+    Sleep( 100 );
+
+    status = pNtPulseEvent( event, NULL );
+    ok( status == STATUS_SUCCESS, "NtPulseEvent failed %08x\n", status );
+    ret = WaitForMultipleObjects( 2, threads, FALSE, 1000 );
+    ok( ret == WAIT_OBJECT_0 || ret == WAIT_OBJECT_0 + 1, "no thread released, ret %u\n", ret );
+    if (ret <= WAIT_OBJECT_0 + 1)
+    {
+        GetExitCodeThread( threads[ret], &code );
+        ok( code == WAIT_OBJECT_0, "wait returned %u\n", code );
+        ret = WaitForSingleObject( threads[!ret], 100 );
+        ok( ret == WAIT_TIMEOUT, "both threads released\n" );
+    }
+    ret = WaitForSingleObject( event, 0 );
+    ok( ret == WAIT_TIMEOUT, "event is signaled\n" );
+
+    status = pNtSetEvent( event, NULL );
+    ok( status == STATUS_SUCCESS, "NtSetEvent failed %08x\n", status );
+    ret = WaitForMultipleObjects( 2, threads, TRUE, 1000 );
+    ok( ret == WAIT_OBJECT_0, "threads not finished, ret %u\n", ret );
+    for (i = 0; i < 2; i++) CloseHandle( threads[i] );
+    pNtClose( event );
+}
+
+static DWORD WINAPI detach_wait_thread( void *arg )
+{
+    return WaitForSingleObject( arg, 5000 );
+}
+
+/* the objects must keep their state when another process gets a handle to them */
+static void test_detached_objects(void)
+{
+    STARTUPINFOA si = { sizeof(si) };
+    PROCESS_INFORMATION pi;
+    HANDLE event, wait_event, mutex, sem, thread, dup;
+    char cmdline[MAX_PATH], **argv;
+    DWORD ret, code;
+    LONG prev;
+    BOOL res;
+
+    winetest_get_mainargs( &argv );
+    sprintf( cmdline, "\"%s\" om", argv[0] );
+    res = CreateProcessA( NULL, cmdline, NULL, NULL, FALSE, CREATE_SUSPENDED, NULL, NULL, &si, &pi );
+    ok( res, "CreateProcess failed %u\n", GetLastError() );
+
+    event = CreateEventA( NULL, FALSE, TRUE, NULL );
+    wait_event = CreateEventA( NULL, TRUE, FALSE, NULL );
+    mutex = CreateMutexA( NULL, FALSE, NULL );
+    sem = CreateSemaphoreA( NULL, 2, 3, NULL );
+    ret = WaitForSingleObject( mutex, 0 );
+    ok( ret == WAIT_OBJECT_0, "wait failed %u\n", ret );
+    ret = WaitForSingleObject( mutex, 0 );
+    ok( ret == WAIT_OBJECT_0, "wait failed %u\n", ret );
+
+    thread = CreateThread( NULL, 0, detach_wait_thread, wait_event, 0, NULL );
+    ret = WaitForSingleObject( thread, 100 );
+    ok( ret == WAIT_TIMEOUT, "thread finished\n" );
+
+    res = DuplicateHandle( GetCurrentProcess(), event, pi.hProcess, &dup, 0, FALSE, DUPLICATE_SAME_ACCESS );
+    ok( res, "DuplicateHandle failed %u\n", GetLastError() );
+    res = DuplicateHandle( GetCurrentProcess(), wait_event, pi.hProcess, &dup, 0, FALSE, DUPLICATE_SAME_ACCESS );
+    ok( res, "DuplicateHandle failed %u\n", GetLastError() );
+    res = DuplicateHandle( GetCurrentProcess(), mutex, pi.hProcess, &dup, 0, FALSE, DUPLICATE_SAME_ACCESS );
+    ok( res, "DuplicateHandle failed %u\n", GetLastError() );
+    res = DuplicateHandle( GetCurrentProcess(), sem, pi.hProcess, &dup, 0, FALSE, DUPLICATE_SAME_ACCESS );
+    ok( res, "DuplicateHandle failed %u\n", GetLastError() );
+
+    /* the waiting thread is still woken up */
+    ret = WaitForSingleObject( thread, 100 );
+    ok( ret == WAIT_TIMEOUT, "thread finished\n" );
+    SetEvent( wait_event );
+    ret = WaitForSingleObject( thread, 1000 );
+    ok( ret == WAIT_OBJECT_0, "thread not finished\n" );
+    GetExitCodeThread( thread, &code );
+    ok( code == WAIT_OBJECT_0, "wait returned %u\n", code );
+    CloseHandle( thread );
+
+    ret = WaitForSingleObject( event, 0 );
+    ok( ret == WAIT_OBJECT_0, "event not signaled\n" );
+    ret = WaitForSingleObject( event, 0 );
+    ok( ret == WAIT_TIMEOUT, "event not reset\n" );
+    SetEvent( event );
+    ResetEvent( event );
+    ret = WaitForSingleObject( event, 0 );
+    ok( ret == WAIT_TIMEOUT, "event signaled\n" );
+
+    res = ReleaseSemaphore( sem, 1, &prev );
+    ok( res, "ReleaseSemaphore failed %u\n", GetLastError() );
+    ok( prev == 2, "got count %d\n", prev );
+    SetLastError( 0xdeadbeef );
+    res = ReleaseSemaphore( sem, 1, &prev );
+    ok( !res, "ReleaseSemaphore succeeded\n" );
+    ok( GetLastError() == ERROR_TOO_MANY_POSTS, "got error %u\n", GetLastError() );
+    ret = WaitForSingleObject( sem, 0 );
+    ok( ret == WAIT_OBJECT_0, "wait failed %u\n", ret );
+    ret = WaitForSingleObject( sem, 0 );
+    ok( ret == WAIT_OBJECT_0, "wait failed %u\n", ret );
+    ret = WaitForSingleObject( sem, 0 );
+    ok( ret == WAIT_OBJECT_0, "wait failed %u\n", ret );
+    ret = WaitForSingleObject( sem, 0 );
+    ok( ret == WAIT_TIMEOUT, "semaphore signaled\n" );
+
+    /* the recursion count of the mutex is kept */
+    res = ReleaseMutex( mutex );
+    ok( res, "ReleaseMutex failed %u\n", GetLastError() );
+    res = ReleaseMutex( mutex );
+    ok( res, "ReleaseMutex failed %u\n", GetLastError() );
+    SetLastError( 0xdeadbeef );
+    res = ReleaseMutex( mutex );
+    ok( !res, "ReleaseMutex succeeded\n" );
+    ok( GetLastError() == ERROR_NOT_OWNER, "got error %u\n", GetLastError() );
+    ret = WaitForSingleObject( mutex, 0 );
+    ok( ret == WAIT_OBJECT_0, "wait failed %u\n", ret );
+    res = ReleaseMutex( mutex );
+    ok( res, "ReleaseMutex failed %u\n", GetLastError() );
+
+    TerminateProcess( pi.hProcess, 0 );
+    WaitForSingleObject( pi.hProcess, 1000 );
+    CloseHandle( pi.hProcess );
+    CloseHandle( pi.hThread );
+    CloseHandle( event );
+    CloseHandle( wait_event );
+    CloseHandle( mutex );
+    CloseHandle( sem );
+}
+
+/* run the synchronization tests again with shared memory synchronization */
+static void test_shared_sync(void)
+{
+    STARTUPINFOA si = { sizeof(si) };
+    PROCESS_INFORMATION pi;
+    char cmdline[MAX_PATH], **argv;
+    BOOL res;
+
+    winetest_get_mainargs( &argv );
+    sprintf( cmdline, "\"%s\" om shared_sync", argv[0] );
+    SetEnvironmentVariableA( "WINEFSYNC", "1" );
+    res = CreateProcessA( NULL, cmdline, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi );
+    ok( res, "CreateProcess failed %u\n", GetLastError() );
+    SetEnvironmentVariableA( "WINEFSYNC", NULL );
+    winetest_wait_child_process( pi.hProcess );
+    CloseHandle( pi.hProcess );
+    CloseHandle( pi.hThread );
+}
+
 static const WCHAR keyed_nameW[] = {'\\','B','a','s','e','N','a','m','e','d','O','b','j','e','c','t','s',
                                     '\\','W','i','n','e','T','e','s','t','E','v','e','n','t',0};
 
@@ -2075,6 +2265,104 @@ static void test_mutant(void)
     NtClose( mutant );
 }
 
+static void test_handle_table(void)
+{
+    static const unsigned int count = 5000;
+    OBJECT_DATA_INFORMATION info;
+    HANDLE *handles, handle, max_handle = 0;
+    NTSTATUS status;
+    unsigned int i;
+
+    handles = HeapAlloc( GetProcessHeap(), 0, count * sizeof(*handles) );
+    for (i = 0; i < count; i++)
+    {
+        status = pNtCreateEvent( &handles[i], EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE );
+        ok( !status, "%u: NtCreateEvent failed %08x\n", i, status );
+        if (status) break;
+        if (handles[i] > max_handle) max_handle = handles[i];
+    }
+    ok( i == count, "got %u handles\n", i );
+
+    /* the most recently closed handle is reused first */
+    pNtClose( handles[count / 2] );
+    status = pNtQueryObject( handles[count / 2], ObjectDataInformation, &info, sizeof(info), NULL );
+    ok( status == STATUS_INVALID_HANDLE, "NtQueryObject returned %08x\n", status );
+    status = pNtCreateEvent( &handle, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE );
+    ok( !status, "NtCreateEvent failed %08x\n", status );
+    ok( handle == handles[count / 2], "got %p, expected %p\n", handle, handles[count / 2] );
+    handles[count / 2] = handle;
+
+    for (i = count; i > 0; i--)
+    {
+        status = pNtClose( handles[i - 1] );
+        ok( !status, "%u: NtClose failed %08x\n", i - 1, status );
+    }
+    for (i = 0; i < count; i += 500)
+    {
+        status = pNtQueryObject( handles[i], ObjectDataInformation, &info, sizeof(info), NULL );
+        ok( status == STATUS_INVALID_HANDLE, "%u: NtQueryObject returned %08x\n", i, status );
+    }
+
+    /* the freed entries are available again */
+    status = pNtCreateEvent( &handle, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE );
+    ok( !status, "NtCreateEvent failed %08x\n", status );
+    ok( handle < max_handle, "got %p, max %p\n", handle, max_handle );
+    status = pNtQueryObject( handle, ObjectDataInformation, &info, sizeof(info), NULL );
+    ok( !status, "NtQueryObject failed %08x\n", status );
+    ok( !info.InheritHandle && !info.ProtectFromClose, "got %u %u\n", info.InheritHandle, info.ProtectFromClose );
+    pNtClose( handle );
+    HeapFree( GetProcessHeap(), 0, handles );
+}
+
+static void test_handle_access(void)
+{
+    char path[MAX_PATH], buffer[16];
+    HANDLE file, event, dup;
+    DWORD size;
+    BOOL ret;
+
+    GetTempPathA( MAX_PATH, path );
+    GetTempFileNameA( path, "wine", 0, path );
+    file = CreateFileA( path, GENERIC_READ, 0, NULL, CREATE_ALWAYS, FILE_FLAG_DELETE_ON_CLOSE, NULL );
+    ok( file != INVALID_HANDLE_VALUE, "CreateFile failed %u\n", GetLastError() );
+
+    /* access checks give the same result before and after the fd is known */
+    SetLastError( 0xdeadbeef );
+    ret = WriteFile( file, "x", 1, &size, NULL );
+    ok( !ret && GetLastError() == ERROR_ACCESS_DENIED, "WriteFile returned %d %u\n", ret, GetLastError() );
+    ret = ReadFile( file, buffer, sizeof(buffer), &size, NULL );
+    ok( ret && !size, "ReadFile returned %d %u\n", ret, size );
+    SetLastError( 0xdeadbeef );
+    ret = WriteFile( file, "x", 1, &size, NULL );
+    ok( !ret && GetLastError() == ERROR_ACCESS_DENIED, "WriteFile returned %d %u\n", ret, GetLastError() );
+
+    ret = DuplicateHandle( GetCurrentProcess(), file, GetCurrentProcess(), &dup, 0, FALSE, DUPLICATE_SAME_ACCESS );
+    ok( ret, "DuplicateHandle failed %u\n", GetLastError() );
+    SetLastError( 0xdeadbeef );
+    ret = WriteFile( dup, "x", 1, &size, NULL );
+    ok( !ret && GetLastError() == ERROR_ACCESS_DENIED, "WriteFile returned %d %u\n", ret, GetLastError() );
+    CloseHandle( dup );
+    CloseHandle( file );
+
+    /* closed handles */
+    SetLastError( 0xdeadbeef );
+    ret = ReadFile( file, buffer, sizeof(buffer), &size, NULL );
+    ok( !ret && GetLastError() == ERROR_INVALID_HANDLE, "ReadFile returned %d %u\n", ret, GetLastError() );
+    SetLastError( 0xdeadbeef );
+    ret = DuplicateHandle( GetCurrentProcess(), file, GetCurrentProcess(), &dup, 0, FALSE, DUPLICATE_SAME_ACCESS );
+    ok( !ret && GetLastError() == ERROR_INVALID_HANDLE, "DuplicateHandle returned %d %u\n", ret, GetLastError() );
+
+    /* objects without an fd report the type mismatch before the missing access */
+    event = CreateEventA( NULL, TRUE, FALSE, NULL );
+    ret = DuplicateHandle( GetCurrentProcess(), event, GetCurrentProcess(), &dup, SYNCHRONIZE, FALSE, 0 );
+    ok( ret, "DuplicateHandle failed %u\n", GetLastError() );
+    SetLastError( 0xdeadbeef );
+    ret = ReadFile( dup, buffer, sizeof(buffer), &size, NULL );
+    ok( !ret && GetLastError() == ERROR_INVALID_HANDLE, "ReadFile returned %d %u\n", ret, GetLastError() );
+    CloseHandle( dup );
+    CloseHandle( event );
+}
+
 static void test_wait_on_address(void)
 {
     DWORD ticks;
@@ -2148,10 +2436,58 @@ static void test_wait_on_address(void)
     ok(address == 0, "got %s\n", wine_dbgstr_longlong(address));
 }
 
+static HANDLE benchmark_event;
+static LONG benchmark_failures;
+
+#define BENCHMARK_REQUESTS 20000
+
+static DWORD WINAPI benchmark_thread(void *arg)
+{
+    EVENT_BASIC_INFORMATION info;
+    NTSTATUS status;
+    int i;
+
+    for (i = 0; i < BENCHMARK_REQUESTS; i++)
+    {
+        status = pNtQueryEvent(benchmark_event, EventBasicInformation, &info, sizeof(info), NULL);
+        if (status || info.EventState != 1) InterlockedIncrement(&benchmark_failures);
+    }
+    return 0;
+}
+
+/* measure the server request throughput with several threads querying the same object */
+static void benchmark_query_requests(void)
+{
+    HANDLE threads[16];
+    SYSTEM_INFO si;
+    DWORD i, count, start;
+
+    GetSystemInfo(&si);
+    benchmark_event = CreateEventA(NULL, TRUE, TRUE, NULL);
+    ok(benchmark_event != NULL, "CreateEvent failed: %u\n", GetLastError());
+
+    for (count = 1; count <= ARRAY_SIZE(threads); count *= 2)
+    {
+        start = GetTickCount();
+        for (i = 0; i < count; i++)
+            threads[i] = CreateThread(NULL, 0, benchmark_thread, NULL, 0, NULL);
+        WaitForMultipleObjects(count, threads, TRUE, INFINITE);
+        trace("%u threads: %u query requests in %u ms\n", count, count * BENCHMARK_REQUESTS,
+              GetTickCount() - start);
+        for (i = 0; i < count; i++) CloseHandle(threads[i]);
+        if (count >= si.dwNumberOfProcessors) break;
+    }
+    ok(!benchmark_failures, "%u queries failed\n", benchmark_failures);
+
+    CloseHandle(benchmark_event);
+}
+
 START_TEST(om)
 {
     HMODULE hntdll = GetModuleHandleA("ntdll.dll");
     HMODULE hkernel32 = GetModuleHandleA("kernel32.dll");
+    char **argv;
+    int argc;
 
     if (!hntdll)
     {
@@ -2208,6 +2544,16 @@ START_TEST(om)
     pRtlWakeAddressAll      =  (void *)GetProcAddress(hntdll, "RtlWakeAddressAll");
     pRtlWakeAddressSingle   =  (void *)GetProcAddress(hntdll, "RtlWakeAddressSingle");
 
+    argc = winetest_get_mainargs( &argv );
+    if (argc >= 3 && !strcmp( argv[2], "shared_sync" ))
+    {
+        test_event();
+        test_event_pulse();
+        test_mutant();
+        test_detached_objects();
+        return;
+    }
+
     test_case_sensitive();
     test_namespace_pipe();
     test_name_collisions();
@@ -2217,8 +2563,14 @@ START_TEST(om)
     test_query_object();
     test_type_mismatch();
     test_event();
+    test_event_pulse();
     test_mutant();
+    test_detached_objects();
+    test_shared_sync();
     test_keyed_events();
     test_null_device();
     test_wait_on_address();
+    test_handle_table();
+    test_handle_access();
+    benchmark_query_requests();
 }
@@ -3322,6 +3322,87 @@ static void test_RtlLeaveCriticalSection(void)
     ok(!status, "RtlDeleteCriticalSection failed: %x\n", status);
 }
 
+struct critsect_contention_info
+{
+    CRITICAL_SECTION *crit;
+    LONG *counter;
+    HANDLE start;
+};
+
+#define CRITSECT_CONTENTION_LOOPS 100000
+
+static DWORD WINAPI critsect_contention_thread(void *param)
+{
+    struct critsect_contention_info *info = param;
+    int i;
+
+    WaitForSingleObject(info->start, INFINITE);
+    for (i = 0; i < CRITSECT_CONTENTION_LOOPS; i++)
+    {
+        RtlEnterCriticalSection(info->crit);
+        (*info->counter)++;
+        RtlLeaveCriticalSection(info->crit);
+    }
+    return 0;
+}
+
+static void test_critsect_contention(ULONG spincount, ULONG flags)
+{
+    struct critsect_contention_info info;
+    HANDLE threads[4];
+    CRITICAL_SECTION cs;
+    LONG counter = 0;
+    DWORD start;
+    int i;
+
+    pRtlInitializeCriticalSectionEx(&cs, spincount, flags);
+    info.crit = &cs;
+    info.counter = &counter;
+    info.start = CreateEventA(NULL, TRUE, FALSE, NULL);
+    for (i = 0; i < ARRAY_SIZE(threads); i++)
+        threads[i] = CreateThread(NULL, 0, critsect_contention_thread, &info, 0, NULL);
+
+    start = GetTickCount();
+    SetEvent(info.start);
+    for (i = 0; i < ARRAY_SIZE(threads); i++)
+    {
+        ok(!WaitForSingleObject(threads[i], 10000), "wait failed\n");
+        CloseHandle(threads[i]);
+    }
+
+    ok(counter == ARRAY_SIZE(threads) * CRITSECT_CONTENTION_LOOPS, "got counter %d\n", counter);
+    if (cs.DebugInfo)
+        trace("spin count %u flags %#x: %u ms, %u contended entries, %u waits\n", spincount, flags,
+              GetTickCount() - start, cs.DebugInfo->EntryCount, cs.DebugInfo->ContentionCount);
+
+    CloseHandle(info.start);
+    RtlDeleteCriticalSection(&cs);
+}
+
+static void test_RtlCriticalSectionContention(void)
+{
+    CRITICAL_SECTION cs;
+    ULONG spincount;
+
+    if (!pRtlInitializeCriticalSectionEx)
+    {
+        win_skip("RtlInitializeCriticalSectionEx is not available\n");
+        return;
+    }
+
+    pRtlInitializeCriticalSectionEx(&cs, 0, 0);
+    spincount = RtlSetCriticalSectionSpinCount(&cs, 100);
+    ok(!spincount || broken(spincount != 0) /* >= Win 8 */, "got spin count %u\n", spincount);
+    spincount = RtlSetCriticalSectionSpinCount(&cs, 0);
+    if (NtCurrentTeb()->Peb->NumberOfProcessors > 1)
+        ok(spincount == 100, "got spin count %u\n", spincount);
+    RtlDeleteCriticalSection(&cs);
+
+    test_critsect_contention(0, 0);
+    test_critsect_contention(4000, 0);
+    test_critsect_contention(0, RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN);
+}
+
 struct ldr_enum_context
 {
     BOOL abort;
@@ -3710,6 +3791,7 @@ START_TEST(rtl)
     test_RtlIsCriticalSectionLocked();
     test_RtlInitializeCriticalSectionEx();
     test_RtlLeaveCriticalSection();
+    test_RtlCriticalSectionContention();
     test_LdrEnumerateLoadedModules();
     test_RtlMakeSelfRelativeSD();
     test_LdrRegisterDllNotification();
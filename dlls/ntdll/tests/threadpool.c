@@ -714,6 +714,79 @@ static void test_tp_work_scheduler(void)
     pTpReleasePool(pool);
 }
 
+static struct
+{
+    TP_POOL *pool;
+    LONG count;
+    LONG total;
+    HANDLE done;
+} submit_info;
+
+static void CALLBACK submit_cb(TP_CALLBACK_INSTANCE *instance, void *userdata)
+{
+    if (InterlockedIncrement(&submit_info.count) == submit_info.total)
+        SetEvent(submit_info.done);
+}
+
+static DWORD WINAPI submit_thread(void *arg)
+{
+    TP_CALLBACK_ENVIRON environment;
+    NTSTATUS status;
+    LONG i, count = (LONG_PTR)arg;
+
+    memset(&environment, 0, sizeof(environment));
+    environment.Version = 1;
+    environment.Pool = submit_info.pool;
+    for (i = 0; i < count; i++)
+    {
+        status = pTpSimpleTryPost(submit_cb, NULL, &environment);
+        ok(!status, "TpSimpleTryPost failed with status %x\n", status);
+    }
+    return 0;
+}
+
+static void test_tp_multi_submit(void)
+{
+    HANDLE threads[64];
+    LONG count = winetest_interactive ? 100000 : 2000;
+    unsigned int i, num_threads;
+    NTSTATUS status;
+    DWORD result, start;
+
+    submit_info.done = CreateEventW(NULL, FALSE, FALSE, NULL);
+    ok(submit_info.done != NULL, "CreateEvent failed with %u\n", GetLastError());
+
+    /* callbacks posted concurrently from several threads are all executed */
+    for (num_threads = 1; num_threads <= ARRAY_SIZE(threads); num_threads *= 4)
+    {
+        submit_info.pool = NULL;
+        status = pTpAllocPool(&submit_info.pool, NULL);
+        ok(!status, "TpAllocPool failed with status %x\n", status);
+        ok(submit_info.pool != NULL, "expected pool != NULL\n");
+
+        submit_info.count = 0;
+        submit_info.total = num_threads * count;
+        start = GetTickCount();
+        for (i = 0; i < num_threads; i++)
+            threads[i] = CreateThread(NULL, 0, submit_thread, (void *)(LONG_PTR)count, 0, NULL);
+        for (i = 0; i < num_threads; i++)
+        {
+            result = WaitForSingleObject(threads[i], 30000);
+            ok(result == WAIT_OBJECT_0, "WaitForSingleObject returned %u\n", result);
+            CloseHandle(threads[i]);
+        }
+        result = WaitForSingleObject(submit_info.done, 30000);
+        ok(result == WAIT_OBJECT_0, "WaitForSingleObject returned %u\n", result);
+        ok(submit_info.count == submit_info.total, "expected %d callbacks, got %d\n",
+           submit_info.total, submit_info.count);
+        trace("%u threads: %d callbacks in %u ms\n", num_threads, submit_info.total, GetTickCount() - start);
+
+        pTpReleasePool(submit_info.pool);
+    }
+
+    CloseHandle(submit_info.done);
+}
+
 static void CALLBACK simple_release_cb(TP_CALLBACK_INSTANCE *instance, void *userdata)
 {
     HANDLE *semaphores = userdata;
@@ -1787,6 +1860,74 @@ static void test_tp_wait(void)
     CloseHandle(semaphores[1]);
 }
 
+static struct
+{
+    HANDLE semaphore;
+    LONG count;
+    BOOL done;
+} rearm_wait_info;
+
+static void CALLBACK rearm_wait_cb(TP_CALLBACK_INSTANCE *instance, void *userdata,
+                                   TP_WAIT *wait, TP_WAIT_RESULT result)
+{
+    ok(result == WAIT_OBJECT_0, "unexpected result %u\n", result);
+    InterlockedIncrement(&rearm_wait_info.count);
+}
+
+static DWORD WINAPI rearm_release_thread(void *arg)
+{
+    LONG i, count = (LONG_PTR)arg;
+
+    for (i = 0; i < count; i++)
+    {
+        ReleaseSemaphore(rearm_wait_info.semaphore, 1, NULL);
+        if (!(i % 16)) Sleep(0);
+    }
+    rearm_wait_info.done = TRUE;
+    return 0;
+}
+
+static void test_tp_wait_rearm(void)
+{
+    LONG remaining = 0, count = winetest_interactive ? 100000 : 5000;
+    TP_CALLBACK_ENVIRON environment;
+    TP_WAIT *wait = NULL;
+    NTSTATUS status;
+    TP_POOL *pool;
+    HANDLE thread;
+    DWORD result;
+
+    status = pTpAllocPool(&pool, NULL);
+    ok(!status, "TpAllocPool failed with status %x\n", status);
+    memset(&environment, 0, sizeof(environment));
+    environment.Version = 1;
+    environment.Pool = pool;
+    status = pTpAllocWait(&wait, rearm_wait_cb, NULL, &environment);
+    ok(!status, "TpAllocWait failed with status %x\n", status);
+
+    /* every semaphore count taken by a wait that gets re-armed is reported */
+    rearm_wait_info.semaphore = CreateSemaphoreW(NULL, 0, count, NULL);
+    ok(rearm_wait_info.semaphore != NULL, "failed to create semaphore\n");
+    rearm_wait_info.count = 0;
+    rearm_wait_info.done = FALSE;
+    thread = CreateThread(NULL, 0, rearm_release_thread, (void *)(LONG_PTR)count, 0, NULL);
+    ok(thread != NULL, "CreateThread failed with %u\n", GetLastError());
+    while (!rearm_wait_info.done) pTpSetWait(wait, rearm_wait_info.semaphore, NULL);
+    result = WaitForSingleObject(thread, 5000);
+    ok(result == WAIT_OBJECT_0, "WaitForSingleObject returned %u\n", result);
+    CloseHandle(thread);
+
+    pTpSetWait(wait, NULL, NULL);
+    pTpWaitForWait(wait, FALSE);
+    while (WaitForSingleObject(rearm_wait_info.semaphore, 0) == WAIT_OBJECT_0) remaining++;
+    ok(rearm_wait_info.count + remaining == count, "got %d callbacks and %d remaining counts, expected %d\n",
+       rearm_wait_info.count, remaining, count);
+
+    pTpReleaseWait(wait);
+    pTpReleasePool(pool);
+    CloseHandle(rearm_wait_info.semaphore);
+}
+
 static struct
 {
     HANDLE semaphore;
@@ -1917,6 +2058,7 @@ START_TEST(threadpool)
     test_tp_simple();
     test_tp_work();
     test_tp_work_scheduler();
+    test_tp_multi_submit();
     test_tp_group_wait();
     test_tp_group_cancel();
     test_tp_instance();
@@ -1924,5 +2066,6 @@ START_TEST(threadpool)
     test_tp_timer();
     test_tp_window_length();
     test_tp_wait();
+    test_tp_wait_rearm();
     test_tp_multi_wait();
 }
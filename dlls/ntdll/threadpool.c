@@ -114,7 +114,21 @@ struct timer_queue
  */
 
 #define THREADPOOL_WORKER_TIMEOUT 5000
-#define MAXIMUM_WAITQUEUE_OBJECTS (MAXIMUM_WAIT_OBJECTS - 1)
+#define THREADPOOL_QUEUES 16  /* number of work queues per pool */
+
+/* Work items are spread over several queues, so that threads submitting
+ * callbacks concurrently don't contend on a single lock. An object always uses
+ * the queue selected from the id of the thread that created it, and its state
+ * is protected by the lock of that queue. Worker threads look for work in the
+ * queue of their own thread id first, and steal it from the other queues in
+ * order; a higher priority item is always preferred over a lower priority one.
+ * Idle workers wait on the address of .wake_seq. */
+struct threadpool_queue
+{
+    RTL_SRWLOCK             lock;
+    /* work items, order matches TP_CALLBACK_PRIORITY - high, normal, low. */
+    struct list             items[3];
+};
 
 /* internal threadpool representation */
 struct threadpool
@@ -123,14 +137,14 @@ struct threadpool
     LONG                    objcount;
     BOOL                    shutdown;
     CRITICAL_SECTION        cs;
-    /* Pools of work items, locked via .cs, order matches TP_CALLBACK_PRIORITY - high, normal, low. */
-    struct list             pools[3];
-    RTL_CONDITION_VARIABLE  update_event;
-    /* information about worker threads, locked via .cs */
+    struct threadpool_queue queues[THREADPOOL_QUEUES];
+    LONG                    wake_seq;
+    /* information about worker threads, changed via .cs or interlocked functions */
     int                     max_workers;
     int                     min_workers;
-    int                     num_workers;
-    int                     num_busy_workers;
+    LONG                    num_workers;
+    LONG                    num_busy_workers;
+    LONG                    num_idle_workers;
     TP_POOL_STACK_INFORMATION stack_info;
 };
 
@@ -150,6 +164,7 @@ struct threadpool_object
     /* read-only information */
     enum threadpool_objtype type;
     struct threadpool       *pool;
+    struct threadpool_queue *queue;
     struct threadpool_group *group;
     PVOID                   userdata;
     PTP_CLEANUP_GROUP_CANCEL_CALLBACK group_cancel_callback;
@@ -160,7 +175,7 @@ struct threadpool_object
     /* information about the group, locked via .group->cs */
     struct list             group_entry;
     BOOL                    is_group_member;
-    /* information about the pool, locked via .pool->cs */
+    /* information about the pool, locked via .queue->lock */
     struct list             pool_entry;
     RTL_CONDITION_VARIABLE  finished_event;
     RTL_CONDITION_VARIABLE  group_finished_event;
@@ -193,9 +208,10 @@ struct threadpool_object
         struct
         {
             PTP_WAIT_CALLBACK callback;
-            LONG            signaled;
+            LONG            signaled;  /* locked via .queue->lock */
             /* information about the wait object, locked via waitqueue.cs */
-            struct waitqueue_bucket *bucket;
+            HANDLE          packet;
+            ULONG_PTR       seq;
             BOOL            wait_pending;
             struct list     wait_entry;
             ULONGLONG       timeout;
@@ -259,20 +275,35 @@ static RTL_CRITICAL_SECTION_DEBUG timerqueue_debug =
       0, 0, { (DWORD_PTR)(__FILE__ ": timerqueue.cs") }
 };
 
-/* global waitqueue object */
+/* global waitqueue object
+ *
+ * Each wait object owns a wait completion packet, which the server queues to
+ * the completion port of the wait queue once the object is signaled, so that
+ * a single thread can service any number of waits. An armed packet holds a
+ * reference to the wait object, it is released by the thread receiving the
+ * packet, or when the packet is cancelled before it is received. The packet
+ * value is the sequence number of the wait, to ignore stale packets. The
+ * waited objects are acquired by the wait queue thread, as if it waited for
+ * them itself. The port and the thread are released when the thread exits. */
 static RTL_CRITICAL_SECTION_DEBUG waitqueue_debug;
 
 static struct
 {
     CRITICAL_SECTION        cs;
-    LONG                    num_buckets;
-    struct list             buckets;
+    LONG                    objcount;
+    BOOL                    thread_running;
+    HANDLE                  thread;
+    HANDLE                  port;
+    struct list             pending_waits;
 }
 waitqueue =
 {
     { &waitqueue_debug, -1, 0, 0, 0, 0 },       /* cs */
-    0,                                          /* num_buckets */
-    LIST_INIT( waitqueue.buckets )              /* buckets */
+    0,                                          /* objcount */
+    FALSE,                                      /* thread_running */
+    NULL,                                       /* thread */
+    NULL,                                       /* port */
+    LIST_INIT( waitqueue.pending_waits )        /* pending_waits */
 };
 
 static RTL_CRITICAL_SECTION_DEBUG waitqueue_debug =
@@ -282,15 +313,6 @@ static RTL_CRITICAL_SECTION_DEBUG waitqueue_debug =
       0, 0, { (DWORD_PTR)(__FILE__ ": waitqueue.cs") }
 };
 
-struct waitqueue_bucket
-{
-    struct list             bucket_entry;
-    LONG                    objcount;
-    struct list             reserved;
-    struct list             waiting;
-    HANDLE                  update_event;
-};
-
 static inline struct threadpool *impl_from_TP_POOL( TP_POOL *pool )
 {
     return (struct threadpool *)pool;
@@ -343,6 +365,11 @@ static inline LONG interlocked_dec( PLONG dest )
     return interlocked_xchg_add( dest, -1 ) - 1;
 }
 
+static inline unsigned int tp_threadpool_get_queue_index(void)
+{
+    return (GetCurrentThreadId() / 4) % THREADPOOL_QUEUES;
+}
+
 static void CALLBACK process_rtl_work_item( TP_CALLBACK_INSTANCE *instance, void *userdata )
 {
     struct rtl_work_item *item = userdata;
@@ -1312,8 +1339,8 @@ static NTSTATUS tp_new_worker_thread( struct threadpool *pool )
     if (status == STATUS_SUCCESS)
     {
         interlocked_inc( &pool->refcount );
-        pool->num_workers++;
-        pool->num_busy_workers++;
+        interlocked_inc( &pool->num_workers );
+        interlocked_inc( &pool->num_busy_workers );
         NtClose( thread );
     }
     return status;
@@ -1393,17 +1420,82 @@ static void tp_timerqueue_unlock( struct threadpool_object *timer )
     RtlLeaveCriticalSection( &timerqueue.cs );
 }
 
+/***********************************************************************
+ *           tp_waitqueue_arm    (internal)
+ *
+ * Starts waiting for the handle of a wait object, the caller holds waitqueue.cs.
+ */
+static void tp_waitqueue_arm( struct threadpool_object *wait, ULONGLONG timeout )
+{
+    struct threadpool_object *other_wait;
+    NTSTATUS status;
+
+    assert( !wait->u.wait.wait_pending );
+
+    interlocked_inc( &wait->refcount );
+    status = associate_wait_packet( wait->u.wait.packet, waitqueue.port, wait->u.wait.handle, waitqueue.thread,
+                                    wait, (void *)++wait->u.wait.seq, STATUS_SUCCESS, 0, NULL );
+    if (status)
+    {
+        WARN( "failed to wait for %p, status %x\n", wait->u.wait.handle, status );
+        tp_object_release( wait );
+        return;
+    }
+
+    wait->u.wait.wait_pending = TRUE;
+    wait->u.wait.timeout = timeout;
+    if (timeout == TIMEOUT_INFINITE)
+        return;
+
+    LIST_FOR_EACH_ENTRY( other_wait, &waitqueue.pending_waits,
+                         struct threadpool_object, u.wait.wait_entry )
+    {
+        assert( other_wait->type == TP_OBJECT_TYPE_WAIT );
+        if (timeout < other_wait->u.wait.timeout)
+            break;
+    }
+    list_add_before( &other_wait->u.wait.wait_entry, &wait->u.wait.wait_entry );
+
+    /* Wake up the wait queue thread when the timeout has to be updated. */
+    if (list_head( &waitqueue.pending_waits ) == &wait->u.wait.wait_entry)
+        NtSetIoCompletion( waitqueue.port, 0, 0, STATUS_SUCCESS, 0 );
+}
+
+/***********************************************************************
+ *           tp_waitqueue_disarm    (internal)
+ *
+ * Stops waiting for the handle of a wait object, the caller holds waitqueue.cs.
+ * Returns TRUE if the wait was already satisfied.
+ */
+static BOOL tp_waitqueue_disarm( struct threadpool_object *wait )
+{
+    NTSTATUS status;
+
+    if (!wait->u.wait.wait_pending)
+        return FALSE;
+
+    wait->u.wait.wait_pending = FALSE;
+    if (wait->u.wait.timeout != TIMEOUT_INFINITE)
+        list_remove( &wait->u.wait.wait_entry );
+
+    /* If the packet was already received, the wait queue thread releases the reference,
+     * and discards the packet since the wait is no longer pending. */
+    status = NtCancelWaitCompletionPacket( wait->u.wait.packet, TRUE );
+    if (status != STATUS_PENDING)
+        tp_object_release( wait );
+    return status == STATUS_CANCELLED || status == STATUS_PENDING;
+}
+
 /***********************************************************************
  *           waitqueue_thread_proc    (internal)
  */
 static void CALLBACK waitqueue_thread_proc( void *param )
 {
-    struct threadpool_object *objects[MAXIMUM_WAITQUEUE_OBJECTS];
-    HANDLE handles[MAXIMUM_WAITQUEUE_OBJECTS + 1];
-    struct waitqueue_bucket *bucket = param;
-    struct threadpool_object *wait, *next;
+    struct threadpool_object *wait;
     LARGE_INTEGER now, timeout;
-    DWORD num_handles;
+    ULONG_PTR key, value;
+    IO_STATUS_BLOCK iosb;
+    struct list *ptr;
     NTSTATUS status;
 
     TRACE( "starting wait queue thread\n" );
@@ -1414,133 +1506,58 @@ static void CALLBACK waitqueue_thread_proc( void *param )
     {
         NtQuerySystemTime( &now );
         timeout.QuadPart = TIMEOUT_INFINITE;
-        num_handles = 0;
 
-        LIST_FOR_EACH_ENTRY_SAFE( wait, next, &bucket->waiting, struct threadpool_object,
-                                  u.wait.wait_entry )
+        while ((ptr = list_head( &waitqueue.pending_waits )))
         {
+            wait = LIST_ENTRY( ptr, struct threadpool_object, u.wait.wait_entry );
             assert( wait->type == TP_OBJECT_TYPE_WAIT );
-            if (wait->u.wait.timeout <= now.QuadPart)
-            {
-                /* Wait object timed out. */
-                list_remove( &wait->u.wait.wait_entry );
-                list_add_tail( &bucket->reserved, &wait->u.wait.wait_entry );
-                tp_object_submit( wait, FALSE );
-            }
-            else
+            if (wait->u.wait.timeout > now.QuadPart)
             {
-                if (wait->u.wait.timeout < timeout.QuadPart)
-                    timeout.QuadPart = wait->u.wait.timeout;
-
-                assert( num_handles < MAXIMUM_WAITQUEUE_OBJECTS );
-                interlocked_inc( &wait->refcount );
-                objects[num_handles] = wait;
-                handles[num_handles] = wait->u.wait.handle;
-                num_handles++;
+                timeout.QuadPart = wait->u.wait.timeout;
+                break;
             }
+
+            /* Wait object timed out, unless it was signaled in the meantime. */
+            tp_object_submit( wait, tp_waitqueue_disarm( wait ) );
         }
 
-        if (!bucket->objcount)
-        {
-            /* All wait objects have been destroyed, if no new wait objects are created
-             * within some amount of time, then we can shutdown this thread. */
-            assert( num_handles == 0 );
-            RtlLeaveCriticalSection( &waitqueue.cs );
+        /* All wait objects have been destroyed, if no new wait objects are created
+         * within some amount of time, then we can shutdown this thread. */
+        if (!waitqueue.objcount)
             timeout.QuadPart = (ULONGLONG)THREADPOOL_WORKER_TIMEOUT * -10000;
-            status = NtWaitForMultipleObjects( 1, &bucket->update_event, TRUE, FALSE, &timeout );
-            RtlEnterCriticalSection( &waitqueue.cs );
 
-            if (status == STATUS_TIMEOUT && !bucket->objcount)
-                break;
-        }
-        else
-        {
-            handles[num_handles] = bucket->update_event;
-            RtlLeaveCriticalSection( &waitqueue.cs );
-            status = NtWaitForMultipleObjects( num_handles + 1, handles, TRUE, FALSE, &timeout );
-            RtlEnterCriticalSection( &waitqueue.cs );
+        RtlLeaveCriticalSection( &waitqueue.cs );
+        status = NtRemoveIoCompletion( waitqueue.port, &key, &value, &iosb, &timeout );
+        RtlEnterCriticalSection( &waitqueue.cs );
 
-            if (status >= STATUS_WAIT_0 && status < STATUS_WAIT_0 + num_handles)
+        if (status == STATUS_SUCCESS && key)
+        {
+            wait = (struct threadpool_object *)key;
+            assert( wait->type == TP_OBJECT_TYPE_WAIT );
+            if (wait->u.wait.wait_pending && wait->u.wait.seq == value)
             {
-                wait = objects[status - STATUS_WAIT_0];
-                assert( wait->type == TP_OBJECT_TYPE_WAIT );
-                if (wait->u.wait.bucket)
-                {
-                    /* Wait object signaled. */
-                    assert( wait->u.wait.bucket == bucket );
+                /* Wait object signaled. */
+                wait->u.wait.wait_pending = FALSE;
+                if (wait->u.wait.timeout != TIMEOUT_INFINITE)
                     list_remove( &wait->u.wait.wait_entry );
-                    list_add_tail( &bucket->reserved, &wait->u.wait.wait_entry );
-                    tp_object_submit( wait, TRUE );
-                }
-                else
-                    WARN("wait object %p triggered while object was destroyed\n", wait);
-            }
-
-            /* Release temporary references to wait objects. */
-            while (num_handles)
-            {
-                wait = objects[--num_handles];
-                assert( wait->type == TP_OBJECT_TYPE_WAIT );
-                tp_object_release( wait );
+                tp_object_submit( wait, TRUE );
             }
-        }
 
-        /* Try to merge bucket with other threads. */
-        if (waitqueue.num_buckets > 1 && bucket->objcount &&
-            bucket->objcount <= MAXIMUM_WAITQUEUE_OBJECTS * 1 / 3)
-        {
-            struct waitqueue_bucket *other_bucket;
-            LIST_FOR_EACH_ENTRY( other_bucket, &waitqueue.buckets, struct waitqueue_bucket, bucket_entry )
-            {
-                if (other_bucket != bucket && other_bucket->objcount &&
-                    other_bucket->objcount + bucket->objcount <= MAXIMUM_WAITQUEUE_OBJECTS * 2 / 3)
-                {
-                    other_bucket->objcount += bucket->objcount;
-                    bucket->objcount = 0;
-
-                    /* Update reserved list. */
-                    LIST_FOR_EACH_ENTRY( wait, &bucket->reserved, struct threadpool_object, u.wait.wait_entry )
-                    {
-                        assert( wait->type == TP_OBJECT_TYPE_WAIT );
-                        wait->u.wait.bucket = other_bucket;
-                    }
-                    list_move_tail( &other_bucket->reserved, &bucket->reserved );
-
-                    /* Update waiting list. */
-                    LIST_FOR_EACH_ENTRY( wait, &bucket->waiting, struct threadpool_object, u.wait.wait_entry )
-                    {
-                        assert( wait->type == TP_OBJECT_TYPE_WAIT );
-                        wait->u.wait.bucket = other_bucket;
-                    }
-                    list_move_tail( &other_bucket->waiting, &bucket->waiting );
-
-                    /* Move bucket to the end, to keep the probability of
-                     * newly added wait objects as small as possible. */
-                    list_remove( &bucket->bucket_entry );
-                    list_add_tail( &waitqueue.buckets, &bucket->bucket_entry );
-
-                    NtSetEvent( other_bucket->update_event, NULL );
-                    break;
-                }
-            }
+            /* Release the reference of the packet. */
+            tp_object_release( wait );
         }
+        else if (status == STATUS_TIMEOUT && !waitqueue.objcount)
+            break;
     }
 
-    /* Remove this bucket from the list. */
-    list_remove( &bucket->bucket_entry );
-    if (!--waitqueue.num_buckets)
-        assert( list_empty( &waitqueue.buckets ) );
-
+    waitqueue.thread_running = FALSE;
+    NtClose( waitqueue.thread );
+    waitqueue.thread = NULL;
+    NtClose( waitqueue.port );
+    waitqueue.port = NULL;
     RtlLeaveCriticalSection( &waitqueue.cs );
 
     TRACE( "terminating wait queue thread\n" );
-
-    assert( bucket->objcount == 0 );
-    assert( list_empty( &bucket->reserved ) );
-    assert( list_empty( &bucket->waiting ) );
-    NtClose( bucket->update_event );
-
-    RtlFreeHeap( GetProcessHeap(), 0, bucket );
     RtlExitUserThread( 0 );
 }
 
@@ -1549,71 +1566,36 @@ static void CALLBACK waitqueue_thread_proc( void *param )
  */
 static NTSTATUS tp_waitqueue_lock( struct threadpool_object *wait )
 {
-    struct waitqueue_bucket *bucket;
-    NTSTATUS status;
-    HANDLE thread;
+    NTSTATUS status = STATUS_SUCCESS;
     assert( wait->type == TP_OBJECT_TYPE_WAIT );
 
     wait->u.wait.signaled       = 0;
-    wait->u.wait.bucket         = NULL;
+    wait->u.wait.packet         = NULL;
+    wait->u.wait.seq            = 0;
     wait->u.wait.wait_pending   = FALSE;
     wait->u.wait.timeout        = 0;
     wait->u.wait.handle         = INVALID_HANDLE_VALUE;
 
     RtlEnterCriticalSection( &waitqueue.cs );
 
-    /* Try to assign to existing bucket if possible. */
-    LIST_FOR_EACH_ENTRY( bucket, &waitqueue.buckets, struct waitqueue_bucket, bucket_entry )
+    if (!waitqueue.port)
     {
-        if (bucket->objcount < MAXIMUM_WAITQUEUE_OBJECTS)
-        {
-            list_add_tail( &bucket->reserved, &wait->u.wait.wait_entry );
-            wait->u.wait.bucket = bucket;
-            bucket->objcount++;
-
-            status = STATUS_SUCCESS;
-            goto out;
-        }
+        status = NtCreateIoCompletion( &waitqueue.port, IO_COMPLETION_ALL_ACCESS, NULL, 1 );
+        if (status) goto out;
     }
 
-    /* Create a new bucket and corresponding worker thread. */
-    bucket = RtlAllocateHeap( GetProcessHeap(), 0, sizeof(*bucket) );
-    if (!bucket)
+    /* Make sure that the wait queue thread is running. */
+    if (!waitqueue.thread_running)
     {
-        status = STATUS_NO_MEMORY;
-        goto out;
-    }
-
-    bucket->objcount = 0;
-    list_init( &bucket->reserved );
-    list_init( &bucket->waiting );
-
-    status = NtCreateEvent( &bucket->update_event, EVENT_ALL_ACCESS,
-                            NULL, SynchronizationEvent, FALSE );
-    if (status)
-    {
-        RtlFreeHeap( GetProcessHeap(), 0, bucket );
-        goto out;
+        status = RtlCreateUserThread( GetCurrentProcess(), NULL, FALSE, NULL, 0, 0,
+                                      waitqueue_thread_proc, NULL, &waitqueue.thread, NULL );
+        if (status) goto out;
+        waitqueue.thread_running = TRUE;
     }
 
-    status = RtlCreateUserThread( GetCurrentProcess(), NULL, FALSE, NULL, 0, 0,
-                                  waitqueue_thread_proc, bucket, &thread, NULL );
+    status = NtCreateWaitCompletionPacket( &wait->u.wait.packet, GENERIC_ALL, NULL );
     if (status == STATUS_SUCCESS)
-    {
-        list_add_tail( &waitqueue.buckets, &bucket->bucket_entry );
-        waitqueue.num_buckets++;
-
-        list_add_tail( &bucket->reserved, &wait->u.wait.wait_entry );
-        wait->u.wait.bucket = bucket;
-        bucket->objcount++;
-
-        NtClose( thread );
-    }
-    else
-    {
-        NtClose( bucket->update_event );
-        RtlFreeHeap( GetProcessHeap(), 0, bucket );
-    }
+        waitqueue.objcount++;
 
 out:
     RtlLeaveCriticalSection( &waitqueue.cs );
@@ -1628,16 +1610,18 @@ static void tp_waitqueue_unlock( struct threadpool_object *wait )
     assert( wait->type == TP_OBJECT_TYPE_WAIT );
 
     RtlEnterCriticalSection( &waitqueue.cs );
-    if (wait->u.wait.bucket)
+    if (wait->u.wait.packet)
     {
-        struct waitqueue_bucket *bucket = wait->u.wait.bucket;
-        assert( bucket->objcount > 0 );
-
-        list_remove( &wait->u.wait.wait_entry );
-        wait->u.wait.bucket = NULL;
-        bucket->objcount--;
+        tp_waitqueue_disarm( wait );
+        NtClose( wait->u.wait.packet );
+        wait->u.wait.packet = NULL;
 
-        NtSetEvent( bucket->update_event, NULL );
+        /* If the last wait object was destroyed, then wake up the thread. */
+        if (!--waitqueue.objcount)
+        {
+            assert( list_empty( &waitqueue.pending_waits ) );
+            NtSetIoCompletion( waitqueue.port, 0, 0, STATUS_SUCCESS, 0 );
+        }
     }
     RtlLeaveCriticalSection( &waitqueue.cs );
 }
@@ -1651,7 +1635,7 @@ static NTSTATUS tp_threadpool_alloc( struct threadpool **out )
 {
     IMAGE_NT_HEADERS *nt = RtlImageNtHeader( NtCurrentTeb()->Peb->ImageBaseAddress );
     struct threadpool *pool;
-    unsigned int i;
+    unsigned int i, j;
 
     pool = RtlAllocateHeap( GetProcessHeap(), 0, sizeof(*pool) );
     if (!pool)
@@ -1664,14 +1648,19 @@ static NTSTATUS tp_threadpool_alloc( struct threadpool **out )
     RtlInitializeCriticalSection( &pool->cs );
     pool->cs.DebugInfo->Spare[0] = (DWORD_PTR)(__FILE__ ": threadpool.cs");
 
-    for (i = 0; i < ARRAY_SIZE(pool->pools); ++i)
-        list_init( &pool->pools[i] );
-    RtlInitializeConditionVariable( &pool->update_event );
+    for (i = 0; i < ARRAY_SIZE(pool->queues); ++i)
+    {
+        RtlInitializeSRWLock( &pool->queues[i].lock );
+        for (j = 0; j < ARRAY_SIZE(pool->queues[i].items); ++j)
+            list_init( &pool->queues[i].items[j] );
+    }
+    pool->wake_seq                = 0;
 
     pool->max_workers             = 500;
     pool->min_workers             = 0;
     pool->num_workers             = 0;
     pool->num_busy_workers        = 0;
+    pool->num_idle_workers        = 0;
     pool->stack_info.StackReserve = nt->OptionalHeader.SizeOfStackReserve;
     pool->stack_info.StackCommit  = nt->OptionalHeader.SizeOfStackCommit;
 
@@ -1693,7 +1682,8 @@ static void tp_threadpool_shutdown( struct threadpool *pool )
     assert( pool != default_threadpool );
 
     pool->shutdown = TRUE;
-    RtlWakeAllConditionVariable( &pool->update_event );
+    interlocked_inc( &pool->wake_seq );
+    RtlWakeAddressAll( &pool->wake_seq );
 }
 
 /***********************************************************************
@@ -1703,7 +1693,7 @@ static void tp_threadpool_shutdown( struct threadpool *pool )
  */
 static BOOL tp_threadpool_release( struct threadpool *pool )
 {
-    unsigned int i;
+    unsigned int i, j;
 
     if (interlocked_dec( &pool->refcount ))
         return FALSE;
@@ -1712,8 +1702,9 @@ static BOOL tp_threadpool_release( struct threadpool *pool )
 
     assert( pool->shutdown );
     assert( !pool->objcount );
-    for (i = 0; i < ARRAY_SIZE(pool->pools); ++i)
-        assert( list_empty( &pool->pools[i] ) );
+    for (i = 0; i < ARRAY_SIZE(pool->queues); ++i)
+        for (j = 0; j < ARRAY_SIZE(pool->queues[i].items); ++j)
+            assert( list_empty( &pool->queues[i].items[j] ) );
 
     pool->cs.DebugInfo->Spare[0] = 0;
     RtlDeleteCriticalSection( &pool->cs );
@@ -1882,6 +1873,7 @@ static void tp_object_initialize( struct threadpool_object *object, struct threa
     object->shutdown                = FALSE;
 
     object->pool                    = pool;
+    object->queue                   = &pool->queues[tp_threadpool_get_queue_index()];
     object->group                   = NULL;
     object->userdata                = userdata;
     object->group_cancel_callback   = NULL;
@@ -1915,7 +1907,7 @@ static void tp_object_initialize( struct threadpool_object *object, struct threa
             TP_CALLBACK_ENVIRON_V3 *environment_v3 = (TP_CALLBACK_ENVIRON_V3 *)environment;
 
             object->priority = environment_v3->CallbackPriority;
-            assert( object->priority < ARRAY_SIZE(pool->pools) );
+            assert( object->priority < ARRAY_SIZE(pool->queues[0].items) );
         }
 
         if (environment->ActivationContext)
@@ -1954,7 +1946,33 @@ static void tp_object_initialize( struct threadpool_object *object, struct threa
 
 static void tp_object_prio_queue( struct threadpool_object *object )
 {
-    list_add_tail( &object->pool->pools[object->priority], &object->pool_entry );
+    list_add_tail( &object->queue->items[object->priority], &object->pool_entry );
+}
+
+/***********************************************************************
+ *           tp_threadpool_wake    (internal)
+ *
+ * Makes sure that a worker thread will process a newly queued work item.
+ */
+static void tp_threadpool_wake( struct threadpool *pool )
+{
+    /* The queue lock has been released, so this can't be reordered before
+     * the item was queued. An idle worker checks the queues after
+     * incrementing num_idle_workers, so at least one of them will notice. */
+    if (*(volatile LONG *)&pool->num_idle_workers)
+    {
+        interlocked_inc( &pool->wake_seq );
+        RtlWakeAddressSingle( &pool->wake_seq );
+        return;
+    }
+
+    /* Start new worker threads if required. */
+    if (*(volatile LONG *)&pool->num_busy_workers < *(volatile LONG *)&pool->num_workers) return;
+
+    RtlEnterCriticalSection( &pool->cs );
+    if (pool->num_busy_workers >= pool->num_workers && pool->num_workers < pool->max_workers)
+        tp_new_worker_thread( pool );
+    RtlLeaveCriticalSection( &pool->cs );
 }
 
 /***********************************************************************
@@ -1965,18 +1983,12 @@ static void tp_object_prio_queue( struct threadpool_object *object )
  */
 static void tp_object_submit( struct threadpool_object *object, BOOL signaled )
 {
-    struct threadpool *pool = object->pool;
-    NTSTATUS status = STATUS_UNSUCCESSFUL;
+    struct threadpool_queue *queue = object->queue;
 
     assert( !object->shutdown );
-    assert( !pool->shutdown );
+    assert( !object->pool->shutdown );
 
-    RtlEnterCriticalSection( &pool->cs );
-
-    /* Start new worker threads if required. */
-    if (pool->num_busy_workers >= pool->num_workers &&
-        pool->num_workers < pool->max_workers)
-        status = tp_new_worker_thread( pool );
+    RtlAcquireSRWLockExclusive( &queue->lock );
 
     /* Queue work item and increment refcount. */
     interlocked_inc( &object->refcount );
@@ -1987,14 +1999,9 @@ static void tp_object_submit( struct threadpool_object *object, BOOL signaled )
     if (object->type == TP_OBJECT_TYPE_WAIT && signaled)
         object->u.wait.signaled++;
 
-    /* No new thread started - wake up one existing thread. */
-    if (status != STATUS_SUCCESS)
-    {
-        assert( pool->num_workers > 0 );
-        RtlWakeConditionVariable( &pool->update_event );
-    }
+    RtlReleaseSRWLockExclusive( &queue->lock );
 
-    RtlLeaveCriticalSection( &pool->cs );
+    tp_threadpool_wake( object->pool );
 }
 
 /***********************************************************************
@@ -2004,10 +2011,10 @@ static void tp_object_submit( struct threadpool_object *object, BOOL signaled )
  */
 static void tp_object_cancel( struct threadpool_object *object )
 {
-    struct threadpool *pool = object->pool;
+    struct threadpool_queue *queue = object->queue;
     LONG pending_callbacks = 0;
 
-    RtlEnterCriticalSection( &pool->cs );
+    RtlAcquireSRWLockExclusive( &queue->lock );
     if (object->num_pending_callbacks)
     {
         pending_callbacks = object->num_pending_callbacks;
@@ -2017,7 +2024,7 @@ static void tp_object_cancel( struct threadpool_object *object )
         if (object->type == TP_OBJECT_TYPE_WAIT)
             object->u.wait.signaled = 0;
     }
-    RtlLeaveCriticalSection( &pool->cs );
+    RtlReleaseSRWLockExclusive( &queue->lock );
 
     while (pending_callbacks--)
         tp_object_release( object );
@@ -2031,20 +2038,20 @@ static void tp_object_cancel( struct threadpool_object *object )
  */
 static void tp_object_wait( struct threadpool_object *object, BOOL group_wait )
 {
-    struct threadpool *pool = object->pool;
+    struct threadpool_queue *queue = object->queue;
 
-    RtlEnterCriticalSection( &pool->cs );
+    RtlAcquireSRWLockExclusive( &queue->lock );
     if (group_wait)
     {
         while (object->num_pending_callbacks || object->num_running_callbacks)
-            RtlSleepConditionVariableCS( &object->group_finished_event, &pool->cs, NULL );
+            RtlSleepConditionVariableSRW( &object->group_finished_event, &queue->lock, NULL, 0 );
     }
     else
     {
         while (object->num_pending_callbacks || object->num_associated_callbacks)
-            RtlSleepConditionVariableCS( &object->finished_event, &pool->cs, NULL );
+            RtlSleepConditionVariableSRW( &object->finished_event, &queue->lock, NULL, 0 );
     }
-    RtlLeaveCriticalSection( &pool->cs );
+    RtlReleaseSRWLockExclusive( &queue->lock );
 }
 
 /***********************************************************************
@@ -2102,46 +2109,55 @@ static BOOL tp_object_release( struct threadpool_object *object )
     return TRUE;
 }
 
-static struct list *threadpool_get_next_item( const struct threadpool *pool )
+/* check if a queue has items of the given priority, without holding its lock */
+static inline BOOL threadpool_queue_has_items( const struct threadpool_queue *queue, unsigned int priority )
 {
-    struct list *ptr;
-    unsigned int i;
+    return *(struct list * const volatile *)&queue->items[priority].next != &queue->items[priority];
+}
 
-    for (i = 0; i < ARRAY_SIZE(pool->pools); ++i)
-    {
-        if ((ptr = list_head( &pool->pools[i] )))
-            break;
-    }
+static BOOL threadpool_has_items( const struct threadpool *pool )
+{
+    unsigned int i, j;
 
-    return ptr;
+    for (i = 0; i < ARRAY_SIZE(pool->queues); ++i)
+        for (j = 0; j < ARRAY_SIZE(pool->queues[i].items); ++j)
+            if (threadpool_queue_has_items( &pool->queues[i], j )) return TRUE;
+    return FALSE;
 }
 
 /***********************************************************************
- *           threadpool_worker_proc    (internal)
+ *           threadpool_get_next_item    (internal)
+ *
+ * Removes a pending callback from the queues, starting with the queue of
+ * the current thread, and marks it as running.
  */
-static void CALLBACK threadpool_worker_proc( void *param )
+static struct threadpool_object *threadpool_get_next_item( struct threadpool *pool,
+                                                           TP_WAIT_RESULT *wait_result )
 {
-    TP_CALLBACK_INSTANCE *callback_instance;
-    struct threadpool_instance instance;
-    struct threadpool *pool = param;
-    TP_WAIT_RESULT wait_result = 0;
-    LARGE_INTEGER timeout;
+    unsigned int i, priority, index = tp_threadpool_get_queue_index();
+    struct threadpool_object *object;
+    struct threadpool_queue *queue;
     struct list *ptr;
-    NTSTATUS status;
 
-    TRACE( "starting worker thread for pool %p\n", pool );
-
-    RtlEnterCriticalSection( &pool->cs );
-    pool->num_busy_workers--;
-    for (;;)
+    for (priority = 0; priority < ARRAY_SIZE(pool->queues[0].items); ++priority)
     {
-        while ((ptr = threadpool_get_next_item( pool )))
+        for (i = 0; i < ARRAY_SIZE(pool->queues); ++i)
         {
-            struct threadpool_object *object = LIST_ENTRY( ptr, struct threadpool_object, pool_entry );
+            queue = &pool->queues[(index + i) % ARRAY_SIZE(pool->queues)];
+            if (!threadpool_queue_has_items( queue, priority )) continue;
+
+            RtlAcquireSRWLockExclusive( &queue->lock );
+            if (!(ptr = list_head( &queue->items[priority] )))
+            {
+                RtlReleaseSRWLockExclusive( &queue->lock );
+                continue;
+            }
+
+            object = LIST_ENTRY( ptr, struct threadpool_object, pool_entry );
             assert( object->num_pending_callbacks > 0 );
 
             /* If further pending callbacks are queued, move the work item to
-             * the end of the pool list. Otherwise remove it from the pool. */
+             * the end of the queue. Otherwise remove it from the queue. */
             list_remove( &object->pool_entry );
             if (--object->num_pending_callbacks)
                 tp_object_prio_queue( object );
@@ -2149,16 +2165,41 @@ static void CALLBACK threadpool_worker_proc( void *param )
             /* For wait objects check if they were signaled or have timed out. */
             if (object->type == TP_OBJECT_TYPE_WAIT)
             {
-                wait_result = object->u.wait.signaled ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
-                if (wait_result == WAIT_OBJECT_0) object->u.wait.signaled--;
+                *wait_result = object->u.wait.signaled ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+                if (*wait_result == WAIT_OBJECT_0) object->u.wait.signaled--;
             }
 
-            /* Leave critical section and do the actual callback. */
             object->num_associated_callbacks++;
             object->num_running_callbacks++;
-            pool->num_busy_workers++;
-            RtlLeaveCriticalSection( &pool->cs );
+            interlocked_inc( &pool->num_busy_workers );
+            RtlReleaseSRWLockExclusive( &queue->lock );
+            return object;
+        }
+    }
+    return NULL;
+}
+
+/***********************************************************************
+ *           threadpool_worker_proc    (internal)
+ */
+static void CALLBACK threadpool_worker_proc( void *param )
+{
+    TP_CALLBACK_INSTANCE *callback_instance;
+    struct threadpool_instance instance;
+    struct threadpool *pool = param;
+    struct threadpool_object *object;
+    TP_WAIT_RESULT wait_result = 0;
+    LARGE_INTEGER timeout;
+    NTSTATUS status;
+    LONG seq;
+
+    TRACE( "starting worker thread for pool %p\n", pool );
 
+    interlocked_dec( &pool->num_busy_workers );
+    for (;;)
+    {
+        while ((object = threadpool_get_next_item( pool, &wait_result )))
+        {
             /* Initialize threadpool instance struct. */
             callback_instance = (TP_CALLBACK_INSTANCE *)&instance;
             instance.object                     = object;
@@ -2250,8 +2291,8 @@ static void CALLBACK threadpool_worker_proc( void *param )
             }
 
         skip_cleanup:
-            RtlEnterCriticalSection( &pool->cs );
-            pool->num_busy_workers--;
+            interlocked_dec( &pool->num_busy_workers );
+            RtlAcquireSRWLockExclusive( &object->queue->lock );
 
             /* Simple callbacks are automatically shutdown after execution. */
             if (object->type == TP_OBJECT_TYPE_SIMPLE)
@@ -2271,27 +2312,45 @@ static void CALLBACK threadpool_worker_proc( void *param )
                     RtlWakeAllConditionVariable( &object->finished_event );
             }
 
+            RtlReleaseSRWLockExclusive( &object->queue->lock );
             tp_object_release( object );
         }
 
         /* Shutdown worker thread if requested. */
         if (pool->shutdown)
+        {
+            RtlEnterCriticalSection( &pool->cs );
+            interlocked_dec( &pool->num_workers );
             break;
+        }
 
-        /* Wait for new tasks or until the timeout expires. A thread only terminates
-         * when no new tasks are available, and the number of threads can be
-         * decreased without violating the min_workers limit. An exception is when
-         * min_workers == 0, then objcount is used to detect if the last thread
-         * can be terminated. */
-        timeout.QuadPart = (ULONGLONG)THREADPOOL_WORKER_TIMEOUT * -10000;
-        if (RtlSleepConditionVariableCS( &pool->update_event, &pool->cs, &timeout ) == STATUS_TIMEOUT &&
-            !threadpool_get_next_item( pool ) && (pool->num_workers > max( pool->min_workers, 1 ) ||
-            (!pool->min_workers && !pool->objcount)))
+        /* Wait for new tasks or until the timeout expires. The queues have to be
+         * checked again once we are accounted as idle, see tp_threadpool_wake. */
+        seq = *(volatile LONG *)&pool->wake_seq;
+        interlocked_inc( &pool->num_idle_workers );
+        status = STATUS_SUCCESS;
+        if (!threadpool_has_items( pool ) && !pool->shutdown)
         {
-            break;
+            timeout.QuadPart = (ULONGLONG)THREADPOOL_WORKER_TIMEOUT * -10000;
+            status = RtlWaitOnAddress( &pool->wake_seq, &seq, sizeof(seq), &timeout );
+        }
+        interlocked_dec( &pool->num_idle_workers );
+        if (status != STATUS_TIMEOUT) continue;
+
+        /* A thread only terminates when no new tasks are available, and the number
+         * of threads can be decreased without violating the min_workers limit. An
+         * exception is when min_workers == 0, then objcount is used to detect if
+         * the last thread can be terminated. Tasks queued after we are no longer
+         * accounted as a worker will start a new thread. */
+        RtlEnterCriticalSection( &pool->cs );
+        if (pool->num_workers > max( pool->min_workers, 1 ) || (!pool->min_workers && !pool->objcount))
+        {
+            interlocked_dec( &pool->num_workers );
+            if (!threadpool_has_items( pool )) break;
+            interlocked_inc( &pool->num_workers );
         }
+        RtlLeaveCriticalSection( &pool->cs );
     }
-    pool->num_workers--;
     RtlLeaveCriticalSection( &pool->cs );
 
     TRACE( "terminating worker thread for pool %p\n", pool );
@@ -2550,7 +2609,6 @@ VOID WINAPI TpDisassociateCallback( TP_CALLBACK_INSTANCE *instance )
 {
     struct threadpool_instance *this = impl_from_TP_CALLBACK_INSTANCE( instance );
     struct threadpool_object *object = this->object;
-    struct threadpool *pool;
 
     TRACE( "%p\n", instance );
 
@@ -2563,14 +2621,13 @@ VOID WINAPI TpDisassociateCallback( TP_CALLBACK_INSTANCE *instance )
     if (!this->associated)
         return;
 
-    pool = object->pool;
-    RtlEnterCriticalSection( &pool->cs );
+    RtlAcquireSRWLockExclusive( &object->queue->lock );
 
     object->num_associated_callbacks--;
     if (!object->num_pending_callbacks && !object->num_associated_callbacks)
         RtlWakeAllConditionVariable( &object->finished_event );
 
-    RtlLeaveCriticalSection( &pool->cs );
+    RtlReleaseSRWLockExclusive( &object->queue->lock );
     this->associated = FALSE;
 }
 
@@ -2868,56 +2925,41 @@ VOID WINAPI TpSetWait( TP_WAIT *wait, HANDLE handle, LARGE_INTEGER *timeout )
 {
     struct threadpool_object *this = impl_from_TP_WAIT( wait );
     ULONGLONG timestamp = TIMEOUT_INFINITE;
-    BOOL submit_wait = FALSE;
+    BOOL submit_wait = FALSE, signaled;
 
     TRACE( "%p %p %p\n", wait, handle, timeout );
 
     RtlEnterCriticalSection( &waitqueue.cs );
 
-    assert( this->u.wait.bucket );
+    assert( this->u.wait.packet );
+    /* the previous wait may have been satisfied before its packet was received */
+    signaled = tp_waitqueue_disarm( this );
     this->u.wait.handle = handle;
 
-    if (handle || this->u.wait.wait_pending)
+    /* Convert relative timeout to absolute timestamp. */
+    if (handle && timeout)
     {
-        struct waitqueue_bucket *bucket = this->u.wait.bucket;
-        list_remove( &this->u.wait.wait_entry );
-
-        /* Convert relative timeout to absolute timestamp. */
-        if (handle && timeout)
-        {
-            timestamp = timeout->QuadPart;
-            if ((LONGLONG)timestamp < 0)
-            {
-                LARGE_INTEGER now;
-                NtQuerySystemTime( &now );
-                timestamp = now.QuadPart - timestamp;
-            }
-            else if (!timestamp)
-            {
-                submit_wait = TRUE;
-                handle = NULL;
-            }
-        }
-
-        /* Add wait object back into one of the queues. */
-        if (handle)
+        timestamp = timeout->QuadPart;
+        if ((LONGLONG)timestamp < 0)
         {
-            list_add_tail( &bucket->waiting, &this->u.wait.wait_entry );
-            this->u.wait.wait_pending = TRUE;
-            this->u.wait.timeout = timestamp;
+            LARGE_INTEGER now;
+            NtQuerySystemTime( &now );
+            timestamp = now.QuadPart - timestamp;
         }
-        else
+        else if (!timestamp)
         {
-            list_add_tail( &bucket->reserved, &this->u.wait.wait_entry );
-            this->u.wait.wait_pending = FALSE;
+            submit_wait = TRUE;
+            handle = NULL;
         }
-
-        /* Wake up the wait queue thread. */
-        NtSetEvent( bucket->update_event, NULL );
     }
 
+    if (handle)
+        tp_waitqueue_arm( this, timestamp );
+
     RtlLeaveCriticalSection( &waitqueue.cs );
 
+    if (signaled)
+        tp_object_submit( this, TRUE );
     if (submit_wait)
         tp_object_submit( this, FALSE );
 }
@@ -44,6 +44,12 @@
 #ifdef HAVE_SYS_SYSINFO_H
 # include <sys/sysinfo.h>
 #endif
+#ifdef HAVE_SYS_IOCTL_H
+# include <sys/ioctl.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
 #ifdef HAVE_VALGRIND_VALGRIND_H
 # include <valgrind/valgrind.h>
 #endif
@@ -67,6 +73,74 @@ WINE_DECLARE_DEBUG_CHANNEL(module);
 #define MAP_NORESERVE 0
 #endif
 
+#if defined(__linux__) && defined(__NR_userfaultfd) && defined(_IOWR)
+#define HAVE_KERNEL_WRITEWATCH
+
+/* userfaultfd and pagemap definitions, from linux/userfaultfd.h and linux/fs.h */
+struct uffdio_api
+{
+    ULONGLONG api;
+    ULONGLONG features;
+    ULONGLONG ioctls;
+};
+
+struct uffdio_range
+{
+    ULONGLONG start;
+    ULONGLONG len;
+};
+
+struct uffdio_register
+{
+    struct uffdio_range range;
+    ULONGLONG mode;
+    ULONGLONG ioctls;
+};
+
+struct uffdio_writeprotect
+{
+    struct uffdio_range range;
+    ULONGLONG mode;
+};
+
+struct page_region
+{
+    ULONGLONG start;
+    ULONGLONG end;
+    ULONGLONG categories;
+};
+
+struct pm_scan_arg
+{
+    ULONGLONG size;
+    ULONGLONG flags;
+    ULONGLONG start;
+    ULONGLONG end;
+    ULONGLONG walk_end;
+    ULONGLONG vec;
+    ULONGLONG vec_len;
+    ULONGLONG max_pages;
+    ULONGLONG category_inverted;
+    ULONGLONG category_mask;
+    ULONGLONG category_anyof_mask;
+    ULONGLONG return_mask;
+};
+
+#define UFFD_API                     0xaa
+#define UFFD_USER_MODE_ONLY          1
+#define UFFD_FEATURE_WP_UNPOPULATED  (1 << 13)
+#define UFFD_FEATURE_WP_ASYNC        (1 << 15)
+#define UFFDIO_REGISTER_MODE_WP      (1 << 1)
+#define UFFDIO_WRITEPROTECT_MODE_WP  (1 << 0)
+#define UFFDIO_API                   _IOWR( 0xaa, 0x3f, struct uffdio_api )
+#define UFFDIO_REGISTER              _IOWR( 0xaa, 0x00, struct uffdio_register )
+#define UFFDIO_WRITEPROTECT          _IOWR( 0xaa, 0x06, struct uffdio_writeprotect )
+#define PAGE_IS_WRITTEN              (1 << 1)
+#define PM_SCAN_WP_MATCHING          (1 << 0)
+#define PM_SCAN_CHECK_WPASYNC        (1 << 1)
+#define PAGEMAP_SCAN                 _IOWR( 'f', 16, struct pm_scan_arg )
+#endif
+
 /* File view */
 struct file_view
 {
@@ -183,6 +257,13 @@ static void *preload_reserve_start;
 static void *preload_reserve_end;
 static BOOL use_locks;
 static BOOL force_exec_prot;  /* whether to force PROT_EXEC on all PROT_READ mmaps */
+#ifdef HAVE_KERNEL_WRITEWATCH
+static int use_kernel_writewatch = -1;  /* whether the kernel tracks write watches, -1 if not checked yet */
+static int uffd = -1;
+static int pagemap_fd = -1;
+#else
+static const int use_kernel_writewatch = 0;
+#endif
 
 static inline int is_view_valloc( const struct file_view *view )
 {
@@ -325,7 +406,7 @@ static int VIRTUAL_GetUnixProt( BYTE vprot )
         if (vprot & VPROT_WRITE) prot |= PROT_WRITE | PROT_READ;
         if (vprot & VPROT_WRITECOPY) prot |= PROT_WRITE | PROT_READ;
         if (vprot & VPROT_EXEC) prot |= PROT_EXEC | PROT_READ;
-        if (vprot & VPROT_WRITEWATCH) prot &= ~PROT_WRITE;
+        if ((vprot & VPROT_WRITEWATCH) && use_kernel_writewatch != 1) prot &= ~PROT_WRITE;
     }
     if (!prot) prot = PROT_NONE;
     return prot;
@@ -1075,6 +1156,156 @@ static NTSTATUS set_protection( struct file_view *view, void *base, SIZE_T size,
 }
 
 
+#ifdef HAVE_KERNEL_WRITEWATCH
+
+/***********************************************************************
+ *           kernel_register_write_watches
+ *
+ * Register a range with userfaultfd and write-protect all its pages.
+ */
+static int kernel_register_write_watches( void *base, size_t size )
+{
+    struct uffdio_register reg;
+    struct uffdio_writeprotect wp;
+
+    /* huge pages would be tracked as a whole */
+    madvise( base, size, MADV_NOHUGEPAGE );
+
+    reg.range.start = (UINT_PTR)base;
+    reg.range.len   = size;
+    reg.mode        = UFFDIO_REGISTER_MODE_WP;
+    if (ioctl( uffd, UFFDIO_REGISTER, &reg ) == -1) return -1;
+
+    wp.range = reg.range;
+    wp.mode  = UFFDIO_WRITEPROTECT_MODE_WP;
+    return ioctl( uffd, UFFDIO_WRITEPROTECT, &wp );
+}
+
+
+/***********************************************************************
+ *           kernel_get_write_watches
+ *
+ * Retrieve the written pages of a range, optionally write-protecting them
+ * again in the same operation.
+ */
+static ULONG_PTR kernel_get_write_watches( void *base, size_t size, void **addresses,
+                                           ULONG_PTR count, BOOL reset )
+{
+    struct page_region regions[64];
+    struct pm_scan_arg arg;
+    char *addr = base, *end = addr + size;
+    ULONGLONG page;
+    ULONG_PTR pos = 0;
+    int i, ret;
+
+    memset( &arg, 0, sizeof(arg) );
+    arg.size          = sizeof(arg);
+    arg.flags         = PM_SCAN_CHECK_WPASYNC | (reset ? PM_SCAN_WP_MATCHING : 0);
+    arg.vec           = (UINT_PTR)regions;
+    arg.category_mask = PAGE_IS_WRITTEN;
+    arg.return_mask   = PAGE_IS_WRITTEN;
+
+    while (pos < count && addr < end)
+    {
+        arg.start     = (UINT_PTR)addr;
+        arg.end       = (UINT_PTR)end;
+        arg.vec_len   = ARRAY_SIZE(regions);
+        arg.max_pages = count - pos;
+        if ((ret = ioctl( pagemap_fd, PAGEMAP_SCAN, &arg )) == -1)
+        {
+            ERR( "failed to scan %p-%p: %s\n", addr, end, strerror(errno) );
+            /* assume that everything was written */
+            for ( ; pos < count && addr < end; addr += page_size) addresses[pos++] = addr;
+            break;
+        }
+        for (i = 0; i < ret; i++)
+            for (page = regions[i].start; page < regions[i].end && pos < count; page += page_size)
+                addresses[pos++] = (void *)(UINT_PTR)page;
+        if (arg.walk_end <= arg.start) break;
+        addr = (char *)(UINT_PTR)arg.walk_end;
+    }
+    return pos;
+}
+
+#endif  /* HAVE_KERNEL_WRITEWATCH */
+
+
+/***********************************************************************
+ *           init_write_watches
+ *
+ * Check whether write watches can be tracked by the kernel with userfaultfd
+ * asynchronous write protection, which avoids taking a signal on the first
+ * write to each page. The csVirtual section must be held by caller.
+ */
+static void init_write_watches(void)
+{
+#ifdef HAVE_KERNEL_WRITEWATCH
+    struct uffdio_api api;
+    struct pm_scan_arg arg;
+    struct page_region region;
+    char *page;
+    int ret = -1;
+
+    if (use_kernel_writewatch != -1) return;
+    use_kernel_writewatch = 0;
+
+    if ((uffd = syscall( __NR_userfaultfd, UFFD_USER_MODE_ONLY | O_CLOEXEC | O_NONBLOCK )) == -1)
+    {
+        TRACE( "userfaultfd not available: %s\n", strerror(errno) );
+        return;
+    }
+    api.api      = UFFD_API;
+    api.features = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED;
+    if (ioctl( uffd, UFFDIO_API, &api ) == -1) goto failed;
+    if ((pagemap_fd = open( "/proc/self/pagemap", O_RDONLY | O_CLOEXEC )) == -1) goto failed;
+
+    /* make sure that the whole sequence works on a test page */
+    if ((page = wine_anon_mmap( NULL, page_size, PROT_READ | PROT_WRITE, 0 )) == (void *)-1) goto failed;
+    if (!kernel_register_write_watches( page, page_size ))
+    {
+        page[0] = 1;
+        memset( &arg, 0, sizeof(arg) );
+        arg.size          = sizeof(arg);
+        arg.flags         = PM_SCAN_CHECK_WPASYNC;
+        arg.start         = (UINT_PTR)page;
+        arg.end           = (UINT_PTR)page + page_size;
+        arg.vec           = (UINT_PTR)&region;
+        arg.vec_len       = 1;
+        arg.category_mask = PAGE_IS_WRITTEN;
+        arg.return_mask   = PAGE_IS_WRITTEN;
+        ret = ioctl( pagemap_fd, PAGEMAP_SCAN, &arg );
+    }
+    munmap( page, page_size );
+    if (ret == 1 && region.start == (UINT_PTR)page)
+    {
+        TRACE( "using kernel write watches\n" );
+        use_kernel_writewatch = 1;
+        return;
+    }
+
+failed:
+    TRACE( "kernel write watches not supported: %s\n", strerror(errno) );
+    if (pagemap_fd != -1) close( pagemap_fd );
+    close( uffd );
+    pagemap_fd = uffd = -1;
+#endif
+}
+
+
+/***********************************************************************
+ *           register_write_watches
+ *
+ * Start tracking writes to a newly mapped write watch range.
+ */
+static void register_write_watches( void *base, size_t size )
+{
+#ifdef HAVE_KERNEL_WRITEWATCH
+    if (use_kernel_writewatch == 1 && kernel_register_write_watches( base, size ))
+        ERR( "failed to register %p-%p: %s\n", base, (char *)base + size, strerror(errno) );
+#endif
+}
+
+
 /***********************************************************************
  *           update_write_watches
  */
@@ -1095,6 +1326,19 @@ static void update_write_watches( void *base, size_t size, size_t accessed_size
  */
 static void reset_write_watches( void *base, SIZE_T size )
 {
+#ifdef HAVE_KERNEL_WRITEWATCH
+    if (use_kernel_writewatch == 1)
+    {
+        struct uffdio_writeprotect wp;
+
+        wp.range.start = (UINT_PTR)base;
+        wp.range.len   = size;
+        wp.mode        = UFFDIO_WRITEPROTECT_MODE_WP;
+        if (ioctl( uffd, UFFDIO_WRITEPROTECT, &wp ) == -1)
+            ERR( "failed to reset %p-%p: %s\n", base, (char *)base + size, strerror(errno) );
+        return;
+    }
+#endif
     set_page_vprot_bits( base, size, VPROT_WRITEWATCH, 0 );
     mprotect_range( base, size, 0, 0 );
 }
@@ -1412,6 +1656,8 @@ static NTSTATUS decommit_pages( struct file_view *view, size_t start, size_t siz
     if (wine_anon_mmap( (char *)view->base + start, size, PROT_NONE, MAP_FIXED ) != (void *)-1)
     {
         set_page_vprot_bits( (char *)view->base + start, size, 0, VPROT_COMMITTED );
+        /* the new mapping is no longer registered */
+        if (view->protect & VPROT_WRITEWATCH) register_write_watches( (char *)view->base + start, size );
         return STATUS_SUCCESS;
     }
     return FILE_GetNtStatus();
@@ -1511,13 +1757,41 @@ static NTSTATUS map_pe_header( void *ptr, size_t size, int fd, BOOL *removable )
 }
 
 
+/***********************************************************************
+ *           get_reloc_file
+ *
+ * Retrieve the copy of an image relocated to a given base by the server.
+ * The returned handle must be closed once the fd isn't needed anymore.
+ */
+static HANDLE get_reloc_file( HANDLE hmapping, client_ptr_t base, int *fd, int *needs_close )
+{
+    HANDLE file = 0;
+
+    SERVER_START_REQ( get_mapping_reloc_file )
+    {
+        req->handle = wine_server_obj_handle( hmapping );
+        req->base   = base;
+        if (!wine_server_call( req )) file = wine_server_ptr_handle( reply->file );
+    }
+    SERVER_END_REQ;
+
+    if (file && server_get_unix_fd( file, FILE_READ_DATA, fd, needs_close, NULL, NULL ))
+    {
+        *fd = -1;
+        *needs_close = FALSE;
+    }
+    return file;
+}
+
+
 /***********************************************************************
  *           map_image
  *
  * Map an executable (PE format) image into memory.
  */
 static NTSTATUS map_image( HANDLE hmapping, ACCESS_MASK access, int fd, int top_down, unsigned short zero_bits_64,
-                           pe_image_info_t *image_info, int shared_fd, BOOL removable, PVOID *addr_ptr )
+                           pe_image_info_t *image_info, int shared_fd, client_ptr_t reloc_base,
+                           BOOL removable, PVOID *addr_ptr )
 {
     IMAGE_DOS_HEADER *dos;
     IMAGE_NT_HEADERS *nt;
@@ -1533,6 +1807,10 @@ static NTSTATUS map_image( HANDLE hmapping, ACCESS_MASK access, int fd, int top_
     struct file_view *view = NULL;
     char *ptr, *header_end, *header_start;
     char *base = wine_server_get_ptr( image_info->base );
+    char *reloc_ptr = wine_server_get_ptr( reloc_base );
+    HANDLE reloc_file = 0;
+    int reloc_fd = -1, reloc_needs_close = FALSE;
+    BOOL relocated = FALSE;
 
     if (total_size != image_info->map_size)  /* truncated */
     {
@@ -1540,6 +1818,7 @@ static NTSTATUS map_image( HANDLE hmapping, ACCESS_MASK access, int fd, int top_
         return STATUS_INVALID_PARAMETER;
     }
     if ((ULONG_PTR)base != image_info->base) base = NULL;
+    if ((ULONG_PTR)reloc_ptr != reloc_base) reloc_ptr = NULL;
 
     /* zero-map the whole range */
 
@@ -1549,6 +1828,20 @@ static NTSTATUS map_image( HANDLE hmapping, ACCESS_MASK access, int fd, int top_
         status = map_view( &view, base, total_size, 0, top_down, SEC_IMAGE | SEC_FILE |
                            VPROT_COMMITTED | VPROT_READ | VPROT_EXEC | VPROT_WRITECOPY, zero_bits_64 );
 
+    /* try the address of the already relocated copy, to share its pages with other processes */
+    if (status != STATUS_SUCCESS && reloc_ptr >= (char *)address_space_start)
+    {
+        server_leave_uninterrupted_section( &csVirtual, &sigset );
+        reloc_file = get_reloc_file( hmapping, reloc_base, &reloc_fd, &reloc_needs_close );
+        server_enter_uninterrupted_section( &csVirtual, &sigset );
+        if (reloc_fd != -1)
+        {
+            status = map_view( &view, reloc_ptr, total_size, 0, top_down, SEC_IMAGE | SEC_FILE |
+                               VPROT_COMMITTED | VPROT_READ | VPROT_EXEC | VPROT_WRITECOPY, zero_bits_64 );
+            relocated = (status == STATUS_SUCCESS);
+        }
+    }
+
     if (status != STATUS_SUCCESS)
         status = map_view( &view, NULL, total_size, 0, top_down, SEC_IMAGE | SEC_FILE |
                            VPROT_COMMITTED | VPROT_READ | VPROT_EXEC | VPROT_WRITECOPY, zero_bits_64 );
@@ -1566,13 +1859,21 @@ static NTSTATUS map_image( HANDLE hmapping, ACCESS_MASK access, int fd, int top_
         goto error;
     }
     header_size = min( image_info->header_size, st.st_size );
-    if ((status = map_pe_header( view->base, header_size, fd, &removable )) != STATUS_SUCCESS) goto error;
+    if (relocated)
+    {
+        /* the relocated file contains the whole image laid out at its virtual addresses */
+        TRACE_(module)( "mapping relocated image at %p\n", ptr );
+        if ((status = map_file_into_view( view, reloc_fd, 0, total_size, 0,
+                                          VPROT_COMMITTED | VPROT_READ | VPROT_WRITECOPY, FALSE )))
+            goto error;
+    }
+    else if ((status = map_pe_header( view->base, header_size, fd, &removable )) != STATUS_SUCCESS) goto error;
 
     status = STATUS_INVALID_IMAGE_FORMAT;  /* generic error */
     dos = (IMAGE_DOS_HEADER *)ptr;
     nt = (IMAGE_NT_HEADERS *)(ptr + dos->e_lfanew);
     header_end = ptr + ROUND_SIZE( 0, header_size );
-    memset( ptr + header_size, 0, header_end - (ptr + header_size) );
+    if (!relocated) memset( ptr + header_size, 0, header_end - (ptr + header_size) );
     if ((char *)(nt + 1) > header_end) goto error;
     header_start = (char*)&nt->OptionalHeader+nt->FileHeader.SizeOfOptionalHeader;
     if (nt->FileHeader.NumberOfSections > ARRAY_SIZE( sections )) goto error;
@@ -1673,7 +1974,7 @@ static NTSTATUS map_image( HANDLE hmapping, ACCESS_MASK access, int fd, int top_
                         sec->PointerToRawData, sec->SizeOfRawData,
                         sec->Misc.VirtualSize, sec->Characteristics );
 
-        if (!sec->PointerToRawData || !file_size) continue;
+        if (!sec->PointerToRawData || !file_size || relocated) continue;
 
         /* Note: if the section is not aligned properly map_file_into_view will magically
          *       fall back to read(), so we don't need to check anything here.
@@ -1746,6 +2047,8 @@ static NTSTATUS map_image( HANDLE hmapping, ACCESS_MASK access, int fd, int top_
 
     VIRTUAL_DEBUG_DUMP_VIEW( view );
     server_leave_uninterrupted_section( &csVirtual, &sigset );
+    if (reloc_needs_close) close( reloc_fd );
+    if (reloc_file) close_handle( reloc_file );
 
     *addr_ptr = ptr;
 #ifdef VALGRIND_LOAD_PDB_DEBUGINFO
@@ -1757,6 +2060,8 @@ static NTSTATUS map_image( HANDLE hmapping, ACCESS_MASK access, int fd, int top_
  error:
     if (view) delete_view( view );
     server_leave_uninterrupted_section( &csVirtual, &sigset );
+    if (reloc_needs_close) close( reloc_fd );
+    if (reloc_file) close_handle( reloc_file );
     return status;
 }
 
@@ -1778,6 +2083,7 @@ NTSTATUS virtual_map_section( HANDLE handle, PVOID *addr_ptr, unsigned short zer
     unsigned int vprot, sec_flags;
     struct file_view *view;
     HANDLE shared_file;
+    client_ptr_t reloc_base;
     LARGE_INTEGER offset;
     sigset_t sigset;
 
@@ -1814,6 +2120,7 @@ NTSTATUS virtual_map_section( HANDLE handle, PVOID *addr_ptr, unsigned short zer
         sec_flags   = reply->flags;
         full_size   = reply->size;
         shared_file = wine_server_ptr_handle( reply->shared_file );
+        reloc_base  = reply->reloc_base;
     }
     SERVER_END_REQ;
     if (res) return res;
@@ -1826,17 +2133,19 @@ NTSTATUS virtual_map_section( HANDLE handle, PVOID *addr_ptr, unsigned short zer
         {
             int shared_fd, shared_needs_close;
 
-            if ((res = server_get_unix_fd( shared_file, FILE_READ_DATA|FILE_WRITE_DATA,
-                                           &shared_fd, &shared_needs_close, NULL, NULL ))) goto done;
-            res = map_image( handle, access, unix_handle, alloc_type & MEM_TOP_DOWN, zero_bits_64, image_info,
-                             shared_fd, needs_close, addr_ptr );
-            if (shared_needs_close) close( shared_fd );
+            if (!(res = server_get_unix_fd( shared_file, FILE_READ_DATA|FILE_WRITE_DATA,
+                                            &shared_fd, &shared_needs_close, NULL, NULL )))
+            {
+                res = map_image( handle, access, unix_handle, alloc_type & MEM_TOP_DOWN, zero_bits_64,
+                                 image_info, shared_fd, reloc_base, needs_close, addr_ptr );
+                if (shared_needs_close) close( shared_fd );
+            }
             close_handle( shared_file );
         }
         else
         {
             res = map_image( handle, access, unix_handle, alloc_type & MEM_TOP_DOWN, zero_bits_64, image_info,
-                             -1, needs_close, addr_ptr );
+                             -1, reloc_base, needs_close, addr_ptr );
         }
         if (needs_close) close( unix_handle );
         if (res >= 0) *size_ptr = image_info->map_size;
@@ -2251,7 +2560,7 @@ static NTSTATUS check_write_access( void *base, size_t size, BOOL *has_write_wat
     for (i = 0; i < size; i += page_size)
     {
         BYTE vprot = get_page_vprot( addr + i );
-        if (vprot & VPROT_WRITEWATCH) *has_write_watch = TRUE;
+        if ((vprot & VPROT_WRITEWATCH) && use_kernel_writewatch != 1) *has_write_watch = TRUE;
         if (!(VIRTUAL_GetUnixProt( vprot & ~VPROT_WRITEWATCH ) & PROT_WRITE))
             return STATUS_INVALID_USER_BUFFER;
     }
@@ -2367,6 +2676,65 @@ ssize_t CDECL __wine_locked_recvmsg( int fd, struct msghdr *hdr, int flags )
 }
 
 
+#ifndef HAVE_RECVMMSG
+struct mmsghdr;
+#else
+/* restore the protection of the write watched pages of a message buffer */
+static void update_msghdr_write_watches( const struct msghdr *hdr, size_t iovlen )
+{
+    size_t i;
+
+    for (i = 0; i < iovlen; i++)
+        update_write_watches( hdr->msg_iov[i].iov_base, hdr->msg_iov[i].iov_len, 0 );
+}
+#endif
+
+/***********************************************************************
+ *           __wine_locked_recvmmsg
+ *
+ * Unlike a stream, a datagram whose copy faults is dropped by the kernel,
+ * so write access is enabled on all the buffers before receiving.
+ */
+int CDECL __wine_locked_recvmmsg( int fd, struct mmsghdr *msgs, unsigned int count, int flags )
+{
+#ifdef HAVE_RECVMMSG
+    sigset_t sigset;
+    unsigned int i;
+    size_t j = 0;
+    BOOL has_write_watch = FALSE;
+    int ret = -1, err = EFAULT;
+
+    server_enter_uninterrupted_section( &csVirtual, &sigset );
+    for (i = 0; i < count; i++)
+    {
+        const struct msghdr *hdr = &msgs[i].msg_hdr;
+
+        for (j = 0; j < hdr->msg_iovlen; j++)
+            if (check_write_access( hdr->msg_iov[j].iov_base, hdr->msg_iov[j].iov_len, &has_write_watch ))
+                break;
+        if (j < hdr->msg_iovlen) break;
+    }
+    if (i == count)
+    {
+        ret = recvmmsg( fd, msgs, count, flags, NULL );
+        err = errno;
+    }
+    if (has_write_watch)
+    {
+        /* the buffers of message i were only partly checked on failure */
+        if (i < count) update_msghdr_write_watches( &msgs[i].msg_hdr, j );
+        while (i--) update_msghdr_write_watches( &msgs[i].msg_hdr, msgs[i].msg_hdr.msg_iovlen );
+    }
+    server_leave_uninterrupted_section( &csVirtual, &sigset );
+    errno = err;
+    return ret;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
 /***********************************************************************
  *           virtual_is_valid_code_address
  */
@@ -2770,14 +3138,22 @@ NTSTATUS virtual_alloc_aligned( PVOID *ret, unsigned short zero_bits_64, SIZE_T
         if (!(status = get_vprot_flags( protect, &vprot, FALSE )))
         {
             if (type & MEM_COMMIT) vprot |= VPROT_COMMITTED;
-            if (type & MEM_WRITE_WATCH) vprot |= VPROT_WRITEWATCH;
+            if (type & MEM_WRITE_WATCH)
+            {
+                init_write_watches();
+                vprot |= VPROT_WRITEWATCH;
+            }
             if (protect & PAGE_NOCACHE) vprot |= SEC_NOCACHE;
 
             if (vprot & VPROT_WRITECOPY) status = STATUS_INVALID_PAGE_PROTECTION;
             else if (is_dos_memory) status = allocate_dos_memory( &view, vprot );
             else status = map_view( &view, base, size, alignment, type & MEM_TOP_DOWN, vprot, zero_bits_64 );
 
-            if (status == STATUS_SUCCESS) base = view->base;
+            if (status == STATUS_SUCCESS)
+            {
+                base = view->base;
+                if (vprot & VPROT_WRITEWATCH) register_write_watches( view->base, view->size );
+            }
         }
     }
     else if (type & MEM_RESET)
@@ -3654,12 +4030,19 @@ NTSTATUS WINAPI NtGetWriteWatch( HANDLE process, ULONG flags, PVOID base, SIZE_T
         char *addr = base;
         char *end = addr + size;
 
-        while (pos < *count && addr < end)
+#ifdef HAVE_KERNEL_WRITEWATCH
+        if (use_kernel_writewatch == 1)
+            pos = kernel_get_write_watches( base, size, addresses, *count, flags & WRITE_WATCH_FLAG_RESET );
+        else
+#endif
         {
-            if (!(get_page_vprot( addr ) & VPROT_WRITEWATCH)) addresses[pos++] = addr;
-            addr += page_size;
+            while (pos < *count && addr < end)
+            {
+                if (!(get_page_vprot( addr ) & VPROT_WRITEWATCH)) addresses[pos++] = addr;
+                addr += page_size;
+            }
+            if (flags & WRITE_WATCH_FLAG_RESET) reset_write_watches( base, addr - (char *)base );
         }
-        if (flags & WRITE_WATCH_FLAG_RESET) reset_write_watches( base, addr - (char *)base );
         *count = pos;
         *granularity = page_size;
     }
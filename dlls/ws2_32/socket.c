@@ -26,6 +26,7 @@
  * clients and servers (www.winsite.com got a lot of those).
  */
 
+#define _GNU_SOURCE  /* for recvmmsg and sendmmsg */
 #include "config.h"
 #include "wine/port.h"
 
@@ -64,6 +65,12 @@
 #ifdef HAVE_SYS_UIO_H
 # include <sys/uio.h>
 #endif
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
 #ifdef HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
 #endif
@@ -159,6 +166,7 @@
 #include "wine/exception.h"
 #include "wine/unicode.h"
 #include "wine/heap.h"
+#include "wine/list.h"
 
 #if defined(linux) && !defined(IP_UNICAST_IF)
 #define IP_UNICAST_IF 50
@@ -243,6 +251,9 @@ static struct interface_filter generic_interface_filter = {
 #endif /* LINUX_BOUND_IF */
 
 extern ssize_t CDECL __wine_locked_recvmsg( int fd, struct msghdr *hdr, int flags );
+#ifdef HAVE_RECVMMSG
+extern int CDECL __wine_locked_recvmmsg( int fd, struct mmsghdr *msgs, unsigned int count, int flags );
+#endif
 
 /*
  * The actual definition of WSASendTo, wrapped in a different function name
@@ -505,6 +516,10 @@ struct ws2_async
     DWORD                               flags;
     DWORD                              *lpFlags;
     WSABUF                             *control;
+    unsigned int                        batch;         /* state of batched I/O */
+    struct list                         batch_entry;   /* entry in the batch list while queued */
+    NTSTATUS                            batch_status;  /* result of the I/O done by another async */
+    int                                 batch_result;
     unsigned int                        n_iovecs;
     unsigned int                        first_iovec;
     struct iovec                        iovec[1];
@@ -535,6 +550,7 @@ struct ws2_transmitfile_async
     TRANSMIT_FILE_BUFFERS buffers;
     DWORD                 flags;
     LARGE_INTEGER         offset;
+    BOOL                  use_sendfile; /* send the file data without copying it */
     struct ws2_async      write;
 };
 
@@ -2370,6 +2386,166 @@ static BOOL ws_protocol_info(SOCKET s, int unicode, WSAPROTOCOL_INFOW *buffer, i
     return TRUE;
 }
 
+/**************************************************************************
+ * Batched datagram I/O
+ *
+ * Each overlapped receive or send on a datagram socket normally needs its
+ * own poll wakeup by the server and its own system call. When one of them is
+ * woken up, its APC also transfers the datagrams of the other asyncs pending
+ * on the same socket with a single recvmmsg() or sendmmsg() call, and then
+ * wakes them all up with a single server request. The result is kept in the
+ * async until its own APC runs and reports it, so that the I/O status block
+ * is only written by the APC the server expects the result from.
+ **************************************************************************/
+
+#define WS2_BATCH_MAX 16
+
+enum ws2_batch_state
+{
+    BATCH_NONE,    /* not available for batched I/O */
+    BATCH_QUEUED,  /* pending, its I/O may be done along with another async */
+    BATCH_DONE     /* I/O done along with another async, waiting for its APC */
+};
+
+static struct list batch_recv_list = LIST_INIT( batch_recv_list );
+static struct list batch_send_list = LIST_INIT( batch_send_list );
+
+static CRITICAL_SECTION batch_cs;
+static CRITICAL_SECTION_DEBUG batch_cs_debug =
+{
+    0, 0, &batch_cs,
+    { &batch_cs_debug.ProcessLocksList, &batch_cs_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": batch_cs") }
+};
+static CRITICAL_SECTION batch_cs = { &batch_cs_debug, -1, 0, 0, 0, 0 };
+
+/* check whether the I/O of an async can be done along with the one of another async */
+static BOOL batch_supported( int fd, const struct ws2_async *wsa, int type )
+{
+    int sock_type;
+    socklen_t len = sizeof(sock_type);
+
+#ifndef HAVE_RECVMMSG
+    if (type == ASYNC_TYPE_READ) return FALSE;
+#endif
+#ifndef HAVE_SENDMMSG
+    if (type == ASYNC_TYPE_WRITE) return FALSE;
+#endif
+    if (wsa->flags || wsa->control || !wsa->n_iovecs) return FALSE;
+    if (type == ASYNC_TYPE_WRITE && wsa->addr && wsa->addr->sa_family == WS_AF_IPX) return FALSE;
+    if (getsockopt( fd, SOL_SOCKET, SO_TYPE, (char *)&sock_type, &len )) return FALSE;
+    return sock_type == SOCK_DGRAM;
+}
+
+/* register an async, making it available for batched I/O if requested */
+static NTSTATUS batch_register_async( int type, struct ws2_async *wsa, BOOL batch, HANDLE event,
+                                      PIO_APC_ROUTINE apc, void *apc_context, IO_STATUS_BLOCK *iosb )
+{
+    NTSTATUS status;
+
+    if (!batch) return register_async( type, wsa->hSocket, &wsa->io, event, apc, apc_context, iosb );
+
+    /* the async may complete and be freed as soon as it is registered, and it
+     * must not be batched before the server knows about it, so keep the lock */
+    EnterCriticalSection( &batch_cs );
+    list_add_tail( type == ASYNC_TYPE_READ ? &batch_recv_list : &batch_send_list, &wsa->batch_entry );
+    wsa->batch = BATCH_QUEUED;
+    status = register_async( type, wsa->hSocket, &wsa->io, event, apc, apc_context, iosb );
+    if (status != STATUS_PENDING)
+    {
+        list_remove( &wsa->batch_entry );
+        wsa->batch = BATCH_NONE;
+    }
+    LeaveCriticalSection( &batch_cs );
+    return status;
+}
+
+/* remove an async from its batch list when its APC runs, and retrieve the result of a batched I/O */
+static unsigned int batch_dequeue( struct ws2_async *wsa, NTSTATUS *status, int *result )
+{
+    unsigned int state;
+
+    /* nobody else changes the state of an async that has never been queued */
+    if (wsa->batch == BATCH_NONE) return BATCH_NONE;
+
+    EnterCriticalSection( &batch_cs );
+    state = wsa->batch;
+    if (state == BATCH_QUEUED) list_remove( &wsa->batch_entry );
+    else if (state == BATCH_DONE)
+    {
+        *status = wsa->batch_status;
+        *result = wsa->batch_result;
+    }
+    wsa->batch = BATCH_NONE;
+    LeaveCriticalSection( &batch_cs );
+    return state;
+}
+
+/* forget the queued asyncs of a socket being closed, so that its handle can be reused */
+static void batch_close_socket( HANDLE handle )
+{
+    struct list *lists[] = { &batch_recv_list, &batch_send_list };
+    struct ws2_async *wsa, *next;
+    unsigned int i;
+
+    EnterCriticalSection( &batch_cs );
+    for (i = 0; i < ARRAY_SIZE(lists); i++)
+    {
+        LIST_FOR_EACH_ENTRY_SAFE( wsa, next, lists[i], struct ws2_async, batch_entry )
+        {
+            if (wsa->hSocket != handle) continue;
+            /* its APC will report the cancellation */
+            list_remove( &wsa->batch_entry );
+            wsa->batch = BATCH_NONE;
+        }
+    }
+    LeaveCriticalSection( &batch_cs );
+}
+
+/* collect the queued asyncs of a socket into a batch; batch_cs must be held */
+static unsigned int batch_collect( struct list *list, struct ws2_async *wsa, struct ws2_async **batch )
+{
+    struct ws2_async *other;
+    unsigned int count = 0;
+
+    batch[count++] = wsa;
+    LIST_FOR_EACH_ENTRY( other, list, struct ws2_async, batch_entry )
+    {
+        if (other->hSocket != wsa->hSocket) continue;
+        batch[count++] = other;
+        if (count == WS2_BATCH_MAX) break;
+    }
+    return count;
+}
+
+/* hand the sizes transferred to the other asyncs of a batch and wake them up; batch_cs must be held */
+static void batch_finish( struct ws2_async **batch, const unsigned int *sizes, unsigned int count, int type )
+{
+    client_ptr_t users[WS2_BATCH_MAX];
+    unsigned int i;
+
+    if (!count) return;
+
+    for (i = 0; i < count; i++)
+    {
+        list_remove( &batch[i]->batch_entry );
+        batch[i]->batch        = BATCH_DONE;
+        batch[i]->batch_status = STATUS_SUCCESS;
+        batch[i]->batch_result = sizes[i];
+        users[i] = wine_server_client_ptr( batch[i] );
+    }
+
+    /* the asyncs may be freed by their APC as soon as they are woken up */
+    SERVER_START_REQ( complete_socket_asyncs )
+    {
+        req->handle = wine_server_obj_handle( batch[0]->hSocket );
+        req->type   = type;
+        wine_server_add_data( req, users, count * sizeof(*users) );
+        wine_server_call( req );
+    }
+    SERVER_END_REQ;
+}
+
 /**************************************************************************
  * Functions for handling overlapped I/O
  **************************************************************************/
@@ -2458,6 +2634,65 @@ static int WS2_recv( int fd, struct ws2_async *wsa, int flags )
     return n;
 }
 
+/***********************************************************************
+ *              batch_recv              (INTERNAL)
+ *
+ * Receive the datagram of an async along with the ones of the other
+ * asyncs queued on the same socket.
+ */
+static int batch_recv( int fd, struct ws2_async *wsa )
+{
+#ifdef HAVE_RECVMMSG
+    struct ws2_async *batch[WS2_BATCH_MAX];
+    struct mmsghdr msgs[WS2_BATCH_MAX];
+    union generic_unix_sockaddr addrs[WS2_BATCH_MAX];
+    unsigned int sizes[WS2_BATCH_MAX];
+    unsigned int i, count;
+    int ret, err;
+
+    EnterCriticalSection( &batch_cs );
+
+    count = batch_collect( &batch_recv_list, wsa, batch );
+    memset( msgs, 0, count * sizeof(msgs[0]) );
+    for (i = 0; i < count; i++)
+    {
+        if (batch[i]->addr)
+        {
+            msgs[i].msg_hdr.msg_name    = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+        msgs[i].msg_hdr.msg_iov    = batch[i]->iovec + batch[i]->first_iovec;
+        msgs[i].msg_hdr.msg_iovlen = batch[i]->n_iovecs - batch[i]->first_iovec;
+    }
+
+    while ((ret = __wine_locked_recvmmsg( fd, msgs, count, 0 )) == -1 && errno == EINTR);
+
+    if (ret == -1)
+    {
+        err = errno;
+        LeaveCriticalSection( &batch_cs );
+        errno = err;
+        if (err == EAGAIN) return -1;
+        /* let the regular path deal with the error */
+        return WS2_recv( fd, wsa, 0 );
+    }
+
+    for (i = 0; i < ret; i++)
+    {
+        if (batch[i]->addr && msgs[i].msg_hdr.msg_namelen)
+            ws_sockaddr_u2ws( &addrs[i].addr, batch[i]->addr, batch[i]->addrlen.ptr );
+        sizes[i] = msgs[i].msg_len;
+    }
+    batch_finish( batch + 1, sizes + 1, ret - 1, ASYNC_TYPE_READ );
+
+    LeaveCriticalSection( &batch_cs );
+    TRACE( "received %d datagrams out of %u\n", ret, count );
+    return msgs[0].msg_len;
+#else
+    return WS2_recv( fd, wsa, 0 );
+#endif
+}
+
 /***********************************************************************
  *              WS2_async_recv          (INTERNAL)
  *
@@ -2467,6 +2702,7 @@ static NTSTATUS WS2_async_recv( void *user, IO_STATUS_BLOCK *iosb, NTSTATUS stat
 {
     struct ws2_async *wsa = user;
     int result = 0, fd;
+    unsigned int batch = batch_dequeue( wsa, &status, &result );
 
     switch (status)
     {
@@ -2474,7 +2710,10 @@ static NTSTATUS WS2_async_recv( void *user, IO_STATUS_BLOCK *iosb, NTSTATUS stat
         if ((status = wine_server_handle_to_fd( wsa->hSocket, FILE_READ_DATA, &fd, NULL ) ))
             break;
 
-        result = WS2_recv( fd, wsa, convert_flags(wsa->flags) );
+        if (batch == BATCH_QUEUED)
+            result = batch_recv( fd, wsa );
+        else
+            result = WS2_recv( fd, wsa, convert_flags(wsa->flags) );
         wine_server_release_fd( wsa->hSocket, fd );
         if (result >= 0)
         {
@@ -2677,6 +2916,68 @@ static int WS2_send( int fd, struct ws2_async *wsa, int flags )
     return ret;
 }
 
+/***********************************************************************
+ *              batch_send              (INTERNAL)
+ *
+ * Send the datagram of an async along with the ones of the other
+ * asyncs queued on the same socket.
+ */
+static int batch_send( int fd, struct ws2_async *wsa )
+{
+#ifdef HAVE_SENDMMSG
+    struct ws2_async *batch[WS2_BATCH_MAX];
+    struct mmsghdr msgs[WS2_BATCH_MAX];
+    union generic_unix_sockaddr addrs[WS2_BATCH_MAX];
+    unsigned int sizes[WS2_BATCH_MAX];
+    unsigned int i, count;
+    int ret, err;
+
+    EnterCriticalSection( &batch_cs );
+
+    count = batch_collect( &batch_send_list, wsa, batch );
+    memset( msgs, 0, count * sizeof(msgs[0]) );
+    for (i = 0; i < count; i++)
+    {
+        if (batch[i]->addr)
+        {
+            msgs[i].msg_hdr.msg_name    = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = ws_sockaddr_ws2u( batch[i]->addr, batch[i]->addrlen.val, &addrs[i] );
+            if (!msgs[i].msg_hdr.msg_namelen) break;  /* leave it to its own APC */
+        }
+        msgs[i].msg_hdr.msg_iov    = batch[i]->iovec + batch[i]->first_iovec;
+        msgs[i].msg_hdr.msg_iovlen = batch[i]->n_iovecs - batch[i]->first_iovec;
+    }
+    count = i;
+
+    if (count) while ((ret = sendmmsg( fd, msgs, count, 0 )) == -1 && errno == EINTR);
+    else ret = -1;
+
+    if (ret == -1)
+    {
+        err = errno;
+        LeaveCriticalSection( &batch_cs );
+        errno = err;
+        if (count && err == EAGAIN) return -1;
+        /* let the regular path deal with the error */
+        return WS2_send( fd, wsa, 0 );
+    }
+
+    for (i = 0; i < ret; i++)
+    {
+        /* datagrams are sent as a whole */
+        batch[i]->first_iovec = batch[i]->n_iovecs;
+        sizes[i] = msgs[i].msg_len;
+    }
+    batch_finish( batch + 1, sizes + 1, ret - 1, ASYNC_TYPE_WRITE );
+
+    LeaveCriticalSection( &batch_cs );
+    TRACE( "sent %d datagrams out of %u\n", ret, count );
+    return msgs[0].msg_len;
+#else
+    return WS2_send( fd, wsa, 0 );
+#endif
+}
+
 /***********************************************************************
  *              WS2_async_send          (INTERNAL)
  *
@@ -2686,6 +2987,9 @@ static NTSTATUS WS2_async_send( void *user, IO_STATUS_BLOCK *iosb, NTSTATUS stat
 {
     struct ws2_async *wsa = user;
     int result = 0, fd;
+    unsigned int batch = batch_dequeue( wsa, &status, &result );
+
+    if (batch == BATCH_DONE) iosb->Information += result;
 
     switch (status)
     {
@@ -2700,7 +3004,10 @@ static NTSTATUS WS2_async_send( void *user, IO_STATUS_BLOCK *iosb, NTSTATUS stat
             break;
 
         /* check to see if the data is ready (non-blocking) */
-        result = WS2_send( fd, wsa, convert_flags(wsa->flags) );
+        if (batch == BATCH_QUEUED)
+            result = batch_send( fd, wsa );
+        else
+            result = WS2_send( fd, wsa, convert_flags(wsa->flags) );
         wine_server_release_fd( wsa->hSocket, fd );
 
         if (result >= 0)
@@ -2927,6 +3234,7 @@ static BOOL WINAPI WS2_AcceptEx(SOCKET listener, SOCKET acceptor, PVOID dest, DW
         wsa->read->control     = NULL;
         wsa->read->n_iovecs    = 1;
         wsa->read->first_iovec = 0;
+        wsa->read->batch       = BATCH_NONE;
         wsa->read->completion_func = NULL;
         wsa->read->iovec[0].iov_base = wsa->buf;
         wsa->read->iovec[0].iov_len  = wsa->data_len;
@@ -3021,6 +3329,9 @@ static NTSTATUS WS2_transmitfile_getbuffer( int fd, struct ws2_transmitfile_asyn
         IO_STATUS_BLOCK iosb;
         NTSTATUS status;
 
+        /* the data is sent directly from the file by WS2_transmitfile_sendfile */
+        if (wsa->use_sendfile) return STATUS_PENDING;
+
         iosb.Information = 0;
         /* when the size of the transfer is limited ensure that we don't go past that limit */
         if (wsa->file_bytes != 0)
@@ -3064,6 +3375,57 @@ static NTSTATUS WS2_transmitfile_getbuffer( int fd, struct ws2_transmitfile_asyn
     return STATUS_SUCCESS;
 }
 
+#ifdef HAVE_SYS_SENDFILE_H
+/***********************************************************************
+ *     WS2_transmitfile_sendfile        (INTERNAL)
+ *
+ * Send the next part of the file straight from the file descriptor.
+ */
+static NTSTATUS WS2_transmitfile_sendfile( int fd, struct ws2_transmitfile_async *wsa )
+{
+    IO_STATUS_BLOCK *iosb = (IO_STATUS_BLOCK *)wsa->write.user_overlapped;
+    size_t count = 0x7ffff000;  /* maximum transfer size of sendfile on Linux */
+    off_t offset = wsa->offset.QuadPart;
+    HANDLE file = wsa->file;
+    NTSTATUS status;
+    ssize_t n;
+    int file_fd;
+
+    if ((status = wine_server_handle_to_fd( file, FILE_READ_DATA, &file_fd, NULL )))
+        return status;
+
+    /* when the size of the transfer is limited ensure that we don't go past that limit */
+    if (wsa->file_bytes != 0)
+        count = min( count, wsa->file_bytes - wsa->file_read );
+    if (wsa->offset.QuadPart != FILE_USE_FILE_POINTER_POSITION)
+        n = sendfile( fd, file_fd, &offset, count );
+    else
+        n = sendfile( fd, file_fd, NULL, count );
+    if (n > 0)
+    {
+        if (wsa->offset.QuadPart != FILE_USE_FILE_POINTER_POSITION)
+            wsa->offset.QuadPart += n;
+        wsa->file_read += n;
+        if (iosb) iosb->Information += n;
+        if (wsa->file_bytes != 0 && wsa->file_read >= wsa->file_bytes)
+            wsa->file = NULL;
+    }
+    else if (!n)
+        wsa->file = NULL; /* end of file, continue on to the footer */
+    else if (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)
+    {
+        /* sendfile can't handle this file or socket, fall back to reading the file */
+        WARN( "sendfile failed (%s), using a buffer instead\n", strerror(errno) );
+        wsa->use_sendfile = FALSE;
+    }
+    else if (errno != EAGAIN && errno != EINTR)
+        status = wsaErrStatus();
+
+    wine_server_release_fd( file, file_fd );
+    return status;
+}
+#endif
+
 /***********************************************************************
  *     WS2_transmitfile_base            (INTERNAL)
  *
@@ -3079,6 +3441,13 @@ static NTSTATUS WS2_transmitfile_base( int fd, struct ws2_transmitfile_async *ws
         IO_STATUS_BLOCK *iosb = (IO_STATUS_BLOCK *)wsa->write.user_overlapped;
         int n;
 
+#ifdef HAVE_SYS_SENDFILE_H
+        if (wsa->use_sendfile && wsa->write.first_iovec == wsa->write.n_iovecs)
+        {
+            NTSTATUS ret = WS2_transmitfile_sendfile( fd, wsa );
+            return ret ? ret : status;
+        }
+#endif
         n = WS2_send( fd, &wsa->write, convert_flags(wsa->write.flags) );
         if (n >= 0)
         {
@@ -3127,6 +3496,7 @@ static BOOL WINAPI WS2_TransmitFile( SOCKET s, HANDLE h, DWORD file_bytes, DWORD
     union generic_unix_sockaddr uaddr;
     socklen_t uaddrlen = sizeof(uaddr);
     struct ws2_transmitfile_async *wsa;
+    BOOL use_sendfile = FALSE;
     NTSTATUS status;
     int fd;
 
@@ -3156,6 +3526,20 @@ static BOOL WINAPI WS2_TransmitFile( SOCKET s, HANDLE h, DWORD file_bytes, DWORD
         return FALSE;
     }
 
+#ifdef HAVE_SYS_SENDFILE_H
+    if (h)
+    {
+        struct stat st;
+        int file_fd;
+
+        if (!wine_server_handle_to_fd( h, FILE_READ_DATA, &file_fd, NULL ))
+        {
+            use_sendfile = !fstat( file_fd, &st ) && S_ISREG( st.st_mode );
+            wine_server_release_fd( h, file_fd );
+        }
+    }
+#endif
+
     /* set reasonable defaults when requested */
     if (!bytes_per_send)
         bytes_per_send = (1 << 16); /* Depends on OS version: PAGE_SIZE, 2*PAGE_SIZE, or 2^16 */
@@ -3178,6 +3562,7 @@ static BOOL WINAPI WS2_TransmitFile( SOCKET s, HANDLE h, DWORD file_bytes, DWORD
     wsa->bytes_per_send        = bytes_per_send;
     wsa->flags                 = flags;
     wsa->offset.QuadPart       = FILE_USE_FILE_POINTER_POSITION;
+    wsa->use_sendfile          = use_sendfile;
     wsa->write.hSocket         = SOCKET2HANDLE(s);
     wsa->write.addr            = NULL;
     wsa->write.addrlen.val     = 0;
@@ -3454,6 +3839,7 @@ int WINAPI WS_closesocket(SOCKET s)
         if (fd >= 0)
         {
             release_sock_fd(s, fd);
+            batch_close_socket(SOCKET2HANDLE(s));
             if (CloseHandle(SOCKET2HANDLE(s)))
                 res = 0;
         }
@@ -3630,6 +4016,7 @@ static BOOL WINAPI WS2_ConnectEx(SOCKET s, const struct WS_sockaddr* name, int n
             wsa->control     = NULL;
             wsa->n_iovecs    = sendBuf ? 1 : 0;
             wsa->first_iovec = 0;
+            wsa->batch       = BATCH_NONE;
             wsa->completion_func = NULL;
             wsa->iovec[0].iov_base = sendBuf;
             wsa->iovec[0].iov_len  = sendBufLen;
@@ -5592,7 +5979,7 @@ static int WS2_sendto( SOCKET s, LPWSABUF lpBuffers, DWORD dwBufferCount,
     struct ws2_async *wsa = NULL, localwsa;
     int totalLength = 0;
     DWORD bytes_sent;
-    BOOL is_blocking;
+    BOOL is_blocking, batch;
 
     TRACE("socket %04lx, wsabuf %p, nbufs %d, flags %d, to %p, tolen %d, ovl %p, func %p\n",
           s, lpBuffers, dwBufferCount, dwFlags,
@@ -5631,6 +6018,7 @@ static int WS2_sendto( SOCKET s, LPWSABUF lpBuffers, DWORD dwBufferCount,
     wsa->control     = NULL;
     wsa->n_iovecs    = dwBufferCount;
     wsa->first_iovec = 0;
+    wsa->batch       = BATCH_NONE;
     for ( i = 0; i < dwBufferCount; i++ )
     {
         wsa->iovec[i].iov_base = lpBuffers[i].buf;
@@ -5653,6 +6041,7 @@ static int WS2_sendto( SOCKET s, LPWSABUF lpBuffers, DWORD dwBufferCount,
 
         wsa->user_overlapped = lpOverlapped;
         wsa->completion_func = lpCompletionRoutine;
+        batch = n == -1 && batch_supported( fd, wsa, ASYNC_TYPE_WRITE );
         release_sock_fd( s, fd );
 
         if (n == -1 || n < totalLength)
@@ -5661,11 +6050,10 @@ static int WS2_sendto( SOCKET s, LPWSABUF lpBuffers, DWORD dwBufferCount,
             iosb->Information = n == -1 ? 0 : n;
 
             if (wsa->completion_func)
-                err = register_async( ASYNC_TYPE_WRITE, wsa->hSocket, &wsa->io, NULL,
-                                      ws2_async_apc, wsa, iosb );
+                err = batch_register_async( ASYNC_TYPE_WRITE, wsa, batch, NULL, ws2_async_apc, wsa, iosb );
             else
-                err = register_async( ASYNC_TYPE_WRITE, wsa->hSocket, &wsa->io, lpOverlapped->hEvent,
-                                      NULL, (void *)cvalue, iosb );
+                err = batch_register_async( ASYNC_TYPE_WRITE, wsa, batch, lpOverlapped->hEvent,
+                                            NULL, (void *)cvalue, iosb );
 
             /* Enable the event only after starting the async. The server will deliver it as soon as
                the async is done. */
@@ -8011,7 +8399,7 @@ static int WS2_recv_base( SOCKET s, LPWSABUF lpBuffers, DWORD dwBufferCount,
     unsigned int i, options;
     int n, fd, err, overlapped, flags;
     struct ws2_async *wsa = NULL, localwsa;
-    BOOL is_blocking;
+    BOOL is_blocking, batch;
     DWORD timeout_start = GetTickCount();
     ULONG_PTR cvalue = (lpOverlapped && ((ULONG_PTR)lpOverlapped->hEvent & 1) == 0) ? (ULONG_PTR)lpOverlapped : 0;
 
@@ -8059,6 +8447,7 @@ static int WS2_recv_base( SOCKET s, LPWSABUF lpBuffers, DWORD dwBufferCount,
     wsa->control     = lpControlBuffer;
     wsa->n_iovecs    = dwBufferCount;
     wsa->first_iovec = 0;
+    wsa->batch       = BATCH_NONE;
     for (i = 0; i < dwBufferCount; i++)
     {
         /* check buffer first to trigger write watches */
@@ -8096,6 +8485,7 @@ static int WS2_recv_base( SOCKET s, LPWSABUF lpBuffers, DWORD dwBufferCount,
 
             wsa->user_overlapped = lpOverlapped;
             wsa->completion_func = lpCompletionRoutine;
+            batch = n == -1 && batch_supported( fd, wsa, ASYNC_TYPE_READ );
             release_sock_fd( s, fd );
 
             if (n == -1)
@@ -8104,11 +8494,10 @@ static int WS2_recv_base( SOCKET s, LPWSABUF lpBuffers, DWORD dwBufferCount,
                 iosb->Information = 0;
 
                 if (wsa->completion_func)
-                    err = register_async( ASYNC_TYPE_READ, wsa->hSocket, &wsa->io, NULL,
-                                          ws2_async_apc, wsa, iosb );
+                    err = batch_register_async( ASYNC_TYPE_READ, wsa, batch, NULL, ws2_async_apc, wsa, iosb );
                 else
-                    err = register_async( ASYNC_TYPE_READ, wsa->hSocket, &wsa->io, lpOverlapped->hEvent,
-                                          NULL, (void *)cvalue, iosb );
+                    err = batch_register_async( ASYNC_TYPE_READ, wsa, batch, lpOverlapped->hEvent,
+                                                NULL, (void *)cvalue, iosb );
 
                 if (err != STATUS_PENDING) HeapFree( GetProcessHeap(), 0, wsa );
                 SetLastError(NtStatusToWSAError( err ));
@@ -6936,6 +6936,150 @@ end:
         WSACloseEvent(event);
 }
 
+#define DGRAM_RECVS 16
+
+struct dgram_sender
+{
+    SOCKET             sock;
+    struct sockaddr_in addr;
+    DWORD              count;
+    DWORD              sent;
+    DWORD              ticks;
+};
+
+static DWORD WINAPI dgram_sender_thread( void *arg )
+{
+    struct dgram_sender *sender = arg;
+    char buf[64];
+    DWORD ticks = GetTickCount();
+
+    memset( buf, 0x55, sizeof(buf) );
+    for (sender->sent = 0; sender->sent < sender->count; sender->sent++)
+        if (sendto( sender->sock, buf, sizeof(buf), 0, (struct sockaddr *)&sender->addr,
+                    sizeof(sender->addr) ) != sizeof(buf)) break;
+    sender->ticks = GetTickCount() - ticks;
+    return 0;
+}
+
+static void test_WSARecvFrom_datagrams(void)
+{
+    static const DWORD packet_count = 20000;
+    struct sockaddr_in addr, src_addr, from[DGRAM_RECVS];
+    int fromlen[DGRAM_RECVS], addrlen, bufsize, ret;
+    char bufs[DGRAM_RECVS][64], data[64];
+    WSABUF wsabuf[DGRAM_RECVS];
+    OVERLAPPED ov[DGRAM_RECVS], *povl;
+    DWORD flags[DGRAM_RECVS], i, size, ticks, received;
+    struct dgram_sender sender;
+    SOCKET src, dest;
+    HANDLE port, thread;
+    ULONG_PTR key;
+
+    src = socket( AF_INET, SOCK_DGRAM, 0 );
+    dest = socket( AF_INET, SOCK_DGRAM, 0 );
+    ok( src != INVALID_SOCKET && dest != INVALID_SOCKET, "socket failed, error %d\n", WSAGetLastError() );
+
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr( "127.0.0.1" );
+    ret = bind( dest, (struct sockaddr *)&addr, sizeof(addr) );
+    ok( !ret, "bind failed, error %d\n", WSAGetLastError() );
+    ret = bind( src, (struct sockaddr *)&addr, sizeof(addr) );
+    ok( !ret, "bind failed, error %d\n", WSAGetLastError() );
+    addrlen = sizeof(addr);
+    ret = getsockname( dest, (struct sockaddr *)&addr, &addrlen );
+    ok( !ret, "getsockname failed, error %d\n", WSAGetLastError() );
+    addrlen = sizeof(src_addr);
+    ret = getsockname( src, (struct sockaddr *)&src_addr, &addrlen );
+    ok( !ret, "getsockname failed, error %d\n", WSAGetLastError() );
+
+    /* pending receives get one datagram each, in the order they were queued */
+    for (i = 0; i < DGRAM_RECVS; i++)
+    {
+        memset( &ov[i], 0, sizeof(ov[i]) );
+        ov[i].hEvent = CreateEventW( NULL, TRUE, FALSE, NULL );
+        wsabuf[i].buf = bufs[i];
+        wsabuf[i].len = sizeof(bufs[i]);
+        flags[i] = 0;
+        fromlen[i] = sizeof(from[i]);
+        ret = WSARecvFrom( dest, &wsabuf[i], 1, NULL, &flags[i], (struct sockaddr *)&from[i], &fromlen[i],
+                           &ov[i], NULL );
+        ok( ret == SOCKET_ERROR && WSAGetLastError() == ERROR_IO_PENDING,
+            "%u: WSARecvFrom returned %d, error %d\n", i, ret, WSAGetLastError() );
+    }
+    for (i = 0; i < DGRAM_RECVS; i++)
+    {
+        memset( data, i, i + 1 );
+        ret = sendto( src, data, i + 1, 0, (struct sockaddr *)&addr, sizeof(addr) );
+        ok( ret == i + 1, "%u: sendto returned %d, error %d\n", i, ret, WSAGetLastError() );
+    }
+    for (i = 0; i < DGRAM_RECVS; i++)
+    {
+        ret = WaitForSingleObject( ov[i].hEvent, 1000 );
+        ok( !ret, "%u: wait failed %d\n", i, ret );
+        ret = WSAGetOverlappedResult( dest, &ov[i], &size, FALSE, &flags[i] );
+        ok( ret, "%u: WSAGetOverlappedResult failed, error %d\n", i, WSAGetLastError() );
+        ok( size == i + 1, "%u: got size %u\n", i, size );
+        ok( bufs[i][0] == i && bufs[i][i] == i, "%u: got wrong data %02x\n", i, (BYTE)bufs[i][0] );
+        ok( fromlen[i] == sizeof(from[i]), "%u: got address length %d\n", i, fromlen[i] );
+        ok( from[i].sin_port == src_addr.sin_port, "%u: got port %u\n", i, ntohs( from[i].sin_port ) );
+        CloseHandle( ov[i].hEvent );
+    }
+
+    /* packets per second through a completion port, the usual server loop */
+    bufsize = 4 * 1024 * 1024;
+    setsockopt( dest, SOL_SOCKET, SO_RCVBUF, (char *)&bufsize, sizeof(bufsize) );
+    port = CreateIoCompletionPort( (HANDLE)dest, NULL, 0, 0 );
+    ok( port != NULL, "CreateIoCompletionPort failed, error %u\n", GetLastError() );
+
+    for (i = 0; i < DGRAM_RECVS; i++)
+    {
+        memset( &ov[i], 0, sizeof(ov[i]) );
+        flags[i] = 0;
+        fromlen[i] = sizeof(from[i]);
+        ret = WSARecvFrom( dest, &wsabuf[i], 1, NULL, &flags[i], (struct sockaddr *)&from[i], &fromlen[i],
+                           &ov[i], NULL );
+        ok( ret == SOCKET_ERROR && WSAGetLastError() == ERROR_IO_PENDING,
+            "%u: WSARecvFrom returned %d, error %d\n", i, ret, WSAGetLastError() );
+    }
+
+    sender.sock  = src;
+    sender.addr  = addr;
+    sender.count = packet_count;
+    ticks = GetTickCount();
+    thread = CreateThread( NULL, 0, dgram_sender_thread, &sender, 0, NULL );
+
+    for (received = 0; received < packet_count; received++)
+    {
+        /* the sender is done once no datagram arrives for a while, some may have been dropped */
+        if (!GetQueuedCompletionStatus( port, &size, &key, &povl, 1000 )) break;
+        ok( size == sizeof(data), "got size %u\n", size );
+        i = povl - ov;
+        flags[i] = 0;
+        fromlen[i] = sizeof(from[i]);
+        ret = WSARecvFrom( dest, &wsabuf[i], 1, NULL, &flags[i], (struct sockaddr *)&from[i], &fromlen[i],
+                           &ov[i], NULL );
+        ok( !ret || WSAGetLastError() == ERROR_IO_PENDING,
+            "WSARecvFrom returned %d, error %d\n", ret, WSAGetLastError() );
+    }
+    ticks = GetTickCount() - ticks;
+    if (received < packet_count) ticks -= min( ticks, 1000 );
+
+    WaitForSingleObject( thread, INFINITE );
+    CloseHandle( thread );
+    ok( sender.sent == packet_count, "sent %u datagrams\n", sender.sent );
+    ok( received > 0, "no datagram received\n" );
+    trace( "sent %u datagrams in %u ms (%u/s), received %u in %u ms (%u/s)\n",
+           sender.sent, sender.ticks, sender.sent * 1000 / max( sender.ticks, 1 ),
+           received, ticks, received * 1000 / max( ticks, 1 ) );
+
+    /* wait for the cancelled receives before releasing their buffers */
+    closesocket( dest );
+    while (GetQueuedCompletionStatus( port, &size, &key, &povl, 1000 ) || povl);
+    CloseHandle( port );
+    closesocket( src );
+}
+
 struct write_watch_thread_args
 {
     int func;
@@ -6989,11 +7133,12 @@ static void test_write_watch(void)
 {
     SOCKET src, dest;
     WSABUF bufs[2];
-    WSAOVERLAPPED ov;
+    WSAOVERLAPPED ov, ov2;
     struct write_watch_thread_args args;
     DWORD bytesReturned, flags, size;
     struct sockaddr addr;
-    int addr_len, ret;
+    struct sockaddr_in sin, from[2];
+    int addr_len, from_len[2], ret;
     HANDLE thread, event;
     char *base;
     void *results[64];
@@ -7119,6 +7264,72 @@ static void test_write_watch(void)
         ok( !ret, "GetWriteWatch failed %u\n", GetLastError() );
         ok( count == 0, "wrong count %lu\n", count );
     }
+    closesocket( dest );
+    closesocket( src );
+
+    /* datagrams, with two receives pending on the same socket */
+    src = socket( AF_INET, SOCK_DGRAM, 0 );
+    dest = socket( AF_INET, SOCK_DGRAM, 0 );
+    ok( src != INVALID_SOCKET && dest != INVALID_SOCKET, "failed to create sockets\n" );
+    memset( &sin, 0, sizeof(sin) );
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = inet_addr( "127.0.0.1" );
+    ret = bind( dest, (struct sockaddr *)&sin, sizeof(sin) );
+    ok( !ret, "bind failed %d\n", WSAGetLastError() );
+    addr_len = sizeof(sin);
+    ret = getsockname( dest, (struct sockaddr *)&sin, &addr_len );
+    ok( !ret, "getsockname failed %d\n", WSAGetLastError() );
+
+    memset( base, 0, size );
+    count = 64;
+    ret = pGetWriteWatch( WRITE_WATCH_FLAG_RESET, base, size, results, &count, &pagesize );
+    ok( !ret, "GetWriteWatch failed %u\n", GetLastError() );
+    ok( count == 16, "wrong count %lu\n", count );
+
+    memset( &ov2, 0, sizeof(ov2) );
+    ov2.hEvent = CreateEventA( NULL, FALSE, FALSE, NULL );
+    ok( ov2.hEvent != NULL, "could not create event object, errno = %d\n", GetLastError() );
+
+    flags = 0;
+    bufs[0].len = 0x2000;
+    bufs[0].buf = base;
+    from_len[0] = sizeof(from[0]);
+    ret = WSARecvFrom( dest, &bufs[0], 1, NULL, &flags, (struct sockaddr *)&from[0], &from_len[0], &ov, NULL );
+    ok( ret == SOCKET_ERROR && GetLastError() == ERROR_IO_PENDING,
+        "WSARecvFrom failed - %d error %d\n", ret, GetLastError() );
+    bufs[1].len = 0x2000;
+    bufs[1].buf = base + 0x8000;
+    from_len[1] = sizeof(from[1]);
+    ret = WSARecvFrom( dest, &bufs[1], 1, NULL, &flags, (struct sockaddr *)&from[1], &from_len[1], &ov2, NULL );
+    ok( ret == SOCKET_ERROR && GetLastError() == ERROR_IO_PENDING,
+        "WSARecvFrom failed - %d error %d\n", ret, GetLastError() );
+
+    count = 64;
+    ret = pGetWriteWatch( WRITE_WATCH_FLAG_RESET, base, size, results, &count, &pagesize );
+    ok( !ret, "GetWriteWatch failed %u\n", GetLastError() );
+    ok( count == 4, "wrong count %lu\n", count );
+    ok( !base[0], "data set\n" );
+
+    ret = sendto( src, "first", sizeof("first"), 0, (struct sockaddr *)&sin, sizeof(sin) );
+    ok( ret == sizeof("first"), "sendto failed %d\n", WSAGetLastError() );
+    ret = sendto( src, "second", sizeof("second"), 0, (struct sockaddr *)&sin, sizeof(sin) );
+    ok( ret == sizeof("second"), "sendto failed %d\n", WSAGetLastError() );
+
+    ret = GetOverlappedResult( (HANDLE)dest, &ov, &bytesReturned, TRUE );
+    ok( ret, "GetOverlappedResult failed %u\n", GetLastError() );
+    ok( bytesReturned == sizeof("first"), "wrong size %u\n", bytesReturned );
+    ok( !strcmp( base, "first" ), "wrong data %s\n", base );
+    ret = GetOverlappedResult( (HANDLE)dest, &ov2, &bytesReturned, TRUE );
+    ok( ret, "GetOverlappedResult failed %u\n", GetLastError() );
+    ok( bytesReturned == sizeof("second"), "wrong size %u\n", bytesReturned );
+    ok( !strcmp( base + 0x8000, "second" ), "wrong data %s\n", base + 0x8000 );
+
+    count = 64;
+    ret = pGetWriteWatch( WRITE_WATCH_FLAG_RESET, base, size, results, &count, &pagesize );
+    ok( !ret, "GetWriteWatch failed %u\n", GetLastError() );
+    ok( count == 0, "wrong count %lu\n", count );
+
+    CloseHandle( ov2.hEvent );
     WSACloseEvent( event );
     closesocket( dest );
     closesocket( src );
@@ -9169,6 +9380,128 @@ cleanup:
     closesocket(server);
 }
 
+struct transmit_reader
+{
+    SOCKET sock;
+    DWORD  offset;    /* file offset of the first byte */
+    DWORD  size;      /* expected number of bytes */
+    DWORD  received;
+    BOOL   valid;
+};
+
+static DWORD WINAPI transmit_reader_thread( void *arg )
+{
+    struct transmit_reader *reader = arg;
+    static char buf[65536];
+    int i, ret;
+
+    reader->received = 0;
+    reader->valid = TRUE;
+    while (reader->received < reader->size)
+    {
+        ret = recv( reader->sock, buf, min( sizeof(buf), reader->size - reader->received ), 0 );
+        if (ret <= 0) break;
+        for (i = 0; i < ret; i++)
+            if ((BYTE)buf[i] != (BYTE)((reader->offset + reader->received + i) % 251)) reader->valid = FALSE;
+        reader->received += ret;
+    }
+    return 0;
+}
+
+static void test_TransmitFile_throughput(void)
+{
+    static const DWORD file_size = 32 * 1024 * 1024;
+    GUID transmitFileGuid = WSAID_TRANSMITFILE;
+    LPFN_TRANSMITFILE pTransmitFile = NULL;
+    struct transmit_reader reader;
+    char path[MAX_PATH], filename[MAX_PATH];
+    SOCKET client, dest;
+    OVERLAPPED ov;
+    HANDLE file, thread;
+    DWORD i, j, ticks, size, total_sent;
+    char *buf;
+    BOOL bret;
+    int iret;
+
+    GetTempPathA( MAX_PATH, path );
+    GetTempFileNameA( path, "wst", 0, filename );
+    file = CreateFileA( filename, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                        FILE_FLAG_DELETE_ON_CLOSE, NULL );
+    ok( file != INVALID_HANDLE_VALUE, "CreateFile failed, error %u\n", GetLastError() );
+    if (file == INVALID_HANDLE_VALUE) return;
+
+    buf = HeapAlloc( GetProcessHeap(), 0, 65536 );
+    for (i = 0; i < file_size; i += 65536)
+    {
+        for (j = 0; j < 65536; j++) buf[j] = (i + j) % 251;
+        bret = WriteFile( file, buf, 65536, &size, NULL );
+        ok( bret && size == 65536, "WriteFile failed, error %u\n", GetLastError() );
+    }
+    HeapFree( GetProcessHeap(), 0, buf );
+
+    /* synchronous transfer of the whole file */
+    if (tcp_socketpair( &client, &dest ))
+    {
+        skip( "could not create a socket pair\n" );
+        CloseHandle( file );
+        return;
+    }
+    iret = WSAIoctl( client, SIO_GET_EXTENSION_FUNCTION_POINTER, &transmitFileGuid, sizeof(transmitFileGuid),
+                     &pTransmitFile, sizeof(pTransmitFile), &size, NULL, NULL );
+    ok( !iret, "failed to get TransmitFile, error %d\n", WSAGetLastError() );
+
+    reader.sock = dest;
+    reader.offset = 0;
+    reader.size = file_size;
+    thread = CreateThread( NULL, 0, transmit_reader_thread, &reader, 0, NULL );
+    SetFilePointer( file, 0, NULL, FILE_BEGIN );
+    ticks = GetTickCount();
+    bret = pTransmitFile( client, file, 0, 0, NULL, NULL, 0 );
+    ok( bret, "TransmitFile failed, error %d\n", WSAGetLastError() );
+    WaitForSingleObject( thread, INFINITE );
+    ticks = GetTickCount() - ticks;
+    CloseHandle( thread );
+    ok( reader.received == file_size, "received %u bytes\n", reader.received );
+    ok( reader.valid, "received wrong data\n" );
+    trace( "synchronous TransmitFile: %u MB in %u ms\n", file_size >> 20, ticks );
+    closesocket( client );
+    closesocket( dest );
+
+    /* overlapped transfer with an offset and a size limit */
+    if (tcp_socketpair_ovl( &client, &dest ))
+    {
+        skip( "could not create an overlapped socket pair\n" );
+        CloseHandle( file );
+        return;
+    }
+    memset( &ov, 0, sizeof(ov) );
+    ov.hEvent = CreateEventW( NULL, FALSE, FALSE, NULL );
+    ov.Offset = 1000;
+    reader.sock = dest;
+    reader.offset = ov.Offset;
+    reader.size = file_size / 2;
+    thread = CreateThread( NULL, 0, transmit_reader_thread, &reader, 0, NULL );
+    ticks = GetTickCount();
+    bret = pTransmitFile( client, file, file_size / 2, 0, &ov, NULL, 0 );
+    ok( !bret && WSAGetLastError() == ERROR_IO_PENDING, "TransmitFile returned %d, error %d\n",
+        bret, WSAGetLastError() );
+    iret = WaitForSingleObject( ov.hEvent, 20000 );
+    ok( iret == WAIT_OBJECT_0, "overlapped TransmitFile failed\n" );
+    WaitForSingleObject( thread, 20000 );
+    ticks = GetTickCount() - ticks;
+    CloseHandle( thread );
+    WSAGetOverlappedResult( client, &ov, &total_sent, FALSE, NULL );
+    ok( total_sent == file_size / 2, "sent %u bytes\n", total_sent );
+    ok( reader.received == file_size / 2, "received %u bytes\n", reader.received );
+    ok( reader.valid, "received wrong data\n" );
+    trace( "overlapped TransmitFile: %u MB in %u ms\n", file_size >> 21, ticks );
+
+    CloseHandle( ov.hEvent );
+    closesocket( client );
+    closesocket( dest );
+    CloseHandle( file );
+}
+
 static void test_getpeername(void)
 {
     SOCKET sock;
@@ -11697,6 +12030,7 @@ START_TEST( sock )
     test_WSASendMsg();
     test_WSASendTo();
     test_WSARecv();
+    test_WSARecvFrom_datagrams();
     test_WSAPoll();
     test_write_watch();
     test_iocp();
@@ -11706,6 +12040,7 @@ START_TEST( sock )
 
     test_ipv6only();
     test_TransmitFile();
+    test_TransmitFile_throughput();
     test_GetAddrInfoW();
     test_GetAddrInfoExW();
     test_getaddrinfo();
@@ -0,0 +1,57 @@
+/*
+ * Wine-specific heap statistics
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINE_WINE_HEAPSTATS_H
+#define __WINE_WINE_HEAPSTATS_H
+
+#include <winternl.h>
+
+/* Wine extensions to RtlQueryHeapInformation, available once the statistics of a
+ * heap are enabled, either for all heaps with the FLG_HEAP_ENABLE_TAGGING global
+ * flag, or for a single heap with RtlSetHeapInformation( HeapWineStatistics ).
+ * Call stacks are recorded for one allocation out of SampleRate with the
+ * FLG_USER_STACK_TRACE_DB global flag, or when the ULONG passed to
+ * RtlSetHeapInformation is non-zero. */
+#define HeapWineStatistics      ((HEAP_INFORMATION_CLASS)0x57000000)
+#define HeapWineStackTraces     ((HEAP_INFORMATION_CLASS)0x57000001)
+#define HeapWineDumpStatistics  ((HEAP_INFORMATION_CLASS)0x57000002)
+
+#define HEAP_WINE_SIZE_CLASSES  16  /* allocations of up to 16 << n bytes, the last one is unbounded */
+#define HEAP_WINE_STACK_DEPTH   8
+
+typedef struct _HEAP_WINE_STATISTICS
+{
+    ULONGLONG BytesInUse;        /* bytes requested by the live blocks */
+    ULONGLONG BlocksInUse;       /* number of live blocks */
+    ULONGLONG BytesCommitted;    /* committed memory, including the heap overhead */
+    ULONGLONG TotalAllocations;  /* reallocations count as a free and an allocation */
+    ULONGLONG TotalFrees;
+    ULONG     Fragmentation;     /* percentage of the committed memory not used by live blocks */
+    ULONG     SampleRate;        /* allocations per recorded call stack, 0 if disabled */
+    ULONGLONG SizeClassAllocations[HEAP_WINE_SIZE_CLASSES];
+} HEAP_WINE_STATISTICS, *PHEAP_WINE_STATISTICS;
+
+typedef struct _HEAP_WINE_STACK_TRACE
+{
+    ULONGLONG BlocksInUse;       /* live sampled blocks allocated from this call stack */
+    ULONGLONG BytesInUse;
+    ULONG     Depth;
+    PVOID     Frames[HEAP_WINE_STACK_DEPTH];
+} HEAP_WINE_STACK_TRACE, *PHEAP_WINE_STACK_TRACE;
+
+#endif  /* __WINE_WINE_HEAPSTATS_H */
@@ -50,6 +50,7 @@ struct __server_request_info
 };
 
 extern unsigned int CDECL wine_server_call( void *req_ptr );
+extern unsigned int CDECL wine_server_call_batch( struct __server_request_info **reqs, unsigned int count );
 extern void CDECL wine_server_send_fd( int fd );
 extern int CDECL wine_server_fd_to_handle( int fd, unsigned int access, unsigned int attributes, HANDLE *handle );
 extern int CDECL wine_server_handle_to_fd( HANDLE handle, unsigned int access, int *unix_fd, unsigned int *options );
@@ -138,5 +139,12 @@ static inline void *wine_server_get_ptr( client_ptr_t ptr )
         while(0); \
     } while(0)
 
+/* initialize a request structure to be sent with wine_server_call_batch */
+#define SERVER_INIT_REQ(info,type) \
+    (memset( &(info)->u.req, 0, sizeof((info)->u.req) ), \
+     (info)->u.req.request_header.req = REQ_##type, \
+     (info)->data_count = 0, \
+     &(info)->u.req.type##_request)
+
 
 #endif  /* __WINE_WINE_SERVER_H */
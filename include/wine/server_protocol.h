@@ -434,6 +434,65 @@ typedef union
     } keyed_event;
 } select_op_t;
 
+
+struct fsync_object
+{
+    int          type;
+    unsigned int state;
+    unsigned int max;
+    unsigned int count;
+    int          abandoned;
+    int          waiters;
+    int          seq;
+    int          pulse;
+};
+enum fsync_type
+{
+    FSYNC_NONE,
+    FSYNC_AUTO_EVENT,
+    FSYNC_MANUAL_EVENT,
+    FSYNC_SEMAPHORE,
+    FSYNC_MUTEX,
+    FSYNC_COMPLETION
+};
+#define FSYNC_SERVER_WAIT 0x80000000
+
+
+
+struct fsync_completion_msg
+{
+    client_ptr_t   ckey;
+    client_ptr_t   cvalue;
+    client_ptr_t   information;
+    unsigned int   status;
+    int            __pad;
+};
+#define FSYNC_COMPLETION_RING 63
+#define FSYNC_COMPLETION_COUNT(state) ((state) & 0xff)
+#define FSYNC_COMPLETION_HEAD(state)  (((state) & ~FSYNC_SERVER_WAIT) >> 8)
+#define FSYNC_COMPLETION_STATE(head,count) ((((head) << 8) & ~FSYNC_SERVER_WAIT) | (count))
+
+
+#define FSYNC_OWNED_MAX 8
+struct fsync_owned
+{
+    unsigned int index[FSYNC_OWNED_MAX];
+};
+
+
+struct handle_mirror_entry
+{
+    unsigned int access;
+    unsigned int flags;
+    unsigned int serial;
+};
+
+#define HANDLE_MIRROR_IN_USE  0x80000000
+#define HANDLE_MIRROR_NO_COMPLETION   0x40000000
+#define HANDLE_MIRROR_SKIP_COMPLETION 0x20000000
+#define HANDLE_MIRROR_HAS_FD  0x10000000
+#define HANDLE_MIRROR_ENTRIES 0x10000
+
 enum apc_type
 {
     APC_NONE,
@@ -1799,6 +1858,20 @@ struct set_socket_deferred_reply
 };
 
 
+struct complete_socket_asyncs_request
+{
+    struct request_header __header;
+    obj_handle_t handle;
+    int          type;
+    /* VARARG(asyncs,uints64); */
+    char __pad_20[4];
+};
+struct complete_socket_asyncs_reply
+{
+    struct reply_header __header;
+};
+
+
 struct alloc_console_request
 {
     struct request_header __header;
@@ -2343,11 +2416,27 @@ struct get_mapping_info_reply
     mem_size_t   size;
     unsigned int flags;
     obj_handle_t shared_file;
+    client_ptr_t reloc_base;
     /* VARARG(image,pe_image_info); */
 };
 
 
 
+struct get_mapping_reloc_file_request
+{
+    struct request_header __header;
+    obj_handle_t handle;
+    client_ptr_t base;
+};
+struct get_mapping_reloc_file_reply
+{
+    struct reply_header __header;
+    obj_handle_t file;
+    char __pad_12[4];
+};
+
+
+
 struct map_view_request
 {
     struct request_header __header;
@@ -2715,11 +2804,28 @@ struct get_key_value_reply
     struct reply_header __header;
     int          type;
     data_size_t  total;
+    unsigned int cache_slot;
+    unsigned int cache_gen;
     /* VARARG(data,bytes); */
 };
 
 
 
+struct get_registry_cache_request
+{
+    struct request_header __header;
+    char __pad_12[4];
+};
+struct get_registry_cache_reply
+{
+    struct reply_header __header;
+    data_size_t  size;
+    char __pad_12[4];
+};
+#define REGISTRY_CACHE_SLOTS 0x10000
+
+
+
 struct enum_key_value_request
 {
     struct request_header __header;
@@ -3476,6 +3582,7 @@ struct create_named_pipe_reply
 #define NAMED_PIPE_MESSAGE_STREAM_WRITE 0x0001
 #define NAMED_PIPE_MESSAGE_STREAM_READ  0x0002
 #define NAMED_PIPE_NONBLOCKING_MODE     0x0004
+#define NAMED_PIPE_DIRECT_DATA          0x0008
 #define NAMED_PIPE_SERVER_END           0x8000
 
 
@@ -5453,6 +5560,58 @@ struct remove_completion_reply
 
 
 
+struct create_completion_wait_request
+{
+    struct request_header __header;
+    unsigned int access;
+    /* VARARG(objattr,object_attributes); */
+};
+struct create_completion_wait_reply
+{
+    struct reply_header __header;
+    obj_handle_t handle;
+    char __pad_12[4];
+};
+
+
+
+struct associate_completion_wait_request
+{
+    struct request_header __header;
+    obj_handle_t  wait;
+    obj_handle_t  completion;
+    obj_handle_t  handle;
+    obj_handle_t  thread;
+    char __pad_28[4];
+    apc_param_t   ckey;
+    apc_param_t   cvalue;
+    apc_param_t   information;
+    unsigned int  status;
+    char __pad_60[4];
+};
+struct associate_completion_wait_reply
+{
+    struct reply_header __header;
+    int           signaled;
+    char __pad_12[4];
+};
+
+
+
+struct cancel_completion_wait_request
+{
+    struct request_header __header;
+    obj_handle_t  wait;
+    int           remove;
+    char __pad_20[4];
+};
+struct cancel_completion_wait_reply
+{
+    struct reply_header __header;
+};
+
+
+
 struct query_completion_request
 {
     struct request_header __header;
@@ -5494,6 +5653,9 @@ struct add_fd_completion_request
 struct add_fd_completion_reply
 {
     struct reply_header __header;
+    apc_param_t    ckey;
+    unsigned int   port;
+    char __pad_20[4];
 };
 
 
@@ -5799,6 +5961,102 @@ struct resume_process_reply
 };
 
 
+
+struct get_fsync_shm_request
+{
+    struct request_header __header;
+    char __pad_12[4];
+};
+struct get_fsync_shm_reply
+{
+    struct reply_header __header;
+    data_size_t  size;
+    char __pad_12[4];
+};
+
+
+
+struct get_fsync_idx_request
+{
+    struct request_header __header;
+    obj_handle_t handle;
+};
+struct get_fsync_idx_reply
+{
+    struct reply_header __header;
+    unsigned int index;
+    int          type;
+};
+
+
+
+struct get_fsync_owned_request
+{
+    struct request_header __header;
+    char __pad_12[4];
+};
+struct get_fsync_owned_reply
+{
+    struct reply_header __header;
+    unsigned int index;
+    unsigned int owner;
+};
+
+
+
+struct call_batch_request
+{
+    struct request_header __header;
+    /* VARARG(requests,bytes); */
+    char __pad_12[4];
+};
+struct call_batch_reply
+{
+    struct reply_header __header;
+    unsigned int count;
+    /* VARARG(replies,bytes); */
+    char __pad_12[4];
+};
+
+
+
+struct get_handle_mirror_request
+{
+    struct request_header __header;
+    char __pad_12[4];
+};
+struct get_handle_mirror_reply
+{
+    struct reply_header __header;
+    data_size_t  size;
+    char __pad_12[4];
+};
+
+
+struct request_profile_info
+{
+    unsigned int    request;
+    unsigned int    count;
+    timeout_t       total;
+    timeout_t       p50;
+    timeout_t       p99;
+};
+
+
+struct get_request_profile_request
+{
+    struct request_header __header;
+    obj_handle_t    handle;
+};
+struct get_request_profile_reply
+{
+    struct reply_header __header;
+    unsigned int    count;
+    /* VARARG(stats,request_profiles); */
+    char __pad_12[4];
+};
+
+
 enum request
 {
     REQ_new_process,
@@ -5862,6 +6120,7 @@ enum request
     REQ_get_socket_info,
     REQ_enable_socket_event,
     REQ_set_socket_deferred,
+    REQ_complete_socket_asyncs,
     REQ_alloc_console,
     REQ_free_console,
     REQ_get_console_renderer_events,
@@ -5889,6 +6148,7 @@ enum request
     REQ_create_mapping,
     REQ_open_mapping,
     REQ_get_mapping_info,
+    REQ_get_mapping_reloc_file,
     REQ_map_view,
     REQ_unmap_view,
     REQ_get_mapping_committed_range,
@@ -5912,6 +6172,7 @@ enum request
     REQ_enum_key,
     REQ_set_key_value,
     REQ_get_key_value,
+    REQ_get_registry_cache,
     REQ_enum_key_value,
     REQ_delete_key_value,
     REQ_load_registry,
@@ -6075,6 +6336,9 @@ enum request
     REQ_open_completion,
     REQ_add_completion,
     REQ_remove_completion,
+    REQ_create_completion_wait,
+    REQ_associate_completion_wait,
+    REQ_cancel_completion_wait,
     REQ_query_completion,
     REQ_set_completion_info,
     REQ_add_fd_completion,
@@ -6098,6 +6362,12 @@ enum request
     REQ_terminate_job,
     REQ_suspend_process,
     REQ_resume_process,
+    REQ_get_fsync_shm,
+    REQ_get_fsync_idx,
+    REQ_get_fsync_owned,
+    REQ_call_batch,
+    REQ_get_handle_mirror,
+    REQ_get_request_profile,
     REQ_NB_REQUESTS
 };
 
@@ -6166,6 +6436,7 @@ union generic_request
     struct get_socket_info_request get_socket_info_request;
     struct enable_socket_event_request enable_socket_event_request;
     struct set_socket_deferred_request set_socket_deferred_request;
+    struct complete_socket_asyncs_request complete_socket_asyncs_request;
     struct alloc_console_request alloc_console_request;
     struct free_console_request free_console_request;
     struct get_console_renderer_events_request get_console_renderer_events_request;
@@ -6193,6 +6464,7 @@ union generic_request
     struct create_mapping_request create_mapping_request;
     struct open_mapping_request open_mapping_request;
     struct get_mapping_info_request get_mapping_info_request;
+    struct get_mapping_reloc_file_request get_mapping_reloc_file_request;
     struct map_view_request map_view_request;
     struct unmap_view_request unmap_view_request;
     struct get_mapping_committed_range_request get_mapping_committed_range_request;
@@ -6216,6 +6488,7 @@ union generic_request
     struct enum_key_request enum_key_request;
     struct set_key_value_request set_key_value_request;
     struct get_key_value_request get_key_value_request;
+    struct get_registry_cache_request get_registry_cache_request;
     struct enum_key_value_request enum_key_value_request;
     struct delete_key_value_request delete_key_value_request;
     struct load_registry_request load_registry_request;
@@ -6379,6 +6652,9 @@ union generic_request
     struct open_completion_request open_completion_request;
     struct add_completion_request add_completion_request;
     struct remove_completion_request remove_completion_request;
+    struct create_completion_wait_request create_completion_wait_request;
+    struct associate_completion_wait_request associate_completion_wait_request;
+    struct cancel_completion_wait_request cancel_completion_wait_request;
     struct query_completion_request query_completion_request;
     struct set_completion_info_request set_completion_info_request;
     struct add_fd_completion_request add_fd_completion_request;
@@ -6402,6 +6678,12 @@ union generic_request
     struct terminate_job_request terminate_job_request;
     struct suspend_process_request suspend_process_request;
     struct resume_process_request resume_process_request;
+    struct get_fsync_shm_request get_fsync_shm_request;
+    struct get_fsync_idx_request get_fsync_idx_request;
+    struct get_fsync_owned_request get_fsync_owned_request;
+    struct call_batch_request call_batch_request;
+    struct get_handle_mirror_request get_handle_mirror_request;
+    struct get_request_profile_request get_request_profile_request;
 };
 union generic_reply
 {
@@ -6468,6 +6750,7 @@ union generic_reply
     struct get_socket_info_reply get_socket_info_reply;
     struct enable_socket_event_reply enable_socket_event_reply;
     struct set_socket_deferred_reply set_socket_deferred_reply;
+    struct complete_socket_asyncs_reply complete_socket_asyncs_reply;
     struct alloc_console_reply alloc_console_reply;
     struct free_console_reply free_console_reply;
     struct get_console_renderer_events_reply get_console_renderer_events_reply;
@@ -6495,6 +6778,7 @@ union generic_reply
     struct create_mapping_reply create_mapping_reply;
     struct open_mapping_reply open_mapping_reply;
     struct get_mapping_info_reply get_mapping_info_reply;
+    struct get_mapping_reloc_file_reply get_mapping_reloc_file_reply;
     struct map_view_reply map_view_reply;
     struct unmap_view_reply unmap_view_reply;
     struct get_mapping_committed_range_reply get_mapping_committed_range_reply;
@@ -6518,6 +6802,7 @@ union generic_reply
     struct enum_key_reply enum_key_reply;
     struct set_key_value_reply set_key_value_reply;
     struct get_key_value_reply get_key_value_reply;
+    struct get_registry_cache_reply get_registry_cache_reply;
     struct enum_key_value_reply enum_key_value_reply;
     struct delete_key_value_reply delete_key_value_reply;
     struct load_registry_reply load_registry_reply;
@@ -6681,6 +6966,9 @@ union generic_reply
     struct open_completion_reply open_completion_reply;
     struct add_completion_reply add_completion_reply;
     struct remove_completion_reply remove_completion_reply;
+    struct create_completion_wait_reply create_completion_wait_reply;
+    struct associate_completion_wait_reply associate_completion_wait_reply;
+    struct cancel_completion_wait_reply cancel_completion_wait_reply;
     struct query_completion_reply query_completion_reply;
     struct set_completion_info_reply set_completion_info_reply;
     struct add_fd_completion_reply add_fd_completion_reply;
@@ -6704,11 +6992,17 @@ union generic_reply
     struct terminate_job_reply terminate_job_reply;
     struct suspend_process_reply suspend_process_reply;
     struct resume_process_reply resume_process_reply;
+    struct get_fsync_shm_reply get_fsync_shm_reply;
+    struct get_fsync_idx_reply get_fsync_idx_reply;
+    struct get_fsync_owned_reply get_fsync_owned_reply;
+    struct call_batch_reply call_batch_reply;
+    struct get_handle_mirror_reply get_handle_mirror_reply;
+    struct get_request_profile_reply get_request_profile_reply;
 };
 
 /* ### protocol_version begin ### */
 
-#define SERVER_PROTOCOL_VERSION 596
+#define SERVER_PROTOCOL_VERSION 616
 
 /* ### protocol_version end ### */
 
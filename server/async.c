@@ -472,6 +472,19 @@ void async_wake_up( struct async_queue *queue, unsigned int status )
     }
 }
 
+/* wake up a single async of the queue, identified by its user data */
+void async_wake_up_user( struct async_queue *queue, client_ptr_t user )
+{
+    struct async *async;
+
+    LIST_FOR_EACH_ENTRY( async, &queue->queue, struct async, queue_entry )
+    {
+        if (async->data.user != user || async->thread->process != current->process) continue;
+        if (async->status == STATUS_PENDING) async_terminate( async, STATUS_ALERTED );
+        return;
+    }
+}
+
 static void iosb_dump( struct object *obj, int verbose );
 static void iosb_destroy( struct object *obj );
 
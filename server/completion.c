@@ -48,10 +48,14 @@ struct completion
     struct object  obj;
     struct list    queue;
     unsigned int   depth;
+    struct fsync_object *fsync;    /* shared state for the messages queued by the clients */
+    struct fsync_object *detached; /* shared state once the server has taken it over */
 };
 
 static void completion_dump( struct object*, int );
 static struct object_type *completion_get_type( struct object *obj );
+static int completion_add_queue( struct object *obj, struct wait_queue_entry *entry );
+static void completion_remove_queue( struct object *obj, struct wait_queue_entry *entry );
 static int completion_signaled( struct object *obj, struct wait_queue_entry *entry );
 static unsigned int completion_map_access( struct object *obj, unsigned int access );
 static void completion_destroy( struct object * );
@@ -61,8 +65,8 @@ static const struct object_ops completion_ops =
     sizeof(struct completion), /* size */
     completion_dump,           /* dump */
     completion_get_type,       /* get_type */
-    add_queue,                 /* add_queue */
-    remove_queue,              /* remove_queue */
+    completion_add_queue,      /* add_queue */
+    completion_remove_queue,   /* remove_queue */
     completion_signaled,       /* signaled */
     no_satisfied,              /* satisfied */
     no_signal,                 /* signal */
@@ -86,8 +90,124 @@ struct comp_msg
     apc_param_t   cvalue;
     apc_param_t   information;
     unsigned int  status;
+    struct completion_wait *wait;   /* wait completion packet that queued the message */
 };
 
+/* wait completion packet, queued to a completion port once an object is signaled */
+struct completion_wait
+{
+    struct object       obj;
+    struct completion  *completion;  /* associated completion port */
+    struct thread_wait *wait;        /* pending wait on the target object */
+    struct comp_msg    *msg;         /* message queued to the port, not yet removed */
+    apc_param_t         ckey;
+    apc_param_t         cvalue;
+    apc_param_t         information;
+    unsigned int        status;
+};
+
+static void completion_wait_dump( struct object *obj, int verbose );
+static struct object_type *completion_wait_get_type( struct object *obj );
+static void completion_wait_destroy( struct object *obj );
+
+static const struct object_ops completion_wait_ops =
+{
+    sizeof(struct completion_wait), /* size */
+    completion_wait_dump,      /* dump */
+    completion_wait_get_type,  /* get_type */
+    no_add_queue,              /* add_queue */
+    NULL,                      /* remove_queue */
+    NULL,                      /* signaled */
+    NULL,                      /* satisfied */
+    no_signal,                 /* signal */
+    no_get_fd,                 /* get_fd */
+    no_map_access,             /* map_access */
+    default_get_sd,            /* get_sd */
+    default_set_sd,            /* set_sd */
+    no_lookup_name,            /* lookup_name */
+    directory_link_name,       /* link_name */
+    default_unlink_name,       /* unlink_name */
+    no_open_file,              /* open_file */
+    no_kernel_obj_list,        /* get_kernel_obj_list */
+    no_close_handle,           /* close_handle */
+    completion_wait_destroy    /* destroy */
+};
+
+/* number of messages queued by the clients in the ring of the port */
+static unsigned int get_client_msg_count( struct completion *completion )
+{
+    if (!completion->fsync) return 0;
+    return FSYNC_COMPLETION_COUNT( fsync_get_state( completion->fsync ));
+}
+
+/* remove the first message queued by the clients; return 0 if there is none */
+static int remove_client_msg( struct completion *completion, struct fsync_completion_msg *msg )
+{
+    const struct fsync_completion_msg *ring;
+    unsigned int state, head, count;
+
+    if (!completion->fsync) return 0;
+    ring = (const struct fsync_completion_msg *)(completion->fsync + 1);
+    do
+    {
+        state = fsync_get_state( completion->fsync );
+        if (!(count = FSYNC_COMPLETION_COUNT( state ))) return 0;
+        head = FSYNC_COMPLETION_HEAD( state );
+        *msg = ring[head % FSYNC_COMPLETION_RING];
+    } while (!fsync_cmpxchg_state( completion->fsync, FSYNC_COMPLETION_STATE( head + 1, count - 1 ), state ));
+    return 1;
+}
+
+/* update the number of server-side messages, which the clients check before using the ring */
+static void set_completion_depth( struct completion *completion, unsigned int depth )
+{
+    completion->depth = depth;
+    if (completion->fsync) completion->fsync->max = depth;
+}
+
+struct fsync_object *get_completion_fsync( struct object *obj )
+{
+    if (obj->ops != &completion_ops) return NULL;
+    return ((struct completion *)obj)->fsync;
+}
+
+/* take over the messages of the ring once another process gets a handle to the port */
+void detach_completion_fsync( struct object *obj, struct process *process )
+{
+    struct completion *completion = (struct completion *)obj;
+    struct fsync_completion_msg msg;
+    struct list *pos = &completion->queue;
+    struct comp_msg *comp_msg;
+    unsigned int count = 0;
+
+    if (obj->ops != &completion_ops || !completion->fsync || !fsync_detach( completion->fsync, process ))
+        return;
+
+    /* the messages of the ring are older than the server-side ones; */
+    /* the creator process may have written anything there, so don't trust the count */
+    while (count < FSYNC_COMPLETION_RING && remove_client_msg( completion, &msg ))
+    {
+        if (!(comp_msg = mem_alloc( sizeof(*comp_msg) ))) break;
+        comp_msg->ckey        = msg.ckey;
+        comp_msg->cvalue      = msg.cvalue;
+        comp_msg->status      = msg.status;
+        comp_msg->information = msg.information;
+        comp_msg->wait        = NULL;
+        list_add_after( pos, &comp_msg->queue_entry );
+        pos = &comp_msg->queue_entry;
+        count++;
+    }
+    set_completion_depth( completion, completion->depth + count );
+    completion->detached = completion->fsync;
+    completion->fsync    = NULL;
+}
+
+/* get the index of the port in the area of a process, if its clients may queue messages to it */
+unsigned int get_completion_client_index( struct completion *completion, struct process *process )
+{
+    return fsync_get_index( completion->fsync, process );
+}
+
 static void completion_destroy( struct object *obj)
 {
     struct completion *completion = (struct completion *) obj;
@@ -95,8 +215,11 @@ static void completion_destroy( struct object *obj)
 
     LIST_FOR_EACH_ENTRY_SAFE( tmp, next, &completion->queue, struct comp_msg, queue_entry )
     {
+        if (tmp->wait) tmp->wait->msg = NULL;
         free( tmp );
     }
+    if (completion->fsync) fsync_free( completion->fsync );
+    if (completion->detached) fsync_free( completion->detached );
 }
 
 static void completion_dump( struct object *obj, int verbose )
@@ -104,7 +227,7 @@ static void completion_dump( struct object *obj, int verbose )
     struct completion *completion = (struct completion *) obj;
 
     assert( obj->ops == &completion_ops );
-    fprintf( stderr, "Completion depth=%u\n", completion->depth );
+    fprintf( stderr, "Completion depth=%u client=%u\n", completion->depth, get_client_msg_count( completion ) );
 }
 
 static struct object_type *completion_get_type( struct object *obj )
@@ -114,11 +237,25 @@ static struct object_type *completion_get_type( struct object *obj )
     return get_object_type( &str );
 }
 
+static int completion_add_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct completion *completion = (struct completion *)obj;
+    assert( obj->ops == &completion_ops );
+    return fsync_add_queue( completion->fsync, obj, entry );
+}
+
+static void completion_remove_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct completion *completion = (struct completion *)obj;
+    assert( obj->ops == &completion_ops );
+    fsync_remove_queue( completion->fsync, obj, entry );
+}
+
 static int completion_signaled( struct object *obj, struct wait_queue_entry *entry )
 {
     struct completion *completion = (struct completion *)obj;
 
-    return !list_empty( &completion->queue );
+    return !list_empty( &completion->queue ) || get_client_msg_count( completion );
 }
 
 static unsigned int completion_map_access( struct object *obj, unsigned int access )
@@ -142,6 +279,8 @@ static struct completion *create_completion( struct object *root, const struct u
         {
             list_init( &completion->queue );
             completion->depth = 0;
+            completion->fsync = fsync_alloc_completion( &completion->obj );
+            completion->detached = NULL;
         }
     }
 
@@ -153,22 +292,91 @@ struct completion *get_completion_obj( struct process *process, obj_handle_t han
     return (struct completion *) get_handle_obj( process, handle, access, &completion_ops );
 }
 
-void add_completion( struct completion *completion, apc_param_t ckey, apc_param_t cvalue,
-                     unsigned int status, apc_param_t information )
+static struct comp_msg *queue_completion( struct completion *completion, apc_param_t ckey, apc_param_t cvalue,
+                                          unsigned int status, apc_param_t information )
 {
     struct comp_msg *msg = mem_alloc( sizeof( *msg ) );
 
     if (!msg)
-        return;
+        return NULL;
 
     msg->ckey = ckey;
     msg->cvalue = cvalue;
     msg->status = status;
     msg->information = information;
+    msg->wait = NULL;
 
     list_add_tail( &completion->queue, &msg->queue_entry );
-    completion->depth++;
+    set_completion_depth( completion, completion->depth + 1 );
+    if (completion->fsync) fsync_wake( completion->fsync );
     wake_up( &completion->obj, 1 );
+    return msg;
+}
+
+void add_completion( struct completion *completion, apc_param_t ckey, apc_param_t cvalue,
+                     unsigned int status, apc_param_t information )
+{
+    queue_completion( completion, ckey, cvalue, status, information );
+}
+
+static void completion_wait_dump( struct object *obj, int verbose )
+{
+    struct completion_wait *wait = (struct completion_wait *)obj;
+
+    assert( obj->ops == &completion_wait_ops );
+    fprintf( stderr, "WaitCompletionPacket completion=%p waiting=%d queued=%d\n",
+             wait->completion, wait->wait != NULL, wait->msg != NULL );
+}
+
+static struct object_type *completion_wait_get_type( struct object *obj )
+{
+    static const WCHAR name[] = {'W','a','i','t','C','o','m','p','l','e','t','i','o','n','P','a','c','k','e','t'};
+    static const struct unicode_str str = { name, sizeof(name) };
+    return get_object_type( &str );
+}
+
+/* remove the queued message of a wait completion packet; return 1 if there was one */
+static int remove_completion_wait_msg( struct completion_wait *wait )
+{
+    struct comp_msg *msg = wait->msg;
+
+    if (!msg) return 0;
+    list_remove( &msg->queue_entry );
+    set_completion_depth( wait->completion, wait->completion->depth - 1 );
+    wait->msg = NULL;
+    free( msg );
+    return 1;
+}
+
+/* disassociate a wait completion packet from its object and port */
+static void reset_completion_wait( struct completion_wait *wait )
+{
+    if (wait->wait) cancel_object_wait( wait->wait );
+    wait->wait = NULL;
+    if (wait->msg) wait->msg->wait = NULL;
+    wait->msg = NULL;
+    if (wait->completion) release_object( wait->completion );
+    wait->completion = NULL;
+}
+
+static void completion_wait_destroy( struct object *obj )
+{
+    struct completion_wait *wait = (struct completion_wait *)obj;
+
+    assert( obj->ops == &completion_wait_ops );
+    remove_completion_wait_msg( wait );
+    reset_completion_wait( wait );
+}
+
+/* the target object of a wait completion packet has been signaled */
+static void completion_wait_signaled( void *private, unsigned int status )
+{
+    struct completion_wait *wait = private;
+
+    wait->wait = NULL;
+    if ((wait->msg = queue_completion( wait->completion, wait->ckey, wait->cvalue,
+                                       wait->status, wait->information )))
+        wait->msg->wait = wait;
 }
 
 /* create a completion */
@@ -217,19 +425,28 @@ DECL_HANDLER(add_completion)
 DECL_HANDLER(remove_completion)
 {
     struct completion* completion = get_completion_obj( current->process, req->handle, IO_COMPLETION_MODIFY_STATE );
+    struct fsync_completion_msg client_msg;
     struct list *entry;
     struct comp_msg *msg;
 
     if (!completion) return;
 
     entry = list_head( &completion->queue );
-    if (!entry)
+    if (remove_client_msg( completion, &client_msg ))
+    {
+        reply->ckey = client_msg.ckey;
+        reply->cvalue = client_msg.cvalue;
+        reply->status = client_msg.status;
+        reply->information = client_msg.information;
+    }
+    else if (!entry)
         set_error( STATUS_PENDING );
     else
     {
         list_remove( entry );
-        completion->depth--;
+        set_completion_depth( completion, completion->depth - 1 );
         msg = LIST_ENTRY( entry, struct comp_msg, queue_entry );
+        if (msg->wait) msg->wait->msg = NULL;
         reply->ckey = msg->ckey;
         reply->cvalue = msg->cvalue;
         reply->status = msg->status;
@@ -247,7 +464,111 @@ DECL_HANDLER(query_completion)
 
     if (!completion) return;
 
-    reply->depth = completion->depth;
+    reply->depth = completion->depth + get_client_msg_count( completion );
 
     release_object( completion );
 }
+
+/* create a wait completion packet */
+DECL_HANDLER(create_completion_wait)
+{
+    struct completion_wait *wait;
+    struct unicode_str name;
+    struct object *root;
+    const struct security_descriptor *sd;
+    const struct object_attributes *objattr = get_req_object_attributes( &sd, &name, &root );
+
+    if (!objattr) return;
+
+    if ((wait = create_named_object( root, &completion_wait_ops, &name, objattr->attributes, sd )))
+    {
+        if (get_error() != STATUS_OBJECT_NAME_EXISTS)
+        {
+            wait->completion = NULL;
+            wait->wait       = NULL;
+            wait->msg        = NULL;
+        }
+        reply->handle = alloc_handle( current->process, wait, req->access, objattr->attributes );
+        release_object( wait );
+    }
+
+    if (root) release_object( root );
+}
+
+/* queue a wait completion packet to a port once an object is signaled */
+DECL_HANDLER(associate_completion_wait)
+{
+    struct completion_wait *wait;
+    struct completion *completion;
+    struct thread *thread;
+    struct object *obj;
+
+    if (!req->thread) thread = (struct thread *)grab_object( current );
+    else if (!(thread = get_thread_from_handle( req->thread, THREAD_QUERY_LIMITED_INFORMATION ))) return;
+    if (thread->process != current->process)
+    {
+        set_error( STATUS_ACCESS_DENIED );
+        release_object( thread );
+        return;
+    }
+
+    if (!(wait = (struct completion_wait *)get_handle_obj( current->process, req->wait, 0,
+                                                           &completion_wait_ops )))
+    {
+        release_object( thread );
+        return;
+    }
+
+    if (wait->wait || wait->msg)
+    {
+        set_error( STATUS_INVALID_PARAMETER_1 );
+        release_object( wait );
+        release_object( thread );
+        return;
+    }
+
+    if ((completion = get_completion_obj( current->process, req->completion, IO_COMPLETION_MODIFY_STATE )))
+    {
+        if ((obj = get_handle_obj( current->process, req->handle, SYNCHRONIZE, NULL )))
+        {
+            reset_completion_wait( wait );
+            wait->completion  = completion;
+            wait->ckey        = req->ckey;
+            wait->cvalue      = req->cvalue;
+            wait->information = req->information;
+            wait->status      = req->status;
+            if (wait_on_object( thread, obj, completion_wait_signaled, wait, &wait->wait ))
+                reply->signaled = !wait->wait;
+            else
+            {
+                wait->completion = NULL;
+                release_object( completion );
+            }
+            release_object( obj );
+        }
+        else release_object( completion );
+    }
+    release_object( wait );
+    release_object( thread );
+}
+
+/* cancel a wait completion packet */
+DECL_HANDLER(cancel_completion_wait)
+{
+    struct completion_wait *wait;
+
+    if (!(wait = (struct completion_wait *)get_handle_obj( current->process, req->wait, 0,
+                                                           &completion_wait_ops )))
+        return;
+
+    if (wait->wait)
+        reset_completion_wait( wait );
+    else if (req->remove && remove_completion_wait_msg( wait ))
+    {
+        reset_completion_wait( wait );
+        set_error( STATUS_CANCELLED );
+    }
+    else set_error( STATUS_PENDING );
+
+    release_object( wait );
+}
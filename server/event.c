@@ -42,23 +42,28 @@ struct event
     struct list    kernel_object;   /* list of kernel object pointers */
     int            manual_reset;    /* is it a manual reset event? */
     int            signaled;        /* event has been signaled */
+    struct fsync_object *fsync;     /* shared state for client-side synchronization */
+    struct fsync_object *detached;  /* shared state once the server has taken it over */
 };
 
 static void event_dump( struct object *obj, int verbose );
 static struct object_type *event_get_type( struct object *obj );
+static int event_add_queue( struct object *obj, struct wait_queue_entry *entry );
+static void event_remove_queue( struct object *obj, struct wait_queue_entry *entry );
 static int event_signaled( struct object *obj, struct wait_queue_entry *entry );
 static void event_satisfied( struct object *obj, struct wait_queue_entry *entry );
 static unsigned int event_map_access( struct object *obj, unsigned int access );
 static int event_signal( struct object *obj, unsigned int access);
 static struct list *event_get_kernel_obj_list( struct object *obj );
+static void event_destroy( struct object *obj );
 
 static const struct object_ops event_ops =
 {
     sizeof(struct event),      /* size */
     event_dump,                /* dump */
     event_get_type,            /* get_type */
-    add_queue,                 /* add_queue */
-    remove_queue,              /* remove_queue */
+    event_add_queue,           /* add_queue */
+    event_remove_queue,        /* remove_queue */
     event_signaled,            /* signaled */
     event_satisfied,           /* satisfied */
     event_signal,              /* signal */
@@ -72,7 +77,7 @@ static const struct object_ops event_ops =
     no_open_file,              /* open_file */
     event_get_kernel_obj_list, /* get_kernel_obj_list */
     no_close_handle,           /* close_handle */
-    no_destroy                 /* destroy */
+    event_destroy              /* destroy */
 };
 
 
@@ -124,6 +129,9 @@ struct event *create_event( struct object *root, const struct unicode_str *name,
             list_init( &event->kernel_object );
             event->manual_reset = manual_reset;
             event->signaled     = initial_state;
+            event->fsync        = fsync_alloc( &event->obj, manual_reset ? FSYNC_MANUAL_EVENT : FSYNC_AUTO_EVENT,
+                                               initial_state != 0, 0 );
+            event->detached     = NULL;
         }
     }
     return event;
@@ -134,24 +142,70 @@ struct event *get_event_obj( struct process *process, obj_handle_t handle, unsig
     return (struct event *)get_handle_obj( process, handle, access, &event_ops );
 }
 
+struct fsync_object *get_event_fsync( struct object *obj )
+{
+    if (obj->ops != &event_ops) return NULL;
+    return ((struct event *)obj)->fsync;
+}
+
+/* take over the shared state once another process gets a handle to the event */
+void detach_event_fsync( struct object *obj, struct process *process )
+{
+    struct event *event = (struct event *)obj;
+
+    if (obj->ops != &event_ops || !event->fsync || !fsync_detach( event->fsync, process )) return;
+    event->signaled = fsync_get_state( event->fsync ) != 0;
+    event->detached = event->fsync;
+    event->fsync    = NULL;
+}
+
+static int get_event_state( struct event *event )
+{
+    if (event->fsync) return fsync_get_state( event->fsync );
+    return event->signaled;
+}
+
+/* set the event state and return the previous one */
+static int set_event_state( struct event *event, int state )
+{
+    int prev = event->signaled;
+
+    if (event->fsync)
+    {
+        prev = fsync_set_state( event->fsync, state );
+        if (state && !prev) fsync_wake( event->fsync );
+    }
+    else event->signaled = state;
+    return prev;
+}
+
 void pulse_event( struct event *event )
 {
-    event->signaled = 1;
+    if (event->fsync)
+    {
+        /* client threads would never see the transient state, release them through the pulse count */
+        fsync_set_state( event->fsync, 1 );
+        wake_up( &event->obj, !event->manual_reset );
+        if (fsync_set_state( event->fsync, 0 ) || event->manual_reset)
+            fsync_pulse( event->fsync, event->manual_reset );
+        return;
+    }
+    set_event_state( event, 1 );
     /* wake up all waiters if manual reset, a single one otherwise */
     wake_up( &event->obj, !event->manual_reset );
-    event->signaled = 0;
+    set_event_state( event, 0 );
 }
 
 void set_event( struct event *event )
 {
-    event->signaled = 1;
+    set_event_state( event, 1 );
     /* wake up all waiters if manual reset, a single one otherwise */
     wake_up( &event->obj, !event->manual_reset );
 }
 
 void reset_event( struct event *event )
 {
-    event->signaled = 0;
+    set_event_state( event, 0 );
 }
 
 static void event_dump( struct object *obj, int verbose )
@@ -159,7 +213,7 @@ static void event_dump( struct object *obj, int verbose )
     struct event *event = (struct event *)obj;
     assert( obj->ops == &event_ops );
     fprintf( stderr, "Event manual=%d signaled=%d\n",
-             event->manual_reset, event->signaled );
+             event->manual_reset, get_event_state( event ));
 }
 
 static struct object_type *event_get_type( struct object *obj )
@@ -169,11 +223,25 @@ static struct object_type *event_get_type( struct object *obj )
     return get_object_type( &str );
 }
 
+static int event_add_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct event *event = (struct event *)obj;
+    assert( obj->ops == &event_ops );
+    return fsync_add_queue( event->fsync, obj, entry );
+}
+
+static void event_remove_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct event *event = (struct event *)obj;
+    assert( obj->ops == &event_ops );
+    fsync_remove_queue( event->fsync, obj, entry );
+}
+
 static int event_signaled( struct object *obj, struct wait_queue_entry *entry )
 {
     struct event *event = (struct event *)obj;
     assert( obj->ops == &event_ops );
-    return event->signaled;
+    return get_event_state( event );
 }
 
 static void event_satisfied( struct object *obj, struct wait_queue_entry *entry )
@@ -181,7 +249,7 @@ static void event_satisfied( struct object *obj, struct wait_queue_entry *entry
     struct event *event = (struct event *)obj;
     assert( obj->ops == &event_ops );
     /* Reset if it's an auto-reset event */
-    if (!event->manual_reset) event->signaled = 0;
+    if (!event->manual_reset) set_event_state( event, 0 );
 }
 
 static unsigned int event_map_access( struct object *obj, unsigned int access )
@@ -213,6 +281,14 @@ static struct list *event_get_kernel_obj_list( struct object *obj )
     return &event->kernel_object;
 }
 
+static void event_destroy( struct object *obj )
+{
+    struct event *event = (struct event *)obj;
+    assert( obj->ops == &event_ops );
+    if (event->fsync) fsync_free( event->fsync );
+    if (event->detached) fsync_free( event->detached );
+}
+
 struct keyed_event *create_keyed_event( struct object *root, const struct unicode_str *name,
                                         unsigned int attr, const struct security_descriptor *sd )
 {
@@ -322,7 +398,7 @@ DECL_HANDLER(event_op)
     struct event *event;
 
     if (!(event = get_event_obj( current->process, req->handle, EVENT_MODIFY_STATE ))) return;
-    reply->state = event->signaled;
+    reply->state = get_event_state( event );
     switch(req->op)
     {
     case PULSE_EVENT:
@@ -349,7 +425,7 @@ DECL_HANDLER(query_event)
     if (!(event = get_event_obj( current->process, req->handle, EVENT_QUERY_STATE ))) return;
 
     reply->manual_reset = event->manual_reset;
-    reply->state = event->signaled;
+    reply->state = get_event_state( event );
 
     release_object( event );
 }
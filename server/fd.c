@@ -188,6 +188,8 @@ struct fd
     unsigned int         cacheable :1;/* can the fd be cached on the client side? */
     unsigned int         signaled :1; /* is the fd signaled? */
     unsigned int         fs_locks :1; /* can we use filesystem locks for this fd? */
+    unsigned int         comp_mirrored :1; /* has a client been told that there is no completion port? */
+    unsigned int         comp_client :1; /* has a client been allowed to queue completions to the port? */
     int                  poll_index;  /* index of fd in poll array */
     struct async_queue   read_q;      /* async readers of this fd */
     struct async_queue   write_q;     /* async writers of this fd */
@@ -361,15 +363,25 @@ static file_pos_t max_unix_offset = OFF_T_MAX;
 /****************************************************************/
 /* timeouts support */
 
+/* pending timeouts are kept in a binary min-heap ordered by expiry time, */
+/* so that both insertion and removal are O(log n) */
+
 struct timeout_user
 {
-    struct list           entry;      /* entry in sorted timeout list */
+    struct list           entry;      /* entry in expired list */
+    unsigned int          index;      /* index in timeout heap, or EXPIRED_TIMEOUT */
+    unsigned int          seq;        /* insertion order, for timeouts with the same expiry */
     timeout_t             when;       /* timeout expiry (absolute time) */
     timeout_callback      callback;   /* callback function */
     void                 *private;    /* callback private data */
 };
 
-static struct list timeout_list = LIST_INIT(timeout_list);   /* sorted timeouts list */
+#define EXPIRED_TIMEOUT (~0u)
+
+static struct timeout_user **timeout_heap;   /* heap of pending timeouts */
+static unsigned int timeout_count;           /* number of pending timeouts */
+static unsigned int timeout_heap_size;       /* allocated size of the heap */
+static unsigned int timeout_seq;             /* next insertion sequence number */
 timeout_t current_time;
 
 static inline void set_current_time(void)
@@ -380,32 +392,100 @@ static inline void set_current_time(void)
     current_time = (timeout_t)now.tv_sec * TICKS_PER_SEC + now.tv_usec * 10 + ticks_1601_to_1970;
 }
 
+static inline int timeout_before( const struct timeout_user *a, const struct timeout_user *b )
+{
+    if (a->when != b->when) return a->when < b->when;
+    return (int)(a->seq - b->seq) < 0;
+}
+
+static inline void set_timeout_heap_entry( unsigned int index, struct timeout_user *user )
+{
+    timeout_heap[index] = user;
+    user->index = index;
+}
+
+/* move a heap entry up towards the root until the heap is ordered again */
+static void timeout_heap_up( unsigned int index )
+{
+    struct timeout_user *user = timeout_heap[index];
+
+    while (index)
+    {
+        unsigned int parent = (index - 1) / 2;
+        if (!timeout_before( user, timeout_heap[parent] )) break;
+        set_timeout_heap_entry( index, timeout_heap[parent] );
+        index = parent;
+    }
+    set_timeout_heap_entry( index, user );
+}
+
+/* move a heap entry down towards the leaves until the heap is ordered again */
+static void timeout_heap_down( unsigned int index )
+{
+    struct timeout_user *user = timeout_heap[index];
+
+    for (;;)
+    {
+        unsigned int child = 2 * index + 1;
+        if (child >= timeout_count) break;
+        if (child + 1 < timeout_count && timeout_before( timeout_heap[child + 1], timeout_heap[child] ))
+            child++;
+        if (!timeout_before( timeout_heap[child], user )) break;
+        set_timeout_heap_entry( index, timeout_heap[child] );
+        index = child;
+    }
+    set_timeout_heap_entry( index, user );
+}
+
+/* remove an entry from the timeout heap */
+static void timeout_heap_remove( struct timeout_user *user )
+{
+    unsigned int index = user->index;
+    struct timeout_user *last = timeout_heap[--timeout_count];
+
+    user->index = EXPIRED_TIMEOUT;
+    if (last == user) return;
+    set_timeout_heap_entry( index, last );
+    if (index && timeout_before( last, timeout_heap[(index - 1) / 2] )) timeout_heap_up( index );
+    else timeout_heap_down( index );
+}
+
 /* add a timeout user */
 struct timeout_user *add_timeout_user( timeout_t when, timeout_callback func, void *private )
 {
     struct timeout_user *user;
-    struct list *ptr;
 
+    if (timeout_count == timeout_heap_size)
+    {
+        unsigned int new_size = max( 64, timeout_heap_size * 2 );
+        struct timeout_user **new_heap;
+
+        if (!(new_heap = realloc( timeout_heap, new_size * sizeof(*new_heap) )))
+        {
+            set_error( STATUS_NO_MEMORY );
+            return NULL;
+        }
+        timeout_heap = new_heap;
+        timeout_heap_size = new_size;
+    }
     if (!(user = mem_alloc( sizeof(*user) ))) return NULL;
     user->when     = (when > 0) ? when : current_time - when;
+    user->seq      = timeout_seq++;
     user->callback = func;
     user->private  = private;
 
-    /* Now insert it in the linked list */
+    /* Now insert it in the heap */
 
-    LIST_FOR_EACH( ptr, &timeout_list )
-    {
-        struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
-        if (timeout->when >= user->when) break;
-    }
-    list_add_before( ptr, &user->entry );
+    timeout_heap[timeout_count++] = user;
+    timeout_heap_up( timeout_count - 1 );
     return user;
 }
 
 /* remove a timeout user */
 void remove_timeout_user( struct timeout_user *user )
 {
-    list_remove( &user->entry );
+    if (user->index != EXPIRED_TIMEOUT) timeout_heap_remove( user );
+    else list_remove( &user->entry );
     free( user );
 }
 
@@ -540,7 +620,9 @@ static inline void main_loop_epoll(void)
         if (!active_users) break;  /* last user removed by a timeout */
         if (epoll_fd == -1) break;  /* an error occurred with epoll */
 
+        release_server_lock();
         ret = epoll_wait( epoll_fd, events, ARRAY_SIZE( events ), timeout );
+        acquire_server_lock();
         set_current_time();
 
         /* put the events into the pollfd array first, like poll does */
@@ -645,6 +727,7 @@ static inline void main_loop_epoll(void)
         if (!active_users) break;  /* last user removed by a timeout */
         if (kqueue_fd == -1) break;  /* an error occurred with kqueue */
 
+        release_server_lock();
         if (timeout != -1)
         {
             struct timespec ts;
@@ -654,6 +737,7 @@ static inline void main_loop_epoll(void)
             ret = kevent( kqueue_fd, NULL, 0, events, ARRAY_SIZE( events ), &ts );
         }
         else ret = kevent( kqueue_fd, NULL, 0, events, ARRAY_SIZE( events ), NULL );
+        acquire_server_lock();
 
         set_current_time();
 
@@ -749,6 +833,7 @@ static inline void main_loop_epoll(void)
         if (!active_users) break;  /* last user removed by a timeout */
         if (port_fd == -1) break;  /* an error occurred with event completion */
 
+        release_server_lock();
         if (timeout != -1)
         {
             struct timespec ts;
@@ -758,6 +843,7 @@ static inline void main_loop_epoll(void)
             ret = port_getn( port_fd, events, ARRAY_SIZE( events ), &nget, &ts );
         }
         else ret = port_getn( port_fd, events, ARRAY_SIZE( events ), &nget, NULL );
+        acquire_server_lock();
 
 	if (ret == -1) break;  /* an error occurred with event completion */
 
@@ -851,20 +937,20 @@ static void remove_poll_user( struct fd *fd, int user )
 /* process pending timeouts and return the time until the next timeout, in milliseconds */
 static int get_next_timeout(void)
 {
-    if (!list_empty( &timeout_list ))
+    if (timeout_count)
     {
         struct list expired_list, *ptr;
 
-        /* first remove all expired timers from the list */
+        /* first remove all expired timers from the heap */
 
         list_init( &expired_list );
-        while ((ptr = list_head( &timeout_list )) != NULL)
+        while (timeout_count)
         {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
+            struct timeout_user *timeout = timeout_heap[0];
 
             if (timeout->when <= current_time)
             {
-                list_remove( &timeout->entry );
+                timeout_heap_remove( timeout );
                 list_add_tail( &expired_list, &timeout->entry );
             }
             else break;
@@ -880,9 +966,9 @@ static int get_next_timeout(void)
             free( timeout );
         }
 
-        if ((ptr = list_head( &timeout_list )) != NULL)
+        if (timeout_count)
         {
-            struct timeout_user *timeout = LIST_ENTRY( ptr, struct timeout_user, entry );
+            struct timeout_user *timeout = timeout_heap[0];
             int diff = (timeout->when - current_time + 9999) / 10000;
             if (diff < 0) diff = 0;
             return diff;
@@ -908,7 +994,9 @@ void main_loop(void)
 
         if (!active_users) break;  /* last user removed by a timeout */
 
+        release_server_lock();
         ret = poll( pollfd, nb_users, timeout );
+        acquire_server_lock();
         set_current_time();
 
         if (ret > 0)
@@ -1610,6 +1698,8 @@ static struct fd *alloc_fd_object(void)
     fd->poll_index = -1;
     fd->completion = NULL;
     fd->comp_flags = 0;
+    fd->comp_mirrored = 0;
+    fd->comp_client = 0;
     init_async_queue( &fd->read_q );
     init_async_queue( &fd->write_q );
     init_async_queue( &fd->wait_q );
@@ -1646,6 +1736,8 @@ struct fd *alloc_pseudo_fd( const struct fd_ops *fd_user_ops, struct object *use
     fd->poll_index = -1;
     fd->completion = NULL;
     fd->comp_flags = 0;
+    fd->comp_mirrored = 0;
+    fd->comp_client = 0;
     fd->no_fd_status = STATUS_BAD_DEVICE_TYPE;
     init_async_queue( &fd->read_q );
     init_async_queue( &fd->write_q );
@@ -1965,6 +2057,16 @@ void allow_fd_caching( struct fd *fd )
     fd->cacheable = 1;
 }
 
+/* attach a unix fd to a pseudo fd, or detach it by passing -1 */
+/* the fd is only cacheable while attached, clients have to detect by themselves that it went away */
+void set_pseudo_fd_unix_fd( struct fd *fd, int unix_fd )
+{
+    assert( !fd->inode );
+    if (fd->unix_fd != -1) close( fd->unix_fd );
+    fd->unix_fd = unix_fd;
+    fd->cacheable = (unix_fd != -1);
+}
+
 /* check if fd is on a removable device */
 int is_fd_removable( struct fd *fd )
 {
@@ -2564,6 +2666,7 @@ DECL_HANDLER(get_handle_fd)
             reply->options = fd->options;
             reply->access = get_handle_access( current->process, req->handle );
             send_client_fd( current->process, unix_fd, req->handle );
+            set_handle_mirror_flags( current->process, req->handle, HANDLE_MIRROR_HAS_FD );
         }
         release_object( fd );
     }
@@ -2663,6 +2766,13 @@ DECL_HANDLER(set_completion_info)
         {
             fd->completion = get_completion_obj( current->process, req->chandle, IO_COMPLETION_MODIFY_STATE );
             fd->comp_key = req->ckey;
+            if (fd->completion && fd->comp_mirrored)
+            {
+                /* the handles may belong to any process */
+                clear_handle_mirror_flags( fd, HANDLE_MIRROR_NO_COMPLETION );
+                fd->comp_mirrored = 0;
+    fd->comp_client = 0;
+            }
         }
         else set_error( STATUS_INVALID_PARAMETER );
         release_object( fd );
@@ -2677,6 +2787,22 @@ DECL_HANDLER(add_fd_completion)
     {
         if (fd->completion && (req->async || !(fd->comp_flags & FILE_SKIP_COMPLETION_PORT_ON_SUCCESS)))
             add_completion( fd->completion, fd->comp_key, req->cvalue, req->status, req->information );
+
+        /* let the client queue the next completions to the port by itself */
+        if (fd->completion && (reply->port = get_completion_client_index( fd->completion, current->process )))
+        {
+            reply->ckey = fd->comp_key;
+            fd->comp_client = 1;
+        }
+
+        /* let the client drop the next completions that would be ignored anyway */
+        if (!fd->completion)
+        {
+            set_handle_mirror_flags( current->process, req->handle, HANDLE_MIRROR_NO_COMPLETION );
+            fd->comp_mirrored = 1;
+        }
+        else if (fd->comp_flags & FILE_SKIP_COMPLETION_PORT_ON_SUCCESS)
+            set_handle_mirror_flags( current->process, req->handle, HANDLE_MIRROR_SKIP_COMPLETION );
         release_object( fd );
     }
 }
@@ -2695,6 +2821,11 @@ DECL_HANDLER(set_fd_completion_mode)
             fd->comp_flags |= req->flags & ( FILE_SKIP_COMPLETION_PORT_ON_SUCCESS
                                            | FILE_SKIP_SET_EVENT_ON_HANDLE
                                            | FILE_SKIP_SET_USER_EVENT_ON_FAST_IO );
+            /* the clients that queue completions by themselves must know it through any handle */
+            if ((fd->comp_flags & FILE_SKIP_COMPLETION_PORT_ON_SUCCESS) && fd->comp_client)
+                set_fd_handle_mirror_flags( fd, HANDLE_MIRROR_SKIP_COMPLETION );
+            else if (fd->comp_flags & FILE_SKIP_COMPLETION_PORT_ON_SUCCESS)
+                set_handle_mirror_flags( current->process, req->handle, HANDLE_MIRROR_SKIP_COMPLETION );
         }
         else
             set_error( STATUS_INVALID_PARAMETER );
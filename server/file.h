@@ -98,6 +98,7 @@ extern void set_fd_events( struct fd *fd, int events );
 extern obj_handle_t lock_fd( struct fd *fd, file_pos_t offset, file_pos_t count, int shared, int wait );
 extern void unlock_fd( struct fd *fd, file_pos_t offset, file_pos_t count );
 extern void allow_fd_caching( struct fd *fd );
+extern void set_pseudo_fd_unix_fd( struct fd *fd, int unix_fd );
 extern void set_fd_signaled( struct fd *fd, int signaled );
 extern int is_fd_signaled( struct fd *fd );
 extern char *dup_fd_name( struct fd *root, const char *name );
@@ -159,6 +160,7 @@ extern struct file *get_mapping_file( struct process *process, client_ptr_t base
                                       unsigned int access, unsigned int sharing );
 extern void free_mapped_views( struct process *process );
 extern int get_page_size(void);
+extern int create_temp_file( file_pos_t size );
 
 /* device functions */
 
@@ -179,6 +181,9 @@ extern struct dir *get_dir_obj( struct process *process, obj_handle_t handle, un
 extern struct completion *get_completion_obj( struct process *process, obj_handle_t handle, unsigned int access );
 extern void add_completion( struct completion *completion, apc_param_t ckey, apc_param_t cvalue,
                             unsigned int status, apc_param_t information );
+extern unsigned int get_completion_client_index( struct completion *completion, struct process *process );
+extern struct fsync_object *get_completion_fsync( struct object *obj );
+extern void detach_completion_fsync( struct object *obj, struct process *process );
 
 /* serial port functions */
 
@@ -197,6 +202,7 @@ extern void set_async_pending( struct async *async, int signal );
 extern int async_waiting( struct async_queue *queue );
 extern void async_terminate( struct async *async, unsigned int status );
 extern void async_wake_up( struct async_queue *queue, unsigned int status );
+extern void async_wake_up_user( struct async_queue *queue, client_ptr_t user );
 extern struct completion *fd_get_completion( struct fd *fd, apc_param_t *p_key );
 extern void fd_copy_completion( struct fd *src, struct fd *dst );
 extern struct iosb *create_iosb( const void *in_data, data_size_t in_size, data_size_t out_size );
@@ -0,0 +1,519 @@
+/*
+ * Shared memory synchronization objects
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * When a client process sets WINEFSYNC in its environment, the server gives
+ * it a shared memory area of its own, where the state of the events,
+ * semaphores and mutexes that the process creates is kept, so that
+ * uncontended signal and wait operations can be done on the client side
+ * with atomic operations and futexes. The server still owns the object
+ * lifetime, naming and handles. The free list of the area and the objects
+ * using its slots are only kept on the server side.
+ *
+ * Clients may only modify the state of an object while the FSYNC_SERVER_WAIT
+ * flag is not set in the state word. The server sets it before checking the
+ * object state for a wait, which makes any concurrent client compare-and-swap
+ * fail; the client then falls back to the corresponding server request.
+ *
+ * Since only the process that created an object maps its state, the object
+ * is detached from the shared memory as soon as another process gets a handle
+ * to it: the flag is then set for good and the server takes over the state.
+ * A mutex that is owned at that time keeps its shared state until it is
+ * released, since only its owner modifies the recursion count.
+ *
+ * A thread records the mutexes that it acquires on the client side in its
+ * own list in the area of its process before acquiring them, so that the
+ * server can abandon them when the thread dies, the same way as the mutexes
+ * that the server hands over, which are kept in the thread mutex list. The
+ * list may contain stale entries, they are checked against the mutex owner.
+ * Mutex owners are identified by ids that the server never reuses, unlike
+ * thread ids.
+ *
+ * A completion port is given a block of slots: the port slot is followed by
+ * a ring where the clients queue their messages without a server request.
+ * The state of the port holds the position and the number of the messages in
+ * the ring, and max the number of messages queued on the server side, which
+ * the clients only read. Clients only add messages to the ring while that
+ * number is 0, and both sides remove the messages of the ring first, so that
+ * they are received in order.
+ */
+
+#include "config.h"
+#include "wine/port.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+#include <unistd.h>
+
+#include "ntstatus.h"
+#define WIN32_NO_STATUS
+#include "windef.h"
+#include "winternl.h"
+
+#include "file.h"
+#include "handle.h"
+#include "process.h"
+#include "thread.h"
+#include "request.h"
+
+#define FSYNC_AREA_OBJECTS 0x8000  /* 1Mb of shared memory per process */
+
+/* the owned mutex lists of the threads are kept in object slots */
+C_ASSERT( sizeof(struct fsync_owned) == sizeof(struct fsync_object) );
+
+/* server-side information about a slot of an area, clients can't modify it */
+struct fsync_info
+{
+    struct object *obj;        /* object using the slot, NULL for the owned lists and completion rings */
+    unsigned int   next_free;  /* next slot in the free list */
+    unsigned int   size;       /* number of slots allocated with this one */
+    int            detached;   /* object has been shared with another process */
+};
+
+struct fsync_area
+{
+    struct list          entry;       /* entry in the list of areas */
+    struct process      *process;     /* process that maps the area, NULL once it is gone */
+    int                  fd;          /* fd of the shared memory file */
+    struct fsync_object *objects;     /* index 0 is used for multiple object waits */
+    struct fsync_info   *info;        /* information about the allocated slots */
+    unsigned int         info_size;   /* size of the info array */
+    unsigned int         next_index;  /* first never allocated index */
+    unsigned int         free_index;  /* head of the free list, 0 if empty */
+    unsigned int         free_ring;   /* head of the free list of completion port blocks, 0 if empty */
+    unsigned int         count;       /* number of allocated slots */
+};
+
+static struct list fsync_areas = LIST_INIT( fsync_areas );
+static struct fsync_area *last_area;  /* last area that was looked up */
+static unsigned int last_owner_id;    /* last allocated mutex owner id */
+
+#ifdef __linux__
+static inline void futex_wake_all( int *addr )
+{
+    syscall( __NR_futex, addr, 1 /* FUTEX_WAKE */, INT_MAX, NULL, 0, 0 );
+}
+#endif
+
+/* create the shared memory area of the current process */
+static struct fsync_area *create_fsync_area(void)
+{
+#if defined(__linux__) && defined(HAVE_SYS_MMAN_H)
+    size_t size = FSYNC_AREA_OBJECTS * sizeof(struct fsync_object);
+    struct fsync_area *area;
+    void *ptr;
+
+    if (!(area = mem_alloc( sizeof(*area) ))) return NULL;
+    if ((area->fd = create_temp_file( size )) == -1)
+    {
+        free( area );
+        return NULL;
+    }
+    if ((ptr = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, area->fd, 0 )) == MAP_FAILED)
+    {
+        file_set_error();
+        close( area->fd );
+        free( area );
+        return NULL;
+    }
+    area->process    = current->process;
+    area->objects    = ptr;
+    area->info       = NULL;
+    area->info_size  = 0;
+    area->next_index = 1;
+    area->free_index = 0;
+    area->free_ring  = 0;
+    area->count      = 0;
+    list_add_tail( &fsync_areas, &area->entry );
+    if (debug_level) fprintf( stderr, "%04x: using shared memory synchronization\n", current->process->id );
+    return area;
+#else
+    set_error( STATUS_NOT_IMPLEMENTED );
+    return NULL;
+#endif
+}
+
+static void destroy_fsync_area( struct fsync_area *area )
+{
+    if (last_area == area) last_area = NULL;
+    list_remove( &area->entry );
+    munmap( area->objects, FSYNC_AREA_OBJECTS * sizeof(struct fsync_object) );
+    if (area->fd != -1) close( area->fd );
+    free( area->info );
+    free( area );
+}
+
+/* release the shared memory area of a process that is being destroyed */
+void fsync_release_area( struct process *process )
+{
+    struct fsync_area *area = process->fsync_area;
+
+    if (!area) return;
+    process->fsync_area = NULL;
+    area->process = NULL;
+    close( area->fd );
+    area->fd = -1;
+    /* the objects that are still alive keep the area mapped */
+    if (!area->count) destroy_fsync_area( area );
+}
+
+/* find the area that contains the shared state of an object */
+static struct fsync_area *get_fsync_area( const struct fsync_object *fsync )
+{
+    struct fsync_area *area;
+
+    if (last_area && fsync >= last_area->objects && fsync < last_area->objects + FSYNC_AREA_OBJECTS)
+        return last_area;
+
+    LIST_FOR_EACH_ENTRY( area, &fsync_areas, struct fsync_area, entry )
+    {
+        if (fsync < area->objects || fsync >= area->objects + FSYNC_AREA_OBJECTS) continue;
+        return last_area = area;
+    }
+    assert( 0 );
+    return NULL;
+}
+
+static inline struct fsync_info *get_fsync_info( struct fsync_area *area, const struct fsync_object *fsync )
+{
+    return &area->info[fsync - area->objects];
+}
+
+/* make sure that the info array covers the slots up to index */
+static int grow_fsync_info( struct fsync_area *area, unsigned int index )
+{
+    unsigned int new_size = area->info_size;
+    struct fsync_info *new_info;
+
+    if (index < area->info_size) return 1;
+    while (new_size <= index) new_size = max( new_size * 2, 256 );
+    if (!(new_info = realloc( area->info, new_size * sizeof(*new_info) ))) return 0;
+    area->info = new_info;
+    area->info_size = new_size;
+    return 1;
+}
+
+/* allocate the shared state of an object created by the current process; */
+/* return NULL if the process doesn't use shared memory synchronization */
+struct fsync_object *fsync_alloc( struct object *obj, enum fsync_type type, unsigned int state,
+                                  unsigned int max )
+{
+    struct fsync_area *area;
+    struct fsync_object *fsync;
+    unsigned int index;
+
+    if (!current || !(area = current->process->fsync_area)) return NULL;
+
+    if (area->free_index)
+    {
+        index = area->free_index;
+        area->free_index = area->info[index].next_free;
+    }
+    else if (area->next_index < FSYNC_AREA_OBJECTS)
+    {
+        if (!grow_fsync_info( area, area->next_index )) return NULL;
+        index = area->next_index++;
+    }
+    else return NULL;  /* the object will use server-side synchronization */
+
+    area->info[index].obj = obj;
+    area->info[index].next_free = 0;
+    area->info[index].size = 1;
+    area->info[index].detached = 0;
+    area->count++;
+
+    fsync = &area->objects[index];
+    fsync->type      = type;
+    fsync->state     = state;
+    fsync->max       = max;
+    fsync->count     = 0;
+    fsync->abandoned = 0;
+    fsync->waiters   = 0;
+    return fsync;
+}
+
+/* allocate the shared state of a completion port created by the current process, */
+/* followed by the ring of the messages queued by its clients */
+struct fsync_object *fsync_alloc_completion( struct object *obj )
+{
+    const unsigned int size = FSYNC_COMPLETION_RING + 1;
+    struct fsync_area *area;
+    struct fsync_object *fsync;
+    unsigned int i, index;
+
+    if (!current || !(area = current->process->fsync_area)) return NULL;
+
+    if (area->free_ring)
+    {
+        index = area->free_ring;
+        area->free_ring = area->info[index].next_free;
+    }
+    else if (area->next_index + size <= FSYNC_AREA_OBJECTS)
+    {
+        if (!grow_fsync_info( area, area->next_index + size - 1 )) return NULL;
+        index = area->next_index;
+        area->next_index += size;
+    }
+    else return NULL;
+
+    for (i = index; i < index + size; i++)
+    {
+        area->info[i].obj = NULL;
+        area->info[i].next_free = 0;
+        area->info[i].size = 0;
+        area->info[i].detached = 0;
+    }
+    area->info[index].obj = obj;
+    area->info[index].size = size;
+    area->count++;
+
+    fsync = &area->objects[index];
+    memset( fsync, 0, size * sizeof(*fsync) );
+    fsync->type = FSYNC_COMPLETION;
+    return fsync;
+}
+
+/* free the shared state of an object once the object is destroyed */
+void fsync_free( struct fsync_object *fsync )
+{
+    struct fsync_area *area = get_fsync_area( fsync );
+    unsigned int index = fsync - area->objects;
+
+    fsync->type  = FSYNC_NONE;
+    fsync->state = 0;
+    area->info[index].obj = NULL;
+    if (area->info[index].size > 1)
+    {
+        area->info[index].next_free = area->free_ring;
+        area->free_ring = index;
+    }
+    else
+    {
+        area->info[index].next_free = area->free_index;
+        area->free_index = index;
+    }
+    if (!--area->count && !area->process) destroy_fsync_area( area );
+}
+
+/* get the object that uses a slot of the area of a process; return NULL if the index is invalid */
+struct object *fsync_get_object( struct process *process, unsigned int index )
+{
+    struct fsync_area *area = process->fsync_area;
+
+    if (!area || !index || index >= area->next_index) return NULL;
+    return area->info[index].obj;
+}
+
+/* get the id that identifies a thread as a mutex owner */
+unsigned int fsync_get_owner_id( struct thread *thread )
+{
+    /* the ids only wrap around after 2^31 threads */
+    while (!thread->fsync_id) thread->fsync_id = ++last_owner_id & ~FSYNC_SERVER_WAIT;
+    return thread->fsync_id;
+}
+
+/* get the object state, without the server wait flag */
+unsigned int fsync_get_state( const struct fsync_object *fsync )
+{
+    return *(volatile const unsigned int *)&fsync->state & ~FSYNC_SERVER_WAIT;
+}
+
+/* replace the object state if it is still equal to prev; return 0 if it changed */
+int fsync_cmpxchg_state( struct fsync_object *fsync, unsigned int state, unsigned int prev )
+{
+    unsigned int old = *(volatile unsigned int *)&fsync->state;
+
+    if ((old & ~FSYNC_SERVER_WAIT) != prev) return 0;
+    state |= old & FSYNC_SERVER_WAIT;
+    return (unsigned int)interlocked_cmpxchg( (int *)&fsync->state, state, old ) == old;
+}
+
+/* set the object state and return the previous one */
+unsigned int fsync_set_state( struct fsync_object *fsync, unsigned int state )
+{
+    unsigned int prev;
+
+    do prev = fsync_get_state( fsync );
+    while (!fsync_cmpxchg_state( fsync, state, prev ));
+    return prev;
+}
+
+static void set_server_wait( struct fsync_object *fsync, int set )
+{
+    unsigned int old, new;
+
+    do
+    {
+        old = *(volatile unsigned int *)&fsync->state;
+        new = set ? (old | FSYNC_SERVER_WAIT) : (old & ~FSYNC_SERVER_WAIT);
+    } while ((unsigned int)interlocked_cmpxchg( (int *)&fsync->state, new, old ) != old);
+}
+
+/* wake up the client threads waiting for a state change */
+void fsync_wake( struct fsync_object *fsync )
+{
+#ifdef __linux__
+    struct fsync_object *multiple = &get_fsync_area( fsync )->objects[0];
+
+    if (*(volatile int *)&fsync->waiters)
+    {
+        interlocked_xchg_add( &fsync->seq, 1 );
+        futex_wake_all( &fsync->seq );
+    }
+    if (*(volatile int *)&multiple->waiters)
+    {
+        interlocked_xchg_add( &multiple->seq, 1 );
+        futex_wake_all( &multiple->seq );
+    }
+#endif
+}
+
+/* release the client threads that were waiting on an event when it was pulsed */
+void fsync_pulse( struct fsync_object *fsync, int all )
+{
+    unsigned int old, new;
+
+    do
+    {
+        old = *(volatile unsigned int *)&fsync->pulse;
+        new = ((old + 2) & ~1) | !all;
+    } while ((unsigned int)interlocked_cmpxchg( &fsync->pulse, new, old ) != old);
+    fsync_wake( fsync );
+}
+
+/* stop the client-side operations on an object once a process other than the one that */
+/* created it gets a handle to it; return 1 if the server has to take over the state now */
+int fsync_detach( struct fsync_object *fsync, struct process *process )
+{
+    struct fsync_area *area = get_fsync_area( fsync );
+    struct fsync_info *info = get_fsync_info( area, fsync );
+
+    if (info->detached || area->process == process) return 0;
+    info->detached = 1;
+    set_server_wait( fsync, 1 );
+    /* the client waiters will notice the flag and wait on the server side */
+    fsync_wake( fsync );
+    return 1;
+}
+
+/* check whether the server has taken over the state of an object */
+int fsync_is_detached( const struct fsync_object *fsync )
+{
+    struct fsync_area *area = get_fsync_area( fsync );
+    return get_fsync_info( area, fsync )->detached;
+}
+
+/* check whether the state of an object may be modified by the clients of a process */
+static int fsync_is_private( const struct fsync_object *fsync, struct process *process )
+{
+    struct fsync_area *area = get_fsync_area( fsync );
+    return area->process == process && !get_fsync_info( area, fsync )->detached;
+}
+
+/* get the index of an object in the area of a process, 0 if its clients may not modify the state */
+unsigned int fsync_get_index( const struct fsync_object *fsync, struct process *process )
+{
+    if (!fsync || !fsync_is_private( fsync, process )) return 0;
+    return fsync - process->fsync_area->objects;
+}
+
+/* called when a process gets a handle to an object */
+void fsync_share_object( struct process *process, struct object *obj )
+{
+    if (list_empty( &fsync_areas )) return;
+    detach_event_fsync( obj, process );
+    detach_semaphore_fsync( obj, process );
+    detach_mutex_fsync( obj, process );
+    detach_completion_fsync( obj, process );
+}
+
+/* add_queue implementation for objects with a shared state */
+int fsync_add_queue( struct fsync_object *fsync, struct object *obj, struct wait_queue_entry *entry )
+{
+    if (fsync && list_empty( &obj->wait_queue )) set_server_wait( fsync, 1 );
+    return add_queue( obj, entry );
+}
+
+/* remove_queue implementation for objects with a shared state */
+void fsync_remove_queue( struct fsync_object *fsync, struct object *obj, struct wait_queue_entry *entry )
+{
+    if (fsync && list_count( &obj->wait_queue ) == 1 && !fsync_is_detached( fsync ))
+        set_server_wait( fsync, 0 );
+    remove_queue( obj, entry );
+}
+
+/* retrieve the shared memory area of the current process */
+DECL_HANDLER(get_fsync_shm)
+{
+    struct process *process = current->process;
+
+    if (!process->fsync_area && !(process->fsync_area = create_fsync_area())) return;
+    reply->size = FSYNC_AREA_OBJECTS * sizeof(struct fsync_object);
+    send_client_fd( process, process->fsync_area->fd, 0 );
+}
+
+/* retrieve the shared memory index of a synchronization object */
+DECL_HANDLER(get_fsync_idx)
+{
+    struct fsync_object *fsync;
+    struct object *obj;
+
+    if (!(obj = get_handle_obj( current->process, req->handle, 0, NULL ))) return;
+
+    if (((fsync = get_event_fsync( obj )) ||
+         (fsync = get_semaphore_fsync( obj )) ||
+         (fsync = get_mutex_fsync( obj )) ||
+         (fsync = get_completion_fsync( obj ))) &&
+        fsync_is_private( fsync, current->process ))
+    {
+        reply->index = fsync - current->process->fsync_area->objects;
+        reply->type  = fsync->type;
+    }
+    else set_error( STATUS_OBJECT_TYPE_MISMATCH );
+
+    release_object( obj );
+}
+
+/* retrieve the list where the current thread records the mutexes it acquires */
+DECL_HANDLER(get_fsync_owned)
+{
+    struct fsync_object *fsync;
+
+    if (!current->fsync_owned)
+    {
+        if (!(fsync = fsync_alloc( NULL, FSYNC_NONE, 0, 0 )))
+        {
+            set_error( STATUS_NOT_IMPLEMENTED );
+            return;
+        }
+        memset( fsync, 0, sizeof(*fsync) );
+        current->fsync_owned = (struct fsync_owned *)fsync;
+    }
+    reply->index = (struct fsync_object *)current->fsync_owned - current->process->fsync_area->objects;
+    reply->owner = fsync_get_owner_id( current );
+}
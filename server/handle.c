@@ -27,12 +27,17 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#include <unistd.h>
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
 #include "windef.h"
 #include "winternl.h"
 
+#include "file.h"
 #include "handle.h"
 #include "process.h"
 #include "thread.h"
@@ -42,17 +47,19 @@
 struct handle_entry
 {
     struct object *ptr;       /* object */
-    unsigned int   access;    /* access rights */
+    unsigned int   access;    /* access rights, or index of the next free entry if ptr is NULL */
 };
 
 struct handle_table
 {
-    struct object        obj;         /* object header */
-    struct process      *process;     /* process owning this table */
-    int                  count;       /* number of allocated entries */
-    int                  last;        /* last used entry */
-    int                  free;        /* first entry that may be free */
-    struct handle_entry *entries;     /* handle entries */
+    struct object               obj;        /* object header */
+    struct process             *process;    /* process owning this table */
+    int                         count;      /* number of allocated entries */
+    int                         last;       /* last used entry */
+    int                         free;       /* head of the free entries list, -1 if empty */
+    struct handle_entry       **segments;   /* segments of handle entries */
+    int                         mirror_fd;  /* unix fd of the client mirror, -1 if none */
+    struct handle_mirror_entry *mirror;     /* mirror of the access rights mapped by the client */
 };
 
 static struct handle_table *global_table;
@@ -66,6 +73,11 @@ static struct handle_table *global_table;
 #define MIN_HANDLE_ENTRIES  32
 #define MAX_HANDLE_ENTRIES  0x00ffffff
 
+/* the entries are allocated by segments, so that they never move in memory */
+#define HANDLE_SEGMENT_SHIFT  8
+#define HANDLE_SEGMENT_SIZE   (1 << HANDLE_SEGMENT_SHIFT)
+#define HANDLE_SEGMENT_MASK   (HANDLE_SEGMENT_SIZE - 1)
+
 
 /* handle to table index conversion */
 
@@ -79,6 +91,33 @@ static inline int handle_to_index( obj_handle_t handle )
     return (handle >> 2) - 1;
 }
 
+/* retrieve the entry for a given index, which must be below table->count */
+static inline struct handle_entry *get_entry( struct handle_table *table, int index )
+{
+    return &table->segments[index >> HANDLE_SEGMENT_SHIFT][index & HANDLE_SEGMENT_MASK];
+}
+
+/* update the client mirror of an entry after it has been modified */
+static inline void update_mirror( struct handle_table *table, int index )
+{
+    struct handle_mirror_entry *mirror;
+    struct handle_entry *entry;
+
+    if (!table->mirror || index >= HANDLE_MIRROR_ENTRIES) return;
+    mirror = &table->mirror[index];
+    entry = get_entry( table, index );
+    if (!entry->ptr)
+    {
+        mirror->flags = 0;
+        mirror->access = 0;
+        return;
+    }
+    mirror->access = entry->access & ~RESERVED_ALL;
+    /* the completion hints stay valid as long as the entry refers to the same object */
+    mirror->flags = ((entry->access & RESERVED_ALL) >> RESERVED_SHIFT) | HANDLE_MIRROR_IN_USE |
+                    (mirror->flags & (HANDLE_MIRROR_NO_COMPLETION | HANDLE_MIRROR_SKIP_COMPLETION));
+}
+
 /* global handle conversion */
 
 #define HANDLE_OBFUSCATOR 0x544a4def
@@ -150,9 +189,9 @@ static void handle_table_dump( struct object *obj, int verbose )
     fprintf( stderr, "Handle table last=%d count=%d process=%p\n",
              table->last, table->count, table->process );
     if (!verbose) return;
-    entry = table->entries;
-    for (i = 0; i <= table->last; i++, entry++)
+    for (i = 0; i <= table->last; i++)
     {
+        entry = get_entry( table, i );
         if (!entry->ptr) continue;
         fprintf( stderr, "    %04x: %p %08x ",
                  index_to_handle(i), entry->ptr, entry->access );
@@ -173,20 +212,29 @@ static void handle_table_destroy( struct object *obj )
     /* first notify all objects that handles are being closed */
     if (table->process)
     {
-        for (i = 0, entry = table->entries; i <= table->last; i++, entry++)
+        for (i = 0; i <= table->last; i++)
         {
-            struct object *obj = entry->ptr;
+            struct object *obj = get_entry( table, i )->ptr;
             if (obj) obj->ops->close_handle( obj, table->process, index_to_handle(i) );
         }
     }
 
-    for (i = 0, entry = table->entries; i <= table->last; i++, entry++)
+    for (i = 0; i <= table->last; i++)
     {
-        struct object *obj = entry->ptr;
+        struct object *obj;
+
+        entry = get_entry( table, i );
+        obj = entry->ptr;
         entry->ptr = NULL;
         if (obj) release_object_from_handle( obj );
     }
-    free( table->entries );
+    for (i = 0; i < (table->count + HANDLE_SEGMENT_MASK) >> HANDLE_SEGMENT_SHIFT; i++)
+        free( table->segments[i] );
+    free( table->segments );
+#ifdef HAVE_SYS_MMAN_H
+    if (table->mirror) munmap( table->mirror, HANDLE_MIRROR_ENTRIES * sizeof(*table->mirror) );
+#endif
+    if (table->mirror_fd != -1) close( table->mirror_fd );
 }
 
 /* close all the process handles and free the handle table */
@@ -198,6 +246,47 @@ void close_process_handles( struct process *process )
     if (table) release_object( table );
 }
 
+/* size of the array of segments, which grows exponentially */
+static inline int get_segments_array_size( int nb_segments )
+{
+    int size = 1;
+
+    if (!nb_segments) return 0;
+    while (size < nb_segments) size *= 2;
+    return size;
+}
+
+/* add segments to a handle table until it has at least count entries */
+static int grow_handle_table( struct handle_table *table, int count )
+{
+    struct handle_entry **new_segments;
+    int nb_segments = (table->count + HANDLE_SEGMENT_MASK) >> HANDLE_SEGMENT_SHIFT;
+    int new_nb_segments;
+
+    if (count > MAX_HANDLE_ENTRIES) goto error;
+    new_nb_segments = (count + HANDLE_SEGMENT_MASK) >> HANDLE_SEGMENT_SHIFT;
+
+    if (new_nb_segments > get_segments_array_size( nb_segments ))
+    {
+        if (!(new_segments = realloc( table->segments,
+                                      get_segments_array_size( new_nb_segments ) * sizeof(*new_segments) )))
+            goto error;
+        table->segments = new_segments;
+    }
+    while (nb_segments < new_nb_segments)
+    {
+        if (!(table->segments[nb_segments] = malloc( HANDLE_SEGMENT_SIZE * sizeof(struct handle_entry) )))
+            break;
+        nb_segments++;
+    }
+    table->count = min( nb_segments << HANDLE_SEGMENT_SHIFT, MAX_HANDLE_ENTRIES );
+    if (table->count >= count) return 1;
+
+ error:
+    set_error( STATUS_INSUFFICIENT_RESOURCES );
+    return 0;
+}
+
 /* allocate a new handle table */
 struct handle_table *alloc_handle_table( struct process *process, int count )
 {
@@ -206,50 +295,80 @@ struct handle_table *alloc_handle_table( struct process *process, int count )
     if (count < MIN_HANDLE_ENTRIES) count = MIN_HANDLE_ENTRIES;
     if (!(table = alloc_object( &handle_table_ops )))
         return NULL;
-    table->process = process;
-    table->count   = count;
-    table->last    = -1;
-    table->free    = 0;
-    if ((table->entries = mem_alloc( count * sizeof(*table->entries) ))) return table;
+    table->process   = process;
+    table->count     = 0;
+    table->last      = -1;
+    table->free      = -1;
+    table->segments  = NULL;
+    table->mirror_fd = -1;
+    table->mirror    = NULL;
+    if (grow_handle_table( table, count )) return table;
     release_object( table );
     return NULL;
 }
 
-/* grow a handle table */
-static int grow_handle_table( struct handle_table *table )
+/* allocate a free entry in the handle table */
+static obj_handle_t alloc_entry( struct handle_table *table, void *obj, unsigned int access )
 {
-    struct handle_entry *new_entries;
-    int count = min( table->count * 2, MAX_HANDLE_ENTRIES );
+    struct handle_entry *entry;
+    int i;
 
-    if (count == table->count ||
-        !(new_entries = realloc( table->entries, count * sizeof(struct handle_entry) )))
+    if ((i = table->free) != -1)
     {
-        set_error( STATUS_INSUFFICIENT_RESOURCES );
-        return 0;
+        entry = get_entry( table, i );
+        table->free = entry->access;
+        if (i > table->last) table->last = i;
+    }
+    else
+    {
+        i = table->last + 1;
+        if (i >= table->count && !grow_handle_table( table, i + 1 )) return 0;
+        table->last = i;
+        entry = get_entry( table, i );
     }
-    table->entries = new_entries;
-    table->count   = count;
-    return 1;
+    entry->ptr    = grab_object_for_handle( obj );
+    entry->access = access;
+    if (table->mirror && i < HANDLE_MIRROR_ENTRIES) table->mirror[i].serial++;
+    update_mirror( table, i );
+    return index_to_handle(i);
 }
 
-/* allocate the first free entry in the handle table */
-static obj_handle_t alloc_entry( struct handle_table *table, void *obj, unsigned int access )
+/* put an entry on the free list once its object has been removed */
+static void free_entry( struct handle_table *table, int index )
 {
-    struct handle_entry *entry = table->entries + table->free;
-    int i;
+    struct handle_entry *entry = get_entry( table, index );
+
+    entry->ptr = NULL;
+    entry->access = table->free;
+    table->free = index;
+    update_mirror( table, index );
+}
+
+/* attempt to shrink a table once its last entry has been freed */
+/* entries above table->last may still be on the free list */
+static void shrink_handle_table( struct handle_table *table )
+{
+    struct handle_entry *entry;
+    int i, count = table->count;
+
+    while (table->last >= 0 && !get_entry( table, table->last )->ptr) table->last--;
+    if (table->last >= count / 4) return;  /* no need to shrink */
+    if (count <= HANDLE_SEGMENT_SIZE) return;  /* too small to shrink */
+    count = ((count / 2 + HANDLE_SEGMENT_MASK) >> HANDLE_SEGMENT_SHIFT) << HANDLE_SEGMENT_SHIFT;
+
+    for (i = count >> HANDLE_SEGMENT_SHIFT; i < (table->count + HANDLE_SEGMENT_MASK) >> HANDLE_SEGMENT_SHIFT; i++)
+        free( table->segments[i] );
+    table->count = count;
 
-    for (i = table->free; i <= table->last; i++, entry++) if (!entry->ptr) goto found;
-    if (i >= table->count)
+    /* the free list may link the removed entries, rebuild it with the lowest entries first */
+    table->free = -1;
+    for (i = table->last; i >= 0; i--)
     {
-        if (!grow_handle_table( table )) return 0;
-        entry = table->entries + i;  /* the entries may have moved */
+        entry = get_entry( table, i );
+        if (entry->ptr) continue;
+        entry->access = table->free;
+        table->free = i;
     }
-    table->last = i;
- found:
-    table->free = i + 1;
-    entry->ptr    = grab_object_for_handle( obj );
-    entry->access = access;
-    return index_to_handle(i);
 }
 
 /* allocate a handle for an object, incrementing its refcount */
@@ -265,6 +384,7 @@ static obj_handle_t alloc_handle_entry( struct process *process, void *ptr,
         set_error( STATUS_PROCESS_IS_TERMINATING );
         return 0;
     }
+    fsync_share_object( process, obj );
     return alloc_entry( process->handles, obj, access );
 }
 
@@ -327,59 +447,46 @@ static struct handle_entry *get_handle( struct process *process, obj_handle_t ha
     index = handle_to_index( handle );
     if (index < 0) return NULL;
     if (index > table->last) return NULL;
-    entry = table->entries + index;
+    entry = get_entry( table, index );
     if (!entry->ptr) return NULL;
     return entry;
 }
 
-/* attempt to shrink a table */
-static void shrink_handle_table( struct handle_table *table )
-{
-    struct handle_entry *entry = table->entries + table->last;
-    struct handle_entry *new_entries;
-    int count = table->count;
-
-    while (table->last >= 0)
-    {
-        if (entry->ptr) break;
-        table->last--;
-        entry--;
-    }
-    if (table->last >= count / 4) return;  /* no need to shrink */
-    if (count < MIN_HANDLE_ENTRIES * 2) return;  /* too small to shrink */
-    count /= 2;
-    if (!(new_entries = realloc( table->entries, count * sizeof(*new_entries) ))) return;
-    table->count   = count;
-    table->entries = new_entries;
-}
-
 /* copy the handle table of the parent process */
 /* return 1 if OK, 0 on error */
 struct handle_table *copy_handle_table( struct process *process, struct process *parent )
 {
     struct handle_table *parent_table = parent->handles;
     struct handle_table *table;
-    int i;
+    struct handle_entry *entry, *ptr;
+    int i, last = -1;
 
     assert( parent_table );
     assert( parent_table->obj.ops == &handle_table_ops );
 
-    if (!(table = alloc_handle_table( process, parent_table->count )))
+    for (i = 0; i <= parent_table->last; i++)
+    {
+        entry = get_entry( parent_table, i );
+        if (entry->ptr && (entry->access & RESERVED_INHERIT)) last = i;
+    }
+
+    if (!(table = alloc_handle_table( process, last + 1 )))
         return NULL;
 
-    if ((table->last = parent_table->last) >= 0)
+    /* inherited handles keep their value, the other entries go on the free list */
+    table->last = last;
+    for (i = last; i >= 0; i--)
     {
-        struct handle_entry *ptr = table->entries;
-        memcpy( ptr, parent_table->entries, (table->last + 1) * sizeof(struct handle_entry) );
-        for (i = 0; i <= table->last; i++, ptr++)
+        entry = get_entry( parent_table, i );
+        ptr = get_entry( table, i );
+        if (entry->ptr && (entry->access & RESERVED_INHERIT))
         {
-            if (!ptr->ptr) continue;
-            if (ptr->access & RESERVED_INHERIT) grab_object_for_handle( ptr->ptr );
-            else ptr->ptr = NULL; /* don't inherit this entry */
+            ptr->ptr = grab_object_for_handle( entry->ptr );
+            ptr->access = entry->access;
+            fsync_share_object( process, entry->ptr );
         }
+        else free_entry( table, i );
     }
-    /* attempt to shrink the table */
-    shrink_handle_table( table );
     return table;
 }
 
@@ -389,15 +496,16 @@ unsigned int close_handle( struct process *process, obj_handle_t handle )
     struct handle_table *table;
     struct handle_entry *entry;
     struct object *obj;
+    int index;
 
     if (!(entry = get_handle( process, handle ))) return STATUS_INVALID_HANDLE;
     if (entry->access & RESERVED_CLOSE_PROTECT) return STATUS_HANDLE_NOT_CLOSABLE;
     obj = entry->ptr;
     if (!obj->ops->close_handle( obj, process, handle )) return STATUS_HANDLE_NOT_CLOSABLE;
-    entry->ptr = NULL;
     table = handle_is_global(handle) ? global_table : process->handles;
-    if (entry < table->entries + table->free) table->free = entry - table->entries;
-    if (entry == table->entries + table->last) shrink_handle_table( table );
+    index = handle_to_index( handle_is_global(handle) ? handle_global_to_local(handle) : handle );
+    free_entry( table, index );
+    if (index == table->last) shrink_handle_table( table );
     release_object_from_handle( obj );
     return STATUS_SUCCESS;
 }
@@ -477,8 +585,9 @@ obj_handle_t find_inherited_handle( struct process *process, const struct object
 
     if (!table) return 0;
 
-    for (i = 0, ptr = table->entries; i <= table->last; i++, ptr++)
+    for (i = 0; i <= table->last; i++)
     {
+        ptr = get_entry( table, i );
         if (!ptr->ptr) continue;
         if (ptr->ptr->ops != ops) continue;
         if (ptr->access & RESERVED_INHERIT) return index_to_handle(i);
@@ -497,8 +606,9 @@ obj_handle_t enumerate_handles( struct process *process, const struct object_ops
 
     if (!table) return 0;
 
-    for (i = *index, entry = &table->entries[i]; i <= table->last; i++, entry++)
+    for (i = *index; i <= table->last; i++)
     {
+        entry = get_entry( table, i );
         if (!entry->ptr) continue;
         if (entry->ptr->ops != ops) continue;
         *index = i + 1;
@@ -529,6 +639,7 @@ static int set_handle_flags( struct process *process, obj_handle_t handle, int m
     mask  = (mask << RESERVED_SHIFT) & RESERVED_ALL;
     flags = (flags << RESERVED_SHIFT) & mask;
     entry->access = (entry->access & ~mask) | flags;
+    if (!handle_is_global( handle )) update_mirror( process->handles, handle_to_index( handle ));
     return (old_access & RESERVED_ALL) >> RESERVED_SHIFT;
 }
 
@@ -778,6 +889,111 @@ done:
     free( label_acl );
 }
 
+/* retrieve the read-only mirror of the handle table of the current process */
+DECL_HANDLER(get_handle_mirror)
+{
+    struct handle_table *table = current->process->handles;
+    data_size_t size = HANDLE_MIRROR_ENTRIES * sizeof(*table->mirror);
+
+    if (!table)
+    {
+        set_error( STATUS_PROCESS_IS_TERMINATING );
+        return;
+    }
+#ifdef HAVE_SYS_MMAN_H
+    if (!table->mirror)
+    {
+        void *ptr;
+        int i;
+
+        if ((table->mirror_fd = create_temp_file( size )) == -1) return;
+        if ((ptr = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, table->mirror_fd, 0 )) == MAP_FAILED)
+        {
+            file_set_error();
+            close( table->mirror_fd );
+            table->mirror_fd = -1;
+            return;
+        }
+        table->mirror = ptr;
+        for (i = 0; i <= table->last && i < HANDLE_MIRROR_ENTRIES; i++) update_mirror( table, i );
+    }
+    reply->size = size;
+    send_client_fd( current->process, table->mirror_fd, 0 );
+#else
+    set_error( STATUS_NOT_IMPLEMENTED );
+#endif
+}
+
+/* set flags in the client mirror of a handle; they are reset when the handle is closed */
+void set_handle_mirror_flags( struct process *process, obj_handle_t handle, unsigned int flags )
+{
+    struct handle_table *table = process->handles;
+    int index = handle_to_index( handle );
+
+    if (handle_is_global( handle ) || !table || !table->mirror) return;
+    if (index < 0 || index > table->last || index >= HANDLE_MIRROR_ENTRIES) return;
+    if (get_entry( table, index )->ptr) table->mirror[index].flags |= flags;
+}
+
+struct mirror_flags_info
+{
+    struct fd   *fd;
+    unsigned int flags;
+    int          set;
+};
+
+static int update_mirror_flags( struct process *process, void *user )
+{
+    struct mirror_flags_info *info = user;
+    struct handle_table *table = process->handles;
+    struct handle_entry *entry;
+    struct fd *fd;
+    int i;
+
+    if (!table || !table->mirror) return 0;
+
+    for (i = 0; i <= table->last && i < HANDLE_MIRROR_ENTRIES; i++)
+    {
+        /* skip the entries that already have the requested state */
+        if (!(table->mirror[i].flags & info->flags) == !info->set) continue;
+        entry = get_entry( table, i );
+        if (!entry->ptr) continue;
+        if ((fd = get_obj_fd( entry->ptr )))
+        {
+            if (fd == info->fd)
+            {
+                if (info->set) table->mirror[i].flags |= info->flags;
+                else table->mirror[i].flags &= ~info->flags;
+            }
+            release_object( fd );
+        }
+        else clear_error();
+    }
+    return 0;
+}
+
+/* clear flags in the client mirrors of the handles to the objects of an fd, in all processes */
+void clear_handle_mirror_flags( struct fd *fd, unsigned int flags )
+{
+    struct mirror_flags_info info;
+
+    info.fd    = fd;
+    info.flags = flags;
+    info.set   = 0;
+    enum_processes( update_mirror_flags, &info );
+}
+
+/* set flags in the client mirrors of the handles to the objects of an fd, in all processes */
+void set_fd_handle_mirror_flags( struct fd *fd, unsigned int flags )
+{
+    struct mirror_flags_info info;
+
+    info.fd    = fd;
+    info.flags = flags;
+    info.set   = 1;
+    enum_processes( update_mirror_flags, &info );
+}
+
 struct enum_handle_info
 {
     unsigned int count;
@@ -795,8 +1011,9 @@ static int enum_handles( struct process *process, void *user )
     if (!table)
         return 0;
 
-    for (i = 0, entry = table->entries; i <= table->last; i++, entry++)
+    for (i = 0; i <= table->last; i++)
     {
+        entry = get_entry( table, i );
         if (!entry->ptr) continue;
         if (!info->handle)
         {
@@ -29,6 +29,7 @@ struct process;
 struct object_ops;
 struct namespace;
 struct unicode_str;
+struct fd;
 
 /* handle functions */
 
@@ -54,5 +55,8 @@ extern void close_process_handles( struct process *process );
 extern struct handle_table *alloc_handle_table( struct process *process, int count );
 extern struct handle_table *copy_handle_table( struct process *process, struct process *parent );
 extern unsigned int get_handle_table_count( struct process *process);
+extern void set_handle_mirror_flags( struct process *process, obj_handle_t handle, unsigned int flags );
+extern void clear_handle_mirror_flags( struct fd *fd, unsigned int flags );
+extern void set_fd_handle_mirror_flags( struct fd *fd, unsigned int flags );
 
 #endif  /* __WINE_SERVER_HANDLE_H */
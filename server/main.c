@@ -144,6 +144,8 @@ int main( int argc, char *argv[] )
     init_signals();
     init_directories();
     init_registry();
+    init_request_profile();
+    init_request_workers();
     main_loop();
     return 0;
 }
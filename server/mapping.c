@@ -119,6 +119,46 @@ static const struct object_ops shared_map_ops =
 
 static struct list shared_map_list = LIST_INIT( shared_map_list );
 
+/* file holding a PE image relocated to a non-preferred base address */
+struct reloc_map
+{
+    struct object   obj;             /* object header */
+    struct fd      *fd;              /* file descriptor of the mapped PE file */
+    struct file    *file;            /* temp file holding the relocated image, NULL until needed */
+    client_ptr_t    base;            /* base address the image is relocated to */
+    struct list     entry;           /* entry in global relocated maps list */
+};
+
+static void reloc_map_dump( struct object *obj, int verbose );
+static void reloc_map_destroy( struct object *obj );
+
+static const struct object_ops reloc_map_ops =
+{
+    sizeof(struct reloc_map),  /* size */
+    reloc_map_dump,            /* dump */
+    no_get_type,               /* get_type */
+    no_add_queue,              /* add_queue */
+    NULL,                      /* remove_queue */
+    NULL,                      /* signaled */
+    NULL,                      /* satisfied */
+    no_signal,                 /* signal */
+    no_get_fd,                 /* get_fd */
+    no_map_access,             /* map_access */
+    default_get_sd,            /* get_sd */
+    default_set_sd,            /* set_sd */
+    no_lookup_name,            /* lookup_name */
+    no_link_name,              /* link_name */
+    NULL,                      /* unlink_name */
+    no_open_file,              /* open_file */
+    no_kernel_obj_list,        /* get_kernel_obj_list */
+    no_close_handle,           /* close_handle */
+    reloc_map_destroy          /* destroy */
+};
+
+static struct list reloc_map_list = LIST_INIT( reloc_map_list );
+
+#define RELOC_MAP_MAX_SIZE (4 * 1024 * 1024)  /* larger images are relocated by the client only */
+
 /* memory view mapped in client address space */
 struct memory_view
 {
@@ -126,6 +166,7 @@ struct memory_view
     struct fd      *fd;              /* fd for mapped file */
     struct ranges  *committed;       /* list of committed ranges in this mapping */
     struct shared_map *shared;       /* temp file for shared PE mapping */
+    struct reloc_map *reloc;         /* temp file for relocated PE mapping */
     unsigned int    flags;           /* SEC_* flags */
     client_ptr_t    base;            /* view base address (in process addr space) */
     mem_size_t      size;            /* view size */
@@ -141,6 +182,7 @@ struct mapping
     pe_image_info_t image;           /* image info (for PE image mapping) */
     struct ranges  *committed;       /* list of committed ranges in this mapping */
     struct shared_map *shared;       /* temp file for shared PE mapping */
+    struct reloc_map *reloc;         /* temp file for relocated PE mapping */
 };
 
 static void mapping_dump( struct object *obj, int verbose );
@@ -220,6 +262,22 @@ static void shared_map_destroy( struct object *obj )
     list_remove( &shared->entry );
 }
 
+static void reloc_map_dump( struct object *obj, int verbose )
+{
+    struct reloc_map *reloc = (struct reloc_map *)obj;
+    fprintf( stderr, "Relocated mapping fd=%p file=%p base=%08x%08x\n", reloc->fd, reloc->file,
+             (unsigned int)(reloc->base >> 32), (unsigned int)reloc->base );
+}
+
+static void reloc_map_destroy( struct object *obj )
+{
+    struct reloc_map *reloc = (struct reloc_map *)obj;
+
+    release_object( reloc->fd );
+    if (reloc->file) release_object( reloc->file );
+    list_remove( &reloc->entry );
+}
+
 /* extend a file beyond the current end of file */
 static int grow_file( int unix_fd, file_pos_t new_size )
 {
@@ -262,7 +320,7 @@ static int check_current_dir_for_exec(void)
 }
 
 /* create a temp file for anonymous mappings */
-static int create_temp_file( file_pos_t size )
+int create_temp_file( file_pos_t size )
 {
     static int temp_dir_fd = -1;
     char tmpfn[] = "anonmap.XXXXXX";
@@ -316,6 +374,7 @@ static void free_memory_view( struct memory_view *view )
     if (view->fd) release_object( view->fd );
     if (view->committed) release_object( view->committed );
     if (view->shared) release_object( view->shared );
+    if (view->reloc) release_object( view->reloc );
     list_remove( &view->entry );
     free( view );
 }
@@ -340,6 +399,17 @@ static struct shared_map *get_shared_file( struct fd *fd )
     return NULL;
 }
 
+/* find the relocated PE mapping for a given mapping, at any base if base is 0 */
+static struct reloc_map *get_reloc_file( struct fd *fd, client_ptr_t base )
+{
+    struct reloc_map *ptr;
+
+    LIST_FOR_EACH_ENTRY( ptr, &reloc_map_list, struct reloc_map, entry )
+        if (is_same_file_fd( ptr->fd, fd ) && (!base || ptr->base == base))
+            return (struct reloc_map *)grab_object( ptr );
+    return NULL;
+}
+
 /* return the size of the memory mapping and file range of a given section */
 static inline void get_section_sizes( const IMAGE_SECTION_HEADER *sec, size_t *map_size,
                                       off_t *file_start, size_t *file_size )
@@ -525,6 +595,202 @@ static int build_shared_mapping( struct mapping *mapping, int fd,
     return 0;
 }
 
+/* apply a block of base relocations to an image; return 0 on invalid data */
+static int apply_relocation_block( char *image, size_t size, unsigned int page,
+                                   const USHORT *relocs, unsigned int count, INT64 delta )
+{
+    while (count--)
+    {
+        size_t offset = page + (*relocs & 0xfff);
+
+        switch (*relocs >> 12)
+        {
+        case IMAGE_REL_BASED_ABSOLUTE:
+            break;
+        case IMAGE_REL_BASED_HIGH:
+            if (offset + sizeof(short) > size) return 0;
+            *(short *)(image + offset) += HIWORD(delta);
+            break;
+        case IMAGE_REL_BASED_LOW:
+            if (offset + sizeof(short) > size) return 0;
+            *(short *)(image + offset) += LOWORD(delta);
+            break;
+        case IMAGE_REL_BASED_HIGHLOW:
+            if (offset + sizeof(int) > size) return 0;
+            *(int *)(image + offset) += delta;
+            break;
+        case IMAGE_REL_BASED_DIR64:
+            if (offset + sizeof(INT64) > size) return 0;
+            *(INT64 *)(image + offset) += delta;
+            break;
+        default:  /* leave the other types to the client */
+            return 0;
+        }
+        relocs++;
+    }
+    return 1;
+}
+
+/* get the nt headers of an image loaded in a buffer */
+static IMAGE_NT_HEADERS32 *get_image_nt_headers( char *image, size_t size )
+{
+    IMAGE_DOS_HEADER *dos = (IMAGE_DOS_HEADER *)image;
+
+    if (size < sizeof(*dos) + sizeof(IMAGE_NT_HEADERS64)) return NULL;
+    if (dos->e_lfanew > size - sizeof(IMAGE_NT_HEADERS64)) return NULL;
+    return (IMAGE_NT_HEADERS32 *)(image + dos->e_lfanew);
+}
+
+/* load the sections of an image into a buffer and relocate it to a new base */
+static int relocate_image( struct mapping *mapping, int fd, char *image, size_t size, client_ptr_t base )
+{
+    static const size_t sector_align = 0x1ff;
+    IMAGE_SECTION_HEADER sec[96];
+    IMAGE_NT_HEADERS32 *nt32;
+    IMAGE_NT_HEADERS64 *nt64;
+    IMAGE_DATA_DIRECTORY *dir;
+    IMAGE_BASE_RELOCATION *rel;
+    size_t header_size, map_size, file_size, pos, end;
+    off_t file_start;
+    unsigned int i, nb_sec;
+    INT64 delta = base - mapping->image.base;
+    ssize_t ret;
+
+    if ((ret = pread( fd, image, min( mapping->image.header_size, size ), 0 )) == -1) return 0;
+    header_size = ret;
+
+    /* copy the section headers, since sections can be loaded over them */
+    if (!(nt32 = get_image_nt_headers( image, header_size ))) return 0;
+    nb_sec = nt32->FileHeader.NumberOfSections;
+    pos = (char *)&nt32->OptionalHeader + nt32->FileHeader.SizeOfOptionalHeader - image;
+    if (nb_sec > ARRAY_SIZE( sec ) || pos + nb_sec * sizeof(*sec) > header_size) return 0;
+    memcpy( sec, image + pos, nb_sec * sizeof(*sec) );
+
+    /* load the sections at their virtual address, like the client does */
+
+    for (i = 0; i < nb_sec; i++)
+    {
+        /* shared sections are mapped from the shared file at the client address */
+        if ((sec[i].Characteristics & IMAGE_SCN_MEM_SHARED) &&
+            (sec[i].Characteristics & IMAGE_SCN_MEM_WRITE)) return 0;
+
+        if (!sec[i].Misc.VirtualSize) map_size = ROUND_SIZE( sec[i].SizeOfRawData );
+        else map_size = ROUND_SIZE( sec[i].Misc.VirtualSize );
+        if (sec[i].VirtualAddress > size || map_size > size - sec[i].VirtualAddress) return 0;
+
+        file_start = sec[i].PointerToRawData & ~sector_align;
+        file_size = (sec[i].SizeOfRawData + (sec[i].PointerToRawData & sector_align) + sector_align) & ~sector_align;
+        if (file_size > map_size) file_size = map_size;
+        if (!sec[i].PointerToRawData || !file_size) continue;
+
+        /* a partial sector at end of file is not an error */
+        if (pread( fd, image + sec[i].VirtualAddress, file_size, file_start ) == -1) return 0;
+    }
+
+    /* apply the relocations from the loaded headers, and store the new base */
+
+    if (!(nt32 = get_image_nt_headers( image, size ))) return 0;
+    nt64 = (IMAGE_NT_HEADERS64 *)nt32;
+    switch (nt32->OptionalHeader.Magic)
+    {
+    case IMAGE_NT_OPTIONAL_HDR32_MAGIC:
+        if (nt32->OptionalHeader.NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_BASERELOC) return 0;
+        dir = &nt32->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+        break;
+    case IMAGE_NT_OPTIONAL_HDR64_MAGIC:
+        if (nt64->OptionalHeader.NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_BASERELOC) return 0;
+        dir = &nt64->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+        break;
+    default:
+        return 0;
+    }
+    if (!dir->VirtualAddress || !dir->Size) return 0;
+    if (dir->VirtualAddress > size || dir->Size > size - dir->VirtualAddress) return 0;
+
+    pos = dir->VirtualAddress;
+    end = pos + dir->Size;
+    while (pos + sizeof(*rel) <= end)
+    {
+        rel = (IMAGE_BASE_RELOCATION *)(image + pos);
+        if (!rel->SizeOfBlock) break;
+        if (rel->SizeOfBlock < sizeof(*rel) || rel->SizeOfBlock > end - pos) return 0;
+        if (rel->VirtualAddress >= size) return 0;
+        if (!apply_relocation_block( image, size, rel->VirtualAddress, (USHORT *)(rel + 1),
+                                     (rel->SizeOfBlock - sizeof(*rel)) / sizeof(USHORT), delta ))
+            return 0;
+        pos += rel->SizeOfBlock;
+    }
+
+    /* the relocations may have modified the headers too */
+    if (!(nt32 = get_image_nt_headers( image, size ))) return 0;
+    if (nt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+        ((IMAGE_NT_HEADERS64 *)nt32)->OptionalHeader.ImageBase = base;
+    else if (nt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
+        nt32->OptionalHeader.ImageBase = base;
+    else return 0;
+    return 1;
+}
+
+/* get the relocated copy of an image mapped at a given base, if it can be shared;
+ * the copy is only built once another process asks for it */
+static struct reloc_map *get_reloc_mapping( struct mapping *mapping, client_ptr_t base )
+{
+    struct reloc_map *reloc;
+
+    /* the client doesn't relocate these images */
+    if (!(mapping->image.image_charact & IMAGE_FILE_DLL)) return NULL;
+    if (mapping->image.image_charact & IMAGE_FILE_RELOCS_STRIPPED) return NULL;
+    if (mapping->image.image_flags & IMAGE_FLAGS_ImageMappedFlat) return NULL;
+    if (mapping->image.loader_flags) return NULL;
+    /* the copy is built synchronously in a request, keep it cheap */
+    if (mapping->image.map_size > RELOC_MAP_MAX_SIZE || is_fd_removable( mapping->fd )) return NULL;
+    /* shared sections would have to be relocated in the shared file too */
+    if (mapping->shared) return NULL;
+
+    /* keep a single relocated copy of each image */
+    if ((reloc = get_reloc_file( mapping->fd, 0 )))
+    {
+        if (reloc->base == base) return reloc;
+        release_object( reloc );
+        return NULL;
+    }
+
+    if (!(reloc = alloc_object( &reloc_map_ops ))) return NULL;
+    reloc->fd   = (struct fd *)grab_object( mapping->fd );
+    reloc->file = NULL;
+    reloc->base = base;
+    list_add_head( &reloc_map_list, &reloc->entry );
+    return reloc;
+}
+
+/* create the temp file holding the relocated copy of an image */
+static int build_reloc_file( struct reloc_map *reloc, struct mapping *mapping )
+{
+    size_t size = mapping->image.map_size;
+    int fd, reloc_fd, ret = 0;
+    void *image;
+
+    if (reloc->file) return 1;
+
+    if ((fd = get_unix_fd( mapping->fd )) != -1 && (reloc_fd = create_temp_file( size )) != -1)
+    {
+        if ((image = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, reloc_fd, 0 )) != MAP_FAILED)
+        {
+            ret = relocate_image( mapping, fd, image, size, reloc->base );
+            munmap( image, size );
+        }
+        if (ret) ret = (reloc->file = create_file_for_fd( reloc_fd, FILE_GENERIC_READ|FILE_GENERIC_WRITE, 0 )) != NULL;
+        else close( reloc_fd );
+    }
+    if (!ret)
+    {
+        /* don't offer the address to other processes anymore */
+        list_remove( &reloc->entry );
+        list_init( &reloc->entry );
+    }
+    return ret;
+}
+
 /* load the CLR header from its section */
 static int load_clr_header( IMAGE_COR20_HEADER *hdr, size_t va, size_t size, int unix_fd,
                             IMAGE_SECTION_HEADER *sec, unsigned int nb_sec )
@@ -800,6 +1066,7 @@ static struct object *create_mapping( struct object *root, const struct unicode_
     mapping->size        = size;
     mapping->fd          = NULL;
     mapping->shared      = NULL;
+    mapping->reloc       = NULL;
     mapping->committed   = NULL;
 
     if (!(mapping->flags = get_mapping_flags( handle, flags ))) goto error;
@@ -930,6 +1197,7 @@ static void mapping_destroy( struct object *obj )
     if (mapping->fd) release_object( mapping->fd );
     if (mapping->committed) release_object( mapping->committed );
     if (mapping->shared) release_object( mapping->shared );
+    if (mapping->reloc) release_object( mapping->reloc );
 }
 
 static enum server_fd_type mapping_get_fd_type( struct fd *fd )
@@ -998,6 +1266,34 @@ DECL_HANDLER(get_mapping_info)
     if (mapping->shared)
         reply->shared_file = alloc_handle( current->process, mapping->shared->file,
                                            GENERIC_READ|GENERIC_WRITE, 0 );
+    if (mapping->flags & SEC_IMAGE)
+    {
+        /* the client only asks for the file if the preferred base isn't available */
+        struct reloc_map *reloc = mapping->reloc ? (struct reloc_map *)grab_object( mapping->reloc )
+                                                 : get_reloc_file( mapping->fd, 0 );
+        if (reloc)
+        {
+            reply->reloc_base = reloc->base;
+            release_object( reloc );
+        }
+    }
+    release_object( mapping );
+}
+
+/* get the file of an image mapping relocated by the server */
+DECL_HANDLER(get_mapping_reloc_file)
+{
+    struct mapping *mapping;
+    struct reloc_map *reloc = NULL;
+
+    if (!(mapping = get_mapping_obj( current->process, req->handle, SECTION_MAP_READ ))) return;
+
+    if (mapping->flags & SEC_IMAGE) reloc = get_reloc_file( mapping->fd, req->base );
+    if (reloc && build_reloc_file( reloc, mapping ))
+        reply->file = alloc_handle( current->process, reloc->file, GENERIC_READ, 0 );
+    else
+        set_error( STATUS_NOT_FOUND );
+    if (reloc) release_object( reloc );
     release_object( mapping );
 }
 
@@ -1049,6 +1345,13 @@ DECL_HANDLER(map_view)
         view->fd        = !is_fd_removable( mapping->fd ) ? (struct fd *)grab_object( mapping->fd ) : NULL;
         view->committed = mapping->committed ? (struct ranges *)grab_object( mapping->committed ) : NULL;
         view->shared    = mapping->shared ? (struct shared_map *)grab_object( mapping->shared ) : NULL;
+        view->reloc     = NULL;
+        if ((mapping->flags & SEC_IMAGE) && req->base != mapping->image.base)
+        {
+            /* offer the address to the next processes mapping the image */
+            if ((view->reloc = get_reloc_mapping( mapping, req->base )) && !mapping->reloc)
+                mapping->reloc = (struct reloc_map *)grab_object( view->reloc );
+        }
         list_add_tail( &current->process->views, &view->entry );
     }
 
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
@@ -32,6 +33,7 @@
 #include "winternl.h"
 
 #include "handle.h"
+#include "process.h"
 #include "thread.h"
 #include "request.h"
 #include "security.h"
@@ -43,10 +45,14 @@ struct mutex
     unsigned int   count;           /* recursion count */
     int            abandoned;       /* has it been abandoned? */
     struct list    entry;           /* entry in owner thread mutex list */
+    struct fsync_object *fsync;     /* shared state for client-side synchronization */
+    struct fsync_object *detached;  /* shared state once the server has taken it over */
 };
 
 static void mutex_dump( struct object *obj, int verbose );
 static struct object_type *mutex_get_type( struct object *obj );
+static int mutex_add_queue( struct object *obj, struct wait_queue_entry *entry );
+static void mutex_remove_queue( struct object *obj, struct wait_queue_entry *entry );
 static int mutex_signaled( struct object *obj, struct wait_queue_entry *entry );
 static void mutex_satisfied( struct object *obj, struct wait_queue_entry *entry );
 static unsigned int mutex_map_access( struct object *obj, unsigned int access );
@@ -58,8 +64,8 @@ static const struct object_ops mutex_ops =
     sizeof(struct mutex),      /* size */
     mutex_dump,                /* dump */
     mutex_get_type,            /* get_type */
-    add_queue,                 /* add_queue */
-    remove_queue,              /* remove_queue */
+    mutex_add_queue,           /* add_queue */
+    mutex_remove_queue,        /* remove_queue */
     mutex_signaled,            /* signaled */
     mutex_satisfied,           /* satisfied */
     mutex_signal,              /* signal */
@@ -77,9 +83,36 @@ static const struct object_ops mutex_ops =
 };
 
 
+/* check if a mutex is owned by a given thread */
+static int is_owner( struct mutex *mutex, struct thread *thread )
+{
+    if (mutex->fsync) return thread->fsync_id && fsync_get_state( mutex->fsync ) == thread->fsync_id;
+    return mutex->count && mutex->owner == thread;
+}
+
+static unsigned int *get_count_ptr( struct mutex *mutex )
+{
+    return mutex->fsync ? &mutex->fsync->count : &mutex->count;
+}
+
 /* grab a mutex for a given thread */
 static void do_grab( struct mutex *mutex, struct thread *thread )
 {
+    if (mutex->fsync)
+    {
+        /* clients cannot grab the mutex while a server wait is queued */
+        if (!fsync_cmpxchg_state( mutex->fsync, fsync_get_owner_id( thread ), 0 ))
+        {
+            mutex->fsync->count++;
+            return;
+        }
+        mutex->fsync->count = 1;
+        /* it may still be in the list of a previous owner that released it on the client side */
+        list_remove( &mutex->entry );
+        list_add_head( &thread->mutex_list, &mutex->entry );
+        return;
+    }
+
     assert( !mutex->count || (mutex->owner == thread) );
 
     if (!mutex->count++)  /* FIXME: avoid wrap-around */
@@ -90,9 +123,33 @@ static void do_grab( struct mutex *mutex, struct thread *thread )
     }
 }
 
+/* keep the state on the server side once the clients can't modify the shared state anymore */
+static void take_over_fsync_state( struct mutex *mutex )
+{
+    list_remove( &mutex->entry );
+    list_init( &mutex->entry );
+    mutex->count     = 0;
+    mutex->owner     = NULL;
+    mutex->abandoned = mutex->fsync->abandoned != 0;
+    mutex->detached  = mutex->fsync;
+    mutex->fsync     = NULL;
+}
+
 /* release a mutex once the recursion count is 0 */
 static void do_release( struct mutex *mutex )
 {
+    if (mutex->fsync)
+    {
+        list_remove( &mutex->entry );
+        list_init( &mutex->entry );
+        mutex->fsync->count = 0;
+        fsync_set_state( mutex->fsync, 0 );
+        if (fsync_is_detached( mutex->fsync )) take_over_fsync_state( mutex );
+        else fsync_wake( mutex->fsync );
+        wake_up( &mutex->obj, 0 );
+        return;
+    }
+
     assert( !mutex->count );
     /* remove the mutex from the thread list of owned mutexes */
     list_remove( &mutex->entry );
@@ -113,19 +170,89 @@ static struct mutex *create_mutex( struct object *root, const struct unicode_str
             mutex->count = 0;
             mutex->owner = NULL;
             mutex->abandoned = 0;
+            list_init( &mutex->entry );
+            mutex->fsync = fsync_alloc( &mutex->obj, FSYNC_MUTEX, 0, 0 );
+            mutex->detached = NULL;
             if (owned) do_grab( mutex, current );
         }
     }
     return mutex;
 }
 
+struct fsync_object *get_mutex_fsync( struct object *obj )
+{
+    if (obj->ops != &mutex_ops) return NULL;
+    return ((struct mutex *)obj)->fsync;
+}
+
+/* take over the shared state once another process gets a handle to the mutex */
+void detach_mutex_fsync( struct object *obj, struct process *process )
+{
+    struct mutex *mutex = (struct mutex *)obj;
+
+    if (obj->ops != &mutex_ops || !mutex->fsync || !fsync_detach( mutex->fsync, process )) return;
+    /* only the owner modifies the recursion count, so an owned mutex is taken over when released */
+    if (!fsync_get_state( mutex->fsync )) take_over_fsync_state( mutex );
+}
+
+/* abandon the shared mutexes that a thread acquired on the client side */
+static void abandon_fsync_owned( struct thread *thread )
+{
+    struct fsync_owned *list = thread->fsync_owned;
+    struct mutex *mutex, *owned[FSYNC_OWNED_MAX];
+    struct object *obj;
+    unsigned int i, count = 0;
+
+    /* collect them first, waking up waiters can destroy other mutexes */
+    for (i = 0; i < FSYNC_OWNED_MAX; i++)
+    {
+        /* the list is in shared memory, anything could have been written there */
+        if (!(obj = fsync_get_object( thread->process, list->index[i] ))) continue;
+        if (!get_mutex_fsync( obj )) continue;
+        mutex = (struct mutex *)obj;
+        if (is_owner( mutex, thread )) owned[count++] = (struct mutex *)grab_object( mutex );
+    }
+    fsync_free( (struct fsync_object *)list );
+    thread->fsync_owned = NULL;
+
+    for (i = 0; i < count; i++)
+    {
+        mutex = owned[i];
+        /* the list may contain the same mutex twice */
+        if (mutex->fsync && is_owner( mutex, thread ))
+        {
+            mutex->fsync->abandoned = 1;
+            do_release( mutex );
+        }
+        release_object( mutex );
+    }
+}
+
 void abandon_mutexes( struct thread *thread )
 {
+    struct mutex *mutex;
     struct list *ptr;
 
+    if (thread->fsync_owned) abandon_fsync_owned( thread );
+
     while ((ptr = list_head( &thread->mutex_list )) != NULL)
     {
-        struct mutex *mutex = LIST_ENTRY( ptr, struct mutex, entry );
+        mutex = LIST_ENTRY( ptr, struct mutex, entry );
+        if (mutex->fsync)
+        {
+            /* it may have been released on the client side since the server handed it over */
+            if (is_owner( mutex, thread ))
+            {
+                mutex->fsync->abandoned = 1;
+                do_release( mutex );
+            }
+            else
+            {
+                list_remove( &mutex->entry );
+                list_init( &mutex->entry );
+            }
+            continue;
+        }
         assert( mutex->owner == thread );
         mutex->count = 0;
         mutex->abandoned = 1;
@@ -137,7 +264,10 @@ static void mutex_dump( struct object *obj, int verbose )
 {
     struct mutex *mutex = (struct mutex *)obj;
     assert( obj->ops == &mutex_ops );
-    fprintf( stderr, "Mutex count=%u owner=%p\n", mutex->count, mutex->owner );
+    if (mutex->fsync)
+        fprintf( stderr, "Mutex count=%u owner=%04x\n", mutex->fsync->count, fsync_get_state( mutex->fsync ));
+    else
+        fprintf( stderr, "Mutex count=%u owner=%p\n", mutex->count, mutex->owner );
 }
 
 static struct object_type *mutex_get_type( struct object *obj )
@@ -147,21 +277,42 @@ static struct object_type *mutex_get_type( struct object *obj )
     return get_object_type( &str );
 }
 
+static int mutex_add_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct mutex *mutex = (struct mutex *)obj;
+    assert( obj->ops == &mutex_ops );
+    return fsync_add_queue( mutex->fsync, obj, entry );
+}
+
+static void mutex_remove_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct mutex *mutex = (struct mutex *)obj;
+    assert( obj->ops == &mutex_ops );
+    fsync_remove_queue( mutex->fsync, obj, entry );
+}
+
 static int mutex_signaled( struct object *obj, struct wait_queue_entry *entry )
 {
     struct mutex *mutex = (struct mutex *)obj;
     assert( obj->ops == &mutex_ops );
+    if (mutex->fsync)
+    {
+        unsigned int owner = fsync_get_state( mutex->fsync );
+        return (!owner || owner == get_wait_queue_thread( entry )->fsync_id);
+    }
     return (!mutex->count || (mutex->owner == get_wait_queue_thread( entry )));
 }
 
 static void mutex_satisfied( struct object *obj, struct wait_queue_entry *entry )
 {
     struct mutex *mutex = (struct mutex *)obj;
+    int *abandoned = mutex->fsync ? &mutex->fsync->abandoned : &mutex->abandoned;
+
     assert( obj->ops == &mutex_ops );
 
     do_grab( mutex, get_wait_queue_thread( entry ));
-    if (mutex->abandoned) make_wait_abandoned( entry );
-    mutex->abandoned = 0;
+    if (*abandoned) make_wait_abandoned( entry );
+    *abandoned = 0;
 }
 
 static unsigned int mutex_map_access( struct object *obj, unsigned int access )
@@ -183,12 +334,12 @@ static int mutex_signal( struct object *obj, unsigned int access )
         set_error( STATUS_ACCESS_DENIED );
         return 0;
     }
-    if (!mutex->count || (mutex->owner != current))
+    if (!is_owner( mutex, current ))
     {
         set_error( STATUS_MUTANT_NOT_OWNED );
         return 0;
     }
-    if (!--mutex->count) do_release( mutex );
+    if (!--*get_count_ptr( mutex )) do_release( mutex );
     return 1;
 }
 
@@ -197,6 +348,13 @@ static void mutex_destroy( struct object *obj )
     struct mutex *mutex = (struct mutex *)obj;
     assert( obj->ops == &mutex_ops );
 
+    if (mutex->fsync)
+    {
+        list_remove( &mutex->entry );
+        fsync_free( mutex->fsync );
+        return;
+    }
+    if (mutex->detached) fsync_free( mutex->detached );
     if (!mutex->count) return;
     mutex->count = 0;
     do_release( mutex );
@@ -243,11 +401,13 @@ DECL_HANDLER(release_mutex)
     if ((mutex = (struct mutex *)get_handle_obj( current->process, req->handle,
                                                  0, &mutex_ops )))
     {
-        if (!mutex->count || (mutex->owner != current)) set_error( STATUS_MUTANT_NOT_OWNED );
+        unsigned int *count = get_count_ptr( mutex );
+
+        if (!is_owner( mutex, current )) set_error( STATUS_MUTANT_NOT_OWNED );
         else
         {
-            reply->prev_count = mutex->count;
-            if (!--mutex->count) do_release( mutex );
+            reply->prev_count = *count;
+            if (!--*count) do_release( mutex );
         }
         release_object( mutex );
     }
@@ -261,9 +421,17 @@ DECL_HANDLER(query_mutex)
     if ((mutex = (struct mutex *)get_handle_obj( current->process, req->handle,
                                                  MUTANT_QUERY_STATE, &mutex_ops )))
     {
-        reply->count = mutex->count;
-        reply->owned = (mutex->owner == current);
-        reply->abandoned = mutex->abandoned;
+        if (mutex->fsync)
+        {
+            reply->count = fsync_get_state( mutex->fsync ) ? mutex->fsync->count : 0;
+            reply->abandoned = mutex->fsync->abandoned;
+        }
+        else
+        {
+            reply->count = mutex->count;
+            reply->abandoned = mutex->abandoned;
+        }
+        reply->owned = is_owner( mutex, current );
 
         release_object( mutex );
     }
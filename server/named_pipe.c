@@ -28,6 +28,18 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#ifdef HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+#ifdef HAVE_SYS_IOCTL_H
+# include <sys/ioctl.h>
+#endif
+#ifdef HAVE_SYS_FILIO_H
+# include <sys/filio.h>
+#endif
+#include <unistd.h>
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
@@ -63,6 +75,7 @@ struct pipe_end
     process_id_t         client_pid; /* process that created the client */
     process_id_t         server_pid; /* process that created the server */
     data_size_t          buffer_size;/* size of buffered data that doesn't block caller */
+    int                  direct;     /* data goes through a socket pair used by the clients */
     struct list          message_queue;
     struct async_queue   read_q;     /* read queue */
     struct async_queue   write_q;    /* write queue */
@@ -80,6 +93,7 @@ struct named_pipe
 {
     struct object       obj;         /* object header */
     int                 message_mode;
+    int                 direct;      /* data may go through a socket pair */
     unsigned int        sharing;
     unsigned int        maxinstances;
     unsigned int        outsize;
@@ -383,12 +397,227 @@ static void free_message( struct pipe_message *message )
     free( message );
 }
 
+/*
+ * When WINEDIRECTPIPES is set in the environment of the server, or in the
+ * environment of the process creating the pipe, pipes whose both ends are
+ * opened for synchronous I/O carry their data over a non-blocking unix socket
+ * pair, which the clients read and write directly. The server only keeps
+ * track of the connection state.
+ *
+ * Byte mode pipes use a stream socket pair. Message mode pipes use a
+ * SOCK_SEQPACKET pair, which keeps the message boundaries, as long as both
+ * ends read in message mode. Clients get the size of the next message with
+ * MSG_PEEK | MSG_TRUNC, which only reports it on Linux, so message mode pipes
+ * stay with server-side I/O elsewhere. A message that doesn't fit in the read
+ * buffer, an empty message, or one that is too large for the socket is passed
+ * through the server instead, which then keeps the rest of the message for the
+ * next read as usual.
+ *
+ * Whenever the server needs to see the data (disconnection, flushing data
+ * that wasn't read yet, switching to non-blocking or byte read mode, or an I/O
+ * request that still reached the server), the data pending in the sockets is
+ * moved back to the message queues and the pipe stays with server-side I/O
+ * until it is reconnected, or until its mode is set again while no data is
+ * left in the queues. The sockets are shut down, so that the clients
+ * notice that their cached fd became invalid and retry through the server.
+ */
+
+static int direct_pipes_enabled = -1;  /* -1 means not initialized yet */
+
+static int init_direct_pipes(void)
+{
+    if (direct_pipes_enabled != -1) return direct_pipes_enabled;
+    direct_pipes_enabled = 0;
+
+#if defined(HAVE_SYS_SOCKET_H) && defined(FIONREAD)
+    {
+        const char *env = getenv( "WINEDIRECTPIPES" );
+
+        if (!env || !atoi( env )) return 0;
+        direct_pipes_enabled = 1;
+        if (debug_level) fprintf( stderr, "wineserver: using direct pipe data path\n" );
+    }
+#endif
+    return direct_pipes_enabled;
+}
+
+/* check whether a new pipe created with the given flags should use the direct data path */
+static int pipe_wants_direct( unsigned int flags )
+{
+#if defined(HAVE_SYS_SOCKET_H) && defined(FIONREAD)
+    if (flags & NAMED_PIPE_DIRECT_DATA) return 1;
+#endif
+    return init_direct_pipes();
+}
+
+#if defined(__linux__) && defined(SOCK_SEQPACKET) && defined(MSG_TRUNC)
+#define DIRECT_MESSAGE_PIPES  /* MSG_TRUNC reports the size of the next message */
+#endif
+
+/* check whether a pipe end opened with the given options can ever use the direct data path */
+static int pipe_end_may_be_direct( struct named_pipe *pipe, unsigned int options )
+{
+    if (!pipe->direct || !(options & (FILE_SYNCHRONOUS_IO_ALERT | FILE_SYNCHRONOUS_IO_NONALERT)))
+        return 0;
+#ifdef DIRECT_MESSAGE_PIPES
+    return 1;
+#else
+    return !pipe->message_mode;
+#endif
+}
+
+#if defined(HAVE_SYS_SOCKET_H) && defined(FIONREAD)
+
+/* get the amount of data waiting in the socket of a pipe end */
+static int get_direct_avail( struct pipe_end *pipe_end )
+{
+    int avail = 0;
+
+    if (ioctl( get_unix_fd( pipe_end->fd ), FIONREAD, &avail ) == -1) return 0;
+    return avail;
+}
+
+/* check whether a connected pipe end can switch to the direct data path */
+static int pipe_end_can_be_direct( struct pipe_end *pipe_end )
+{
+    if (!pipe_end_may_be_direct( pipe_end->pipe, get_fd_options( pipe_end->fd ) )) return 0;
+    if (pipe_end->flags & NAMED_PIPE_NONBLOCKING_MODE) return 0;
+    /* byte mode reads of a message mode pipe cross the message boundaries */
+    if (pipe_end->pipe->message_mode && !(pipe_end->flags & NAMED_PIPE_MESSAGE_STREAM_READ)) return 0;
+    /* nothing may be left for the server to deliver */
+    return list_empty( &pipe_end->message_queue ) &&
+           !async_queued( &pipe_end->read_q ) && !async_queued( &pipe_end->write_q );
+}
+
+/* switch a connected pipe to the direct data path if possible; this is done on
+ * connection, or when a message mode pipe end switches to message read mode */
+static void pipe_end_set_direct( struct pipe_end *pipe_end, struct pipe_end *connection )
+{
+    int fds[2];
+
+    if (!pipe_end_can_be_direct( pipe_end ) || !pipe_end_can_be_direct( connection )) return;
+
+    if (socketpair( PF_UNIX, pipe_end->pipe->message_mode ? SOCK_SEQPACKET : SOCK_STREAM, 0, fds ) == -1)
+        return;
+    /* the clients poll the sockets themselves, so that waits stay interruptible */
+    fcntl( fds[0], F_SETFL, O_NONBLOCK );
+    fcntl( fds[1], F_SETFL, O_NONBLOCK );
+    set_pseudo_fd_unix_fd( pipe_end->fd, fds[0] );
+    set_pseudo_fd_unix_fd( connection->fd, fds[1] );
+    pipe_end->direct = connection->direct = 1;
+}
+
+/* move the data left in the socket of a pipe end to its message queue; the
+ * sockets must be shut down already, so that no data can arrive behind it */
+static void drain_direct_data( struct pipe_end *pipe_end )
+{
+    struct iosb *iosb;
+    int avail, ret;
+    char *data;
+
+    while ((avail = get_direct_avail( pipe_end )))
+    {
+        if (!(data = malloc( avail ))) return;
+
+        /* a single recv takes everything queued at once on a stream socket, or
+         * a single message on a message mode pipe; if a client read got there
+         * first, it got the data in front of ours */
+        if ((ret = recv( get_unix_fd( pipe_end->fd ), data, avail, MSG_DONTWAIT )) <= 0 ||
+            !(iosb = create_iosb( NULL, 0, 0 )))
+        {
+            free( data );
+            return;
+        }
+        iosb->in_data = data;
+        iosb->in_size = ret;
+        queue_message( pipe_end, iosb );
+        release_object( iosb );
+    }
+}
+
+/* move a pipe back to server-side I/O, keeping the data that wasn't read yet */
+static void pipe_end_leave_direct( struct pipe_end *pipe_end )
+{
+    struct pipe_end *connection = pipe_end->connection;
+
+    /* shut down both directions before draining: a write still in progress then
+     * fails with EPIPE instead of appending data behind what the server takes,
+     * and the clients see EOF once the data is gone and retry through the server */
+    shutdown( get_unix_fd( pipe_end->fd ), SHUT_RDWR );
+    shutdown( get_unix_fd( connection->fd ), SHUT_RDWR );
+    drain_direct_data( pipe_end );
+    drain_direct_data( connection );
+
+    set_pseudo_fd_unix_fd( pipe_end->fd, -1 );
+    set_pseudo_fd_unix_fd( connection->fd, -1 );
+    pipe_end->direct = connection->direct = 0;
+}
+
+static int pipe_end_peek_direct( struct pipe_end *pipe_end, data_size_t reply_size )
+{
+    FILE_PIPE_PEEK_BUFFER *buffer;
+    int avail = get_direct_avail( pipe_end ), ret = 0, message_length = 0;
+    char *data = NULL;
+
+    reply_size = min( reply_size, avail );
+#ifdef DIRECT_MESSAGE_PIPES
+    if (avail && pipe_end->pipe->message_mode)
+    {
+        if ((message_length = recv( get_unix_fd( pipe_end->fd ), NULL, 0,
+                                    MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT )) == -1)
+            message_length = 0;
+        reply_size = min( reply_size, message_length );
+    }
+#endif
+    if (reply_size)
+    {
+        if (!(data = mem_alloc( reply_size ))) return 0;
+        if ((ret = recv( get_unix_fd( pipe_end->fd ), data, reply_size, MSG_PEEK | MSG_DONTWAIT )) == -1)
+            ret = 0;
+    }
+
+    if ((buffer = set_reply_data_size( offsetof( FILE_PIPE_PEEK_BUFFER, Data[ret] ) )))
+    {
+        buffer->NamedPipeState    = pipe_end->state;
+        buffer->ReadDataAvailable = avail;
+        buffer->NumberOfMessages  = 0;  /* FIXME */
+        buffer->MessageLength     = message_length;
+        if (ret) memcpy( buffer->Data, data, ret );
+    }
+    free( data );
+    if (buffer && message_length > ret) set_error( STATUS_BUFFER_OVERFLOW );
+    return buffer != NULL;
+}
+
+#else  /* HAVE_SYS_SOCKET_H && FIONREAD */
+
+static int get_direct_avail( struct pipe_end *pipe_end )
+{
+    return 0;
+}
+
+static void pipe_end_set_direct( struct pipe_end *pipe_end, struct pipe_end *connection )
+{
+}
+
+static void pipe_end_leave_direct( struct pipe_end *pipe_end )
+{
+}
+
+static int pipe_end_peek_direct( struct pipe_end *pipe_end, data_size_t reply_size )
+{
+    return 0;
+}
+
+#endif  /* HAVE_SYS_SOCKET_H && FIONREAD */
+
 static void pipe_end_disconnect( struct pipe_end *pipe_end, unsigned int status )
 {
     struct pipe_end *connection = pipe_end->connection;
     struct pipe_message *message, *next;
     struct async *async;
 
+    if (pipe_end->direct) pipe_end_leave_direct( pipe_end );
     pipe_end->connection = NULL;
 
     pipe_end->state = status == STATUS_PIPE_DISCONNECTED
@@ -553,6 +782,12 @@ static int pipe_end_flush( struct fd *fd, struct async *async )
         return 0;
     }
 
+    if (pipe_end->direct)
+    {
+        if (!get_direct_avail( pipe_end->connection )) return 1;
+        pipe_end_leave_direct( pipe_end );  /* we need to know when the data gets read */
+    }
+
     if (pipe_end->connection && !list_empty( &pipe_end->connection->message_queue ))
     {
         fd_queue_async( pipe_end->fd, async, ASYNC_TYPE_WAIT );
@@ -854,6 +1089,9 @@ static int pipe_end_read( struct fd *fd, struct async *async, file_pos_t pos )
 {
     struct pipe_end *pipe_end = get_fd_user( fd );
 
+    /* the client didn't use the socket, e.g. because it raced with the connection */
+    if (pipe_end->direct) pipe_end_leave_direct( pipe_end );
+
     switch (pipe_end->state)
     {
     case FILE_PIPE_CONNECTED_STATE:
@@ -887,6 +1125,8 @@ static int pipe_end_write( struct fd *fd, struct async *async, file_pos_t pos )
     struct pipe_message *message;
     struct iosb *iosb;
 
+    if (pipe_end->direct) pipe_end_leave_direct( pipe_end );
+
     switch (pipe_end->state)
     {
     case FILE_PIPE_CONNECTED_STATE:
@@ -961,6 +1201,8 @@ static int pipe_end_peek( struct pipe_end *pipe_end )
         return 0;
     }
 
+    if (pipe_end->direct) return pipe_end_peek_direct( pipe_end, reply_size );
+
     LIST_FOR_EACH_ENTRY( message, &pipe_end->message_queue, struct pipe_message, entry )
         avail += message->iosb->in_size - message->read_pos;
     reply_size = min( reply_size, avail );
@@ -1011,6 +1253,9 @@ static int pipe_end_transceive( struct pipe_end *pipe_end, struct async *async )
         return 0;
     }
 
+    /* the reply is read from the message queue */
+    if (pipe_end->direct) pipe_end_leave_direct( pipe_end );
+
     /* not allowed if we already have read data buffered */
     if (!list_empty( &pipe_end->message_queue ))
     {
@@ -1166,6 +1411,7 @@ static void init_pipe_end( struct pipe_end *pipe_end, struct named_pipe *pipe,
     pipe_end->flags = pipe_flags;
     pipe_end->connection = NULL;
     pipe_end->buffer_size = buffer_size;
+    pipe_end->direct = 0;
     init_async_queue( &pipe_end->read_q );
     init_async_queue( &pipe_end->write_q );
     list_init( &pipe_end->message_queue );
@@ -1192,7 +1438,8 @@ static struct pipe_server *create_pipe_server( struct named_pipe *pipe, unsigned
         release_object( server );
         return NULL;
     }
-    allow_fd_caching( server->pipe_end.fd );
+    /* the fd can only be cached while it has a socket attached */
+    if (!pipe_end_may_be_direct( pipe, options )) allow_fd_caching( server->pipe_end.fd );
     set_fd_signaled( server->pipe_end.fd, 1 );
     async_wake_up( &pipe->waiters, STATUS_SUCCESS );
     return server;
@@ -1216,7 +1463,7 @@ static struct pipe_end *create_pipe_client( struct named_pipe *pipe, data_size_t
         release_object( client );
         return NULL;
     }
-    allow_fd_caching( client->fd );
+    if (!pipe_end_may_be_direct( pipe, options )) allow_fd_caching( client->fd );
     set_fd_signaled( client->fd, 1 );
 
     return client;
@@ -1268,6 +1515,7 @@ static struct object *named_pipe_open_file( struct object *obj, unsigned int acc
         server->pipe_end.client_pid = client->client_pid;
         client->server_pid = server->pipe_end.server_pid;
         list_remove( &server->entry );
+        pipe_end_set_direct( &server->pipe_end, client );
     }
     return &client->obj;
 }
@@ -1359,6 +1607,7 @@ DECL_HANDLER(create_named_pipe)
         pipe->maxinstances = req->maxinstances;
         pipe->timeout = req->timeout;
         pipe->message_mode = (req->flags & NAMED_PIPE_MESSAGE_STREAM_WRITE) != 0;
+        pipe->direct = pipe_wants_direct( req->flags );
         pipe->sharing = req->sharing;
         if (sd) default_set_sd( &pipe->obj, sd, OWNER_SECURITY_INFORMATION |
                                                 GROUP_SECURITY_INFORMATION |
@@ -1382,7 +1631,7 @@ DECL_HANDLER(create_named_pipe)
         clear_error(); /* clear the name collision */
     }
 
-    server = create_pipe_server( pipe, req->options, req->flags );
+    server = create_pipe_server( pipe, req->options, req->flags & ~NAMED_PIPE_DIRECT_DATA );
     if (server)
     {
         reply->handle = alloc_handle( current->process, server, req->access, objattr->attributes );
@@ -1421,7 +1670,14 @@ DECL_HANDLER(set_named_pipe_info)
     }
     else
     {
+        /* non-blocking I/O and byte reads of messages need the server */
+        if (pipe_end->direct && ((req->flags & NAMED_PIPE_NONBLOCKING_MODE) ||
+            (pipe_end->pipe->message_mode && !(req->flags & NAMED_PIPE_MESSAGE_STREAM_READ))))
+            pipe_end_leave_direct( pipe_end );
         pipe_end->flags = req->flags;
+        /* message mode clients usually only switch to message reads once connected */
+        if (!pipe_end->direct && pipe_end->connection)
+            pipe_end_set_direct( pipe_end, pipe_end->connection );
     }
 
     release_object( pipe_end );
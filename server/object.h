@@ -190,10 +190,41 @@ extern struct keyed_event *get_keyed_event_obj( struct process *process, obj_han
 extern void pulse_event( struct event *event );
 extern void set_event( struct event *event );
 extern void reset_event( struct event *event );
+extern struct fsync_object *get_event_fsync( struct object *obj );
+extern void detach_event_fsync( struct object *obj, struct process *process );
+
+/* semaphore functions */
+
+extern struct fsync_object *get_semaphore_fsync( struct object *obj );
+extern void detach_semaphore_fsync( struct object *obj, struct process *process );
 
 /* mutex functions */
 
 extern void abandon_mutexes( struct thread *thread );
+extern struct fsync_object *get_mutex_fsync( struct object *obj );
+extern void detach_mutex_fsync( struct object *obj, struct process *process );
+
+/* shared memory synchronization functions */
+
+extern struct fsync_object *fsync_alloc( struct object *obj, enum fsync_type type, unsigned int state,
+                                         unsigned int max );
+extern struct fsync_object *fsync_alloc_completion( struct object *obj );
+extern void fsync_free( struct fsync_object *fsync );
+extern void fsync_release_area( struct process *process );
+extern struct object *fsync_get_object( struct process *process, unsigned int index );
+extern unsigned int fsync_get_owner_id( struct thread *thread );
+extern int fsync_detach( struct fsync_object *fsync, struct process *process );
+extern int fsync_is_detached( const struct fsync_object *fsync );
+extern unsigned int fsync_get_index( const struct fsync_object *fsync, struct process *process );
+extern void fsync_share_object( struct process *process, struct object *obj );
+extern unsigned int fsync_get_state( const struct fsync_object *fsync );
+extern int fsync_cmpxchg_state( struct fsync_object *fsync, unsigned int state, unsigned int prev );
+extern unsigned int fsync_set_state( struct fsync_object *fsync, unsigned int state );
+extern void fsync_wake( struct fsync_object *fsync );
+extern void fsync_pulse( struct fsync_object *fsync, int all );
+extern int fsync_add_queue( struct fsync_object *fsync, struct object *obj, struct wait_queue_entry *entry );
+extern void fsync_remove_queue( struct fsync_object *fsync, struct object *obj,
+                                struct wait_queue_entry *entry );
 
 /* serial functions */
 
@@ -223,6 +254,7 @@ extern void start_watchdog(void);
 extern void stop_watchdog(void);
 extern int watchdog_triggered(void);
 extern void init_signals(void);
+extern void wake_up_main_loop(void);
 
 /* atom functions */
 
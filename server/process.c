@@ -504,6 +504,7 @@ struct process *create_process( int fd, struct process *parent, int inherit_all,
     process->debugger        = NULL;
     process->debug_event     = NULL;
     process->handles         = NULL;
+    process->fsync_area      = NULL;
     process->msg_fd          = NULL;
     process->sigkill_timeout = NULL;
     process->unix_pid        = -1;
@@ -529,6 +530,7 @@ struct process *create_process( int fd, struct process *parent, int inherit_all,
     process->trace_data      = 0;
     process->rawinput_mouse  = NULL;
     process->rawinput_kbd    = NULL;
+    process->profile         = NULL;
     list_init( &process->kernel_object );
     list_init( &process->thread_list );
     list_init( &process->locks );
@@ -612,6 +614,7 @@ static void process_destroy( struct object *obj )
     assert( !process->sigkill_timeout );  /* timeout should hold a reference to the process */
 
     close_process_handles( process );
+    fsync_release_area( process );
     set_process_startup_state( process, STARTUP_ABORTED );
 
     if (process->job)
@@ -627,6 +630,7 @@ static void process_destroy( struct object *obj )
     if (process->id) free_ptid( process->id );
     if (process->token) release_object( process->token );
     free( process->dir_cache );
+    free_process_profile( process );
 }
 
 /* dump a process on stdout for debugging purposes */
@@ -888,6 +892,7 @@ static void process_killed( struct process *process )
     process->winstation = 0;
     process->desktop = 0;
     close_process_handles( process );
+    fsync_release_area( process );
     cancel_process_asyncs( process );
     if (process->idle_event) release_object( process->idle_event );
     if (process->exe_file) release_object( process->exe_file );
@@ -59,6 +59,7 @@ struct process
     struct thread       *debugger;        /* thread debugging this process */
     struct debug_event  *debug_event;     /* debug event being sent to debugger */
     struct handle_table *handles;         /* handle entries */
+    struct fsync_area   *fsync_area;      /* shared memory of the synchronization objects it creates */
     struct fd           *msg_fd;          /* fd for sendmsg/recvmsg */
     process_id_t         id;              /* id of the process */
     process_id_t         group_id;        /* group id of the process */
@@ -98,6 +99,7 @@ struct process
     const struct rawinput_device *rawinput_mouse; /* rawinput mouse device, if any */
     const struct rawinput_device *rawinput_kbd;   /* rawinput keyboard device, if any */
     struct list          kernel_object;   /* list of kernel object pointers */
+    struct request_profile **profile;     /* per-request statistics, if profiling */
 };
 
 struct process_snapshot
@@ -0,0 +1,248 @@
+/*
+ * Server request profiling
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * When WINESERVERPROFILE is set in the environment of the server, the
+ * handling time of every request is measured and accumulated per request
+ * type, both globally and for each client process. Times are kept in a
+ * logarithmic histogram with two buckets per power of two, from which the
+ * median and 99th percentile are estimated. The statistics can be retrieved
+ * with the get_request_profile request, or dumped to stderr by sending
+ * SIGUSR1 to the server.
+ */
+
+#include "config.h"
+#include "wine/port.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "ntstatus.h"
+#define WIN32_NO_STATUS
+#include "windef.h"
+#include "winternl.h"
+
+#include "handle.h"
+#include "process.h"
+#include "thread.h"
+#include "request.h"
+
+#define PROFILE_BUCKETS 64  /* two buckets per power of two, up to about 4 seconds */
+
+struct request_profile
+{
+    unsigned int count;                       /* number of calls */
+    timeout_t    total;                       /* total handling time in ns */
+    unsigned int histogram[PROFILE_BUCKETS];  /* number of calls per time bucket */
+};
+
+int profile_requests;  /* is request profiling enabled? */
+static struct request_profile *global_profile[REQ_NB_REQUESTS];
+
+/* return a monotonic time in ns for measuring request handling time */
+timeout_t get_profile_time(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+
+    if (!clock_gettime( CLOCK_MONOTONIC, &ts ))
+        return (timeout_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    {
+        struct timeval now;
+        gettimeofday( &now, NULL );
+        return (timeout_t)now.tv_sec * 1000000000 + now.tv_usec * 1000;
+    }
+}
+
+static unsigned int get_bucket( timeout_t time )
+{
+    unsigned int bits = 0;
+
+    if (time < 4) return time < 0 ? 0 : time;
+    while ((time >> bits) >= 4) bits++;
+    return min( 2 * (bits + 1) + (unsigned int)((time >> bits) & 1), PROFILE_BUCKETS - 1 );
+}
+
+/* return the upper bound of a time bucket */
+static timeout_t get_bucket_limit( unsigned int bucket )
+{
+    unsigned int bits = bucket / 2 - 1;
+
+    if (bucket < 4) return bucket;
+    return ((timeout_t)((bucket & 1) + 3) << bits) - 1;
+}
+
+/* estimate a percentile of the handling time from the histogram */
+static timeout_t get_percentile( const struct request_profile *profile, unsigned int percent )
+{
+    unsigned int i, rank = (profile->count * (unsigned long long)percent + 99) / 100, sum = 0;
+
+    for (i = 0; i < PROFILE_BUCKETS; i++)
+        if ((sum += profile->histogram[i]) >= rank) break;
+    return get_bucket_limit( min( i, PROFILE_BUCKETS - 1 ));
+}
+
+/* enable profiling if requested; must be called before entering the main loop */
+void init_request_profile(void)
+{
+    const char *env = getenv( "WINESERVERPROFILE" );
+
+    if (env && atoi( env ))
+    {
+        profile_requests = 1;
+        if (debug_level) fprintf( stderr, "wineserver: profiling requests\n" );
+    }
+}
+
+static void add_sample( struct request_profile **profiles, enum request req, timeout_t time )
+{
+    struct request_profile *profile = profiles[req];
+
+    if (!profile && !(profile = profiles[req] = calloc( 1, sizeof(*profile) ))) return;
+    profile->count++;
+    profile->total += time;
+    profile->histogram[get_bucket( time )]++;
+}
+
+/* record the handling time of a request */
+void profile_request( struct process *process, enum request req, timeout_t time )
+{
+    if (req >= REQ_NB_REQUESTS) return;
+    add_sample( global_profile, req, time );
+    if (!process->profile && !(process->profile = calloc( REQ_NB_REQUESTS, sizeof(*process->profile) )))
+        return;
+    add_sample( process->profile, req, time );
+}
+
+/* free the statistics of a process */
+void free_process_profile( struct process *process )
+{
+    unsigned int i;
+
+    if (!process->profile) return;
+    for (i = 0; i < REQ_NB_REQUESTS; i++) free( process->profile[i] );
+    free( process->profile );
+    process->profile = NULL;
+}
+
+static int compare_profile_info( const void *p1, const void *p2 )
+{
+    const struct request_profile_info *info1 = p1;
+    const struct request_profile_info *info2 = p2;
+
+    if (info1->total > info2->total) return -1;
+    if (info1->total < info2->total) return 1;
+    return info1->request - info2->request;
+}
+
+/* fill the statistics of the profiled requests, sorted by total handling time; return their count */
+static unsigned int get_profile_info( struct request_profile **profiles, struct request_profile_info *info )
+{
+    unsigned int i, count = 0;
+
+    if (!profiles) return 0;
+    for (i = 0; i < REQ_NB_REQUESTS; i++)
+    {
+        if (!profiles[i]) continue;
+        info[count].request = i;
+        info[count].count   = profiles[i]->count;
+        info[count].total   = profiles[i]->total;
+        info[count].p50     = get_percentile( profiles[i], 50 );
+        info[count].p99     = get_percentile( profiles[i], 99 );
+        count++;
+    }
+    qsort( info, count, sizeof(*info), compare_profile_info );
+    return count;
+}
+
+static int dump_process_profile( struct process *process, void *arg )
+{
+    struct request_profile_info *info = arg;
+    unsigned int i, nb_info, count = 0;
+    timeout_t total = 0;
+
+    if (!(nb_info = get_profile_info( process->profile, info ))) return 0;
+
+    for (i = 0; i < nb_info; i++)
+    {
+        count += info[i].count;
+        total += info[i].total;
+    }
+    fprintf( stderr, "  process %04x (unix pid %d): %u requests, %lu us\n",
+             process->id, process->unix_pid, count, (unsigned long)(total / 1000) );
+    /* only show the requests with the highest total time */
+    for (i = 0; i < min( nb_info, 5 ); i++)
+        fprintf( stderr, "    %-32s %10u %12lu us\n", get_req_name( info[i].request ),
+                 info[i].count, (unsigned long)(info[i].total / 1000) );
+    return 0;
+}
+
+/* dump the request statistics to stderr, sorted by total handling time */
+void dump_request_profile(void)
+{
+    static struct request_profile_info info[REQ_NB_REQUESTS];
+    unsigned int i, count;
+
+    if (!profile_requests)
+    {
+        fprintf( stderr, "wineserver: request profiling is not enabled\n" );
+        return;
+    }
+
+    count = get_profile_info( global_profile, info );
+
+    fprintf( stderr, "wineserver: request profile\n" );
+    fprintf( stderr, "  %-32s %10s %12s %10s %10s\n", "request", "count", "total (us)", "p50 (ns)", "p99 (ns)" );
+    for (i = 0; i < count; i++)
+        fprintf( stderr, "  %-32s %10u %12lu %10lu %10lu\n", get_req_name( info[i].request ), info[i].count,
+                 (unsigned long)(info[i].total / 1000),
+                 (unsigned long)info[i].p50, (unsigned long)info[i].p99 );
+    enum_processes( dump_process_profile, info );
+}
+
+/* retrieve the request profiling statistics, sorted by total handling time */
+DECL_HANDLER(get_request_profile)
+{
+    static struct request_profile_info info[REQ_NB_REQUESTS];
+    struct request_profile **profiles = global_profile;
+    struct process *process = NULL;
+    unsigned int count;
+
+    if (!profile_requests)
+    {
+        set_error( STATUS_NOT_IMPLEMENTED );
+        return;
+    }
+    if (req->handle)
+    {
+        if (!(process = get_process_from_handle( req->handle, PROCESS_QUERY_INFORMATION ))) return;
+        profiles = process->profile;
+    }
+
+    reply->count = count = get_profile_info( profiles, info );
+    if (get_reply_max_size() < count * sizeof(*info))
+        set_error( STATUS_BUFFER_TOO_SMALL );
+    else
+        set_reply_data( info, count * sizeof(*info) );
+    if (process) release_object( process );
+}
@@ -34,6 +34,9 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -59,6 +62,13 @@ struct notify
     struct process   *process;  /* process in which the hkey is valid */
 };
 
+/* hash index of the subkeys or values of a large key */
+struct key_index
+{
+    unsigned int      size;        /* number of buckets, a power of 2 */
+    int               buckets[1];  /* index + 1 of each entry in the array allocation, 0 if free */
+};
+
 /* a registry key */
 struct key
 {
@@ -74,6 +84,11 @@ struct key
     int               last_value;  /* last in use value */
     int               nb_values;   /* count of allocated values in array */
     struct key_value *values;      /* values array */
+    struct key_index *subkey_index; /* index of the subkeys array, or NULL */
+    struct key_index *value_index; /* index of the values array, or NULL */
+    int               subkey_offset; /* offset of the subkeys array in its allocation */
+    int               value_offset; /* offset of the values array in its allocation */
+    unsigned int      cache_slot;  /* index of the generation counter in the registry cache */
     unsigned int      flags;       /* flags */
     timeout_t         modif;       /* last modification time */
     struct list       notify_list; /* list of notifications */
@@ -86,6 +101,9 @@ struct key
 #define KEY_SYMLINK  0x0008  /* key is a symbolic link */
 #define KEY_WOW64    0x0010  /* key contains a Wow6432Node subkey */
 #define KEY_WOWSHARE 0x0020  /* key is a Wow64 shared key (used for Software\Classes) */
+#define KEY_UNSORTED_SUBKEYS 0x0040  /* indexed subkeys array needs sorting */
+#define KEY_UNSORTED_VALUES  0x0080  /* indexed values array needs sorting */
+#define KEY_CHANGED  0x0100  /* key values have been modified since the last save */
 
 /* a key value */
 struct key_value
@@ -99,6 +117,7 @@ struct key_value
 
 #define MIN_SUBKEYS  8   /* min. number of allocated subkeys per key */
 #define MIN_VALUES   8   /* min. number of allocated values per key */
+#define MIN_INDEXED  64  /* min. number of subkeys or values to use a hash index */
 
 #define MAX_NAME_LEN  256    /* max. length of a key name */
 #define MAX_VALUE_LEN 16383  /* max. length of a value name */
@@ -106,6 +125,12 @@ struct key_value
 /* the root of the registry tree */
 static struct key *root_key;
 
+/* generation counters of the key values, shared with the clients so that they
+ * can validate their cached values; keys are spread over the counters */
+static unsigned int *cache_generations;
+static int cache_generations_fd = -1;
+static unsigned int next_cache_slot;
+
 static const timeout_t ticks_1601_to_1970 = (timeout_t)86400 * (369 * 365 + 89) * TICKS_PER_SEC;
 static const timeout_t save_period = 30 * -TICKS_PER_SEC;  /* delay between periodic saves */
 static struct timeout_user *save_timeout_user;  /* saving timer */
@@ -118,18 +143,88 @@ static const struct unicode_str symlink_str = { symlink_value, sizeof(symlink_va
 
 static void set_periodic_save_timer(void);
 static struct key_value *find_value( const struct key *key, const struct unicode_str *name, int *index );
+static void sort_subkeys( struct key *key );
+static void sort_values( struct key *key );
 
 /* information about where to save a registry branch */
 struct save_branch_info
 {
     struct key  *key;
     const char  *path;
+    struct list  deleted;       /* keys deleted since the last save, for the journal */
+    file_pos_t   journal_size;  /* current size of the journal file */
 };
 
 #define MAX_SAVE_BRANCH_INFO 3
 static int save_branch_count;
 static struct save_branch_info save_branch_info[MAX_SAVE_BRANCH_INFO];
 
+/* Registry journals.
+ *
+ * When WINEREGJOURNAL is set, the periodic saves append the modified keys
+ * and the deleted key paths to a journal file next to the branch file,
+ * instead of rewriting the whole branch. The journal uses the text format,
+ * with two extra key options: #clear to remove all values before loading
+ * the following ones, and #delete to delete the key and its subkeys. The
+ * branch file is only rewritten when the journal grows larger than it, and
+ * when the server exits; the journal is then removed. */
+
+struct deleted_key
+{
+    struct list  entry;
+    data_size_t  len;      /* length of the path relative to the branch */
+    WCHAR        path[1];
+};
+
+static int journal_enabled;  /* whether to use journals for the periodic saves */
+static const char journal_suffix[] = ".journal";
+
+/* Binary snapshots of the registry branches.
+ *
+ * When WINEREGSNAPSHOT is set, a binary copy of each branch is written next
+ * to the text file every time the branch is saved. It is loaded instead of
+ * the text file at startup, as long as the text file has not been modified
+ * since. Only the branches of the prefix get snapshots, the files used by
+ * RegSaveKey and RegLoadKey never do. All the structures are aligned to 8
+ * bytes, in host byte order. */
+
+#define SNAPSHOT_MAGIC    0x47455257  /* "WREG" */
+#define SNAPSHOT_VERSION  1
+
+struct snapshot_header
+{
+    unsigned int   magic;       /* SNAPSHOT_MAGIC */
+    unsigned int   version;     /* SNAPSHOT_VERSION */
+    unsigned int   prefix;      /* prefix type */
+    unsigned int   pad;
+    file_pos_t     text_size;   /* size of the matching text file */
+    file_pos_t     text_inode;  /* inode of the matching text file */
+    timeout_t      text_mtime;  /* modification time of the matching text file */
+};
+
+struct snapshot_key
+{
+    timeout_t      modif;       /* last modification time */
+    unsigned int   flags;       /* key flags, only KEY_SYMLINK is stored */
+    unsigned int   nb_values;   /* number of values that follow */
+    unsigned int   nb_subkeys;  /* number of subkeys that follow the values */
+    unsigned short namelen;     /* length of the name that follows */
+    unsigned short classlen;    /* length of the class that follows the name */
+};
+
+struct snapshot_value
+{
+    unsigned int   type;        /* value type */
+    data_size_t    len;         /* length of the data that follows the name */
+    unsigned short namelen;     /* length of the name that follows */
+    unsigned short pad[3];
+};
+
+#define SNAPSHOT_ALIGN(len)  (((len) + 7) & ~7)
+
+static const char snapshot_suffix[] = ".bin";
+static int use_snapshots;  /* whether to read and write the snapshots */
+
 
 /* information about a file being loaded */
 struct file_load_info
@@ -141,6 +236,7 @@ struct file_load_info
     int         line;     /* current input line */
     WCHAR      *tmp;      /* temp buffer to use while parsing input */
     size_t      tmplen;   /* length of temp buffer */
+    int         journal;  /* whether this is a journal file */
 };
 
 
@@ -255,11 +351,13 @@ static void dump_value( const struct key_value *value, FILE *f )
 }
 
 /* save a registry and all its subkeys to a text file */
-static void save_subkeys( const struct key *key, const struct key *base, FILE *f )
+static void save_subkeys( struct key *key, const struct key *base, FILE *f )
 {
     int i;
 
     if (key->flags & KEY_VOLATILE) return;
+    sort_subkeys( key );
+    sort_values( key );
     /* save key if it has either some values or no subkeys, or needs special options */
     /* keys with no values but subkeys are saved implicitly by saving the subkeys */
     if ((key->last_value >= 0) || (key->last_subkey == -1) || key->class || (key->flags & KEY_SYMLINK))
@@ -416,13 +514,15 @@ static void key_destroy( struct object *obj )
         free( key->values[i].name );
         free( key->values[i].data );
     }
-    free( key->values );
+    free( key->values - key->value_offset );
     for (i = 0; i <= key->last_subkey; i++)
     {
         key->subkeys[i]->parent = NULL;
         release_object( key->subkeys[i] );
     }
-    free( key->subkeys );
+    free( key->subkeys - key->subkey_offset );
+    free( key->subkey_index );
+    free( key->value_index );
     /* unconditionally notify everything waiting on this key */
     while ((ptr = list_head( &key->notify_list )))
     {
@@ -488,8 +588,13 @@ static struct key *alloc_key( const struct unicode_str *name, timeout_t modif )
         key->nb_values   = 0;
         key->last_value  = -1;
         key->values      = NULL;
+        key->subkey_index = NULL;
+        key->value_index = NULL;
+        key->subkey_offset = 0;
+        key->value_offset = 0;
         key->modif       = modif;
         key->parent      = NULL;
+        key->cache_slot  = next_cache_slot++ % REGISTRY_CACHE_SLOTS;
         list_init( &key->notify_list );
         if (name->len && !(key->name = memdup( name->str, name->len )))
         {
@@ -518,7 +623,7 @@ static void make_clean( struct key *key )
 
     if (key->flags & KEY_VOLATILE) return;
     if (!(key->flags & KEY_DIRTY)) return;
-    key->flags &= ~KEY_DIRTY;
+    key->flags &= ~(KEY_DIRTY | KEY_CHANGED);
     for (i = 0; i <= key->last_subkey; i++) make_clean( key->subkeys[i] );
 }
 
@@ -535,6 +640,12 @@ static void check_notify( struct key *key, unsigned int change, int not_subtree
     }
 }
 
+/* invalidate the values of a key cached by the clients */
+static void invalidate_key_cache( struct key *key )
+{
+    if (cache_generations) cache_generations[key->cache_slot]++;
+}
+
 /* update key modification time */
 static void touch_key( struct key *key, unsigned int change )
 {
@@ -542,6 +653,11 @@ static void touch_key( struct key *key, unsigned int change )
 
     key->modif = current_time;
     make_dirty( key );
+    if (change & REG_NOTIFY_CHANGE_LAST_SET)
+    {
+        key->flags |= KEY_CHANGED;
+        invalidate_key_cache( key );
+    }
 
     /* do notifications */
     check_notify( key, change, 1 );
@@ -549,6 +665,245 @@ static void touch_key( struct key *key, unsigned int change )
         check_notify( k, change, 0 );
 }
 
+/* get the name of a subkey or value by array index */
+static inline void get_index_name( const struct key *key, int values, int i, struct unicode_str *name )
+{
+    if (values)
+    {
+        name->str = key->values[i].name;
+        name->len = key->values[i].namelen;
+    }
+    else
+    {
+        name->str = key->subkeys[i]->name;
+        name->len = key->subkeys[i]->namelen;
+    }
+}
+
+/* return the offset of the subkeys or values array in its allocation */
+static inline int get_array_offset( const struct key *key, int values )
+{
+    return values ? key->value_offset : key->subkey_offset;
+}
+
+/* return the bucket where a name starts probing */
+static inline unsigned int get_index_bucket( const struct key_index *index, const struct unicode_str *name )
+{
+    return hash_strW( name->str, name->len, index->size );
+}
+
+/* add the entry at a given array index to a hash index */
+static void add_index_entry( const struct key *key, int values, struct key_index *index, int i )
+{
+    struct unicode_str name;
+    unsigned int pos;
+
+    get_index_name( key, values, i, &name );
+    pos = get_index_bucket( index, &name );
+    while (index->buckets[pos]) pos = (pos + 1) & (index->size - 1);
+    index->buckets[pos] = get_array_offset( key, values ) + i + 1;
+}
+
+/* find the bucket holding the entry at a given array index */
+static unsigned int find_index_bucket( const struct key *key, int values, const struct key_index *index, int i )
+{
+    struct unicode_str name;
+    unsigned int pos;
+    int entry = get_array_offset( key, values ) + i + 1;
+
+    get_index_name( key, values, i, &name );
+    pos = get_index_bucket( index, &name );
+    while (index->buckets[pos] != entry)
+    {
+        assert( index->buckets[pos] );
+        pos = (pos + 1) & (index->size - 1);
+    }
+    return pos;
+}
+
+/* look up a name in a hash index and return its array index, or -1 if not found */
+static int lookup_index( const struct key *key, int values, const struct key_index *index,
+                         const struct unicode_str *name )
+{
+    struct unicode_str entry;
+    unsigned int pos = get_index_bucket( index, name );
+    int i, offset = get_array_offset( key, values );
+
+    while ((i = index->buckets[pos]))
+    {
+        get_index_name( key, values, i - offset - 1, &entry );
+        if (entry.len == name->len && !memicmp_strW( entry.str, name->str, name->len ))
+            return i - offset - 1;
+        pos = (pos + 1) & (index->size - 1);
+    }
+    return -1;
+}
+
+/* remove the entry at a given array index from a hash index */
+static void remove_index_entry( const struct key *key, int values, struct key_index *index, int i )
+{
+    unsigned int mask = index->size - 1, pos, next, home;
+    int offset = get_array_offset( key, values );
+    struct unicode_str name;
+
+    pos = find_index_bucket( key, values, index, i );
+    index->buckets[pos] = 0;
+
+    /* move back the following entries of the cluster that can no longer be reached */
+    for (next = (pos + 1) & mask; index->buckets[next]; next = (next + 1) & mask)
+    {
+        get_index_name( key, values, index->buckets[next] - offset - 1, &name );
+        home = get_index_bucket( index, &name );
+        if (((next - home) & mask) < ((next - pos) & mask)) continue;
+        index->buckets[pos] = index->buckets[next];
+        index->buckets[next] = 0;
+        pos = next;
+    }
+}
+
+/* build a hash index for the current entries, with room for count entries */
+static struct key_index *build_index( const struct key *key, int values, int count )
+{
+    struct key_index *index;
+    unsigned int size = MIN_INDEXED * 2;
+    int i, last = values ? key->last_value : key->last_subkey;
+
+    while (size < 2 * count) size *= 2;  /* keep the load factor below 1/2 */
+    if (!(index = calloc( 1, offsetof( struct key_index, buckets[size] ))))
+    {
+        set_error( STATUS_NO_MEMORY );
+        return NULL;
+    }
+    index->size = size;
+    for (i = 0; i <= last; i++) add_index_entry( key, values, index, i );
+    return index;
+}
+
+/* make sure there is room in the hash index for one more entry, creating it if needed */
+static int grow_index( struct key *key, int values )
+{
+    struct key_index *index, **ptr = values ? &key->value_index : &key->subkey_index;
+    int count = (values ? key->last_value : key->last_subkey) + 2;
+
+    if (!*ptr && count < MIN_INDEXED) return 1;
+    if (*ptr && 2 * count <= (*ptr)->size) return 1;
+    if (!(index = build_index( key, values, count ))) return 0;
+    free( *ptr );
+    *ptr = index;
+    return 1;
+}
+
+/* move the subkeys or values array back to the start of its allocation */
+static void compact_array( struct key *key, int values )
+{
+    struct key_index *index = values ? key->value_index : key->subkey_index;
+    int *offset = values ? &key->value_offset : &key->subkey_offset;
+    unsigned int pos;
+
+    if (!*offset) return;
+    if (values)
+    {
+        memmove( key->values - *offset, key->values, (key->last_value + 1) * sizeof(*key->values) );
+        key->values -= *offset;
+    }
+    else
+    {
+        memmove( key->subkeys - *offset, key->subkeys, (key->last_subkey + 1) * sizeof(*key->subkeys) );
+        key->subkeys -= *offset;
+    }
+    if (index)
+        for (pos = 0; pos < index->size; pos++) if (index->buckets[pos]) index->buckets[pos] -= *offset;
+    *offset = 0;
+}
+
+/* remove an entry from the subkeys or values array; the caller updates the last index */
+static void remove_array_entry( struct key *key, int values, int i )
+{
+    struct key_index *index = values ? key->value_index : key->subkey_index;
+    unsigned int flag = values ? KEY_UNSORTED_VALUES : KEY_UNSORTED_SUBKEYS;
+    int last = values ? key->last_value : key->last_subkey;
+
+    if (index) remove_index_entry( key, values, index, i );
+    if (i == last) return;
+
+    if (index && (key->flags & flag))
+    {
+        /* order doesn't matter, move the last entry into the free slot */
+        index->buckets[find_index_bucket( key, values, index, last )] = get_array_offset( key, values ) + i + 1;
+        if (values) key->values[i] = key->values[last];
+        else key->subkeys[i] = key->subkeys[last];
+    }
+    else if (!i)
+    {
+        /* move the start of the array instead of its tail, this keeps enumerate-and-delete
+         * loops linear; the index refers to the allocation, so it doesn't change */
+        if (values)
+        {
+            key->values++;
+            key->value_offset++;
+        }
+        else
+        {
+            key->subkeys++;
+            key->subkey_offset++;
+        }
+    }
+    else
+    {
+        if (values) memmove( key->values + i, key->values + i + 1, (last - i) * sizeof(*key->values) );
+        else memmove( key->subkeys + i, key->subkeys + i + 1, (last - i) * sizeof(*key->subkeys) );
+        /* a sorted array can be searched without the index, it is rebuilt on the next insertion */
+        free( index );
+        if (values) key->value_index = NULL;
+        else key->subkey_index = NULL;
+    }
+}
+
+/* compare two names in the sort order of the subkeys and values arrays */
+static int compare_names( const WCHAR *name1, data_size_t len1, const WCHAR *name2, data_size_t len2 )
+{
+    int res = memicmp_strW( name1, name2, min( len1, len2 ));
+    if (!res) res = len1 - len2;
+    return res;
+}
+
+static int compare_subkeys( const void *p1, const void *p2 )
+{
+    const struct key *key1 = *(const struct key * const *)p1;
+    const struct key *key2 = *(const struct key * const *)p2;
+    return compare_names( key1->name, key1->namelen, key2->name, key2->namelen );
+}
+
+static int compare_values( const void *p1, const void *p2 )
+{
+    const struct key_value *value1 = p1;
+    const struct key_value *value2 = p2;
+    return compare_names( value1->name, value1->namelen, value2->name, value2->namelen );
+}
+
+/* sort the subkeys array of an indexed key, for operations that depend on the order */
+static void sort_subkeys( struct key *key )
+{
+    if (!(key->flags & KEY_UNSORTED_SUBKEYS)) return;
+    qsort( key->subkeys, key->last_subkey + 1, sizeof(*key->subkeys), compare_subkeys );
+    key->flags &= ~KEY_UNSORTED_SUBKEYS;
+    /* the array is sorted now, so we can do without the index if it can't be rebuilt */
+    free( key->subkey_index );
+    key->subkey_index = build_index( key, 0, key->last_subkey + 1 );
+    clear_error();
+}
+
+/* sort the values array of an indexed key, for operations that depend on the order */
+static void sort_values( struct key *key )
+{
+    if (!(key->flags & KEY_UNSORTED_VALUES)) return;
+    qsort( key->values, key->last_value + 1, sizeof(*key->values), compare_values );
+    key->flags &= ~KEY_UNSORTED_VALUES;
+    free( key->value_index );
+    key->value_index = build_index( key, 1, key->last_value + 1 );
+    clear_error();
+}
+
 /* try to grow the array of subkeys; return 1 if OK, 0 on error */
 static int grow_subkeys( struct key *key )
 {
@@ -558,7 +913,7 @@ static int grow_subkeys( struct key *key )
     if (key->nb_subkeys)
     {
         nb_subkeys = key->nb_subkeys + (key->nb_subkeys / 2);  /* grow by 50% */
-        if (!(new_subkeys = realloc( key->subkeys, nb_subkeys * sizeof(*new_subkeys) )))
+        if (!(new_subkeys = realloc( key->subkeys - key->subkey_offset, nb_subkeys * sizeof(*new_subkeys) )))
         {
             set_error( STATUS_NO_MEMORY );
             return 0;
@@ -569,7 +924,7 @@ static int grow_subkeys( struct key *key )
         nb_subkeys = MIN_SUBKEYS;
         if (!(new_subkeys = mem_alloc( nb_subkeys * sizeof(*new_subkeys) ))) return 0;
     }
-    key->subkeys    = new_subkeys;
+    key->subkeys    = new_subkeys + key->subkey_offset;
     key->nb_subkeys = nb_subkeys;
     return 1;
 }
@@ -586,17 +941,30 @@ static struct key *alloc_subkey( struct key *parent, const struct unicode_str *n
         set_error( STATUS_INVALID_PARAMETER );
         return NULL;
     }
-    if (parent->last_subkey + 1 == parent->nb_subkeys)
+    if (parent->subkey_offset + parent->last_subkey + 1 == parent->nb_subkeys)
     {
         /* need to grow the array */
         if (!grow_subkeys( parent )) return NULL;
     }
+    if (!grow_index( parent, 0 )) return NULL;
     if ((key = alloc_key( name, modif )) != NULL)
     {
         key->parent = parent;
-        for (i = ++parent->last_subkey; i > index; i--)
-            parent->subkeys[i] = parent->subkeys[i-1];
-        parent->subkeys[index] = key;
+        if (parent->subkey_index)
+        {
+            /* indexed keys append new entries, and get sorted when needed */
+            index = ++parent->last_subkey;
+            parent->subkeys[index] = key;
+            add_index_entry( parent, 0, parent->subkey_index, index );
+            if (index && compare_subkeys( &parent->subkeys[index - 1], &parent->subkeys[index] ) > 0)
+                parent->flags |= KEY_UNSORTED_SUBKEYS;
+        }
+        else
+        {
+            for (i = ++parent->last_subkey; i > index; i--)
+                parent->subkeys[i] = parent->subkeys[i-1];
+            parent->subkeys[index] = key;
+        }
         if (is_wow6432node( key->name, key->namelen ) && !is_wow6432node( parent->name, parent->namelen ))
             parent->flags |= KEY_WOW64;
     }
@@ -607,15 +975,16 @@ static struct key *alloc_subkey( struct key *parent, const struct unicode_str *n
 static void free_subkey( struct key *parent, int index )
 {
     struct key *key;
-    int i, nb_subkeys;
+    int nb_subkeys;
 
     assert( index >= 0 );
     assert( index <= parent->last_subkey );
 
     key = parent->subkeys[index];
-    for (i = index; i < parent->last_subkey; i++) parent->subkeys[i] = parent->subkeys[i + 1];
+    remove_array_entry( parent, 0, index );
     parent->last_subkey--;
     key->flags |= KEY_DELETED;
+    invalidate_key_cache( key );
     key->parent = NULL;
     if (is_wow6432node( key->name, key->namelen )) parent->flags &= ~KEY_WOW64;
     release_object( key );
@@ -627,6 +996,7 @@ static void free_subkey( struct key *parent, int index )
         struct key **new_subkeys;
         nb_subkeys -= nb_subkeys / 3;  /* shrink by 33% */
         if (nb_subkeys < MIN_SUBKEYS) nb_subkeys = MIN_SUBKEYS;
+        compact_array( parent, 0 );
         if (!(new_subkeys = realloc( parent->subkeys, nb_subkeys * sizeof(*new_subkeys) ))) return;
         parent->subkeys = new_subkeys;
         parent->nb_subkeys = nb_subkeys;
@@ -639,6 +1009,17 @@ static struct key *find_subkey( const struct key *key, const struct unicode_str
     int i, min, max, res;
     data_size_t len;
 
+    if (key->subkey_index)
+    {
+        if ((i = lookup_index( key, 0, key->subkey_index, name )) == -1)
+        {
+            *index = key->last_subkey + 1;
+            return NULL;
+        }
+        *index = i;
+        return key->subkeys[i];
+    }
+
     min = 0;
     max = key->last_subkey;
     while (min <= max)
@@ -814,7 +1195,7 @@ static struct key *create_key( struct key *key, const struct unicode_str *name,
 
     if (options & REG_OPTION_CREATE_LINK) key->flags |= KEY_SYMLINK;
     if (options & REG_OPTION_VOLATILE) key->flags |= KEY_VOLATILE;
-    else key->flags |= KEY_DIRTY;
+    else key->flags |= KEY_DIRTY | KEY_CHANGED;
 
     if (sd) default_set_sd( &key->obj, sd, OWNER_SECURITY_INFORMATION | GROUP_SECURITY_INFORMATION |
                             DACL_SECURITY_INFORMATION | SACL_SECURITY_INFORMATION );
@@ -875,7 +1256,7 @@ static struct key *create_key_recursive( struct key *key, const struct unicode_s
 }
 
 /* query information about a key or a subkey */
-static void enum_key( const struct key *key, int index, int info_class,
+static void enum_key( struct key *key, int index, int info_class,
                       struct enum_key_reply *reply )
 {
     static const WCHAR backslash[] = { '\\' };
@@ -893,6 +1274,7 @@ static void enum_key( const struct key *key, int index, int info_class,
             set_error( STATUS_NO_MORE_ENTRIES );
             return;
         }
+        sort_subkeys( key );
         key = key->subkeys[index];
     }
 
@@ -980,9 +1362,40 @@ static void enum_key( const struct key *key, int index, int info_class,
     if (debug_level > 1) dump_operation( key, NULL, "Enum" );
 }
 
+/* remember the path of a deleted key, so that the deletion can be written to the journal */
+static void record_deleted_key( const struct key *key )
+{
+    struct save_branch_info *info = NULL;
+    struct deleted_key *deleted;
+    const struct key *k;
+    data_size_t len = 0;
+    WCHAR *p;
+    int i;
+
+    if (key->flags & KEY_VOLATILE) return;
+    for (k = key->parent; k && !info; k = k->parent)
+        for (i = 0; i < save_branch_count; i++)
+            if (save_branch_info[i].key == k) info = &save_branch_info[i];
+    if (!info) return;
+
+    for (k = key; k != info->key; k = k->parent) len += k->namelen + sizeof(WCHAR);
+    len -= sizeof(WCHAR);
+    if (!(deleted = mem_alloc( offsetof( struct deleted_key, path[len / sizeof(WCHAR)] )))) return;
+    deleted->len = len;
+    p = deleted->path + len / sizeof(WCHAR);
+    for (k = key; k != info->key; k = k->parent)
+    {
+        p -= k->namelen / sizeof(WCHAR);
+        memcpy( p, k->name, k->namelen );
+        if (k->parent != info->key) *--p = '\\';
+    }
+    list_add_tail( &info->deleted, &deleted->entry );
+}
+
 /* delete a key and its values */
 static int delete_key( struct key *key, int recurse )
 {
+    struct unicode_str name;
     int index;
     struct key *parent = key->parent;
 
@@ -998,9 +1411,10 @@ static int delete_key( struct key *key, int recurse )
         if (0 > delete_key(key->subkeys[key->last_subkey], 1))
             return -1;
 
-    for (index = 0; index <= parent->last_subkey; index++)
-        if (parent->subkeys[index] == key) break;
-    assert( index <= parent->last_subkey );
+    name.str = key->name;
+    name.len = key->namelen;
+    find_subkey( parent, &name, &index );
+    assert( index <= parent->last_subkey && parent->subkeys[index] == key );
 
     /* we can only delete a key that has no subkeys */
     if (key->last_subkey >= 0)
@@ -1010,6 +1424,7 @@ static int delete_key( struct key *key, int recurse )
     }
 
     if (debug_level > 1) dump_operation( key, NULL, "Delete" );
+    if (journal_enabled) record_deleted_key( key );
     free_subkey( parent, index );
     touch_key( parent, REG_NOTIFY_CHANGE_NAME );
     return 0;
@@ -1024,7 +1439,7 @@ static int grow_values( struct key *key )
     if (key->nb_values)
     {
         nb_values = key->nb_values + (key->nb_values / 2);  /* grow by 50% */
-        if (!(new_val = realloc( key->values, nb_values * sizeof(*new_val) )))
+        if (!(new_val = realloc( key->values - key->value_offset, nb_values * sizeof(*new_val) )))
         {
             set_error( STATUS_NO_MEMORY );
             return 0;
@@ -1035,7 +1450,7 @@ static int grow_values( struct key *key )
         nb_values = MIN_VALUES;
         if (!(new_val = mem_alloc( nb_values * sizeof(*new_val) ))) return 0;
     }
-    key->values = new_val;
+    key->values = new_val + key->value_offset;
     key->nb_values = nb_values;
     return 1;
 }
@@ -1046,6 +1461,17 @@ static struct key_value *find_value( const struct key *key, const struct unicode
     int i, min, max, res;
     data_size_t len;
 
+    if (key->value_index)
+    {
+        if ((i = lookup_index( key, 1, key->value_index, name )) == -1)
+        {
+            *index = key->last_value + 1;
+            return NULL;
+        }
+        *index = i;
+        return &key->values[i];
+    }
+
     min = 0;
     max = key->last_value;
     while (min <= max)
@@ -1078,17 +1504,24 @@ static struct key_value *insert_value( struct key *key, const struct unicode_str
         set_error( STATUS_NAME_TOO_LONG );
         return NULL;
     }
-    if (key->last_value + 1 == key->nb_values)
+    if (key->value_offset + key->last_value + 1 == key->nb_values)
     {
         if (!grow_values( key )) return NULL;
     }
+    if (!grow_index( key, 1 )) return NULL;
     if (name->len && !(new_name = memdup( name->str, name->len ))) return NULL;
-    for (i = ++key->last_value; i > index; i--) key->values[i] = key->values[i - 1];
+    if (key->value_index) index = ++key->last_value;  /* indexed keys append new entries */
+    else for (i = ++key->last_value; i > index; i--) key->values[i] = key->values[i - 1];
     value = &key->values[index];
     value->name    = new_name;
     value->namelen = name->len;
     value->len     = 0;
     value->data    = NULL;
+    if (key->value_index)
+    {
+        add_index_entry( key, 1, key->value_index, index );
+        if (index && compare_values( value - 1, value ) > 0) key->flags |= KEY_UNSORTED_VALUES;
+    }
     return value;
 }
 
@@ -1171,6 +1604,7 @@ static void enum_value( struct key *key, int i, int info_class, struct enum_key_
         void *data;
         data_size_t namelen, maxlen;
 
+        sort_values( key );
         value = &key->values[i];
         reply->type = value->type;
         namelen = value->namelen;
@@ -1215,7 +1649,8 @@ static void enum_value( struct key *key, int i, int info_class, struct enum_key_
 static void delete_value( struct key *key, const struct unicode_str *name )
 {
     struct key_value *value;
-    int i, index, nb_values;
+    WCHAR *value_name;
+    int index, nb_values;
 
     if (!(value = find_value( key, name, &index )))
     {
@@ -1223,9 +1658,10 @@ static void delete_value( struct key *key, const struct unicode_str *name )
         return;
     }
     if (debug_level > 1) dump_operation( key, value, "Delete" );
-    free( value->name );
+    value_name = value->name;
     free( value->data );
-    for (i = index; i < key->last_value; i++) key->values[i] = key->values[i + 1];
+    remove_array_entry( key, 1, index );
+    free( value_name );
     key->last_value--;
     touch_key( key, REG_NOTIFY_CHANGE_LAST_SET );
 
@@ -1236,12 +1672,29 @@ static void delete_value( struct key *key, const struct unicode_str *name )
         struct key_value *new_val;
         nb_values -= nb_values / 3;  /* shrink by 33% */
         if (nb_values < MIN_VALUES) nb_values = MIN_VALUES;
+        compact_array( key, 1 );
         if (!(new_val = realloc( key->values, nb_values * sizeof(*new_val) ))) return;
         key->values = new_val;
         key->nb_values = nb_values;
     }
 }
 
+/* delete all the values of a key */
+static void clear_values( struct key *key )
+{
+    int i;
+
+    for (i = 0; i <= key->last_value; i++)
+    {
+        free( key->values[i].name );
+        free( key->values[i].data );
+    }
+    key->last_value = -1;
+    key->flags &= ~KEY_UNSORTED_VALUES;
+    free( key->value_index );
+    key->value_index = NULL;
+}
+
 /* get the registry key corresponding to an hkey handle */
 static struct key *get_hkey_obj( obj_handle_t hkey, unsigned int access )
 {
@@ -1449,7 +1902,8 @@ static int load_key_option( struct key *key, const char *buffer, struct file_loa
             else if (*p >= 'a' && *p <= 'f') modif = (modif << 4) | (*p - 'a' + 10);
             else break;
         }
-        update_key_time( key, modif );
+        if (info->journal) key->modif = modif;
+        else update_key_time( key, modif );
     }
     if (!strncmp( buffer, "#class=", 7 ))
     {
@@ -1463,6 +1917,11 @@ static int load_key_option( struct key *key, const char *buffer, struct file_loa
         key->classlen = len;
     }
     if (!strncmp( buffer, "#link", 5 )) key->flags |= KEY_SYMLINK;
+    if (info->journal)
+    {
+        if (!strcmp( buffer, "#clear" )) clear_values( key );
+        if (!strcmp( buffer, "#delete" ) && key->parent) delete_key( key, 1 );
+    }
     /* ignore unknown options */
     return 1;
 }
@@ -1621,7 +2080,8 @@ static int get_prefix_len( struct key *key, const char *name, struct file_load_i
 
 /* load all the keys from the input file */
 /* prefix_len is the number of key name prefixes to skip, or -1 for autodetection */
-static void load_keys( struct key *key, const char *filename, FILE *f, int prefix_len )
+/* journal is set when loading the journal of a branch */
+static void load_keys( struct key *key, const char *filename, FILE *f, int prefix_len, int journal )
 {
     struct key *subkey = NULL;
     struct file_load_info info;
@@ -1633,6 +2093,7 @@ static void load_keys( struct key *key, const char *filename, FILE *f, int prefi
     info.len    = 4;
     info.tmplen = 4;
     info.line   = 0;
+    info.journal = journal;
     if (!(info.buffer = mem_alloc( info.len ))) return;
     if (!(info.tmp = mem_alloc( info.tmplen )))
     {
@@ -1705,35 +2166,257 @@ static void load_registry( struct key *key, obj_handle_t handle )
         FILE *f = fdopen( fd, "r" );
         if (f)
         {
-            load_keys( key, NULL, f, -1 );
+            load_keys( key, NULL, f, -1, 0 );
             fclose( f );
         }
         else file_set_error();
     }
 }
 
-/* load one of the initial registry files */
-static int load_init_registry_from_file( const char *filename, struct key *key )
+/* snapshot parsing state */
+struct snapshot_reader
+{
+    const char *base;    /* start of the mapped snapshot */
+    size_t      size;    /* size of the mapping */
+    size_t      pos;     /* current position */
+    int         load;    /* whether to create the keys, or only validate the data */
+};
+
+/* return the next item of a snapshot, or NULL if the snapshot is truncated */
+static const void *read_snapshot( struct snapshot_reader *reader, size_t len )
+{
+    const void *ret = reader->base + reader->pos;
+
+    if (len > reader->size - reader->pos) return NULL;
+    reader->pos += min( SNAPSHOT_ALIGN(len), reader->size - reader->pos );
+    return ret;
+}
+
+/* load the values of a key from a snapshot */
+static int load_snapshot_values( struct snapshot_reader *reader, struct key *key, unsigned int count )
+{
+    const struct snapshot_value *sv;
+    struct key_value *value;
+    struct unicode_str name;
+    const void *data;
+    void *ptr;
+    int index;
+
+    if (reader->load && key->last_value == -1 && count > key->nb_values)
+    {
+        /* allocate the array at once */
+        compact_array( key, 1 );
+        if (!(ptr = realloc( key->values, count * sizeof(*key->values) ))) return 0;
+        key->values = ptr;
+        key->nb_values = count;
+    }
+
+    while (count--)
+    {
+        if (!(sv = read_snapshot( reader, sizeof(*sv) ))) return 0;
+        if (sv->namelen > MAX_VALUE_LEN * sizeof(WCHAR) || (sv->namelen % sizeof(WCHAR))) return 0;
+        if (!(name.str = read_snapshot( reader, sv->namelen ))) return 0;
+        if (!(data = read_snapshot( reader, sv->len ))) return 0;
+        if (!reader->load) continue;
+
+        name.len = sv->namelen;
+        ptr = NULL;
+        if (sv->len && !(ptr = memdup( data, sv->len ))) return 0;
+        if (!(value = find_value( key, &name, &index )) && !(value = insert_value( key, &name, index )))
+        {
+            free( ptr );
+            return 0;
+        }
+        free( value->data );
+        value->data = ptr;
+        value->len  = sv->len;
+        value->type = sv->type;
+    }
+    return 1;
+}
+
+/* load a key and its subkeys from a snapshot; key is NULL to create it as a subkey of parent */
+static int load_snapshot_key( struct snapshot_reader *reader, struct key *parent, struct key *key )
+{
+    const struct snapshot_key *sk;
+    struct unicode_str name;
+    const WCHAR *class;
+    unsigned int i;
+    int index;
+    void *ptr;
+
+    if (!(sk = read_snapshot( reader, sizeof(*sk) ))) return 0;
+    if (sk->namelen > MAX_NAME_LEN * sizeof(WCHAR) || (sk->namelen % sizeof(WCHAR))) return 0;
+    if (sk->classlen % sizeof(WCHAR)) return 0;
+    if (!(name.str = read_snapshot( reader, sk->namelen ))) return 0;
+    if (!(class = read_snapshot( reader, sk->classlen ))) return 0;
+    name.len = sk->namelen;
+
+    if (reader->load)
+    {
+        if (!key && !(key = find_subkey( parent, &name, &index )) &&
+            !(key = alloc_subkey( parent, &name, index, sk->modif )))
+            return 0;
+        key->modif = sk->modif;
+        key->flags |= sk->flags & KEY_SYMLINK;
+        if (sk->classlen)
+        {
+            free( key->class );
+            if (!(key->class = memdup( class, sk->classlen ))) return 0;
+            key->classlen = sk->classlen;
+        }
+        if (key->last_subkey == -1 && sk->nb_subkeys > key->nb_subkeys)
+        {
+            /* allocate the array at once */
+            compact_array( key, 0 );
+            if (!(ptr = realloc( key->subkeys, sk->nb_subkeys * sizeof(*key->subkeys) ))) return 0;
+            key->subkeys = ptr;
+            key->nb_subkeys = sk->nb_subkeys;
+        }
+    }
+
+    if (!load_snapshot_values( reader, key, sk->nb_values )) return 0;
+    for (i = 0; i < sk->nb_subkeys; i++)
+        if (!load_snapshot_key( reader, key, NULL )) return 0;
+    return 1;
+}
+
+/* return the modification time of a file, as stored in snapshots */
+static timeout_t get_stat_mtime( const struct stat *st )
+{
+    timeout_t ret = (timeout_t)st->st_mtime * TICKS_PER_SEC;
+#if defined(HAVE_STRUCT_STAT_ST_MTIM)
+    ret += st->st_mtim.tv_nsec / 100;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+    ret += st->st_mtimespec.tv_nsec / 100;
+#endif
+    return ret;
+}
+
+/* check if a snapshot matches the current state of its text file */
+static int check_snapshot_header( const struct snapshot_header *header, const struct stat *st )
 {
+    if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION) return 0;
+    if (header->text_size != st->st_size || header->text_inode != st->st_ino) return 0;
+    if (header->text_mtime != get_stat_mtime( st )) return 0;
+    switch (header->prefix)
+    {
+    case PREFIX_32BIT:
+    case PREFIX_64BIT:
+        return prefix_type == PREFIX_UNKNOWN || prefix_type == header->prefix;
+    case PREFIX_UNKNOWN:
+        return 1;
+    }
+    return 0;
+}
+
+/* load a registry branch from its binary snapshot; return 0 if it cannot be used */
+static int load_registry_snapshot( const char *filename, struct key *key )
+{
+    int ret = 0;
+#ifdef HAVE_SYS_MMAN_H
+    struct snapshot_reader reader;
+    const struct snapshot_header *header;
+    struct stat st, text_st;
+    char *path;
+    void *ptr;
+    int fd;
+
+    if (stat( filename, &text_st ) == -1) return 0;
+    if (!(path = malloc( strlen(filename) + sizeof(snapshot_suffix) ))) return 0;
+    strcpy( path, filename );
+    strcat( path, snapshot_suffix );
+    fd = open( path, O_RDONLY );
+    free( path );
+    if (fd == -1) return 0;
+
+    if (fstat( fd, &st ) == -1 || st.st_size < (off_t)sizeof(*header) || (off_t)(size_t)st.st_size != st.st_size ||
+        (ptr = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 )) == MAP_FAILED)
+    {
+        close( fd );
+        return 0;
+    }
+    close( fd );
+
+    header = ptr;
+    reader.base = ptr;
+    reader.size = st.st_size;
+    reader.pos  = sizeof(*header);
+    reader.load = 0;
+
+    /* validate everything before creating any key */
+    if (check_snapshot_header( header, &text_st ) && load_snapshot_key( &reader, NULL, NULL ) &&
+        reader.pos == reader.size)
+    {
+        if (header->prefix != PREFIX_UNKNOWN) prefix_type = header->prefix;
+        reader.pos  = sizeof(*header);
+        reader.load = 1;
+        ret = load_snapshot_key( &reader, NULL, key );
+        if (debug_level) fprintf( stderr, "wineserver: loaded %s from snapshot\n", filename );
+    }
+    munmap( ptr, st.st_size );
+#endif
+    return ret;
+}
+
+static void save_branch_snapshot( struct key *key, const char *path );
+
+/* replay the journal of a registry branch, and return its size */
+static file_pos_t load_registry_journal( const char *filename, struct key *key )
+{
+    file_pos_t size = 0;
+    struct stat st;
+    char *path;
     FILE *f;
 
-    if ((f = fopen( filename, "r" )))
+    if (!(path = malloc( strlen(filename) + sizeof(journal_suffix) ))) return 0;
+    strcpy( path, filename );
+    strcat( path, journal_suffix );
+    if ((f = fopen( path, "r" )))
     {
-        load_keys( key, filename, f, 0 );
+        if (!fstat( fileno( f ), &st )) size = st.st_size;
+        load_keys( key, path, f, 0, 1 );
         fclose( f );
         if (get_error() == STATUS_NOT_REGISTRY_FILE)
+            fprintf( stderr, "%s is not a valid registry file\n", path );
+        clear_error();
+        make_clean( key );
+        if (debug_level) fprintf( stderr, "wineserver: replayed journal %s\n", path );
+    }
+    free( path );
+    return size;
+}
+
+/* load one of the initial registry files */
+static int load_init_registry_from_file( const char *filename, struct key *key )
+{
+    FILE *f = NULL;
+    int ret = 1;
+
+    if (!use_snapshots || !load_registry_snapshot( filename, key ))
+    {
+        if ((f = fopen( filename, "r" )))
         {
-            fprintf( stderr, "%s is not a valid registry file\n", filename );
-            return 1;
+            load_keys( key, filename, f, 0, 0 );
+            fclose( f );
+            if (get_error() == STATUS_NOT_REGISTRY_FILE)
+            {
+                fprintf( stderr, "%s is not a valid registry file\n", filename );
+                return 1;
+            }
+            save_branch_snapshot( key, filename );
         }
+        else ret = 0;
     }
 
     assert( save_branch_count < MAX_SAVE_BRANCH_INFO );
 
+    save_branch_info[save_branch_count].journal_size = load_registry_journal( filename, key );
+    list_init( &save_branch_info[save_branch_count].deleted );
     save_branch_info[save_branch_count].path = filename;
     save_branch_info[save_branch_count++].key = (struct key *)grab_object( key );
     make_object_static( &key->obj );
-    return (f != NULL);
+    return ret;
 }
 
 static WCHAR *format_user_registry_path( const SID *sid, struct unicode_str *path )
@@ -1796,6 +2479,9 @@ void init_registry(void)
     struct key *key, *hklm, *hkcu;
     char *p;
 
+    if ((p = getenv( "WINEREGSNAPSHOT" ))) use_snapshots = atoi( p );
+    if ((p = getenv( "WINEREGJOURNAL" ))) journal_enabled = atoi( p );
+
     /* switch to the config dir */
 
     if (fchdir( config_dir_fd ) == -1) fatal_error( "chdir to config dir: %s\n", strerror( errno ));
@@ -1913,15 +2599,218 @@ static void save_registry( struct key *key, obj_handle_t handle )
     }
 }
 
+/* write an item to a snapshot, padded to 8 bytes */
+static void write_snapshot( FILE *f, const void *data, size_t len )
+{
+    static const char padding[8];
+
+    if (len) fwrite( data, len, 1, f );
+    if (SNAPSHOT_ALIGN(len) != len) fwrite( padding, SNAPSHOT_ALIGN(len) - len, 1, f );
+}
+
+/* save a key and its subkeys to a snapshot */
+static void save_snapshot_key( const struct key *key, FILE *f )
+{
+    struct snapshot_key sk;
+    struct snapshot_value sv;
+    int i;
+
+    memset( &sk, 0, sizeof(sk) );
+    sk.modif      = key->modif;
+    sk.flags      = key->flags & KEY_SYMLINK;
+    sk.nb_values  = key->last_value + 1;
+    sk.namelen    = key->namelen;
+    sk.classlen   = key->class ? key->classlen : 0;
+    for (i = 0; i <= key->last_subkey; i++)
+        if (!(key->subkeys[i]->flags & KEY_VOLATILE)) sk.nb_subkeys++;
+
+    write_snapshot( f, &sk, sizeof(sk) );
+    write_snapshot( f, key->name, sk.namelen );
+    write_snapshot( f, key->class, sk.classlen );
+
+    for (i = 0; i <= key->last_value; i++)
+    {
+        const struct key_value *value = &key->values[i];
+
+        memset( &sv, 0, sizeof(sv) );
+        sv.type    = value->type;
+        sv.len     = value->len;
+        sv.namelen = value->namelen;
+        write_snapshot( f, &sv, sizeof(sv) );
+        write_snapshot( f, value->name, value->namelen );
+        write_snapshot( f, value->data, value->len );
+    }
+
+    for (i = 0; i <= key->last_subkey; i++)
+        if (!(key->subkeys[i]->flags & KEY_VOLATILE)) save_snapshot_key( key->subkeys[i], f );
+}
+
+/* save the snapshot of a registry branch, once the text file has been written */
+static void save_branch_snapshot( struct key *key, const char *path )
+{
+    struct snapshot_header header;
+    char *snapshot, *tmp;
+    struct stat st;
+    int ret = 0;
+    FILE *f;
+
+    if (!use_snapshots) return;
+    if (!(snapshot = malloc( strlen(path) + sizeof(snapshot_suffix) ))) return;
+    strcpy( snapshot, path );
+    strcat( snapshot, snapshot_suffix );
+
+    if (stat( path, &st ) == -1)
+    {
+        unlink( snapshot );  /* don't leave an outdated snapshot around */
+        free( snapshot );
+        return;
+    }
+
+    if ((tmp = malloc( strlen(snapshot) + 5 )))
+    {
+        strcpy( tmp, snapshot );
+        strcat( tmp, ".tmp" );
+        if ((f = fopen( tmp, "w" )))
+        {
+            memset( &header, 0, sizeof(header) );
+            header.magic      = SNAPSHOT_MAGIC;
+            header.version    = SNAPSHOT_VERSION;
+            header.prefix     = prefix_type;
+            header.text_size  = st.st_size;
+            header.text_inode = st.st_ino;
+            header.text_mtime = get_stat_mtime( &st );
+            write_snapshot( f, &header, sizeof(header) );
+            save_snapshot_key( key, f );
+            ret = !ferror( f );
+            if (fclose( f )) ret = 0;
+            if (ret) ret = !rename( tmp, snapshot );
+            if (!ret) unlink( tmp );
+        }
+        free( tmp );
+    }
+    if (!ret) unlink( snapshot );
+    free( snapshot );
+}
+
+/* return the name of the journal file of a branch */
+static char *get_journal_path( const struct save_branch_info *info )
+{
+    char *path;
+
+    if (!(path = malloc( strlen(info->path) + sizeof(journal_suffix) ))) return NULL;
+    strcpy( path, info->path );
+    strcat( path, journal_suffix );
+    return path;
+}
+
+/* free the list of deleted keys of a branch */
+static void free_deleted_keys( struct save_branch_info *info )
+{
+    struct deleted_key *deleted, *next;
+
+    LIST_FOR_EACH_ENTRY_SAFE( deleted, next, &info->deleted, struct deleted_key, entry )
+    {
+        list_remove( &deleted->entry );
+        free( deleted );
+    }
+}
+
+/* dump the path of a deleted key to a text file */
+static void dump_deleted_path( const struct deleted_key *deleted, FILE *f )
+{
+    const WCHAR *p = deleted->path, *end = p + deleted->len / sizeof(WCHAR), *next;
+
+    for (;;)
+    {
+        for (next = p; next < end && *next != '\\'; next++) ;
+        dump_strW( p, (next - p) * sizeof(WCHAR), f, "[]" );
+        if (next == end) break;
+        fprintf( f, "\\\\" );
+        p = next + 1;
+    }
+}
+
+/* save the modified keys of a branch to its journal */
+static void save_journal_keys( const struct key *key, const struct key *base, FILE *f )
+{
+    int i;
+
+    if (key->flags & KEY_VOLATILE) return;
+    if (!(key->flags & KEY_DIRTY)) return;
+
+    fprintf( f, "\n[" );
+    if (key != base) dump_path( key, base, f );
+    fprintf( f, "] %u\n", (unsigned int)((key->modif - ticks_1601_to_1970) / TICKS_PER_SEC) );
+    fprintf( f, "#time=%x%08x\n", (unsigned int)(key->modif >> 32), (unsigned int)key->modif );
+    if (key->flags & KEY_CHANGED)
+    {
+        fputs( "#clear\n", f );
+        if (key->class)
+        {
+            fprintf( f, "#class=\"" );
+            dump_strW( key->class, key->classlen, f, "\"\"" );
+            fprintf( f, "\"\n" );
+        }
+        if (key->flags & KEY_SYMLINK) fputs( "#link\n", f );
+        for (i = 0; i <= key->last_value; i++) dump_value( &key->values[i], f );
+    }
+    for (i = 0; i <= key->last_subkey; i++) save_journal_keys( key->subkeys[i], base, f );
+}
+
+/* append the changes of a registry branch to its journal; return 0 if the whole branch must be saved */
+static int save_branch_journal( struct save_branch_info *info )
+{
+    struct deleted_key *deleted;
+    struct stat st;
+    char *path;
+    int ret = 0;
+    FILE *f;
+
+    if (!(info->key->flags & KEY_DIRTY) && list_empty( &info->deleted )) return 1;
+
+    /* rewrite the branch instead once the journal is larger than it */
+    if (stat( info->path, &st ) == -1 || info->journal_size > st.st_size) return 0;
+
+    if (!(path = get_journal_path( info ))) return 0;
+    if ((f = fopen( path, "a" )))
+    {
+        if (debug_level > 1)
+        {
+            fprintf( stderr, "%s: ", path );
+            dump_operation( info->key, NULL, "journaling" );
+        }
+        if (!info->journal_size) fprintf( f, "WINE REGISTRY Version 2\n;; Changes to %s\n", info->path );
+        LIST_FOR_EACH_ENTRY( deleted, &info->deleted, struct deleted_key, entry )
+        {
+            fprintf( f, "\n[" );
+            dump_deleted_path( deleted, f );
+            fprintf( f, "]\n#delete\n" );
+        }
+        save_journal_keys( info->key, info->key, f );
+        ret = !ferror( f );
+        if (fclose( f )) ret = 0;
+        if (!stat( path, &st )) info->journal_size = st.st_size;
+    }
+    free( path );
+    if (ret)
+    {
+        free_deleted_keys( info );
+        make_clean( info->key );
+    }
+    return ret;
+}
+
 /* save a registry branch to a file */
-static int save_branch( struct key *key, const char *path )
+static int save_branch( struct save_branch_info *info )
 {
+    struct key *key = info->key;
+    const char *path = info->path;
     struct stat st;
     char *p, *tmp = NULL;
     int fd, count = 0, ret = 0;
     FILE *f;
 
-    if (!(key->flags & KEY_DIRTY))
+    if (!(key->flags & KEY_DIRTY) && !info->journal_size)
     {
         if (debug_level > 1) dump_operation( key, NULL, "Not saving clean" );
         return 1;
@@ -1983,7 +2872,18 @@ static int save_branch( struct key *key, const char *path )
 
 done:
     free( tmp );
-    if (ret) make_clean( key );
+    if (ret)
+    {
+        save_branch_snapshot( key, path );
+        make_clean( key );
+        free_deleted_keys( info );
+        if (info->journal_size && (p = get_journal_path( info )))
+        {
+            unlink( p );
+            free( p );
+        }
+        info->journal_size = 0;
+    }
     return ret;
 }
 
@@ -1995,7 +2895,10 @@ static void periodic_save( void *arg )
     if (fchdir( config_dir_fd ) == -1) return;
     save_timeout_user = NULL;
     for (i = 0; i < save_branch_count; i++)
-        save_branch( save_branch_info[i].key, save_branch_info[i].path );
+    {
+        if (journal_enabled && save_branch_journal( &save_branch_info[i] )) continue;
+        save_branch( &save_branch_info[i] );
+    }
     if (fchdir( server_dir_fd ) == -1) fatal_error( "chdir to server dir: %s\n", strerror( errno ));
     set_periodic_save_timer();
 }
@@ -2015,7 +2918,7 @@ void flush_registry(void)
     if (fchdir( config_dir_fd ) == -1) return;
     for (i = 0; i < save_branch_count; i++)
     {
-        if (!save_branch( save_branch_info[i].key, save_branch_info[i].path ))
+        if (!save_branch( &save_branch_info[i] ))
         {
             fprintf( stderr, "wineserver: could not save registry branch to %s",
                      save_branch_info[i].path );
@@ -2025,6 +2928,23 @@ void flush_registry(void)
     if (fchdir( server_dir_fd ) == -1) fatal_error( "chdir to server dir: %s\n", strerror( errno ));
 }
 
+/* save the branch containing a key to its journal right away */
+static void flush_key_branch( struct key *key )
+{
+    struct save_branch_info *info = NULL;
+    int i;
+
+    if (!journal_enabled) return;  /* the periodic saves are enough */
+    for ( ; key && !info; key = key->parent)
+        for (i = 0; i < save_branch_count; i++)
+            if (save_branch_info[i].key == key) info = &save_branch_info[i];
+    if (!info) return;  /* volatile or loaded key */
+
+    if (fchdir( config_dir_fd ) == -1) return;
+    if (!save_branch_journal( info )) save_branch( info );
+    if (fchdir( server_dir_fd ) == -1) fatal_error( "chdir to server dir: %s\n", strerror( errno ));
+}
+
 /* determine if the thread is wow64 (32-bit client running on 64-bit prefix) */
 static int is_wow64_thread( struct thread *thread )
 {
@@ -2109,7 +3029,7 @@ DECL_HANDLER(flush_key)
     struct key *key = get_hkey_obj( req->hkey, 0 );
     if (key)
     {
-        /* we don't need to do anything here with the current implementation */
+        flush_key_branch( key );
         release_object( key );
     }
 }
@@ -2160,6 +3080,8 @@ DECL_HANDLER(get_key_value)
     reply->total = 0;
     if ((key = get_hkey_obj( req->hkey, KEY_QUERY_VALUE )))
     {
+        reply->cache_slot = key->cache_slot;
+        if (cache_generations) reply->cache_gen = cache_generations[key->cache_slot];
         get_value( key, &name, &reply->type, &reply->total );
         release_object( key );
     }
@@ -2305,3 +3227,30 @@ DECL_HANDLER(set_registry_notification)
         release_object( key );
     }
 }
+
+/* retrieve the shared memory area used for client-side registry caching */
+DECL_HANDLER(get_registry_cache)
+{
+    data_size_t size = REGISTRY_CACHE_SLOTS * sizeof(*cache_generations);
+
+#ifdef HAVE_SYS_MMAN_H
+    if (!cache_generations)
+    {
+        void *ptr;
+
+        if ((cache_generations_fd = create_temp_file( size )) == -1) return;
+        if ((ptr = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, cache_generations_fd, 0 )) == MAP_FAILED)
+        {
+            file_set_error();
+            close( cache_generations_fd );
+            cache_generations_fd = -1;
+            return;
+        }
+        cache_generations = ptr;
+    }
+    reply->size = size;
+    send_client_fd( current->process, cache_generations_fd, 0 );
+#else
+    set_error( STATUS_NOT_IMPLEMENTED );
+#endif
+}
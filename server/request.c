@@ -51,6 +51,9 @@
 #ifdef HAVE_POLL_H
 #include <poll.h>
 #endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #ifdef __APPLE__
 # include <mach/mach_time.h>
 #endif
@@ -123,8 +126,9 @@ static const struct fd_ops master_socket_fd_ops =
 };
 
 
-struct thread *current = NULL;  /* thread handling the current request */
-unsigned int global_error = 0;  /* global error code for when no thread is current */
+/* thread-local, as the request workers run handlers concurrently */
+__thread struct thread *current = NULL;  /* thread handling the current request */
+__thread unsigned int global_error = 0;  /* global error code for when no thread is current */
 timeout_t server_start_time = 0;  /* server startup time */
 char *server_dir = NULL;   /* server directory */
 int server_dir_fd = -1;    /* file descriptor for the server dir */
@@ -251,89 +255,411 @@ void write_reply( struct thread *thread )
         fatal_protocol_error( thread, "reply write: %s\n", strerror( errno ));
 }
 
-/* send a reply to the current thread */
-static void send_reply( union generic_reply *reply )
+/* write a complete reply to a thread, return the result of the write call */
+static int write_full_reply( struct thread *thread, const union generic_reply *reply )
 {
-    int ret;
+    struct iovec vec[2];
 
-    if (!current->reply_size)
+    if (!thread->reply_size) return write( get_unix_fd( thread->reply_fd ), reply, sizeof(*reply) );
+
+    vec[0].iov_base = (void *)reply;
+    vec[0].iov_len  = sizeof(*reply);
+    vec[1].iov_base = thread->reply_data;
+    vec[1].iov_len  = thread->reply_size;
+    return writev( get_unix_fd( thread->reply_fd ), vec, 2 );
+}
+
+/* finish sending a reply once it has been written; errno is set if the write failed */
+static void reply_written( struct thread *thread, int ret )
+{
+    if (ret < (int)sizeof(union generic_reply))
     {
-        if ((ret = write( get_unix_fd( current->reply_fd ),
-                          reply, sizeof(*reply) )) != sizeof(*reply)) goto error;
+        if (ret >= 0)
+            fatal_protocol_error( thread, "partial write %d\n", ret );
+        else if (errno == EPIPE)
+            kill_thread( thread, 0 );  /* normal death */
+        else
+            fatal_protocol_error( thread, "reply write: %s\n", strerror( errno ));
+        return;
     }
-    else
+    if ((thread->reply_towrite = thread->reply_size - (ret - sizeof(union generic_reply))))
     {
-        struct iovec vec[2];
+        /* couldn't write it all, wait for POLLOUT */
+        set_fd_events( thread->reply_fd, POLLOUT );
+        set_fd_events( thread->request_fd, 0 );
+        return;
+    }
+    free( thread->reply_data );
+    thread->reply_data = NULL;
+}
+
+/* send a reply to the current thread */
+static void send_reply( union generic_reply *reply )
+{
+    reply_written( current, write_full_reply( current, reply ));
+}
+
+/* run the handler of the request of a thread; return 1 if a reply has to be sent to current */
+static int handle_request( struct thread *thread, union generic_reply *reply )
+{
+    enum request req = thread->req.request_header.req;
+    struct process *process = NULL;
+    timeout_t start = 0;
 
-        vec[0].iov_base = (void *)reply;
-        vec[0].iov_len  = sizeof(*reply);
-        vec[1].iov_base = current->reply_data;
-        vec[1].iov_len  = current->reply_size;
+    current = thread;
+    current->reply_size = 0;
+    clear_error();
+    memset( reply, 0, sizeof(*reply) );
 
-        if ((ret = writev( get_unix_fd( current->reply_fd ), vec, 2 )) < sizeof(*reply)) goto error;
+    if (debug_level) trace_request();
 
-        if ((current->reply_towrite = current->reply_size - (ret - sizeof(*reply))))
-        {
-            /* couldn't write it all, wait for POLLOUT */
-            set_fd_events( current->reply_fd, POLLOUT );
-            set_fd_events( current->request_fd, 0 );
-            return;
-        }
+    if (profile_requests)
+    {
+        process = (struct process *)grab_object( thread->process );
+        start = get_profile_time();
     }
-    free( current->reply_data );
-    current->reply_data = NULL;
-    return;
 
- error:
-    if (ret >= 0)
-        fatal_protocol_error( current, "partial write %d\n", ret );
-    else if (errno == EPIPE)
-        kill_thread( current, 0 );  /* normal death */
+    if (req < REQ_NB_REQUESTS)
+        req_handlers[req]( &current->req, reply );
     else
-        fatal_protocol_error( current, "reply write: %s\n", strerror( errno ));
+        set_error( STATUS_NOT_IMPLEMENTED );
+
+    if (process)
+    {
+        /* the requests of a batch are profiled individually, don't count their time twice */
+        if (req != REQ_call_batch) profile_request( process, req, get_profile_time() - start );
+        release_object( process );
+    }
+
+    if (!current) return 0;
+    if (!current->reply_fd)
+    {
+        current->exit_code = 1;
+        kill_thread( current, 1 );  /* no way to continue without reply fd */
+        return 0;
+    }
+    reply->reply_header.error = current->error;
+    reply->reply_header.reply_size = current->reply_size;
+    if (debug_level) trace_reply( req, reply );
+    return 1;
 }
 
 /* call a request handler */
 static void call_req_handler( struct thread *thread )
 {
     union generic_reply reply;
-    enum request req = thread->req.request_header.req;
 
-    current = thread;
+    if (handle_request( thread, &reply )) send_reply( &reply );
+    current = NULL;
+}
+
+/* check whether a request can be part of a batch; only requests that don't */
+/* transfer file descriptors, don't wait and don't need client-side state */
+/* updates are allowed */
+static int is_batch_request_allowed( enum request req )
+{
+    switch (req)
+    {
+    case REQ_get_object_info:
+    case REQ_get_object_type:
+    case REQ_get_process_info:
+    case REQ_get_thread_info:
+    case REQ_get_thread_times:
+    case REQ_next_process:
+    case REQ_next_thread:
+    case REQ_event_op:
+    case REQ_query_event:
+    case REQ_release_semaphore:
+    case REQ_query_semaphore:
+    case REQ_release_mutex:
+    case REQ_query_mutex:
+    case REQ_open_key:
+    case REQ_get_key_value:
+    case REQ_enum_key:
+    case REQ_get_token_statistics:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* perform several independent requests in a single round trip */
+DECL_HANDLER(call_batch)
+{
+    struct thread *thread = current;
+    union generic_request batch_req = current->req;
+    void *batch_data = current->req_data;
+    struct process *process = current->process;
+    data_size_t size = get_req_data_size(), max_size = get_reply_max_size();
+    data_size_t req_pos = 0, reply_pos = 0;
+    unsigned int count = 0;
+    char *replies = NULL;
+
+    if (max_size && !(replies = mem_alloc( max_size ))) return;
+
+    while (size - req_pos >= sizeof(union generic_request))
+    {
+        const union generic_request *sub_req = (const union generic_request *)((char *)batch_data + req_pos);
+        union generic_reply *sub_reply = (union generic_reply *)(replies + reply_pos);
+        data_size_t data_size = sub_req->request_header.request_size;
+        data_size_t reply_max = sub_req->request_header.reply_size;
+        enum request type = sub_req->request_header.req;
+
+        if (data_size > size - req_pos - sizeof(*sub_req)) break;
+        if (max_size - reply_pos < sizeof(*sub_reply) ||
+            reply_max > max_size - reply_pos - sizeof(*sub_reply)) break;
+
+        /* the request data is freed with the thread if it gets killed, so it can't point into the batch */
+        current->req = *sub_req;
+        current->req_data = data_size ? memdup( sub_req + 1, data_size ) : NULL;
+        current->reply_size = 0;
+        clear_error();
+        memset( sub_reply, 0, sizeof(*sub_reply) );
+
+        if (data_size && !current->req_data)
+            set_error( STATUS_NO_MEMORY );
+        else
+        {
+            if (debug_level) trace_request();
+
+            if (is_batch_request_allowed( type ))
+            {
+                timeout_t start = profile_requests ? get_profile_time() : 0;
+                req_handlers[type]( &current->req, sub_reply );
+                /* the process is kept alive by handle_request while profiling */
+                if (profile_requests) profile_request( process, type, get_profile_time() - start );
+            }
+            else
+                set_error( STATUS_NOT_SUPPORTED );
+        }
+
+        if (!current)  /* the thread has been killed, its request data is already freed */
+        {
+            thread->req = batch_req;
+            thread->req_data = batch_data;
+            free( replies );
+            return;
+        }
+
+        free( current->req_data );
+        current->req_data = NULL;
+        sub_reply->reply_header.error = current->error;
+        sub_reply->reply_header.reply_size = current->reply_size;
+        if (debug_level) trace_reply( type, sub_reply );
+        memcpy( sub_reply + 1, current->reply_data, current->reply_size );
+        free( current->reply_data );
+        current->reply_data = NULL;
+
+        req_pos += min( size - req_pos, sizeof(*sub_req) + ((data_size + 7) & ~7) );
+        reply_pos += min( max_size - reply_pos, sizeof(*sub_reply) + ((current->reply_size + 7) & ~7) );
+        count++;
+    }
+
+    current->req = batch_req;
+    current->req_data = batch_data;
     current->reply_size = 0;
     clear_error();
-    memset( &reply, 0, sizeof(reply) );
+    reply->count = count;
+    if (replies) set_reply_data_ptr( replies, reply_pos );
+}
 
-    if (debug_level) trace_request();
+/* request workers */
 
-    if (req < REQ_NB_REQUESTS)
-        req_handlers[req]( &current->req, &reply );
-    else
-        set_error( STATUS_NOT_IMPLEMENTED );
+/* When WINESERVERTHREADS is set, the requests that only look up an object and
+ * read its state are handled by a pool of worker threads. The main loop holds
+ * the server lock for writing, except while it waits for events, and the
+ * workers hold it for reading; so the workers only run while the main loop
+ * waits, and the handle tables, the thread ids and the objects they look at
+ * can't change under them. Object refcounts are updated atomically, and
+ * current and the global error are thread-local, which is all that these
+ * handlers need to run concurrently. */
+
+#ifdef HAVE_PTHREAD_H
+
+static int request_workers;  /* number of request worker threads */
+
+static pthread_rwlock_t server_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t worker_mutex = PTHREAD_MUTEX_INITIALIZER;  /* protects the lists below */
+static pthread_cond_t worker_cond = PTHREAD_COND_INITIALIZER;
+static struct list worker_queue = LIST_INIT( worker_queue );  /* threads waiting for a worker */
+static struct list worker_done = LIST_INIT( worker_done );    /* replies the main loop has to finish */
+
+/* check whether a request can be handled by a worker; the handler must not */
+/* modify anything but the reply and the error of the current thread */
+static int is_worker_request( enum request req )
+{
+    switch (req)
+    {
+    case REQ_get_object_info:
+    case REQ_get_process_info:
+    case REQ_get_thread_info:
+    case REQ_get_thread_times:
+    case REQ_query_event:
+    case REQ_query_semaphore:
+    case REQ_query_mutex:
+    case REQ_get_token_statistics:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* queue the request of a thread for the workers; return 0 if the main loop has to handle it */
+static int queue_worker_request( struct thread *thread )
+{
+    /* tracing and profiling record into shared state, keep them on the main loop */
+    if (!request_workers || debug_level || profile_requests) return 0;
+    if (!is_worker_request( thread->req.request_header.req )) return 0;
+
+    pthread_mutex_lock( &worker_mutex );
+    list_add_tail( &worker_queue, &thread->worker_entry );
+    pthread_cond_signal( &worker_cond );
+    pthread_mutex_unlock( &worker_mutex );
+    return 1;
+}
+
+/* handle a queued request, called by a worker with the server lock held for reading */
+static void run_worker_request( struct thread *thread )
+{
+    union generic_reply reply;
+    int ret;
 
-    if (current)
+    if (handle_request( thread, &reply ))
     {
-        if (current->reply_fd)
+        ret = write_full_reply( thread, &reply );
+        if (ret == (int)(sizeof(reply) + thread->reply_size))
         {
-            reply.reply_header.error = current->error;
-            reply.reply_header.reply_size = current->reply_size;
-            if (debug_level) trace_reply( req, &reply );
-            send_reply( &reply );
+            free( thread->reply_data );
+            thread->reply_data = NULL;
         }
         else
         {
-            current->exit_code = 1;
-            kill_thread( current, 1 );  /* no way to continue without reply fd */
+            /* errors and partial writes have to be dealt with by the main loop */
+            thread->worker_ret = ret;
+            thread->worker_errno = errno;
+            pthread_mutex_lock( &worker_mutex );
+            list_add_tail( &worker_done, &thread->worker_entry );
+            pthread_mutex_unlock( &worker_mutex );
+            wake_up_main_loop();
         }
     }
+    free( thread->req_data );
+    thread->req_data = NULL;
     current = NULL;
 }
 
+static void *request_worker( void *arg )
+{
+    struct list *ptr;
+
+    for (;;)
+    {
+        pthread_mutex_lock( &worker_mutex );
+        while (list_empty( &worker_queue )) pthread_cond_wait( &worker_cond, &worker_mutex );
+        pthread_mutex_unlock( &worker_mutex );
+
+        pthread_rwlock_rdlock( &server_lock );
+        pthread_mutex_lock( &worker_mutex );
+        /* another worker may have taken it, or the thread may have been killed meanwhile */
+        if ((ptr = list_head( &worker_queue )))
+        {
+            list_remove( ptr );
+            list_init( ptr );
+        }
+        pthread_mutex_unlock( &worker_mutex );
+        if (ptr) run_worker_request( LIST_ENTRY( ptr, struct thread, worker_entry ));
+        pthread_rwlock_unlock( &server_lock );
+    }
+    return NULL;
+}
+
+/* forget the queued request of a thread that is being killed */
+void cancel_worker_request( struct thread *thread )
+{
+    if (list_empty( &thread->worker_entry )) return;
+    pthread_mutex_lock( &worker_mutex );
+    list_remove( &thread->worker_entry );
+    list_init( &thread->worker_entry );
+    pthread_mutex_unlock( &worker_mutex );
+}
+
+/* finish the replies that the workers couldn't write entirely */
+void finish_worker_requests(void)
+{
+    struct list *ptr;
+
+    pthread_mutex_lock( &worker_mutex );
+    while ((ptr = list_head( &worker_done )))
+    {
+        struct thread *thread = LIST_ENTRY( ptr, struct thread, worker_entry );
+
+        list_remove( ptr );
+        list_init( ptr );
+        pthread_mutex_unlock( &worker_mutex );
+        errno = thread->worker_errno;
+        reply_written( thread, thread->worker_ret );
+        pthread_mutex_lock( &worker_mutex );
+    }
+    pthread_mutex_unlock( &worker_mutex );
+}
+
+/* let the workers run while the main loop waits for events */
+void release_server_lock(void)
+{
+    if (request_workers) pthread_rwlock_unlock( &server_lock );
+}
+
+/* take the server lock back once the main loop is done waiting */
+void acquire_server_lock(void)
+{
+    if (request_workers) pthread_rwlock_wrlock( &server_lock );
+}
+
+/* start the request workers if enabled in the environment */
+void init_request_workers(void)
+{
+    const char *env = getenv( "WINESERVERTHREADS" );
+    sigset_t sigset, old_sigset;
+    pthread_t thread;
+    int i, count;
+
+    if (!env || (count = atoi( env )) <= 0) return;
+    if (count > 64) count = 64;
+
+    /* signals have to be delivered to the main loop */
+    sigfillset( &sigset );
+    pthread_sigmask( SIG_BLOCK, &sigset, &old_sigset );
+    pthread_rwlock_wrlock( &server_lock );
+    for (i = 0; i < count; i++)
+    {
+        if (pthread_create( &thread, NULL, request_worker, NULL )) break;
+        pthread_detach( thread );
+    }
+    pthread_sigmask( SIG_SETMASK, &old_sigset, NULL );
+    if (!(request_workers = i)) pthread_rwlock_unlock( &server_lock );
+}
+
+#else  /* HAVE_PTHREAD_H */
+
+static int queue_worker_request( struct thread *thread ) { return 0; }
+void cancel_worker_request( struct thread *thread ) { }
+void finish_worker_requests(void) { }
+void release_server_lock(void) { }
+void acquire_server_lock(void) { }
+void init_request_workers(void) { }
+
+#endif  /* HAVE_PTHREAD_H */
+
 /* read a request from a thread */
 void read_request( struct thread *thread )
 {
     int ret;
 
+    if (!list_empty( &thread->worker_entry ))
+    {
+        fatal_protocol_error( thread, "request sent before the previous reply\n" );
+        return;
+    }
     if (!thread->req_toread)  /* no pending request */
     {
         if ((ret = read( get_unix_fd( thread->request_fd ), &thread->req,
@@ -341,7 +667,7 @@ void read_request( struct thread *thread )
         if (!(thread->req_toread = thread->req.request_header.request_size))
         {
             /* no data, handle request at once */
-            call_req_handler( thread );
+            if (!queue_worker_request( thread )) call_req_handler( thread );
             return;
         }
         if (!(thread->req_data = malloc( thread->req_toread )))
@@ -362,6 +688,7 @@ void read_request( struct thread *thread )
         if (ret <= 0) break;
         if (!(thread->req_toread -= ret))
         {
+            if (queue_worker_request( thread )) return;
             call_req_handler( thread );
             free( thread->req_data );
             thread->req_data = NULL;
@@ -54,15 +54,27 @@ extern int receive_fd( struct process *process );
 extern int send_client_fd( struct process *process, int fd, obj_handle_t handle );
 extern void read_request( struct thread *thread );
 extern void write_reply( struct thread *thread );
+extern void cancel_worker_request( struct thread *thread );
+extern void finish_worker_requests(void);
+extern void release_server_lock(void);
+extern void acquire_server_lock(void);
+extern void init_request_workers(void);
 extern unsigned int get_tick_count(void);
 extern void open_master_socket(void);
 extern void close_master_socket( timeout_t timeout );
 extern void shutdown_master_socket(void);
 extern int wait_for_lock(void);
 extern int kill_lock_owner( int sig );
+extern void init_request_profile(void);
+extern timeout_t get_profile_time(void);
+extern void profile_request( struct process *process, enum request req, timeout_t time );
+extern void free_process_profile( struct process *process );
+extern void dump_request_profile(void);
+extern int profile_requests;
 extern char *server_dir;
 extern int server_dir_fd, config_dir_fd;
 
+extern const char *get_req_name( enum request req );
 extern void trace_request(void);
 extern void trace_reply( enum request req, const union generic_reply *reply );
 
@@ -174,6 +186,7 @@ DECL_HANDLER(get_socket_event);
 DECL_HANDLER(get_socket_info);
 DECL_HANDLER(enable_socket_event);
 DECL_HANDLER(set_socket_deferred);
+DECL_HANDLER(complete_socket_asyncs);
 DECL_HANDLER(alloc_console);
 DECL_HANDLER(free_console);
 DECL_HANDLER(get_console_renderer_events);
@@ -201,6 +214,7 @@ DECL_HANDLER(read_change);
 DECL_HANDLER(create_mapping);
 DECL_HANDLER(open_mapping);
 DECL_HANDLER(get_mapping_info);
+DECL_HANDLER(get_mapping_reloc_file);
 DECL_HANDLER(map_view);
 DECL_HANDLER(unmap_view);
 DECL_HANDLER(get_mapping_committed_range);
@@ -224,6 +238,7 @@ DECL_HANDLER(flush_key);
 DECL_HANDLER(enum_key);
 DECL_HANDLER(set_key_value);
 DECL_HANDLER(get_key_value);
+DECL_HANDLER(get_registry_cache);
 DECL_HANDLER(enum_key_value);
 DECL_HANDLER(delete_key_value);
 DECL_HANDLER(load_registry);
@@ -387,6 +402,9 @@ DECL_HANDLER(create_completion);
 DECL_HANDLER(open_completion);
 DECL_HANDLER(add_completion);
 DECL_HANDLER(remove_completion);
+DECL_HANDLER(create_completion_wait);
+DECL_HANDLER(associate_completion_wait);
+DECL_HANDLER(cancel_completion_wait);
 DECL_HANDLER(query_completion);
 DECL_HANDLER(set_completion_info);
 DECL_HANDLER(add_fd_completion);
@@ -410,6 +428,12 @@ DECL_HANDLER(set_job_completion_port);
 DECL_HANDLER(terminate_job);
 DECL_HANDLER(suspend_process);
 DECL_HANDLER(resume_process);
+DECL_HANDLER(get_fsync_shm);
+DECL_HANDLER(get_fsync_idx);
+DECL_HANDLER(get_fsync_owned);
+DECL_HANDLER(call_batch);
+DECL_HANDLER(get_handle_mirror);
+DECL_HANDLER(get_request_profile);
 
 #ifdef WANT_REQUEST_HANDLERS
 
@@ -477,6 +501,7 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_get_socket_info,
     (req_handler)req_enable_socket_event,
     (req_handler)req_set_socket_deferred,
+    (req_handler)req_complete_socket_asyncs,
     (req_handler)req_alloc_console,
     (req_handler)req_free_console,
     (req_handler)req_get_console_renderer_events,
@@ -504,6 +529,7 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_create_mapping,
     (req_handler)req_open_mapping,
     (req_handler)req_get_mapping_info,
+    (req_handler)req_get_mapping_reloc_file,
     (req_handler)req_map_view,
     (req_handler)req_unmap_view,
     (req_handler)req_get_mapping_committed_range,
@@ -527,6 +553,7 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_enum_key,
     (req_handler)req_set_key_value,
     (req_handler)req_get_key_value,
+    (req_handler)req_get_registry_cache,
     (req_handler)req_enum_key_value,
     (req_handler)req_delete_key_value,
     (req_handler)req_load_registry,
@@ -690,6 +717,9 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_open_completion,
     (req_handler)req_add_completion,
     (req_handler)req_remove_completion,
+    (req_handler)req_create_completion_wait,
+    (req_handler)req_associate_completion_wait,
+    (req_handler)req_cancel_completion_wait,
     (req_handler)req_query_completion,
     (req_handler)req_set_completion_info,
     (req_handler)req_add_fd_completion,
@@ -713,6 +743,12 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_terminate_job,
     (req_handler)req_suspend_process,
     (req_handler)req_resume_process,
+    (req_handler)req_get_fsync_shm,
+    (req_handler)req_get_fsync_idx,
+    (req_handler)req_get_fsync_owned,
+    (req_handler)req_call_batch,
+    (req_handler)req_get_handle_mirror,
+    (req_handler)req_get_request_profile,
 };
 
 C_ASSERT( sizeof(affinity_t) == 8 );
@@ -1120,6 +1156,9 @@ C_ASSERT( sizeof(struct enable_socket_event_request) == 32 );
 C_ASSERT( FIELD_OFFSET(struct set_socket_deferred_request, handle) == 12 );
 C_ASSERT( FIELD_OFFSET(struct set_socket_deferred_request, deferred) == 16 );
 C_ASSERT( sizeof(struct set_socket_deferred_request) == 24 );
+C_ASSERT( FIELD_OFFSET(struct complete_socket_asyncs_request, handle) == 12 );
+C_ASSERT( FIELD_OFFSET(struct complete_socket_asyncs_request, type) == 16 );
+C_ASSERT( sizeof(struct complete_socket_asyncs_request) == 24 );
 C_ASSERT( FIELD_OFFSET(struct alloc_console_request, access) == 12 );
 C_ASSERT( FIELD_OFFSET(struct alloc_console_request, attributes) == 16 );
 C_ASSERT( FIELD_OFFSET(struct alloc_console_request, pid) == 20 );
@@ -1310,7 +1349,13 @@ C_ASSERT( sizeof(struct get_mapping_info_request) == 24 );
 C_ASSERT( FIELD_OFFSET(struct get_mapping_info_reply, size) == 8 );
 C_ASSERT( FIELD_OFFSET(struct get_mapping_info_reply, flags) == 16 );
 C_ASSERT( FIELD_OFFSET(struct get_mapping_info_reply, shared_file) == 20 );
-C_ASSERT( sizeof(struct get_mapping_info_reply) == 24 );
+C_ASSERT( FIELD_OFFSET(struct get_mapping_info_reply, reloc_base) == 24 );
+C_ASSERT( sizeof(struct get_mapping_info_reply) == 32 );
+C_ASSERT( FIELD_OFFSET(struct get_mapping_reloc_file_request, handle) == 12 );
+C_ASSERT( FIELD_OFFSET(struct get_mapping_reloc_file_request, base) == 16 );
+C_ASSERT( sizeof(struct get_mapping_reloc_file_request) == 24 );
+C_ASSERT( FIELD_OFFSET(struct get_mapping_reloc_file_reply, file) == 8 );
+C_ASSERT( sizeof(struct get_mapping_reloc_file_reply) == 16 );
 C_ASSERT( FIELD_OFFSET(struct map_view_request, mapping) == 12 );
 C_ASSERT( FIELD_OFFSET(struct map_view_request, access) == 16 );
 C_ASSERT( FIELD_OFFSET(struct map_view_request, base) == 24 );
@@ -1429,7 +1474,12 @@ C_ASSERT( FIELD_OFFSET(struct get_key_value_request, hkey) == 12 );
 C_ASSERT( sizeof(struct get_key_value_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct get_key_value_reply, type) == 8 );
 C_ASSERT( FIELD_OFFSET(struct get_key_value_reply, total) == 12 );
-C_ASSERT( sizeof(struct get_key_value_reply) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_key_value_reply, cache_slot) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_key_value_reply, cache_gen) == 20 );
+C_ASSERT( sizeof(struct get_key_value_reply) == 24 );
+C_ASSERT( sizeof(struct get_registry_cache_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_registry_cache_reply, size) == 8 );
+C_ASSERT( sizeof(struct get_registry_cache_reply) == 16 );
 C_ASSERT( FIELD_OFFSET(struct enum_key_value_request, hkey) == 12 );
 C_ASSERT( FIELD_OFFSET(struct enum_key_value_request, index) == 16 );
 C_ASSERT( FIELD_OFFSET(struct enum_key_value_request, info_class) == 20 );
@@ -2354,6 +2404,24 @@ C_ASSERT( FIELD_OFFSET(struct remove_completion_reply, cvalue) == 16 );
 C_ASSERT( FIELD_OFFSET(struct remove_completion_reply, information) == 24 );
 C_ASSERT( FIELD_OFFSET(struct remove_completion_reply, status) == 32 );
 C_ASSERT( sizeof(struct remove_completion_reply) == 40 );
+C_ASSERT( FIELD_OFFSET(struct create_completion_wait_request, access) == 12 );
+C_ASSERT( sizeof(struct create_completion_wait_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct create_completion_wait_reply, handle) == 8 );
+C_ASSERT( sizeof(struct create_completion_wait_reply) == 16 );
+C_ASSERT( FIELD_OFFSET(struct associate_completion_wait_request, wait) == 12 );
+C_ASSERT( FIELD_OFFSET(struct associate_completion_wait_request, completion) == 16 );
+C_ASSERT( FIELD_OFFSET(struct associate_completion_wait_request, handle) == 20 );
+C_ASSERT( FIELD_OFFSET(struct associate_completion_wait_request, thread) == 24 );
+C_ASSERT( FIELD_OFFSET(struct associate_completion_wait_request, ckey) == 32 );
+C_ASSERT( FIELD_OFFSET(struct associate_completion_wait_request, cvalue) == 40 );
+C_ASSERT( FIELD_OFFSET(struct associate_completion_wait_request, information) == 48 );
+C_ASSERT( FIELD_OFFSET(struct associate_completion_wait_request, status) == 56 );
+C_ASSERT( sizeof(struct associate_completion_wait_request) == 64 );
+C_ASSERT( FIELD_OFFSET(struct associate_completion_wait_reply, signaled) == 8 );
+C_ASSERT( sizeof(struct associate_completion_wait_reply) == 16 );
+C_ASSERT( FIELD_OFFSET(struct cancel_completion_wait_request, wait) == 12 );
+C_ASSERT( FIELD_OFFSET(struct cancel_completion_wait_request, remove) == 16 );
+C_ASSERT( sizeof(struct cancel_completion_wait_request) == 24 );
 C_ASSERT( FIELD_OFFSET(struct query_completion_request, handle) == 12 );
 C_ASSERT( sizeof(struct query_completion_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct query_completion_reply, depth) == 8 );
@@ -2368,6 +2436,9 @@ C_ASSERT( FIELD_OFFSET(struct add_fd_completion_request, information) == 24 );
 C_ASSERT( FIELD_OFFSET(struct add_fd_completion_request, status) == 32 );
 C_ASSERT( FIELD_OFFSET(struct add_fd_completion_request, async) == 36 );
 C_ASSERT( sizeof(struct add_fd_completion_request) == 40 );
+C_ASSERT( FIELD_OFFSET(struct add_fd_completion_reply, ckey) == 8 );
+C_ASSERT( FIELD_OFFSET(struct add_fd_completion_reply, port) == 16 );
+C_ASSERT( sizeof(struct add_fd_completion_reply) == 24 );
 C_ASSERT( FIELD_OFFSET(struct set_fd_completion_mode_request, handle) == 12 );
 C_ASSERT( FIELD_OFFSET(struct set_fd_completion_mode_request, flags) == 16 );
 C_ASSERT( sizeof(struct set_fd_completion_mode_request) == 24 );
@@ -2446,6 +2517,28 @@ C_ASSERT( FIELD_OFFSET(struct suspend_process_request, handle) == 12 );
 C_ASSERT( sizeof(struct suspend_process_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct resume_process_request, handle) == 12 );
 C_ASSERT( sizeof(struct resume_process_request) == 16 );
+C_ASSERT( sizeof(struct get_fsync_shm_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_fsync_shm_reply, size) == 8 );
+C_ASSERT( sizeof(struct get_fsync_shm_reply) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_fsync_idx_request, handle) == 12 );
+C_ASSERT( sizeof(struct get_fsync_idx_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_fsync_idx_reply, index) == 8 );
+C_ASSERT( FIELD_OFFSET(struct get_fsync_idx_reply, type) == 12 );
+C_ASSERT( sizeof(struct get_fsync_idx_reply) == 16 );
+C_ASSERT( sizeof(struct get_fsync_owned_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_fsync_owned_reply, index) == 8 );
+C_ASSERT( FIELD_OFFSET(struct get_fsync_owned_reply, owner) == 12 );
+C_ASSERT( sizeof(struct get_fsync_owned_reply) == 16 );
+C_ASSERT( sizeof(struct call_batch_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct call_batch_reply, count) == 8 );
+C_ASSERT( sizeof(struct call_batch_reply) == 16 );
+C_ASSERT( sizeof(struct get_handle_mirror_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_handle_mirror_reply, size) == 8 );
+C_ASSERT( sizeof(struct get_handle_mirror_reply) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_request_profile_request, handle) == 12 );
+C_ASSERT( sizeof(struct get_request_profile_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_request_profile_reply, count) == 8 );
+C_ASSERT( sizeof(struct get_request_profile_reply) == 16 );
 
 #endif  /* WANT_REQUEST_HANDLERS */
 
@@ -41,22 +41,27 @@ struct semaphore
     struct object  obj;    /* object header */
     unsigned int   count;  /* current count */
     unsigned int   max;    /* maximum possible count */
+    struct fsync_object *fsync; /* shared state for client-side synchronization */
+    struct fsync_object *detached; /* shared state once the server has taken it over */
 };
 
 static void semaphore_dump( struct object *obj, int verbose );
 static struct object_type *semaphore_get_type( struct object *obj );
+static int semaphore_add_queue( struct object *obj, struct wait_queue_entry *entry );
+static void semaphore_remove_queue( struct object *obj, struct wait_queue_entry *entry );
 static int semaphore_signaled( struct object *obj, struct wait_queue_entry *entry );
 static void semaphore_satisfied( struct object *obj, struct wait_queue_entry *entry );
 static unsigned int semaphore_map_access( struct object *obj, unsigned int access );
 static int semaphore_signal( struct object *obj, unsigned int access );
+static void semaphore_destroy( struct object *obj );
 
 static const struct object_ops semaphore_ops =
 {
     sizeof(struct semaphore),      /* size */
     semaphore_dump,                /* dump */
     semaphore_get_type,            /* get_type */
-    add_queue,                     /* add_queue */
-    remove_queue,                  /* remove_queue */
+    semaphore_add_queue,           /* add_queue */
+    semaphore_remove_queue,        /* remove_queue */
     semaphore_signaled,            /* signaled */
     semaphore_satisfied,           /* satisfied */
     semaphore_signal,              /* signal */
@@ -70,7 +75,7 @@ static const struct object_ops semaphore_ops =
     no_open_file,                  /* open_file */
     no_kernel_obj_list,            /* get_kernel_obj_list */
     no_close_handle,               /* close_handle */
-    no_destroy                     /* destroy */
+    semaphore_destroy              /* destroy */
 };
 
 
@@ -92,14 +97,67 @@ static struct semaphore *create_semaphore( struct object *root, const struct uni
             /* initialize it if it didn't already exist */
             sem->count = initial;
             sem->max   = max;
+            sem->fsync = fsync_alloc( &sem->obj, FSYNC_SEMAPHORE, initial, max );
+            sem->detached = NULL;
         }
     }
     return sem;
 }
 
+struct fsync_object *get_semaphore_fsync( struct object *obj )
+{
+    if (obj->ops != &semaphore_ops) return NULL;
+    return ((struct semaphore *)obj)->fsync;
+}
+
+/* take over the shared state once another process gets a handle to the semaphore */
+void detach_semaphore_fsync( struct object *obj, struct process *process )
+{
+    struct semaphore *sem = (struct semaphore *)obj;
+
+    if (obj->ops != &semaphore_ops || !sem->fsync || !fsync_detach( sem->fsync, process )) return;
+    /* the creator process may have written anything there */
+    sem->count    = min( fsync_get_state( sem->fsync ), sem->max );
+    sem->detached = sem->fsync;
+    sem->fsync    = NULL;
+}
+
+static unsigned int get_semaphore_count( struct semaphore *sem )
+{
+    if (sem->fsync) return fsync_get_state( sem->fsync );
+    return sem->count;
+}
+
+static int release_fsync_semaphore( struct semaphore *sem, unsigned int count,
+                                    unsigned int *prev )
+{
+    unsigned int current;
+
+    do
+    {
+        current = fsync_get_state( sem->fsync );
+        if (prev) *prev = current;
+        if (current + count < current || current + count > sem->max)
+        {
+            set_error( STATUS_SEMAPHORE_LIMIT_EXCEEDED );
+            return 0;
+        }
+    } while (!fsync_cmpxchg_state( sem->fsync, current + count, current ));
+
+    /* there cannot be any thread to wake up if the count was != 0 */
+    if (!current)
+    {
+        fsync_wake( sem->fsync );
+        wake_up( &sem->obj, count );
+    }
+    return 1;
+}
+
 static int release_semaphore( struct semaphore *sem, unsigned int count,
                               unsigned int *prev )
 {
+    if (sem->fsync) return release_fsync_semaphore( sem, count, prev );
+
     if (prev) *prev = sem->count;
     if (sem->count + count < sem->count || sem->count + count > sem->max)
     {
@@ -123,7 +181,7 @@ static void semaphore_dump( struct object *obj, int verbose )
 {
     struct semaphore *sem = (struct semaphore *)obj;
     assert( obj->ops == &semaphore_ops );
-    fprintf( stderr, "Semaphore count=%d max=%d\n", sem->count, sem->max );
+    fprintf( stderr, "Semaphore count=%d max=%d\n", get_semaphore_count( sem ), sem->max );
 }
 
 static struct object_type *semaphore_get_type( struct object *obj )
@@ -133,17 +191,40 @@ static struct object_type *semaphore_get_type( struct object *obj )
     return get_object_type( &str );
 }
 
+static int semaphore_add_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct semaphore *sem = (struct semaphore *)obj;
+    assert( obj->ops == &semaphore_ops );
+    return fsync_add_queue( sem->fsync, obj, entry );
+}
+
+static void semaphore_remove_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct semaphore *sem = (struct semaphore *)obj;
+    assert( obj->ops == &semaphore_ops );
+    fsync_remove_queue( sem->fsync, obj, entry );
+}
+
 static int semaphore_signaled( struct object *obj, struct wait_queue_entry *entry )
 {
     struct semaphore *sem = (struct semaphore *)obj;
     assert( obj->ops == &semaphore_ops );
-    return (sem->count > 0);
+    return (get_semaphore_count( sem ) > 0);
 }
 
 static void semaphore_satisfied( struct object *obj, struct wait_queue_entry *entry )
 {
     struct semaphore *sem = (struct semaphore *)obj;
+    unsigned int count;
+
     assert( obj->ops == &semaphore_ops );
+    if (sem->fsync)
+    {
+        /* clients cannot decrement the count while a server wait is queued */
+        do count = fsync_get_state( sem->fsync );
+        while (count && !fsync_cmpxchg_state( sem->fsync, count - 1, count ));
+        return;
+    }
     assert( sem->count );
     sem->count--;
 }
@@ -170,6 +251,14 @@ static int semaphore_signal( struct object *obj, unsigned int access )
     return release_semaphore( sem, 1, NULL );
 }
 
+static void semaphore_destroy( struct object *obj )
+{
+    struct semaphore *sem = (struct semaphore *)obj;
+    assert( obj->ops == &semaphore_ops );
+    if (sem->fsync) fsync_free( sem->fsync );
+    if (sem->detached) fsync_free( sem->detached );
+}
+
 /* create a semaphore */
 DECL_HANDLER(create_semaphore)
 {
@@ -224,7 +313,7 @@ DECL_HANDLER(query_semaphore)
     if ((sem = (struct semaphore *)get_handle_obj( current->process, req->handle,
                                                    SEMAPHORE_QUERY_STATE, &semaphore_ops )))
     {
-        reply->current = sem->count;
+        reply->current = get_semaphore_count( sem );
         reply->max = sem->max;
         release_object( sem );
     }
@@ -1321,6 +1321,38 @@ DECL_HANDLER(set_socket_deferred)
     release_object( sock );
 }
 
+/* wake up asyncs whose data has been received or sent by the client along with another one,
+ * so that their own callbacks report the result */
+DECL_HANDLER(complete_socket_asyncs)
+{
+    const client_ptr_t *users = get_req_data();
+    data_size_t i, count = get_req_data_size() / sizeof(*users);
+    struct async_queue *queue;
+    unsigned int access;
+    struct sock *sock;
+
+    switch (req->type)
+    {
+    case ASYNC_TYPE_READ:
+        access = FILE_READ_DATA;
+        break;
+    case ASYNC_TYPE_WRITE:
+        access = FILE_WRITE_DATA;
+        break;
+    default:
+        set_error( STATUS_INVALID_PARAMETER );
+        return;
+    }
+
+    if (!(sock = (struct sock *)get_handle_obj( current->process, req->handle, access, &sock_ops )))
+        return;
+
+    queue = req->type == ASYNC_TYPE_READ ? &sock->read_q : &sock->write_q;
+    for (i = 0; i < count; i++) async_wake_up_user( queue, users[i] );
+
+    release_object( &sock->obj );
+}
+
 DECL_HANDLER(get_socket_info)
 {
     struct sock *sock;
@@ -81,6 +81,8 @@ struct thread_wait
     client_ptr_t            cookie;     /* magic cookie to return to client */
     timeout_t               timeout;
     struct timeout_user    *user;
+    wait_callback           callback;   /* callback for object waits, NULL for thread waits */
+    void                   *private;    /* callback private data */
     struct wait_queue_entry queues[1];
 };
 
@@ -203,6 +205,8 @@ static inline void init_thread_structure( struct thread *thread )
     thread->token           = NULL;
     thread->desc            = NULL;
     thread->desc_len        = 0;
+    thread->fsync_owned     = NULL;
+    thread->fsync_id        = 0;
 
     thread->creation_time = current_time;
     thread->exit_time     = 0;
@@ -211,6 +215,7 @@ static inline void init_thread_structure( struct thread *thread )
     list_init( &thread->system_apc );
     list_init( &thread->user_apc );
     list_init( &thread->kernel_object );
+    list_init( &thread->worker_entry );
 
     for (i = 0; i < MAX_INFLIGHT_FDS; i++)
         thread->inflight[i].server = thread->inflight[i].client = -1;
@@ -318,6 +323,7 @@ static void cleanup_thread( struct thread *thread )
 {
     int i;
 
+    cancel_worker_request( thread );
     clear_apc_queue( &thread->system_apc );
     clear_apc_queue( &thread->user_apc );
     free( thread->req_data );
@@ -703,6 +709,8 @@ static int wait_on( const select_op_t *select_op, unsigned int count, struct obj
     wait->user    = NULL;
     wait->timeout = timeout;
     wait->abandoned = 0;
+    wait->callback = NULL;
+    wait->private = NULL;
     current->wait = wait;
 
     for (i = 0, entry = wait->queues; i < count; i++, entry++)
@@ -816,6 +824,71 @@ int wake_thread( struct thread *thread )
     return count;
 }
 
+/* satisfy an object wait if the object is signaled; return 1 if the callback was called */
+static int wake_object_wait( struct thread_wait *wait )
+{
+    struct wait_queue_entry *entry = wait->queues;
+    wait_callback callback = wait->callback;
+    void *private = wait->private;
+    unsigned int status;
+
+    if (!entry->obj->ops->signaled( entry->obj, entry )) return 0;
+
+    entry->obj->ops->satisfied( entry->obj, entry );
+    status = wait->abandoned ? STATUS_ABANDONED_WAIT_0 : STATUS_WAIT_0;
+    entry->obj->ops->remove_queue( entry->obj, entry );
+    release_object( wait->thread );
+    free( wait );
+    callback( private, status );
+    return 1;
+}
+
+/* wait for an object on behalf of a thread without blocking it; the thread acquires
+ * the object, and the callback is called once it is signaled, possibly before returning */
+int wait_on_object( struct thread *thread, struct object *obj, wait_callback callback,
+                    void *private, struct thread_wait **ret )
+{
+    struct thread_wait *wait;
+    struct wait_queue_entry *entry;
+
+    if (!(wait = mem_alloc( sizeof(*wait) ))) return 0;
+    wait->next      = NULL;
+    wait->thread    = (struct thread *)grab_object( thread );
+    wait->count     = 1;
+    wait->flags     = 0;
+    wait->select    = SELECT_WAIT;
+    wait->key       = 0;
+    wait->cookie    = 0;
+    wait->user      = NULL;
+    wait->timeout   = TIMEOUT_INFINITE;
+    wait->abandoned = 0;
+    wait->callback  = callback;
+    wait->private   = private;
+
+    entry = wait->queues;
+    entry->wait = wait;
+    if (!obj->ops->add_queue( obj, entry ))
+    {
+        release_object( wait->thread );
+        free( wait );
+        return 0;
+    }
+    *ret = wait;
+    wake_object_wait( wait );
+    return 1;
+}
+
+/* cancel an object wait whose callback has not been called yet */
+void cancel_object_wait( struct thread_wait *wait )
+{
+    struct wait_queue_entry *entry = wait->queues;
+
+    assert( wait->callback );
+    entry->obj->ops->remove_queue( entry->obj, entry );
+    release_object( wait->thread );
+    free( wait );
+}
+
 /* attempt to wake up a thread from a wait queue entry, assuming that it is signaled */
 int wake_thread_queue_entry( struct wait_queue_entry *entry )
 {
@@ -824,6 +897,8 @@ int wake_thread_queue_entry( struct wait_queue_entry *entry )
     int signaled;
     client_ptr_t cookie;
 
+    if (wait->callback) return wake_object_wait( wait );
+
     if (thread->wait != wait) return 0;  /* not the current wait */
     if (thread->process->suspend + thread->suspend > 0) return 0;  /* cannot acquire locks */
 
@@ -964,7 +1039,9 @@ void wake_up( struct object *obj, int max )
     LIST_FOR_EACH( ptr, &obj->wait_queue )
     {
         struct wait_queue_entry *entry = LIST_ENTRY( ptr, struct wait_queue_entry, entry );
-        if (!(ret = wake_thread( get_wait_queue_thread( entry )))) continue;
+        if (entry->wait->callback) ret = wake_object_wait( entry->wait );
+        else ret = wake_thread( get_wait_queue_thread( entry ));
+        if (!ret) continue;
         if (ret > 0 && max && !--max) break;
         /* restart at the head of the list since a wake up can change the object wait queue */
         ptr = &obj->wait_queue;
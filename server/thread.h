@@ -54,6 +54,8 @@ struct thread
     struct process        *process;
     thread_id_t            id;            /* thread id */
     struct list            mutex_list;    /* list of currently owned mutexes */
+    struct fsync_owned    *fsync_owned;   /* mutexes acquired on the client side, in shared memory */
+    unsigned int           fsync_id;      /* id in the owner field of the shared mutexes, 0 if none yet */
     struct debug_ctx      *debug_ctx;     /* debugger context if this thread is a debugger */
     unsigned int           system_regs;   /* which system regs have been set */
     struct msg_queue      *queue;         /* message queue */
@@ -68,6 +70,9 @@ struct thread
     void                  *reply_data;    /* variable-size data for reply */
     unsigned int           reply_size;    /* size of reply data */
     unsigned int           reply_towrite; /* amount of data still to write in reply */
+    struct list            worker_entry;  /* entry in the request worker lists */
+    int                    worker_ret;    /* result of the reply write done by a request worker */
+    int                    worker_errno;  /* errno of that write if it failed */
     struct fd             *request_fd;    /* fd for receiving client requests */
     struct fd             *reply_fd;      /* fd to send a reply to a client */
     struct fd             *wait_fd;       /* fd to use to wake a sleeping client */
@@ -99,7 +104,10 @@ struct thread_snapshot
     int             priority;  /* priority class */
 };
 
-extern struct thread *current;
+extern __thread struct thread *current;
+
+/* callback for waits that don't block a thread, see wait_on_object */
+typedef void (*wait_callback)( void *private, unsigned int status );
 
 /* thread functions */
 
@@ -117,6 +125,9 @@ extern void stop_thread( struct thread *thread );
 extern void stop_thread_if_suspended( struct thread *thread );
 extern int wake_thread( struct thread *thread );
 extern int wake_thread_queue_entry( struct wait_queue_entry *entry );
+extern int wait_on_object( struct thread *thread, struct object *obj, wait_callback callback,
+                           void *private, struct thread_wait **ret );
+extern void cancel_object_wait( struct thread_wait *wait );
 extern int add_queue( struct object *obj, struct wait_queue_entry *entry );
 extern void remove_queue( struct object *obj, struct wait_queue_entry *entry );
 extern void kill_thread( struct thread *thread, int violent_death );
@@ -143,7 +154,7 @@ extern int send_thread_signal( struct thread *thread, int sig );
 extern void get_selector_entry( struct thread *thread, int entry, unsigned int *base,
                                 unsigned int *limit, unsigned char *flags );
 
-extern unsigned int global_error;  /* global error code for when no thread is current */
+extern __thread unsigned int global_error;  /* global error code for when no thread is current */
 
 static inline unsigned int get_error(void)       { return current ? current->error : global_error; }
 static inline void set_error( unsigned int err ) { global_error = err; if (current) current->error = err; }
@@ -1235,6 +1235,26 @@ static void dump_varargs_handle_infos( const char *prefix, data_size_t size )
     fputc( '}', stderr );
 }
 
+static void dump_varargs_request_profiles( const char *prefix, data_size_t size )
+{
+    const struct request_profile_info *info;
+
+    fprintf( stderr, "%s{", prefix );
+    while (size >= sizeof(*info))
+    {
+        info = cur_data;
+        fprintf( stderr, "{request=%s,count=%u", get_req_name( info->request ), info->count );
+        dump_uint64( ",total=", (const unsigned __int64 *)&info->total );
+        dump_uint64( ",p50=", (const unsigned __int64 *)&info->p50 );
+        dump_uint64( ",p99=", (const unsigned __int64 *)&info->p99 );
+        fputc( '}', stderr );
+        size -= sizeof(*info);
+        remove_data( sizeof(*info) );
+        if (size) fputc( ',', stderr );
+    }
+    fputc( '}', stderr );
+}
+
 typedef void (*dump_func)( const void *req );
 
 /* Everything below this line is generated automatically by tools/make_requests */
@@ -1976,6 +1996,13 @@ static void dump_set_socket_deferred_request( const struct set_socket_deferred_r
     fprintf( stderr, ", deferred=%04x", req->deferred );
 }
 
+static void dump_complete_socket_asyncs_request( const struct complete_socket_asyncs_request *req )
+{
+    fprintf( stderr, " handle=%04x", req->handle );
+    fprintf( stderr, ", type=%d", req->type );
+    dump_varargs_uints64( ", asyncs=", cur_size );
+}
+
 static void dump_alloc_console_request( const struct alloc_console_request *req )
 {
     fprintf( stderr, " access=%08x", req->access );
@@ -2319,9 +2346,21 @@ static void dump_get_mapping_info_reply( const struct get_mapping_info_reply *re
     dump_uint64( " size=", &req->size );
     fprintf( stderr, ", flags=%08x", req->flags );
     fprintf( stderr, ", shared_file=%04x", req->shared_file );
+    dump_uint64( ", reloc_base=", &req->reloc_base );
     dump_varargs_pe_image_info( ", image=", cur_size );
 }
 
+static void dump_get_mapping_reloc_file_request( const struct get_mapping_reloc_file_request *req )
+{
+    fprintf( stderr, " handle=%04x", req->handle );
+    dump_uint64( ", base=", &req->base );
+}
+
+static void dump_get_mapping_reloc_file_reply( const struct get_mapping_reloc_file_reply *req )
+{
+    fprintf( stderr, " file=%04x", req->file );
+}
+
 static void dump_map_view_request( const struct map_view_request *req )
 {
     fprintf( stderr, " mapping=%04x", req->mapping );
@@ -2559,9 +2598,20 @@ static void dump_get_key_value_reply( const struct get_key_value_reply *req )
 {
     fprintf( stderr, " type=%d", req->type );
     fprintf( stderr, ", total=%u", req->total );
+    fprintf( stderr, ", cache_slot=%08x", req->cache_slot );
+    fprintf( stderr, ", cache_gen=%08x", req->cache_gen );
     dump_varargs_bytes( ", data=", cur_size );
 }
 
+static void dump_get_registry_cache_request( const struct get_registry_cache_request *req )
+{
+}
+
+static void dump_get_registry_cache_reply( const struct get_registry_cache_reply *req )
+{
+    fprintf( stderr, " size=%u", req->size );
+}
+
 static void dump_enum_key_value_request( const struct enum_key_value_request *req )
 {
     fprintf( stderr, " hkey=%04x", req->hkey );
@@ -4420,6 +4470,40 @@ static void dump_remove_completion_reply( const struct remove_completion_reply *
     fprintf( stderr, ", status=%08x", req->status );
 }
 
+static void dump_create_completion_wait_request( const struct create_completion_wait_request *req )
+{
+    fprintf( stderr, " access=%08x", req->access );
+    dump_varargs_object_attributes( ", objattr=", cur_size );
+}
+
+static void dump_create_completion_wait_reply( const struct create_completion_wait_reply *req )
+{
+    fprintf( stderr, " handle=%04x", req->handle );
+}
+
+static void dump_associate_completion_wait_request( const struct associate_completion_wait_request *req )
+{
+    fprintf( stderr, " wait=%04x", req->wait );
+    fprintf( stderr, ", completion=%04x", req->completion );
+    fprintf( stderr, ", handle=%04x", req->handle );
+    fprintf( stderr, ", thread=%04x", req->thread );
+    dump_uint64( ", ckey=", &req->ckey );
+    dump_uint64( ", cvalue=", &req->cvalue );
+    dump_uint64( ", information=", &req->information );
+    fprintf( stderr, ", status=%08x", req->status );
+}
+
+static void dump_associate_completion_wait_reply( const struct associate_completion_wait_reply *req )
+{
+    fprintf( stderr, " signaled=%d", req->signaled );
+}
+
+static void dump_cancel_completion_wait_request( const struct cancel_completion_wait_request *req )
+{
+    fprintf( stderr, " wait=%04x", req->wait );
+    fprintf( stderr, ", remove=%d", req->remove );
+}
+
 static void dump_query_completion_request( const struct query_completion_request *req )
 {
     fprintf( stderr, " handle=%04x", req->handle );
@@ -4446,6 +4530,12 @@ static void dump_add_fd_completion_request( const struct add_fd_completion_reque
     fprintf( stderr, ", async=%d", req->async );
 }
 
+static void dump_add_fd_completion_reply( const struct add_fd_completion_reply *req )
+{
+    dump_uint64( " ckey=", &req->ckey );
+    fprintf( stderr, ", port=%08x", req->port );
+}
+
 static void dump_set_fd_completion_mode_request( const struct set_fd_completion_mode_request *req )
 {
     fprintf( stderr, " handle=%04x", req->handle );
@@ -4608,6 +4698,67 @@ static void dump_resume_process_request( const struct resume_process_request *re
     fprintf( stderr, " handle=%04x", req->handle );
 }
 
+static void dump_get_fsync_shm_request( const struct get_fsync_shm_request *req )
+{
+}
+
+static void dump_get_fsync_shm_reply( const struct get_fsync_shm_reply *req )
+{
+    fprintf( stderr, " size=%u", req->size );
+}
+
+static void dump_get_fsync_idx_request( const struct get_fsync_idx_request *req )
+{
+    fprintf( stderr, " handle=%04x", req->handle );
+}
+
+static void dump_get_fsync_idx_reply( const struct get_fsync_idx_reply *req )
+{
+    fprintf( stderr, " index=%08x", req->index );
+    fprintf( stderr, ", type=%d", req->type );
+}
+
+static void dump_get_fsync_owned_request( const struct get_fsync_owned_request *req )
+{
+}
+
+static void dump_get_fsync_owned_reply( const struct get_fsync_owned_reply *req )
+{
+    fprintf( stderr, " index=%08x", req->index );
+    fprintf( stderr, ", owner=%08x", req->owner );
+}
+
+static void dump_call_batch_request( const struct call_batch_request *req )
+{
+    dump_varargs_bytes( " requests=", cur_size );
+}
+
+static void dump_call_batch_reply( const struct call_batch_reply *req )
+{
+    fprintf( stderr, " count=%08x", req->count );
+    dump_varargs_bytes( ", replies=", cur_size );
+}
+
+static void dump_get_handle_mirror_request( const struct get_handle_mirror_request *req )
+{
+}
+
+static void dump_get_handle_mirror_reply( const struct get_handle_mirror_reply *req )
+{
+    fprintf( stderr, " size=%u", req->size );
+}
+
+static void dump_get_request_profile_request( const struct get_request_profile_request *req )
+{
+    fprintf( stderr, " handle=%04x", req->handle );
+}
+
+static void dump_get_request_profile_reply( const struct get_request_profile_reply *req )
+{
+    fprintf( stderr, " count=%08x", req->count );
+    dump_varargs_request_profiles( ", stats=", cur_size );
+}
+
 static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_new_process_request,
     (dump_func)dump_exec_process_request,
@@ -4670,6 +4821,7 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_get_socket_info_request,
     (dump_func)dump_enable_socket_event_request,
     (dump_func)dump_set_socket_deferred_request,
+    (dump_func)dump_complete_socket_asyncs_request,
     (dump_func)dump_alloc_console_request,
     (dump_func)dump_free_console_request,
     (dump_func)dump_get_console_renderer_events_request,
@@ -4697,6 +4849,7 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_create_mapping_request,
     (dump_func)dump_open_mapping_request,
     (dump_func)dump_get_mapping_info_request,
+    (dump_func)dump_get_mapping_reloc_file_request,
     (dump_func)dump_map_view_request,
     (dump_func)dump_unmap_view_request,
     (dump_func)dump_get_mapping_committed_range_request,
@@ -4720,6 +4873,7 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_enum_key_request,
     (dump_func)dump_set_key_value_request,
     (dump_func)dump_get_key_value_request,
+    (dump_func)dump_get_registry_cache_request,
     (dump_func)dump_enum_key_value_request,
     (dump_func)dump_delete_key_value_request,
     (dump_func)dump_load_registry_request,
@@ -4883,6 +5037,9 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_open_completion_request,
     (dump_func)dump_add_completion_request,
     (dump_func)dump_remove_completion_request,
+    (dump_func)dump_create_completion_wait_request,
+    (dump_func)dump_associate_completion_wait_request,
+    (dump_func)dump_cancel_completion_wait_request,
     (dump_func)dump_query_completion_request,
     (dump_func)dump_set_completion_info_request,
     (dump_func)dump_add_fd_completion_request,
@@ -4906,6 +5063,12 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_terminate_job_request,
     (dump_func)dump_suspend_process_request,
     (dump_func)dump_resume_process_request,
+    (dump_func)dump_get_fsync_shm_request,
+    (dump_func)dump_get_fsync_idx_request,
+    (dump_func)dump_get_fsync_owned_request,
+    (dump_func)dump_call_batch_request,
+    (dump_func)dump_get_handle_mirror_request,
+    (dump_func)dump_get_request_profile_request,
 };
 
 static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
@@ -4970,6 +5133,7 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_get_socket_info_reply,
     NULL,
     NULL,
+    NULL,
     (dump_func)dump_alloc_console_reply,
     NULL,
     (dump_func)dump_get_console_renderer_events_reply,
@@ -4997,6 +5161,7 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_create_mapping_reply,
     (dump_func)dump_open_mapping_reply,
     (dump_func)dump_get_mapping_info_reply,
+    (dump_func)dump_get_mapping_reloc_file_reply,
     NULL,
     NULL,
     (dump_func)dump_get_mapping_committed_range_reply,
@@ -5020,6 +5185,7 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_enum_key_reply,
     NULL,
     (dump_func)dump_get_key_value_reply,
+    (dump_func)dump_get_registry_cache_reply,
     (dump_func)dump_enum_key_value_reply,
     NULL,
     NULL,
@@ -5183,9 +5349,12 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_open_completion_reply,
     NULL,
     (dump_func)dump_remove_completion_reply,
-    (dump_func)dump_query_completion_reply,
+    (dump_func)dump_create_completion_wait_reply,
+    (dump_func)dump_associate_completion_wait_reply,
     NULL,
+    (dump_func)dump_query_completion_reply,
     NULL,
+    (dump_func)dump_add_fd_completion_reply,
     NULL,
     NULL,
     NULL,
@@ -5206,6 +5375,12 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     NULL,
     NULL,
     NULL,
+    (dump_func)dump_get_fsync_shm_reply,
+    (dump_func)dump_get_fsync_idx_reply,
+    (dump_func)dump_get_fsync_owned_reply,
+    (dump_func)dump_call_batch_reply,
+    (dump_func)dump_get_handle_mirror_reply,
+    (dump_func)dump_get_request_profile_reply,
 };
 
 static const char * const req_names[REQ_NB_REQUESTS] = {
@@ -5270,6 +5445,7 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "get_socket_info",
     "enable_socket_event",
     "set_socket_deferred",
+    "complete_socket_asyncs",
     "alloc_console",
     "free_console",
     "get_console_renderer_events",
@@ -5297,6 +5473,7 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "create_mapping",
     "open_mapping",
     "get_mapping_info",
+    "get_mapping_reloc_file",
     "map_view",
     "unmap_view",
     "get_mapping_committed_range",
@@ -5320,6 +5497,7 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "enum_key",
     "set_key_value",
     "get_key_value",
+    "get_registry_cache",
     "enum_key_value",
     "delete_key_value",
     "load_registry",
@@ -5483,6 +5661,9 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "open_completion",
     "add_completion",
     "remove_completion",
+    "create_completion_wait",
+    "associate_completion_wait",
+    "cancel_completion_wait",
     "query_completion",
     "set_completion_info",
     "add_fd_completion",
@@ -5506,6 +5687,12 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "terminate_job",
     "suspend_process",
     "resume_process",
+    "get_fsync_shm",
+    "get_fsync_idx",
+    "get_fsync_owned",
+    "call_batch",
+    "get_handle_mirror",
+    "get_request_profile",
 };
 
 static const struct
@@ -5573,6 +5760,7 @@ static const struct
     { "INVALID_LOCK_SEQUENCE",       STATUS_INVALID_LOCK_SEQUENCE },
     { "INVALID_OWNER",               STATUS_INVALID_OWNER },
     { "INVALID_PARAMETER",           STATUS_INVALID_PARAMETER },
+    { "INVALID_PARAMETER_1",         STATUS_INVALID_PARAMETER_1 },
     { "INVALID_PIPE_STATE",          STATUS_INVALID_PIPE_STATE },
     { "INVALID_READ_MODE",           STATUS_INVALID_READ_MODE },
     { "INVALID_SECURITY_DESCR",      STATUS_INVALID_SECURITY_DESCR },
@@ -5699,6 +5887,11 @@ static const char *get_status_name( unsigned int status )
     return buffer;
 }
 
+const char *get_req_name( enum request req )
+{
+    return req < REQ_NB_REQUESTS ? req_names[req] : "?";
+}
+
 void trace_request(void)
 {
     enum request req = current->req.request_header.req;